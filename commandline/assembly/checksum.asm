@@ -0,0 +1,175 @@
+	!cpu 6502 ; We want to run on a 1541 disc station.
+	*= $0500
+
+	!source "assembly/definitions.asm" ; Include standard definitions.
+
+	; Reads a list of sectors on a single track and computes a CRC-16
+	; (CCITT, polynomial $1021, initial value $ffff) over the content of each
+	; one. Only the checksums need to be transferred to the host, which makes
+	; verification cheap compared to reading back the sector content.
+	; We expect the following parameters after M-E<mem_lo><mem_hi>:
+	; <track> <num_sectors> <sector_0> ... <sector_n-1>
+	; When done, checksum_table holds the checksum of sector i (low byte
+	; first) at offset 2 * i.
+
+	checksum_param_track = input_buffer + 0x05
+	checksum_param_num_sectors = input_buffer + 0x06
+	checksum_param_sectors = input_buffer + 0x07
+
+	checksum_data_buffer_start = $0600 ; Data buffer to read to.
+
+	checksum_max_sectors = 21 ; A full track.
+	checksum_table = $05d6	; Checksums for up to 21 sectors, up to $05ff.
+				; Must match kChecksumTableAddress.
+
+	!if checksum_table + 2 * checksum_max_sectors > $0600 {
+	!error "checksum_table exceeds buffer 2"
+	}
+
+	; Entry point for execute buffer. The actual main program starts below.
+	jmp checksum_job
+
+	; Main program (entry point for M-E).
+	lda checksum_param_track
+	sta track_for_job_buffer_2 	; We run in buffer 2 (0x500).
+	lda checksum_param_sectors
+	sta sector_for_job_buffer_2
+	lda #jc_execute_buffer
+	sta jm_buffer_2
+wait_for_completion:
+	lda jm_buffer_2
+	bmi wait_for_completion
+	cmp #jr_error
+	bcc ok
+	ldx #$00
+	jmp print_error
+ok:
+	rts
+
+checksum_job:
+	lda #$00
+	sta checksum_index
+
+checksum_next_sector:
+	ldx checksum_index
+	lda checksum_param_sectors, x
+	sta sector_for_job_buffer_2	; The header search looks for our buffer's track / sector.
+
+	lda #<checksum_data_buffer_start ; Switch to the buffer we should read to.
+	sta current_buffer_start_low
+	lda #>checksum_data_buffer_start
+	sta current_buffer_start_high
+
+	jsr dc_search_block_header_and_sync
+
+	ldy #$00
+read_content_loop:
+	bvc read_content_loop
+	clv
+	lda via2_drive_data
+	sta (current_buffer_start_low), y
+	iny
+	bne read_content_loop 	; Read 256 bytes.
+
+	ldy #$ba
+read_content_aux_loop:
+	bvc read_content_aux_loop
+	clv
+	lda via2_drive_data
+	sta processor_stack_page, y
+	iny
+	bne read_content_aux_loop ; Read another 70 bytes into aux space.
+
+	jsr read_convert_gcr_to_binary
+
+	lda data_block_signature_byte
+	cmp data_block_identifier
+	beq calculate_checksum
+
+	lda #errno_readerror_22
+	jmp dc_end_job_loop_with_status
+
+calculate_checksum:
+	jsr format_calculate_checksum
+	cmp sector_data_checksum
+	beq read_successful
+
+	; Report checksum error.
+	lda #errno_readerror_23
+	jmp dc_end_job_loop_with_status
+
+read_successful:
+	lda #$ff		; Calculate the CRC-16 over the sector content.
+	sta crc_low
+	sta crc_high
+	ldy #$00
+crc_loop:
+	tya			; The update clobbers y.
+	pha
+	lda checksum_data_buffer_start, y
+	jsr crc16_update
+	pla
+	tay
+	iny
+	bne crc_loop
+
+	lda checksum_index	; Store it in the table, low byte first.
+	asl
+	tax
+	lda crc_low
+	sta checksum_table, x
+	lda crc_high
+	sta checksum_table + 1, x
+
+	inc checksum_index
+	lda checksum_index
+	cmp checksum_param_num_sectors
+	bcc checksum_next_sector
+
+	; Done reading.
+	lda #$01
+	jmp dc_end_job_loop_with_status
+
+	; Add the byte in a to the CRC in crc_low / crc_high. Table-less
+	; implementation, clobbers x and y.
+crc16_update:
+	eor crc_high
+	sta crc_high
+	lsr			; Top of the x^12 term.
+	lsr
+	lsr
+	lsr
+	tax
+	asl			; Top of the x^5 term.
+	eor crc_low
+	sta crc_low
+	txa
+	eor crc_high
+	sta crc_high
+	asl			; Remaining terms have feedback from x^12.
+	asl
+	asl
+	tax
+	asl
+	asl
+	eor crc_high		; Bottom of the x^5 term.
+	tay
+	txa
+	rol			; Bottom of x^12, middle of x^5.
+	eor crc_low
+	sta crc_high		; Swap low and high bytes.
+	sty crc_low
+	rts
+
+	; Auxiliary variables.
+
+checksum_index:
+	!8 0			; Index of the sector currently being read.
+crc_low:
+	!8 0			; CRC of the current sector.
+crc_high:
+	!8 0
+
+	!if * > checksum_table {
+	!error "checksum code overlaps checksum_table"
+	}
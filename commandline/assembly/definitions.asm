@@ -41,6 +41,7 @@
 	errno_readerror_22 = $04      ; 22, READ ERROR
 	errno_readerror_23 = $05      ; 23, READ ERROR
 	errno_readerror_24 = $06      ; 24, READ ERROR
+	errno_writeerror_25 = $07     ; 25, WRITE ERROR
 	errno_writeprotect = $08
 
 	; Zero page memory locations.
@@ -120,6 +121,8 @@
 	via1_timer_control = $180b ; Timer control register of Via 1.
 	via1_interrupt_status = $180d ; Interrupt status register.
 	
+	via1_serial_port = $1800   ; Port B of Via 1: Serial bus lines.
+
 	via2_drive_port = $1c00	   ; Port B of Via 2.
 	
 	via2_drive_data = $1c01    ; Port A of Via 2: Read or write data byte.
@@ -139,6 +142,10 @@
 	
 	via2_drive_port_write_protect_bit = $10 ; Bit 4 controls write protection.
 
+	via1_serial_data_in = $01  ; Set while the DATA line is pulled low.
+	via1_serial_data_out = $02 ; Set to pull the DATA line low.
+	via1_serial_clock_out = $08 ; Set to pull the CLK line low.
+
 	via2_drive_direction_read = 0x00
 	via2_drive_direction_write = 0xff
 
@@ -0,0 +1,121 @@
+	!cpu 6502 ; We want to run on a 1541 disc station.
+	*= $0700
+
+	!source "assembly/definitions.asm" ; Include standard definitions.
+
+	; Sends the content of a memory page to the host, two bits at a time on
+	; the CLK and DATA lines. The standard serial protocol needs a handshake
+	; for every bit, which makes it several times slower.
+	; For each byte:
+	; - We pull CLK (busy) and wait for the host to release DATA (ready).
+	; - We release CLK (start). Starting 8 us later, each bit pair is held
+	;   for 8 us, lowest bits first. The lower bit of each pair is on DATA,
+	;   the higher one on CLK. A released line represents a 1.
+	; - We pull CLK (busy) again 42 us after the start. The host pulls DATA
+	;   once it has sampled the last bit pair, which happens long before we
+	;   check DATA for the next byte.
+	; If the host pulls ATN while we wait, we give up.
+	; We expect the following parameters after M-E<mem_lo><mem_hi>:
+	; <page> <num_bytes>
+	; Zero bytes means a full page.
+	; We reside in buffer 4, where the DOS keeps the BAM. We clear the BAM
+	; dirty flag so the DOS never writes us to disc, the host has the DOS
+	; read the BAM again ("I0") once it's done with us.
+
+	fast_send_param_page = input_buffer + 0x05
+	fast_send_param_num_bytes = input_buffer + 0x06
+
+	; Main program (entry point for M-E). We don't access the disc, so
+	; there's no job.
+	lda #$00
+	sta bam_dirty_flag
+	lda fast_send_param_page
+	sta fast_send_load + 2		; Patch the page we send from.
+	ldy #$00
+	lda #via1_serial_clock_out	; Busy.
+	sta via1_serial_port
+
+fast_send_next_byte:
+fast_send_load:
+	lda $0000, y
+	sta fast_send_byte		; Encode the bit pairs up front, so we
+	and #$03			; can put them on the bus in time.
+	tax
+	lda fast_send_pair_table, x
+	sta fast_send_pair_0
+	lda fast_send_byte
+	lsr
+	lsr
+	sta fast_send_byte
+	and #$03
+	tax
+	lda fast_send_pair_table, x
+	sta fast_send_pair_1
+	lda fast_send_byte
+	lsr
+	lsr
+	sta fast_send_byte
+	and #$03
+	tax
+	lda fast_send_pair_table, x
+	sta fast_send_pair_2
+	lda fast_send_byte
+	lsr
+	lsr
+	tax
+	lda fast_send_pair_table, x
+	sta fast_send_pair_3
+
+fast_send_wait_ready:
+	lda via1_serial_port
+	bmi fast_send_abort		; Bit 7 is set while ATN is pulled low.
+	lsr				; DATA in to carry.
+	bcs fast_send_wait_ready
+
+	; Cycle exact from here on. Interrupts would get in the way.
+	sei
+	ldx #$00
+	stx via1_serial_port		; Start.
+	lda fast_send_pair_0
+	sta via1_serial_port		; Start + 8 us.
+	lda fast_send_pair_1
+	sta via1_serial_port		; Start + 16 us.
+	lda fast_send_pair_2
+	sta via1_serial_port		; Start + 24 us.
+	lda fast_send_pair_3
+	sta via1_serial_port		; Start + 32 us.
+	lda #via1_serial_clock_out
+	nop
+	nop
+	sta via1_serial_port		; Start + 42 us: Busy.
+	cli
+
+	iny
+	cpy fast_send_param_num_bytes
+	bne fast_send_next_byte
+
+fast_send_abort:
+	lda #$00			; Release the bus.
+	sta via1_serial_port
+	cli
+	rts
+
+	; Bus output for each bit pair. Lines are pulled for zero bits.
+fast_send_pair_table:
+	!8 via1_serial_data_out | via1_serial_clock_out
+	!8 via1_serial_clock_out
+	!8 via1_serial_data_out
+	!8 $00
+
+	; Auxiliary variables.
+
+fast_send_byte:
+	!8 0			; Remaining bits of the byte being encoded.
+fast_send_pair_0:
+	!8 0			; Bus output for each bit pair of the byte.
+fast_send_pair_1:
+	!8 0
+fast_send_pair_2:
+	!8 0
+fast_send_pair_3:
+	!8 0
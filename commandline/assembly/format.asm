@@ -3,6 +3,14 @@
 	
 	!source "assembly/definitions.asm" ; Include standard definitions.
 
+	; Formats a range of tracks.
+	; We expect the following parameters after M-E<mem_lo><mem_hi>:
+	; <first_track> <num_tracks>
+	; The head is only bumped if formatting starts at track 1.
+
+	format_param_first_track = input_buffer + 0x05
+	format_param_num_tracks = input_buffer + 0x06
+
 	; Entry point at the beginning of buffer 2.
 	jmp format_job		
 
@@ -17,8 +25,12 @@
 
 	jsr close_all_channels
 
-	lda #$01
-	sta current_track_number
+	lda format_param_first_track
+	sta format_first_track
+	sta current_track_number	; Have the DC move the head there first.
+	clc
+	adc format_param_num_tracks
+	sta format_end_track
 		
 	lda #$02  ; Set track and sector number for buffer 2.
 	jsr set_track_and_sector
@@ -54,6 +66,21 @@ format_job:
 	lda format_current_track
 	bpl in_progress		; If valid, we're already formatting
 
+	lda #$0a
+	sta max_format_errors
+
+	lda #$a0
+	sta half_format_area_size_low
+	lda #$0f
+	sta half_format_area_size_high
+
+	lda format_first_track
+	cmp #$01
+	beq start_with_bump
+	sta format_current_track ; The head is on the first track already.
+	jmp in_progress
+
+start_with_bump:
 	lda #(dc_cr_seeking + dc_cr_idle)
 	sta dc_command_register
 	
@@ -68,14 +95,6 @@ format_job:
 	and #$fc
 	sta via2_drive_port	; Step 00 for head movement.
 
-	lda #$0a
-	sta max_format_errors
-
-	lda #$a0
-	sta half_format_area_size_low
-	lda #$0f
-	sta half_format_area_size_high
-
 	jmp dc_end_of_job_loop
 
 in_progress:
@@ -492,8 +511,8 @@ write_last_track_byte_loop:	; Not exactly sure what this is for, but I assume
 
 	inc format_current_track
 	lda format_current_track
-	cmp #$29		; Do we have all 40 tracks yet?
-	bcs done_formatting	; TODO(aeckleder): Should we have an option to do 40 vs. 35?
+	cmp format_end_track	; Do we have all requested tracks yet?
+	bcs done_formatting
 
 	jmp dc_end_of_job_loop
 
@@ -544,4 +563,8 @@ format_sector_counter:
 	!8 0			; Counts sectors while building the data buffer.
 verify_retry_counter:
 	!8 0			; Count down number of retries during verify.
+format_first_track:
+	!8 0			; First track to format.
+format_end_track:
+	!8 0			; Track following the last one to format.
 
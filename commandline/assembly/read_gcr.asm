@@ -0,0 +1,115 @@
+	!cpu 6502 ; We want to run on a 1541 disc station.
+	*= $0500
+
+	!source "assembly/definitions.asm" ; Include standard definitions.
+
+	; Captures the raw GCR bytes passing under the head on a single track,
+	; starting right after the header of sector 0. The drive doesn't have
+	; enough memory to hold a full revolution, so we capture into a ring
+	; of two pages ($0300 - $04ff) and the host retrieves a different
+	; 512 byte window of the track with every call.
+	; Sync marks don't produce any bytes. We store a single byte below $20
+	; (which doesn't occur in valid GCR data) for each sync mark instead,
+	; holding its length in iterations of the 13 cycle sync loop, up to
+	; read_gcr_max_sync_count.
+	; We expect the following parameters after M-E<mem_lo><mem_hi>:
+	; <track> <num_pages>
+	; When done, $0300 - $04ff hold the last two pages captured. To retrieve
+	; the window starting at byte 512 * k, capture 2 * k + 2 pages.
+
+	read_gcr_param_track = input_buffer + 0x05
+	read_gcr_param_num_pages = input_buffer + 0x06
+
+	read_gcr_ring_page_0 = $0300 ; Ring buffer for captured data.
+	read_gcr_ring_page_1 = $0400
+
+	read_gcr_max_sync_count = $1f ; Sync lengths saturate at this count.
+
+	; Entry point for execute buffer. The actual main program starts below.
+	jmp read_gcr_job
+
+	; Main program (entry point for M-E).
+	lda read_gcr_param_track
+	sta track_for_job_buffer_2 	; We run in buffer 2 (0x500).
+	lda #$00
+	sta sector_for_job_buffer_2	; Sector 0 serves as our reference point.
+	lda #jc_execute_buffer
+	sta jm_buffer_2
+wait_for_completion:
+	lda jm_buffer_2
+	bmi wait_for_completion
+	cmp #jr_error
+	bcc ok
+	ldx #$00
+	jmp print_error
+ok:
+	rts
+
+read_gcr_job:
+	jsr dc_search_block_header	; Wait for the header of sector 0.
+
+	lda read_gcr_param_num_pages
+	sta read_gcr_pages_left
+	ldy #$00
+	clv
+
+	; Storing a byte takes 19 cycles, which leaves enough room for polling
+	; within the 26 cycles a byte takes to pass under the head in speed
+	; zone 3. We poll with lda rather than bit, as the latter would load
+	; the density bits into the byte ready flag.
+read_gcr_loop_0:
+	bvs read_gcr_byte_0
+	lda via2_drive_port		; Bit 7 is clear while reading a sync mark.
+	bmi read_gcr_loop_0
+	ldx #$00
+read_gcr_sync_0:
+	cpx #read_gcr_max_sync_count
+	bcs read_gcr_sync_wait_0
+	inx
+read_gcr_sync_wait_0:
+	lda via2_drive_port
+	bpl read_gcr_sync_0
+	txa
+	bne read_gcr_store_0		; The count is at least one.
+read_gcr_byte_0:
+	clv
+	lda via2_drive_data
+read_gcr_store_0:
+	sta read_gcr_ring_page_0, y
+	iny
+	bne read_gcr_loop_0
+	dec read_gcr_pages_left
+	beq read_gcr_done
+
+read_gcr_loop_1:
+	bvs read_gcr_byte_1
+	lda via2_drive_port
+	bmi read_gcr_loop_1
+	ldx #$00
+read_gcr_sync_1:
+	cpx #read_gcr_max_sync_count
+	bcs read_gcr_sync_wait_1
+	inx
+read_gcr_sync_wait_1:
+	lda via2_drive_port
+	bpl read_gcr_sync_1
+	txa
+	bne read_gcr_store_1
+read_gcr_byte_1:
+	clv
+	lda via2_drive_data
+read_gcr_store_1:
+	sta read_gcr_ring_page_1, y
+	iny
+	bne read_gcr_loop_1
+	dec read_gcr_pages_left
+	bne read_gcr_loop_0
+
+read_gcr_done:
+	lda #$01
+	jmp dc_end_job_loop_with_status
+
+	; Auxiliary variables.
+
+read_gcr_pages_left:
+	!8 0			; Number of pages still to capture.
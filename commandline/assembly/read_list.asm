@@ -0,0 +1,140 @@
+	!cpu 6502 ; We want to run on a 1541 disc station.
+	*= $0500
+
+	!source "assembly/definitions.asm" ; Include standard definitions.
+
+	; Reads sectors from a list of track / sector pairs uploaded by the host
+	; (via M-W) into read_list_tracks and read_list_sectors. The host orders
+	; the list to minimize head movement and rotational delay.
+	; Each call reads up to three consecutive list entries, all located on
+	; the same track, into the buffers listed in read_list_buffer_pages.
+	; We expect the following parameters after M-E<mem_lo><mem_hi>:
+	; <first_list_index> <num_entries>
+	; When done, read_list_tags holds the list index of the entry each
+	; buffer holds ($ff if the buffer wasn't used).
+
+	read_list_param_first = input_buffer + 0x05
+	read_list_param_num_entries = input_buffer + 0x06
+
+	read_list_max_entries = 45 ; Must match kMaxReadListEntries.
+	read_list_tracks = $05a0  ; Track numbers of the list.
+	read_list_sectors = $05d0 ; Sector numbers of the list.
+	read_list_tags = $05fd	  ; List index per buffer (3 entries).
+
+	!if read_list_tracks + read_list_max_entries > read_list_sectors {
+	!error "read_list_tracks overlaps read_list_sectors"
+	}
+	!if read_list_sectors + read_list_max_entries > read_list_tags {
+	!error "read_list_sectors overlaps read_list_tags"
+	}
+
+	; Entry point for execute buffer. The actual main program starts below.
+	jmp read_list_job
+
+	; Main program (entry point for M-E).
+	ldx read_list_param_first
+	lda read_list_tracks, x
+	sta track_for_job_buffer_2 	; We run in buffer 2 (0x500).
+	lda read_list_sectors, x
+	sta sector_for_job_buffer_2
+	lda #$ff
+	sta read_list_tags
+	sta read_list_tags + 1
+	sta read_list_tags + 2
+	lda #jc_execute_buffer
+	sta jm_buffer_2
+wait_for_completion:
+	lda jm_buffer_2
+	bmi wait_for_completion
+	cmp #jr_error
+	bcc ok
+	ldx #$00
+	jmp print_error
+ok:
+	rts
+
+read_list_job:
+	ldy #$00
+	sty read_list_index
+
+read_next_entry:
+	ldy read_list_index
+	tya
+	clc
+	adc read_list_param_first
+	tax
+	lda read_list_sectors, x
+	sta sector_for_job_buffer_2	; The header search looks for our buffer's track / sector.
+
+	lda #$00			; Switch to the buffer we should read to.
+	sta current_buffer_start_low
+	lda read_list_buffer_pages, y
+	sta current_buffer_start_high
+
+	jsr dc_search_block_header_and_sync
+
+	ldy #$00
+read_content_loop:
+	bvc read_content_loop
+	clv
+	lda via2_drive_data
+	sta (current_buffer_start_low), y
+	iny
+	bne read_content_loop 	; Read 256 bytes.
+
+	ldy #$ba
+read_content_aux_loop:
+	bvc read_content_aux_loop
+	clv
+	lda via2_drive_data
+	sta processor_stack_page, y
+	iny
+	bne read_content_aux_loop ; Read another 70 bytes into aux space.
+
+	jsr read_convert_gcr_to_binary
+
+	lda data_block_signature_byte
+	cmp data_block_identifier
+	beq calculate_checksum
+
+	lda #errno_readerror_22
+	jmp dc_end_job_loop_with_status
+
+calculate_checksum:
+	jsr format_calculate_checksum
+	cmp sector_data_checksum
+	beq read_successful
+
+	; Report checksum error.
+	lda #errno_readerror_23
+	jmp dc_end_job_loop_with_status
+
+read_successful:
+	ldy read_list_index		; Tag the buffer with the entry it now holds.
+	tya
+	clc
+	adc read_list_param_first
+	sta read_list_tags, y
+
+	iny
+	sty read_list_index
+	cpy read_list_param_num_entries
+	bcc read_next_entry
+
+	; Done reading.
+	lda #$01
+	jmp dc_end_job_loop_with_status
+
+	; Memory pages of the buffers to read to, in list order. These match
+	; the buffers the host associates with its direct access channels.
+read_list_buffer_pages:
+	!8 >$0400, >$0600, >$0300
+
+	; Auxiliary variables.
+
+read_list_index:
+	!8 0			; Index of the entry currently being read, relative to the first.
+
+	!if * > read_list_tracks {
+	!error "read_list code overlaps read_list_tracks"
+	}
@@ -11,6 +11,12 @@
 	block_read_data_buffer_start = $0600    ; Data buffer to read to.
 	block_read_buffer_number = 3            ; Matches memory address above.
 
+	; Summary of the sector read last, fetched by the host via M-R. Must
+	; match kReadBlockSummaryAddress.
+	block_read_summary = $05fe	; The end of buffer 2.
+	block_read_run_length = block_read_summary	; Length of the run of bytes equal to the first one (0: all 256).
+	block_read_first_byte = block_read_summary + 1	; Value of the first byte in the sector.
+
 	; Entry point for execute buffer. The actual main program starts below.
 	jmp read_or_write_block_job
 
@@ -165,6 +171,24 @@ calculate_checksum:
 	jmp dc_end_job_loop_with_status
 
 read_successful:
+	; Find out how many bytes at the start of the sector match the first one,
+	; so the host doesn't need to transfer sectors consisting of a single
+	; repeated byte (e.g. empty ones).
+	ldy #$00
+	lda block_read_data_buffer_start
+	sta block_read_first_byte
+find_run_end_loop:
+	cmp block_read_data_buffer_start, y
+	bne run_end_found
+	iny
+	bne find_run_end_loop
+run_end_found:
+	sty block_read_run_length
+
 	; Done reading.
 	lda #$01
 	jmp dc_end_job_loop_with_status
+
+	!if * > block_read_summary {
+	!error "rw_block code overlaps block_read_summary"
+	}
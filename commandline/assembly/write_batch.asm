@@ -0,0 +1,178 @@
+	!cpu 6502 ; We want to run on a 1541 disc station.
+	*= $0500
+
+	!source "assembly/definitions.asm" ; Include standard definitions.
+
+	; Writes a batch of sectors on a single track in one job, so we don't
+	; have to pay for a command round trip (and usually a full revolution)
+	; per sector. The sector content is expected to have been uploaded to
+	; the buffers listed in batch_buffer_pages below.
+	; We expect the following parameters after M-E<mem_lo><mem_hi>:
+	; <track> <num_sectors> <verify> <sector_0> ... <sector_n-1>
+	; Sector i is written from the i-th buffer in batch_buffer_pages, in the
+	; order specified. The host is expected to order sectors so that each one
+	; passes under the head shortly after the previous one has been written.
+	; If verify is non-zero, each sector is read back in the next revolution
+	; and compared to what we wrote, failing with 25, WRITE ERROR on mismatch.
+
+	batch_param_track = input_buffer + 0x05
+	batch_param_num_sectors = input_buffer + 0x06
+	batch_param_verify = input_buffer + 0x07
+	batch_param_sectors = input_buffer + 0x08
+
+	; Entry point for execute buffer. The actual main program starts below.
+	jmp write_batch_job
+
+	; Main program (entry point for M-E).
+	lda batch_param_track
+	sta track_for_job_buffer_2 	; We run in buffer 2 (0x500).
+	lda batch_param_sectors
+	sta sector_for_job_buffer_2
+	lda #jc_execute_buffer
+	sta jm_buffer_2
+wait_for_completion:
+	lda jm_buffer_2
+	bmi wait_for_completion
+	cmp #jr_error
+	bcc ok
+	ldx #$00
+	jmp print_error
+ok:
+	rts
+
+write_batch_job:
+	lda via2_drive_port
+	and #via2_drive_port_write_protect_bit
+	bne disc_is_writable
+
+	lda #errno_writeprotect
+	jmp dc_end_job_loop_with_status
+
+disc_is_writable:
+	lda #$00
+	sta batch_index
+
+write_next_sector:
+	ldx batch_index
+	lda batch_param_sectors, x
+	sta sector_for_job_buffer_2	; The header search looks for our buffer's track / sector.
+
+	lda #$00			; Switch to the buffer holding this sector's content.
+	sta current_buffer_start_low
+	lda batch_buffer_pages, x
+	sta current_buffer_start_high
+
+	jsr format_calculate_checksum
+	sta sector_data_checksum
+
+	jsr format_convert_content_to_gcr
+	jsr dc_search_block_header
+
+	ldx #$09
+skip_header_loop:
+	bvc skip_header_loop
+	clv
+	dex
+	bne skip_header_loop
+
+	lda #via2_drive_direction_write
+	sta via2_drive_direction
+
+	lda via2_aux_control	; Write to disc.
+	and #$1f
+	ora #$c0
+	sta via2_aux_control
+
+	lda #gcr_sync_byte
+	ldx #$05
+	sta via2_drive_data
+	clv
+write_content_sync_loop:
+	bvc write_content_sync_loop
+	clv
+	dex
+	bne write_content_sync_loop
+
+	ldy #$bb
+write_aux_content_loop:
+	lda processor_stack_page, y
+write_aux_content_byte_loop:
+	bvc write_aux_content_byte_loop
+	clv
+	sta via2_drive_data
+	iny
+	bne write_aux_content_loop
+
+write_content_loop:
+	lda (current_buffer_start_low),y
+write_content_byte_loop:
+	bvc write_content_byte_loop
+	clv
+	sta via2_drive_data
+	iny
+	bne write_content_loop
+
+wait_last_content_byte_loop:
+	bvc wait_last_content_byte_loop
+
+	lda via2_aux_control	; Switch back to read.
+	ora #$e0
+	sta via2_aux_control
+
+	lda #via2_drive_direction_read
+	sta via2_drive_direction
+
+	lda batch_param_verify
+	beq verify_done
+
+	; Verify what we just wrote while the buffer still holds its GCR
+	; representation. We have to wait for the sector to come around again.
+	jsr dc_search_block_header_and_sync
+
+	ldy #$bb
+verify_aux_content_loop:
+	bvc verify_aux_content_loop
+	clv
+	lda via2_drive_data
+	cmp processor_stack_page, y
+	bne verification_failed
+	iny
+	bne verify_aux_content_loop
+
+	ldx #$fc		; Like verify_content.asm, skip the last few bytes.
+verify_content_loop:
+	bvc verify_content_loop
+	clv
+	lda via2_drive_data
+	cmp (current_buffer_start_low), y
+	bne verification_failed
+	iny
+	dex
+	bne verify_content_loop
+
+verify_done:
+	jsr format_convert_gcr_to_binary
+
+	inc batch_index
+	lda batch_index
+	cmp batch_param_num_sectors
+	bcs batch_done
+	jmp write_next_sector	; Out of branch range.
+
+batch_done:
+	lda #$01
+	jmp dc_end_job_loop_with_status
+
+verification_failed:
+	lda #errno_writeerror_25
+	jmp dc_end_job_loop_with_status
+
+	; Memory pages of the buffers holding the content to write, in batch order.
+	; These match the buffers the host associates with its direct access channels.
+batch_buffer_pages:
+	!8 >$0400, >$0600, >$0300
+
+	; Auxiliary variables.
+
+batch_index:
+	!8 0			; Index of the sector currently being written.
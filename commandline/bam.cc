@@ -0,0 +1,84 @@
+// Support for the block availability map (BAM) of 1541 formatted discs.
+
+#include "bam.h"
+
+#include "boost/format.hpp"
+#include "cbm1541_drive.h"
+
+// The BAM holds an entry for each of these tracks.
+static const unsigned int kNumBAMTracks = 35;
+
+// Offset of the first BAM entry. Each entry consists of the number of free
+// sectors on the track, followed by a bitmap holding a set bit for each
+// free sector.
+static const size_t kBAMEntriesOffset = 4;
+static const size_t kBAMEntrySize = 4;
+
+// Returns the number of sectors on track.
+static unsigned int GetNumTrackSectors(unsigned int track) {
+  if (track <= 17)
+    return 21;
+  if (track <= 24)
+    return 19;
+  if (track <= 30)
+    return 18;
+  return 17;
+}
+
+bool GetAllocatedSectors(const std::string &bam, size_t num_sectors,
+                         std::vector<bool> *allocated, IECStatus *status) {
+  if (bam.size() != DriveInterface::kNumBytesPerSector) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("BAM has %u bytes") % bam.size()).str(), status);
+    return false;
+  }
+  // The BAM links to the first directory sector.
+  if (static_cast<unsigned char>(bam[0]) != kDirectoryTrack) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("BAM links to track %u") %
+              static_cast<unsigned int>(static_cast<unsigned char>(bam[0])))
+                 .str(),
+             status);
+    return false;
+  }
+  // Make sure each track's free sector count matches its bitmap.
+  for (unsigned int track = 1; track <= kNumBAMTracks; ++track) {
+    const size_t offset = kBAMEntriesOffset + kBAMEntrySize * (track - 1);
+    unsigned int bitmap = static_cast<unsigned char>(bam[offset + 1]) |
+                          static_cast<unsigned char>(bam[offset + 2]) << 8 |
+                          static_cast<unsigned char>(bam[offset + 3]) << 16;
+    if (bitmap >> GetNumTrackSectors(track)) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("BAM lists non-existing sectors on track %u") %
+                track)
+                   .str(),
+               status);
+      return false;
+    }
+    unsigned int num_free = 0;
+    for (; bitmap; bitmap >>= 1) {
+      num_free += bitmap & 1;
+    }
+    if (num_free != static_cast<unsigned char>(bam[offset])) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("BAM free sector count mismatch on track %u") %
+                track)
+                   .str(),
+               status);
+      return false;
+    }
+  }
+
+  allocated->assign(num_sectors, true);
+  for (size_t s = 0; s < num_sectors; ++s) {
+    unsigned int track = 1;
+    unsigned int sector = 0;
+    CBM1541Drive::GetTrackSector(s, &track, &sector);
+    if (track == kDirectoryTrack || track > kNumBAMTracks)
+      continue;
+    const size_t offset = kBAMEntriesOffset + kBAMEntrySize * (track - 1);
+    unsigned char bits = bam[offset + 1 + sector / 8];
+    (*allocated)[s] = !(bits & (1 << (sector % 8)));
+  }
+  return true;
+}
@@ -0,0 +1,25 @@
+// Support for the block availability map (BAM) of 1541 formatted discs.
+
+#ifndef BAM_H
+#define BAM_H
+
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+// The BAM is stored at track 18, sector 0.
+const size_t kBAMSectorNumber = 357;
+
+// The directory track, which is considered to be allocated in its entirety.
+const unsigned int kDirectoryTrack = 18;
+
+// Determine which of the first num_sectors sectors of a disc are in use,
+// based on the content of its BAM sector. Sets (*allocated)[s] to true if
+// sector s is allocated in the BAM, is located on the directory track or on
+// a track the BAM doesn't cover. Returns true if successful. If the BAM
+// looks corrupt, returns false and sets status.
+bool GetAllocatedSectors(const std::string &bam, size_t num_sectors,
+                         std::vector<bool> *allocated, IECStatus *status);
+
+#endif // BAM_H
@@ -0,0 +1,93 @@
+#include "bam.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+class BAMTest : public ::testing::Test {
+public:
+  void SetUp() {
+    // Start out with an empty disc, holding only the BAM and the first
+    // directory sector.
+    bam_.assign(256, '\0');
+    bam_[0] = 18;
+    bam_[1] = 1;
+    bam_[2] = 'A';
+    for (unsigned int track = 1; track <= 35; ++track) {
+      unsigned int num_sectors =
+          track <= 17 ? 21 : track <= 24 ? 19 : track <= 30 ? 18 : 17;
+      for (unsigned int sector = 0; sector < num_sectors; ++sector) {
+        SetFree(track, sector, true);
+      }
+    }
+    SetFree(18, 0, false);
+    SetFree(18, 1, false);
+  }
+
+protected:
+  // Mark sector on track as free or allocated, updating the free count.
+  void SetFree(unsigned int track, unsigned int sector, bool free) {
+    size_t offset = 4 * track;
+    char mask = 1 << (sector % 8);
+    bool was_free = bam_[offset + 1 + sector / 8] & mask;
+    if (free == was_free)
+      return;
+    bam_[offset + 1 + sector / 8] ^= mask;
+    bam_[offset] += free ? 1 : -1;
+  }
+
+  std::string bam_;
+};
+
+TEST_F(BAMTest, AllocatedSectorsTest) {
+  // Allocate track 1, sector 5 and track 19, sector 18.
+  SetFree(1, 5, false);
+  SetFree(19, 18, false);
+
+  IECStatus status;
+  std::vector<bool> allocated;
+  ASSERT_TRUE(GetAllocatedSectors(bam_, 683, &allocated, &status))
+      << status.message;
+  ASSERT_EQ(allocated.size(), 683u);
+  for (size_t s = 0; s < allocated.size(); ++s) {
+    // Sectors 357 to 375 make up the directory track. Track 19, sector 18
+    // is sector 394.
+    bool expected = s == 5 || (s >= 357 && s < 376) || s == 394;
+    EXPECT_EQ(allocated[s], expected) << s;
+  }
+
+  // Tracks beyond 35 aren't covered by the BAM.
+  ASSERT_TRUE(GetAllocatedSectors(bam_, 768, &allocated, &status))
+      << status.message;
+  ASSERT_EQ(allocated.size(), 768u);
+  EXPECT_FALSE(allocated[682]);
+  EXPECT_TRUE(allocated[683]);
+  EXPECT_TRUE(allocated[767]);
+}
+
+TEST_F(BAMTest, CorruptBAMTest) {
+  IECStatus status;
+  std::vector<bool> allocated;
+
+  std::string bam = bam_;
+  bam[0] = 17;
+  EXPECT_FALSE(GetAllocatedSectors(bam, 683, &allocated, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
+  // Free count doesn't match the bitmap.
+  bam = bam_;
+  bam[4 * 3] -= 1;
+  status.Clear();
+  EXPECT_FALSE(GetAllocatedSectors(bam, 683, &allocated, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
+  // Track 35 only has 17 sectors.
+  bam = bam_;
+  bam[4 * 35 + 3] = 0x02;
+  status.Clear();
+  EXPECT_FALSE(GetAllocatedSectors(bam, 683, &allocated, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
+  status.Clear();
+  EXPECT_FALSE(GetAllocatedSectors(bam_.substr(1), 683, &allocated, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+}
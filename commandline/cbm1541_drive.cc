@@ -2,9 +2,19 @@
 
 #include "cbm1541_drive.h"
 
+#include <algorithm>
+#include <assert.h>
+#include <stdio.h>
+
+#include "assembly/checksum_h.h"
+#include "assembly/fast_send_h.h"
 #include "assembly/format_h.h"
+#include "assembly/read_gcr_h.h"
+#include "assembly/read_list_h.h"
 #include "assembly/rw_block_h.h"
+#include "assembly/write_batch_h.h"
 #include "boost/format.hpp"
+#include "g64_image.h"
 
 // Logical OK response.
 static const char kOKResponse[] = "00, OK,00,00\r";
@@ -12,6 +22,22 @@ static const char kOKResponse[] = "00, OK,00,00\r";
 // Max amount of data for a single M-W command is 35 bytes.
 static const size_t kMaxMWSize = 35;
 
+// Max amount of data for a single M-R command.
+static const size_t kMaxMRSize = 255;
+
+// Size of the drive's RAM, starting at address 0.
+static const size_t kDriveRAMSize = 0x800;
+
+// Returns the start address of the specified drive buffer.
+static unsigned short int BufferAddress(int buffer) {
+  return 0x300 + 0x100 * buffer;
+}
+
+// Number of fast transfers that may fail in a row before we stop trying.
+// A single failure, e.g. due to a glitch on the bus, shouldn't slow down the
+// rest of the disc.
+static const int kMaxFastTransferFailures = 3;
+
 // We skip the first three bytes, because they're a jmp into the read/write job.
 static const size_t kReadWriteBlockEntryPoint = 0x503;
 
@@ -19,6 +45,90 @@ static const size_t kReadWriteBlockEntryPoint = 0x503;
 static const size_t kReadBlockOption = 0x00;
 static const size_t kWriteBlockOption = 0x01;
 
+// Location of the summary of the sector read last, which rw_block.asm keeps
+// at the end of buffer 2, past its code. It holds the length of the run of
+// bytes equal to the first one (zero if all bytes are equal), followed by the
+// first byte.
+static const unsigned short int kReadBlockSummaryAddress = 0x5fe;
+
+// We skip the first three bytes, because they're a jmp into the batched write
+// job.
+static const size_t kWriteBatchEntryPoint = 0x503;
+
+// Sectors on the same track are read or written in this interleave.
+// Converting a sector to and from GCR takes a little longer than it takes the
+// next sector to pass under the head, so accessing consecutive sectors would
+// cost a revolution each.
+static const unsigned int kSectorInterleave = 3;
+
+// We skip the first three bytes, because they're a jmp into the list read job.
+static const size_t kReadListEntryPoint = 0x503;
+
+// Location of the track / sector list and buffer tags within read_list.asm.
+static const unsigned short int kReadListTracksAddress = 0x5a0;
+static const unsigned short int kReadListSectorsAddress = 0x5d0;
+static const unsigned short int kReadListTagsAddress = 0x5fd;
+
+// We skip the first three bytes, because they're a jmp into the checksum job.
+static const size_t kChecksumEntryPoint = 0x503;
+
+// Location of the checksum table within checksum.asm.
+static const unsigned short int kChecksumTableAddress = 0x5d6;
+
+// Calculating a sector's checksum takes about two more sectors' worth of
+// rotation on top of reading it.
+static const unsigned int kChecksumInterleave = kSectorInterleave + 2;
+
+// We skip the first three bytes, because they're a jmp into the GCR capture
+// job.
+static const size_t kReadGCREntryPoint = 0x503;
+
+// read_gcr.asm captures into a ring of two pages in buffers 0 and 1, so we
+// retrieve a track in windows of this many bytes, one per revolution.
+static const size_t kReadGCRWindowSize = 0x200;
+
+// Number of bytes we capture per track. A revolution yields at most 7692
+// bytes (speed zone 3), plus we need kGCRRevolutionMatchSize bytes to find
+// the start of the next revolution.
+static const size_t kReadGCRCaptureSize = 17 * kReadGCRWindowSize;
+
+// A revolution yields at least 6250 bytes (speed zone 0), minus what we save
+// by storing sync marks as a single byte.
+static const size_t kGCRMinRevolutionSize = 5800;
+
+// read_gcr.asm stores a byte up to this one in place of each sync mark,
+// holding the number of iterations of its sync loop.
+static const unsigned char kGCRMaxSyncMarker = 0x1f;
+
+// Number of cycles an iteration of read_gcr.asm's sync loop takes.
+static const unsigned int kGCRSyncLoopCycles = 13;
+
+// Number of 1 bits the drive needs to see before reporting a sync mark.
+static const unsigned int kGCRSyncDetectionBits = 10;
+
+// Number of bytes we compare to find where the next revolution starts. This
+// needs to cover the next sector header, as data blocks of equal content are
+// indistinguishable.
+static const size_t kGCRRevolutionMatchSize = 400;
+
+// Minimum number of those bytes which need to match. Weak bits may differ
+// between revolutions, but anything below this is no revolution at all.
+static const size_t kGCRMinRevolutionMatches = 360;
+
+// Returns true if the captured bytes a and b are equal, treating all sync
+// marks as equal regardless of their length.
+static bool GCRBytesMatch(char a, char b) {
+  if (static_cast<unsigned char>(a) <= kGCRMaxSyncMarker)
+    return static_cast<unsigned char>(b) <= kGCRMaxSyncMarker;
+  return a == b;
+}
+
+// fast_send.asm doesn't run as a job, so it starts with its main program.
+// It resides in buffer 4, as the other buffers hold sector data or the
+// remaining fragments. That's where the DOS keeps the BAM, which we have it
+// read again once we're done, see ~CBM1541Drive().
+static const size_t kFastSendEntryPoint = 0x700;
+
 // We skip the first three bytes, because they're a jmp into the format job.
 static const size_t kFormatEntryPoint = 0x503;
 
@@ -27,21 +137,108 @@ static const size_t kNumBytesPerSector = 0x100;
 // The direct access channels to use.
 static const int kWriteDirectAccessChannel = 2;
 static const int kReadDirectAccessChannel = 3;
+static const int kBatchDirectAccessChannel = 4;
+
+// Direct access channels holding the content for batched writes and list
+// reads, in batch order. Must match the buffer order expected by
+// write_batch.asm and read_list.asm.
+static const int kBatchChannels[CBM1541Drive::kMaxBatchSectors] = {
+    kWriteDirectAccessChannel, kReadDirectAccessChannel,
+    kBatchDirectAccessChannel};
 
-// We won't allow trying to access a track higher than this as it might damage
-// the hardware.
-static const int kMaxTrackNumber = 41;
+// The buffers associated with kBatchChannels.
+static const int kBatchBuffers[CBM1541Drive::kMaxBatchSectors] = {1, 3, 0};
+
+// Number of sectors on standard (35 tracks) and extended (40 tracks) discs.
+static const size_t kNumSectorsStandard = 683;
+static const size_t kNumSectorsExtended = 768;
+
+// The tracks we probe to find out whether we're dealing with an extended
+// disc.
+static const unsigned int kFirstExtendedTrack = 36;
+static const unsigned int kLastExtendedTrack = 40;
+
+// Job queue location. The job code for buffer n is stored at
+// kJobCodeAddress + n, the track and sector it refers to at
+// kJobTrackSectorAddress + 2 * n.
+static const unsigned short int kJobCodeAddress = 0x0000;
+static const unsigned short int kJobTrackSectorAddress = 0x0006;
+
+// Job codes for searching any sector header on the job's track, for writing
+// the job's buffer to disc, for verifying it against the disc and for
+// bumping the head.
+static const unsigned char kSeekJobCode = 0xb0;
+static const unsigned char kBumpJobCode = 0xc0;
+static const unsigned char kWriteJobCode = 0x90;
+static const unsigned char kVerifyJobCode = 0xa0;
+
+// The result code of a successful job. Other result codes correspond to
+// drive error numbers, starting at 20 for result code 2.
+static const unsigned char kJobResultOK = 0x01;
+static const unsigned int kJobResultErrorOffset = 18;
+
+// Jobs which only move the head use the job queue entry for buffer 2, which
+// holds our code. They don't touch the buffer's content.
+static const unsigned int kHeadJobBuffer = 2;
+
+// Channels holding the content of drive buffers 0 and 1, which the drive's
+// own jobs write to disc and read_gcr.asm captures to.
+static const int kJobChannels[] = {kBatchDirectAccessChannel,
+                                   kWriteDirectAccessChannel};
+
+// Number of times we check for completion of a job before giving up.
+static const int kMaxJobPolls = 1000;
 
 const std::map<CBM1541Drive::FirmwareState,
                CBM1541Drive::CustomFirmwareFragment>
     CBM1541Drive::fw_fragment_map_ = {
         {FW_CUSTOM_FORMATTING_CODE, {format_bin, sizeof(format_bin), 0x500}},
         {FW_CUSTOM_READ_WRITE_CODE,
-         {rw_block_bin, sizeof(rw_block_bin), 0x500}}};
+         {rw_block_bin, sizeof(rw_block_bin), 0x500}},
+        {FW_CUSTOM_WRITE_BATCH_CODE,
+         {write_batch_bin, sizeof(write_batch_bin), 0x500}},
+        {FW_CUSTOM_READ_LIST_CODE,
+         {read_list_bin, sizeof(read_list_bin), 0x500}},
+        {FW_CUSTOM_CHECKSUM_CODE,
+         {checksum_bin, sizeof(checksum_bin), 0x500}},
+        {FW_CUSTOM_READ_GCR_CODE,
+         {read_gcr_bin, sizeof(read_gcr_bin), 0x500}},
+        {FW_CUSTOM_FAST_SEND_CODE,
+         {fast_send_bin, sizeof(fast_send_bin), kFastSendEntryPoint}}};
+
+// Returns true if response reports that a sector couldn't be read due to a
+// media error (errors 20 to 29).
+static bool IsMediaErrorResponse(const std::string &response) {
+  unsigned int error_number = 0;
+  return sscanf(response.c_str(), "%u,", &error_number) == 1 &&
+         error_number >= 20 && error_number <= 29;
+}
+
+// Returns the track local sector numbers in sectors (which must be sorted
+// and unique) in the order we should access them, honoring interleave.
+static std::vector<unsigned int>
+OrderForRotation(const std::vector<unsigned int> &sectors,
+                 unsigned int interleave = kSectorInterleave) {
+  std::vector<unsigned int> remaining = sectors;
+  std::vector<unsigned int> result;
+  while (!remaining.empty()) {
+    // Pick the next sector at least interleave sectors after the one we
+    // accessed last, wrapping around to the lowest one if necessary.
+    auto it = remaining.begin();
+    if (!result.empty()) {
+      it = std::lower_bound(remaining.begin(), remaining.end(),
+                            result.back() + interleave);
+      if (it == remaining.end())
+        it = remaining.begin();
+    }
+    result.push_back(*it);
+    remaining.erase(it);
+  }
+  return result;
+}
 
 CBM1541Drive::CBM1541Drive(IECBusConnection *bus_conn, char device_number)
-    : bus_conn_(bus_conn), device_number_(device_number),
-      fw_state_(FW_NO_CUSTOM_CODE) {}
+    : bus_conn_(bus_conn), device_number_(device_number) {}
 
 CBM1541Drive::~CBM1541Drive() {
   // Close direct access channels that have been initialized.
@@ -58,19 +255,51 @@ CBM1541Drive::~CBM1541Drive() {
     bus_conn_->CloseChannel(device_number_, read_da_chan_, &status);
     read_da_chan_ = -1;
   }
+  if (batch_da_chan_ != -1) {
+    IECStatus status;
+    bus_conn_->CloseChannel(device_number_, batch_da_chan_, &status);
+    batch_da_chan_ = -1;
+  }
+  // fast_send.asm overwrote the BAM the DOS holds in memory.
+  auto page_it = page_content_.find(kFastSendEntryPoint >> 8);
+  if (page_it != page_content_.end() &&
+      page_it->second == FW_CUSTOM_FAST_SEND_CODE) {
+    IECStatus status;
+    std::string response;
+    if (bus_conn_->WriteToChannel(device_number_, 15, "I0", &status))
+      bus_conn_->ReadFromChannel(device_number_, 15, &response, &status);
+  }
 }
 
 bool CBM1541Drive::FormatDiscLowLevel(size_t num_tracks, IECStatus *status) {
+  return FormatTracks(1, num_tracks, status);
+}
+
+bool CBM1541Drive::FormatTracks(unsigned int first_track,
+                                unsigned int num_tracks, IECStatus *status) {
+  if (first_track < 1 || num_tracks < 1 ||
+      first_track + num_tracks - 1 > kMaxTrackNumber) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("not trying to format tracks %u to %u as it "
+                            "might cause hardware damage") %
+              first_track % (first_track + num_tracks - 1))
+                 .str(),
+             status);
+    return false;
+  }
   if (!SetFirmwareState(FW_CUSTOM_FORMATTING_CODE, status))
     return false;
 
-  // TODO(aeckleder): Pass num_tracks to format code.
   std::string request = "M-E";
   request.append(1, char(kFormatEntryPoint & 0xff));
   request.append(1, char(kFormatEntryPoint >> 8));
+  request.append(1, char(first_track));
+  request.append(1, char(num_tracks));
   if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
     return false;
   }
+  ForgetChannels();
+
   // Get the result for the disc format.
   std::string response;
   if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
@@ -84,9 +313,18 @@ bool CBM1541Drive::FormatDiscLowLevel(size_t num_tracks, IECStatus *status) {
 }
 
 bool CBM1541Drive::GetNumSectors(size_t *num_sectors, IECStatus *status) {
-  // Hardcoded 35 tracks disc.
-  // TODO(aeckleder): 40 track discs have 768 blocks.
-  *num_sectors = 683;
+  // Extended discs hold sector headers on all of the additional tracks.
+  for (unsigned int track = kFirstExtendedTrack; track <= kLastExtendedTrack;
+       ++track) {
+    bool formatted = false;
+    if (!ProbeTrackFormatted(track, &formatted, status))
+      return false;
+    if (!formatted) {
+      *num_sectors = kNumSectorsStandard;
+      return true;
+    }
+  }
+  *num_sectors = kNumSectorsExtended;
   return true;
 }
 
@@ -106,45 +344,78 @@ bool CBM1541Drive::ReadSector(size_t sector_number, std::string *content,
     return false;
   }
 
-  if (!SetFirmwareState(FW_CUSTOM_READ_WRITE_CODE, status))
-    return false;
-  if (!InitDirectAccessChannel(status))
+  if (!ReadBlock(track, sector, status))
     return false;
 
-  // Read from disc.
-  std::string request = "M-E";
-  request.append(1, char(kReadWriteBlockEntryPoint & 0xff));
-  request.append(1, char(kReadWriteBlockEntryPoint >> 8));
-  request.append(1, char(track));
-  request.append(1, char(sector));
-  request.append(1, char(kReadBlockOption));
-  if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+  // Sectors consisting of a single repeated byte (such as empty ones) are
+  // common, and there's no need to transfer them byte by byte.
+  std::string summary;
+  if (!ReadMemory(kReadBlockSummaryAddress, 2, &summary, status))
     return false;
+  if (summary[0] == 0) {
+    content->assign(kNumBytesPerSector, summary[1]);
+    return true;
   }
 
-  // Reposition buffer pointer
-  // TODO(aeckleder): Fix block read code to no longer require this.
-  request = (boost::format("B-P:%u 0") % read_da_chan_).str();
-  if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+  // Read sector content.
+  return ReadBuffer(read_da_chan_, 3, content, status);
+}
+
+bool CBM1541Drive::CopySectorTo(size_t sector_number, CBM1541Drive *target,
+                                IECStatus *status) {
+  if (target->bus_conn_ != bus_conn_) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             "source and target drive need to share the same bus", status);
+    return false;
+  }
+  if (!bus_conn_->SupportsDirectCopy()) {
+    SetError(IECStatus::UNIMPLEMENTED,
+             "the bus connection doesn't support direct copies", status);
+    return false;
+  }
+  unsigned int track = 1;
+  unsigned int sector = 0;
+  GetTrackSector(sector_number, &track, &sector);
+  if (track > kMaxTrackNumber) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("not trying to copy track %u as it might cause "
+                            "hardware damage") %
+              track)
+                 .str(),
+             status);
     return false;
   }
 
-  // Read sector content.
-  if (!bus_conn_->ReadFromChannel(device_number_, read_da_chan_, content,
-                                  status)) {
+  if (!ReadBlock(track, sector, status))
     return false;
+  if (target->format_on_write_ && !target->formatted_tracks_.count(track)) {
+    if (!target->FormatTracks(track, 1, status))
+      return false;
+    target->formatted_tracks_.insert(track);
   }
+  if (!target->InitWriteChannel(status))
+    return false;
 
-  // Get the result for the read command.
-  std::string response;
-  if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+  // Both buffers are transferred from and to their beginning.
+  auto cmd = boost::format("B-P:%u 0") % read_da_chan_;
+  if (!bus_conn_->WriteToChannel(device_number_, 15, cmd.str(), status)) {
     return false;
   }
-  if (response != kOKResponse) {
-    SetError(IECStatus::DRIVE_ERROR, response, status);
+  cmd = boost::format("B-P:%u 0") % target->write_da_chan_;
+  if (!bus_conn_->WriteToChannel(target->device_number_, 15, cmd.str(),
+                                 status)) {
     return false;
   }
-  return true;
+  if (!bus_conn_->CopyBetweenChannels(device_number_, read_da_chan_,
+                                      target->device_number_,
+                                      target->write_da_chan_, status)) {
+    return false;
+  }
+
+  // The target's own write job doesn't need any custom code, which leaves
+  // its format routine resident if it has one. Its write channel uses
+  // buffer 1.
+  return target->WriteBuffersWithJobs(1, track, {sector}, status);
 }
 
 bool CBM1541Drive::WriteSector(size_t sector_number, const std::string &content,
@@ -169,6 +440,15 @@ bool CBM1541Drive::WriteSector(size_t sector_number, const std::string &content,
              status);
     return false;
   }
+  if (format_on_write_) {
+    // The track may need formatting first.
+    return WriteSectors(sector_number, {content}, status);
+  }
+  if (verify_writes_) {
+    // There's no room for verification in the read/write code, but the
+    // batched write routine handles it.
+    return WriteBatch(track, {{sector, &content}}, status);
+  }
 
   if (!SetFirmwareState(FW_CUSTOM_READ_WRITE_CODE, status))
     return false;
@@ -204,12 +484,542 @@ bool CBM1541Drive::WriteSector(size_t sector_number, const std::string &content,
   return true;
 }
 
+bool CBM1541Drive::WriteSectors(size_t first_sector,
+                                const std::vector<std::string> &contents,
+                                IECStatus *status) {
+  std::vector<std::pair<unsigned int, SectorBatch>> tracks;
+  if (!OrderByTrack(first_sector, contents, &tracks, status))
+    return false;
+  if (format_on_write_) {
+    // Format every track we're about to write to before writing any of
+    // them, one request per range of consecutive tracks. The write jobs
+    // move the head back to each track themselves.
+    for (size_t t = 0; t < tracks.size();) {
+      unsigned int first_track = tracks[t].first;
+      unsigned int num_tracks = 0;
+      while (t < tracks.size() &&
+             tracks[t].first == first_track + num_tracks &&
+             !formatted_tracks_.count(tracks[t].first)) {
+        ++num_tracks;
+        ++t;
+      }
+      if (num_tracks == 0) {
+        ++t;
+        continue;
+      }
+      if (!FormatTracks(first_track, num_tracks, status))
+        return false;
+      for (unsigned int i = 0; i < num_tracks; ++i) {
+        formatted_tracks_.insert(first_track + i);
+      }
+    }
+  }
+  for (const auto &entry : tracks) {
+    unsigned int track = entry.first;
+    const SectorBatch &track_order = entry.second;
+    if (format_on_write_) {
+      // Keep the format routine resident and have the drive's own write job
+      // write the content, so we don't need to swap code for every track.
+      if (!WriteWithJobs(track, track_order, status))
+        return false;
+      continue;
+    }
+    for (size_t b = 0; b < track_order.size(); b += kMaxBatchSectors) {
+      size_t batch_end =
+          std::min(track_order.size(), b + size_t(kMaxBatchSectors));
+      SectorBatch batch(track_order.begin() + b,
+                        track_order.begin() + batch_end);
+      if (!WriteBatch(track, batch, status))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool CBM1541Drive::WriteSectorsToAll(const std::vector<CBM1541Drive *> &drives,
+                                     size_t first_sector,
+                                     const std::vector<std::string> &contents,
+                                     std::vector<IECStatus> *results,
+                                     IECStatus *status) {
+  if (!CheckBroadcast(drives, *results, status))
+    return false;
+  for (CBM1541Drive *drive : drives) {
+    if (drive->verify_writes_ != drives[0]->verify_writes_) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               "all drives need the same write verification setting", status);
+      return false;
+    }
+  }
+  std::vector<std::pair<unsigned int, SectorBatch>> tracks;
+  if (!OrderByTrack(first_sector, contents, &tracks, status))
+    return false;
+
+  for (const auto &entry : tracks) {
+    unsigned int track = entry.first;
+    const SectorBatch &track_order = entry.second;
+    for (size_t b = 0; b < track_order.size(); b += kMaxBatchSectors) {
+      size_t batch_end =
+          std::min(track_order.size(), b + size_t(kMaxBatchSectors));
+      SectorBatch batch(track_order.begin() + b,
+                        track_order.begin() + batch_end);
+
+      // Code uploads and channel setup depend on what each drive did before,
+      // so they're done drive by drive.
+      std::vector<char> devices;
+      for (size_t i = 0; i < drives.size(); ++i) {
+        IECStatus &result = (*results)[i];
+        if (!result.ok())
+          continue;
+        if (drives[i]->SetFirmwareState(FW_CUSTOM_WRITE_BATCH_CODE,
+                                        &result) &&
+            drives[i]->InitDirectAccessChannel(&result) &&
+            (batch.size() < kMaxBatchSectors ||
+             drives[i]->InitBatchChannel(&result))) {
+          devices.push_back(drives[i]->device_number_);
+        }
+      }
+      if (devices.empty())
+        return true;
+
+      // All drives use the same channels, so the sector content only needs
+      // to be sent once.
+      IECBusConnection *bus_conn = drives[0]->bus_conn_;
+      for (size_t i = 0; i < batch.size(); ++i) {
+        if (kBatchChannels[i] == kReadDirectAccessChannel) {
+          // Reading may have left the buffer pointer anywhere.
+          std::string request =
+              (boost::format("B-P:%u 0") % kBatchChannels[i]).str();
+          if (!bus_conn->WriteToChannels(devices, 15, request, status))
+            return false;
+        }
+        if (!bus_conn->WriteToChannels(devices, kBatchChannels[i],
+                                       *batch[i].second, status)) {
+          return false;
+        }
+      }
+      if (!bus_conn->WriteToChannels(
+              devices, 15, drives[0]->GetWriteBatchRequest(track, batch),
+              status)) {
+        return false;
+      }
+      CollectResults(drives, results);
+    }
+  }
+  return true;
+}
+
+bool CBM1541Drive::FormatDiscLowLevelOnAll(
+    const std::vector<CBM1541Drive *> &drives, size_t num_tracks,
+    std::vector<IECStatus> *results, IECStatus *status) {
+  if (!CheckBroadcast(drives, *results, status))
+    return false;
+  if (num_tracks < 1 || num_tracks > kMaxTrackNumber) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("not trying to format %u tracks as it might "
+                            "cause hardware damage") %
+              num_tracks)
+                 .str(),
+             status);
+    return false;
+  }
+
+  std::vector<char> devices;
+  for (size_t i = 0; i < drives.size(); ++i) {
+    IECStatus &result = (*results)[i];
+    if (result.ok() &&
+        drives[i]->SetFirmwareState(FW_CUSTOM_FORMATTING_CODE, &result)) {
+      devices.push_back(drives[i]->device_number_);
+    }
+  }
+  if (devices.empty())
+    return true;
+
+  std::string request = "M-E";
+  request.append(1, char(kFormatEntryPoint & 0xff));
+  request.append(1, char(kFormatEntryPoint >> 8));
+  request.append(1, char(1));
+  request.append(1, char(num_tracks));
+  if (!drives[0]->bus_conn_->WriteToChannels(devices, 15, request, status))
+    return false;
+  for (size_t i = 0; i < drives.size(); ++i) {
+    if ((*results)[i].ok())
+      drives[i]->ForgetChannels();
+  }
+  // All drives format at the same time, so collecting the results takes
+  // about as long as formatting a single disc.
+  CollectResults(drives, results);
+  return true;
+}
+
+bool CBM1541Drive::VerifySectors(
+    size_t first_sector, const std::vector<unsigned short int> &expected,
+    std::vector<size_t> *mismatches, IECStatus *status) {
+  mismatches->clear();
+  size_t pos = 0;
+  while (pos < expected.size()) {
+    // Find all sectors located on the same track.
+    unsigned int track = 1;
+    unsigned int first_track_sector = 0;
+    GetTrackSector(first_sector + pos, &track, &first_track_sector);
+    size_t track_end = pos + 1;
+    while (track_end < expected.size()) {
+      unsigned int next_track = 1;
+      unsigned int next_sector = 0;
+      GetTrackSector(first_sector + track_end, &next_track, &next_sector);
+      if (next_track != track)
+        break;
+      ++track_end;
+    }
+    if (track > kMaxTrackNumber) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("not trying to read from track %u as it might "
+                              "cause hardware damage") %
+                track)
+                   .str(),
+               status);
+      return false;
+    }
+    if (!SetFirmwareState(FW_CUSTOM_CHECKSUM_CODE, status))
+      return false;
+    // The checksum routine reads sectors into buffer #3.
+    SetPageContent(BufferAddress(3), 0x100, FW_NO_CUSTOM_CODE);
+
+    // Checksum all sectors on this track with a single job. The job stops
+    // at the first sector it can't read, in which case we checksum the
+    // track's sectors one by one to tell which ones are unreadable.
+    std::vector<unsigned int> sectors;
+    for (size_t i = pos; i < track_end; ++i) {
+      sectors.push_back(first_track_sector + (i - pos));
+    }
+    std::vector<std::vector<unsigned int>> jobs = {
+        OrderForRotation(sectors, kChecksumInterleave)};
+    for (size_t job = 0; job < jobs.size(); ++job) {
+      // Copy, jobs might grow below.
+      const std::vector<unsigned int> job_sectors = jobs[job];
+      std::string request = "M-E";
+      request.append(1, char(kChecksumEntryPoint & 0xff));
+      request.append(1, char(kChecksumEntryPoint >> 8));
+      request.append(1, char(track));
+      request.append(1, char(job_sectors.size()));
+      for (unsigned int sector : job_sectors) {
+        request.append(1, char(sector));
+      }
+      if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+        return false;
+      }
+      std::string response;
+      if (!bus_conn_->ReadFromChannel(device_number_, 15, &response,
+                                      status)) {
+        return false;
+      }
+      if (response != kOKResponse) {
+        if (!IsMediaErrorResponse(response)) {
+          SetError(IECStatus::DRIVE_ERROR, response, status);
+          return false;
+        }
+        // A sector that can't be read doesn't hold what's expected.
+        if (job_sectors.size() == 1) {
+          mismatches->push_back(first_sector + pos +
+                                (job_sectors[0] - first_track_sector));
+        } else {
+          for (unsigned int sector : job_sectors)
+            jobs.push_back({sector});
+        }
+        continue;
+      }
+
+      std::string checksums;
+      if (!ReadMemory(kChecksumTableAddress, 2 * job_sectors.size(),
+                      &checksums, status)) {
+        return false;
+      }
+      for (size_t i = 0; i < job_sectors.size(); ++i) {
+        unsigned short int checksum =
+            static_cast<unsigned char>(checksums[2 * i]) |
+            static_cast<unsigned char>(checksums[2 * i + 1]) << 8;
+        size_t index = pos + (job_sectors[i] - first_track_sector);
+        if (checksum != expected[index])
+          mismatches->push_back(first_sector + index);
+      }
+    }
+    pos = track_end;
+  }
+  std::sort(mismatches->begin(), mismatches->end());
+  return true;
+}
+
+bool CBM1541Drive::SetWriteVerification(bool enable) {
+  verify_writes_ = enable;
+  return true;
+}
+
+bool CBM1541Drive::SetFormatOnWrite(bool enable) {
+  format_on_write_ = enable;
+  formatted_tracks_.clear();
+  return true;
+}
+
+bool CBM1541Drive::MoveHead(size_t sector_number, HeadMovement movement,
+                            IECStatus *status) {
+  unsigned int track = 1;
+  unsigned int sector = 0;
+  GetTrackSector(sector_number, &track, &sector);
+  if (track > kMaxTrackNumber) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("not trying to move to track %u as it might "
+                            "cause hardware damage") %
+              track)
+                 .str(),
+             status);
+    return false;
+  }
+  unsigned char job_code = kBumpJobCode;
+  if (movement == HEAD_NEIGHBOUR_TRACK) {
+    // Seeking a header on the neighbouring track moves the head there. We
+    // don't care whether it finds one.
+    job_code = kSeekJobCode;
+    track = track > 1 ? track - 1 : track + 1;
+  }
+  const unsigned char track_sector[] = {static_cast<unsigned char>(track),
+                                        0x00};
+  if (!WriteMemory(kJobTrackSectorAddress + 2 * kHeadJobBuffer,
+                   sizeof(track_sector), track_sector, status)) {
+    return false;
+  }
+  std::string results;
+  return RunJobs(kHeadJobBuffer, {job_code}, &results, status);
+}
+
 bool CBM1541Drive::ReadCommandChannel(std::string *response,
                                       IECStatus *status) {
   // Accessing the command channel is always ok, no open call necessary.
   return bus_conn_->ReadFromChannel(device_number_, 15, response, status);
 }
 
+bool CBM1541Drive::ReadSectorList(const std::vector<size_t> &sector_numbers,
+                                  std::map<size_t, std::string> *contents,
+                                  IECStatus *status) {
+  // Group the requested sectors by track. Tracks are visited in ascending
+  // order, sectors within a track in rotation friendly order.
+  std::map<unsigned int, std::map<unsigned int, size_t>> track_map;
+  for (size_t sector_number : sector_numbers) {
+    unsigned int track = 1;
+    unsigned int sector = 0;
+    GetTrackSector(sector_number, &track, &sector);
+    if (track > kMaxTrackNumber) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("not trying to read from track %u as it might "
+                              "cause hardware damage") %
+                track)
+                   .str(),
+               status);
+      return false;
+    }
+    track_map[track][sector] = sector_number;
+  }
+  struct ListEntry {
+    unsigned int track;
+    unsigned int sector;
+    size_t sector_number;
+  };
+  std::vector<ListEntry> list;
+  for (const auto &track_entry : track_map) {
+    std::vector<unsigned int> sectors;
+    for (const auto &sector_entry : track_entry.second) {
+      sectors.push_back(sector_entry.first);
+    }
+    for (unsigned int sector : OrderForRotation(sectors)) {
+      list.push_back(
+          {track_entry.first, sector, track_entry.second.at(sector)});
+    }
+  }
+
+  contents->clear();
+  if (list.empty())
+    return true;
+  if (!SetFirmwareState(FW_CUSTOM_READ_LIST_CODE, status))
+    return false;
+  if (!InitDirectAccessChannel(status))
+    return false;
+
+  for (size_t chunk = 0; chunk < list.size(); chunk += kMaxReadListEntries) {
+    // Upload the next part of the list.
+    size_t chunk_size =
+        std::min(list.size() - chunk, size_t(kMaxReadListEntries));
+    std::vector<unsigned char> tracks, sectors;
+    for (size_t i = chunk; i < chunk + chunk_size; ++i) {
+      tracks.push_back(list[i].track);
+      sectors.push_back(list[i].sector);
+    }
+    if (!WriteMemory(kReadListTracksAddress, tracks.size(), &tracks[0],
+                     status) ||
+        !WriteMemory(kReadListSectorsAddress, sectors.size(), &sectors[0],
+                     status)) {
+      return false;
+    }
+
+    size_t first = 0;
+    while (first < chunk_size) {
+      // Read up to kMaxBatchSectors entries on the same track.
+      size_t num_entries = 1;
+      while (num_entries < kMaxBatchSectors &&
+             first + num_entries < chunk_size &&
+             tracks[first + num_entries] == tracks[first]) {
+        ++num_entries;
+      }
+      if (num_entries == kMaxBatchSectors && !InitBatchChannel(status))
+        return false;
+
+      std::string request = "M-E";
+      request.append(1, char(kReadListEntryPoint & 0xff));
+      request.append(1, char(kReadListEntryPoint >> 8));
+      request.append(1, char(first));
+      request.append(1, char(num_entries));
+      if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+        return false;
+      }
+      std::string response;
+      if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+        return false;
+      }
+      if (response != kOKResponse) {
+        SetError(IECStatus::DRIVE_ERROR, response, status);
+        return false;
+      }
+
+      // Find out which list entry each buffer holds.
+      std::string tags;
+      if (!ReadMemory(kReadListTagsAddress, kMaxBatchSectors, &tags, status))
+        return false;
+      for (size_t i = 0; i < num_entries; ++i) {
+        if (i >= tags.size() || static_cast<unsigned char>(tags[i]) >=
+                                    chunk_size) {
+          SetError(IECStatus::DRIVE_ERROR,
+                   (boost::format("unexpected tag for buffer %u") % i).str(),
+                   status);
+          return false;
+        }
+        const ListEntry &entry =
+            list[chunk + static_cast<unsigned char>(tags[i])];
+
+        std::string content;
+        if (!ReadBuffer(kBatchChannels[i], kBatchBuffers[i], &content,
+                        status)) {
+          return false;
+        }
+        (*contents)[entry.sector_number] = content;
+      }
+      first += num_entries;
+    }
+  }
+  return true;
+}
+
+bool CBM1541Drive::ReadTrackGCR(unsigned int track, std::string *gcr,
+                                std::vector<GCRSyncMark> *sync_marks,
+                                IECStatus *status) {
+  if (track < 1 || track > kMaxTrackNumber) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("not trying to read from track %u as it might "
+                            "cause hardware damage") %
+              track)
+                 .str(),
+             status);
+    return false;
+  }
+  if (!SetFirmwareState(FW_CUSTOM_READ_GCR_CODE, status))
+    return false;
+  // Buffers 0 and 1 hold the captured data, which we retrieve through the
+  // channels using them.
+  if (!InitDirectAccessChannel(status) || !InitBatchChannel(status))
+    return false;
+
+  std::string capture;
+  for (size_t window = 0; capture.size() < kReadGCRCaptureSize; ++window) {
+    std::string request = "M-E";
+    request.append(1, char(kReadGCREntryPoint & 0xff));
+    request.append(1, char(kReadGCREntryPoint >> 8));
+    request.append(1, char(track));
+    request.append(1, char(2 * window + 2));
+    if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+      return false;
+    }
+    std::string response;
+    if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+      return false;
+    }
+    if (response != kOKResponse) {
+      SetError(IECStatus::DRIVE_ERROR, response, status);
+      return false;
+    }
+    for (int buffer : {0, 1}) {
+      std::string content;
+      if (!ReadBuffer(kJobChannels[buffer], buffer, &content, status))
+        return false;
+      if (content.size() != kNumBytesPerSector) {
+        SetError(IECStatus::DRIVE_ERROR,
+                 (boost::format("read %u bytes of GCR data, expected %u") %
+                  content.size() % kNumBytesPerSector)
+                     .str(),
+                 status);
+        return false;
+      }
+      capture += content;
+    }
+  }
+
+  // Each window was captured during a different revolution, but relative to
+  // the same reference point. Find the revolution length as the offset at
+  // which the capture best matches its own start.
+  size_t revolution_size = 0;
+  size_t best_matches = kGCRMinRevolutionMatches - 1;
+  for (size_t offset = kGCRMinRevolutionSize;
+       offset + kGCRRevolutionMatchSize <= capture.size(); ++offset) {
+    size_t matches = 0;
+    for (size_t i = 0; i < kGCRRevolutionMatchSize; ++i) {
+      if (GCRBytesMatch(capture[offset + i], capture[i]))
+        ++matches;
+    }
+    if (matches > best_matches) {
+      best_matches = matches;
+      revolution_size = offset;
+    }
+  }
+  if (revolution_size == 0) {
+    SetError(IECStatus::DRIVE_ERROR,
+             (boost::format("unable to find revolution on track %u") % track)
+                 .str(),
+             status);
+    return false;
+  }
+
+  // The sync loop starts once the drive has seen kGCRSyncDetectionBits 1
+  // bits, which we add to the time it measured.
+  unsigned int cycles_per_byte = 32 - 2 * GetSpeedZone(track);
+  gcr->clear();
+  sync_marks->clear();
+  for (size_t i = 0; i < revolution_size; ++i) {
+    unsigned char byte = capture[i];
+    if (byte <= kGCRMaxSyncMarker) {
+      unsigned int cycles = byte * kGCRSyncLoopCycles +
+                            kGCRSyncDetectionBits * cycles_per_byte / 8;
+      sync_marks->push_back(
+          {gcr->size(), (cycles + cycles_per_byte / 2) / cycles_per_byte});
+      gcr->append(kGCRSyncLength, '\xff');
+    } else {
+      gcr->append(1, byte);
+    }
+  }
+  return true;
+}
+
+unsigned int CBM1541Drive::GetNumTracks(size_t num_sectors) {
+  unsigned int track = 0;
+  unsigned int sector = 0;
+  GetTrackSector(num_sectors - 1, &track, &sector);
+  return track;
+}
+
 void CBM1541Drive::GetTrackSector(unsigned int s, unsigned int *track,
                                   unsigned int *sector) {
   const unsigned int area1_sectors = 357;
@@ -240,65 +1050,505 @@ void CBM1541Drive::GetTrackSector(unsigned int s, unsigned int *track,
 
 bool CBM1541Drive::SetFirmwareState(CBM1541Drive::FirmwareState firmware_state,
                                     IECStatus *status) {
-  // Exit early if we're already in the desired state.
-  if (fw_state_ == firmware_state)
-    return true;
-  fw_state_ = firmware_state;
-
   auto fw_it = fw_fragment_map_.find(firmware_state);
   // No specific firmware requirements for this state. We're done.
   if (fw_it == fw_fragment_map_.end())
     return true;
-  return WriteMemory(fw_it->second.loading_address, fw_it->second.binary_size,
-                     fw_it->second.binary, status);
+  const CustomFirmwareFragment &fragment = fw_it->second;
+
+  // Exit early if we know the fragment to be in place already. If we don't
+  // know what some of its pages hold, ask the drive.
+  bool known_resident = true;
+  bool may_be_resident = true;
+  unsigned int first_page = fragment.loading_address >> 8;
+  unsigned int last_page =
+      (fragment.loading_address + fragment.binary_size - 1) >> 8;
+  for (unsigned int page = first_page; page <= last_page; ++page) {
+    auto page_it = page_content_.find(page);
+    if (page_it == page_content_.end()) {
+      known_resident = false;
+    } else if (page_it->second != firmware_state) {
+      known_resident = false;
+      may_be_resident = false;
+    }
+  }
+  if (known_resident)
+    return true;
+  bool resident = false;
+  if (may_be_resident &&
+      !ProbeFirmwareFragment(fragment, &resident, status)) {
+    return false;
+  }
+  if (!resident && !WriteMemory(fragment.loading_address, fragment.binary_size,
+                                fragment.binary, status)) {
+    // We don't know how much of the fragment made it.
+    for (unsigned int page = first_page; page <= last_page; ++page) {
+      page_content_.erase(page);
+    }
+    return false;
+  }
+  SetPageContent(fragment.loading_address, fragment.binary_size,
+                 firmware_state);
+  return true;
+}
+
+bool CBM1541Drive::ProbeFirmwareFragment(
+    const CustomFirmwareFragment &fragment, bool *resident,
+    IECStatus *status) {
+  *resident = false;
+  std::string content;
+  if (!ReadMemory(fragment.loading_address, fragment.binary_size, &content,
+                  status)) {
+    if (status->status_code != IECStatus::DRIVE_ERROR)
+      return false;
+    // Whatever the drive holds there, it isn't our fragment.
+    status->Clear();
+    return true;
+  }
+  *resident = content.compare(
+                  0, std::string::npos,
+                  reinterpret_cast<const char *>(fragment.binary),
+                  fragment.binary_size) == 0;
+  return true;
+}
+
+void CBM1541Drive::SetPageContent(unsigned short int first_address,
+                                  size_t num_bytes, FirmwareState content) {
+  for (unsigned int page = first_address >> 8;
+       page <= (first_address + num_bytes - 1) >> 8; ++page) {
+    page_content_[page] = content;
+  }
 }
 
 bool CBM1541Drive::WriteMemory(unsigned short int target_address,
                                size_t num_bytes, const unsigned char *source,
                                IECStatus *status) {
-  size_t bytes_written = 0;
-  while (num_bytes - bytes_written > 0) {
+  size_t num_chunks = (num_bytes + kMaxMWSize - 1) / kMaxMWSize;
+  for (size_t chunk = 0; chunk < num_chunks; ++chunk) {
     std::string request = "M-W";
-    unsigned short int mem_pos = target_address + bytes_written;
+    size_t offset = chunk * kMaxMWSize;
+    unsigned short int mem_pos = target_address + offset;
     request.append(1, mem_pos & 0xff);
     request.append(1, mem_pos >> 8);
-    size_t num_data_bytes = std::min(kMaxMWSize, num_bytes - bytes_written);
+    size_t num_data_bytes = std::min(kMaxMWSize, num_bytes - offset);
     request.append(1, num_data_bytes);
     for (size_t i = 0; i < num_data_bytes; ++i) {
-      request.append(1, source[bytes_written + i]);
+      request.append(1, source[offset + i]);
     }
     if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
       return false;
     }
+  }
+
+  // M-W only fails for invalid requests, so a single status check at the end
+  // suffices.
+  std::string response;
+  if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+    return false;
+  }
+  if (response != kOKResponse) {
+    SetError(IECStatus::DRIVE_ERROR, response, status);
+    return false;
+  }
+  return true;
+}
+
+bool CBM1541Drive::WriteBatch(unsigned int track, const SectorBatch &batch,
+                              IECStatus *status) {
+  assert(batch.size() <= kMaxBatchSectors);
+  if (!SetFirmwareState(FW_CUSTOM_WRITE_BATCH_CODE, status))
+    return false;
+  if (!InitDirectAccessChannel(status))
+    return false;
+  if (batch.size() == kMaxBatchSectors && !InitBatchChannel(status))
+    return false;
+
+  // Upload the sector content into the buffers associated with our channels.
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (kBatchChannels[i] == read_da_chan_) {
+      // Reading may have left the buffer pointer anywhere.
+      std::string request =
+          (boost::format("B-P:%u 0") % kBatchChannels[i]).str();
+      if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+        return false;
+      }
+    }
+    if (!bus_conn_->WriteToChannel(device_number_, kBatchChannels[i],
+                                   *batch[i].second, status)) {
+      return false;
+    }
+  }
+
+  // Write all buffers to disc.
+  if (!bus_conn_->WriteToChannel(device_number_, 15,
+                                 GetWriteBatchRequest(track, batch), status)) {
+    return false;
+  }
+
+  // Get the result for the batched write command.
+  std::string response;
+  if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+    return false;
+  }
+  if (response != kOKResponse) {
+    SetError(IECStatus::DRIVE_ERROR, response, status);
+    return false;
+  }
+  return true;
+}
+
+std::string CBM1541Drive::GetWriteBatchRequest(unsigned int track,
+                                               const SectorBatch &batch) {
+  std::string request = "M-E";
+  request.append(1, char(kWriteBatchEntryPoint & 0xff));
+  request.append(1, char(kWriteBatchEntryPoint >> 8));
+  request.append(1, char(track));
+  request.append(1, char(batch.size()));
+  request.append(1, char(verify_writes_ ? 1 : 0));
+  for (const auto &entry : batch) {
+    request.append(1, char(entry.first));
+  }
+  return request;
+}
+
+bool CBM1541Drive::OrderByTrack(
+    size_t first_sector, const std::vector<std::string> &contents,
+    std::vector<std::pair<unsigned int, SectorBatch>> *tracks,
+    IECStatus *status) {
+  tracks->clear();
+  size_t pos = 0;
+  while (pos < contents.size()) {
+    // Find all sectors located on the same track.
+    unsigned int track = 1;
+    unsigned int first_track_sector = 0;
+    GetTrackSector(first_sector + pos, &track, &first_track_sector);
+    size_t track_end = pos + 1;
+    while (track_end < contents.size()) {
+      unsigned int next_track = 1;
+      unsigned int next_sector = 0;
+      GetTrackSector(first_sector + track_end, &next_track, &next_sector);
+      if (next_track != track)
+        break;
+      ++track_end;
+    }
+    if (track > kMaxTrackNumber) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("not trying to write to track %u as it might "
+                              "cause hardware damage") %
+                track)
+                   .str(),
+               status);
+      return false;
+    }
+    for (size_t i = pos; i < track_end; ++i) {
+      if (contents[i].size() != kNumBytesPerSector) {
+        SetError(IECStatus::INVALID_ARGUMENT,
+                 (boost::format("contents[%u].size(%u) != "
+                                "kNumBytesPerSector(%u)") %
+                  i % contents[i].size() % kNumBytesPerSector)
+                     .str(),
+                 status);
+        return false;
+      }
+    }
+
+    // Order the sectors on this track according to our interleave.
+    std::vector<unsigned int> sectors;
+    for (size_t i = pos; i < track_end; ++i) {
+      sectors.push_back(first_track_sector + (i - pos));
+    }
+    SectorBatch track_order;
+    for (unsigned int sector : OrderForRotation(sectors)) {
+      track_order.emplace_back(
+          sector, &contents[pos + (sector - first_track_sector)]);
+    }
+    tracks->emplace_back(track, track_order);
+    pos = track_end;
+  }
+  return true;
+}
+
+bool CBM1541Drive::CheckBroadcast(const std::vector<CBM1541Drive *> &drives,
+                                  const std::vector<IECStatus> &results,
+                                  IECStatus *status) {
+  if (drives.empty() || results.size() != drives.size()) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             "need a result for each of at least one drive", status);
+    return false;
+  }
+  for (CBM1541Drive *drive : drives) {
+    if (drive->bus_conn_ != drives[0]->bus_conn_) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               "all drives need to share the same bus", status);
+      return false;
+    }
+  }
+  if (!drives[0]->bus_conn_->SupportsBroadcast()) {
+    SetError(IECStatus::UNIMPLEMENTED,
+             "the bus connection doesn't support broadcasts", status);
+    return false;
+  }
+  return true;
+}
+
+void CBM1541Drive::CollectResults(const std::vector<CBM1541Drive *> &drives,
+                                  std::vector<IECStatus> *results) {
+  for (size_t i = 0; i < drives.size(); ++i) {
+    IECStatus &result = (*results)[i];
     std::string response;
-    if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+    if (!result.ok() ||
+        !drives[i]->bus_conn_->ReadFromChannel(drives[i]->device_number_, 15,
+                                               &response, &result)) {
+      continue;
+    }
+    if (response != kOKResponse)
+      SetError(IECStatus::DRIVE_ERROR, response, &result);
+  }
+}
+
+void CBM1541Drive::ForgetChannels() {
+  // The format routine closes all channels and uses buffers 0 and 1 for
+  // sector headers and content.
+  write_da_chan_ = -1;
+  read_da_chan_ = -1;
+  batch_da_chan_ = -1;
+  SetPageContent(BufferAddress(0), 0x200, FW_NO_CUSTOM_CODE);
+}
+
+bool CBM1541Drive::WriteWithJobs(unsigned int track, const SectorBatch &order,
+                                 IECStatus *status) {
+  const size_t num_job_buffers = sizeof(kJobChannels) / sizeof(kJobChannels[0]);
+  if (!InitBatchChannel(status) || !InitWriteChannel(status))
+    return false;
+
+  for (size_t pos = 0; pos < order.size(); pos += num_job_buffers) {
+    size_t num_jobs = std::min(num_job_buffers, order.size() - pos);
+    std::vector<unsigned int> sectors;
+    for (size_t i = 0; i < num_jobs; ++i) {
+      if (!bus_conn_->WriteToChannel(device_number_, kJobChannels[i],
+                                     *order[pos + i].second, status)) {
+        return false;
+      }
+      sectors.push_back(order[pos + i].first);
+    }
+    if (!WriteBuffersWithJobs(0, track, sectors, status))
       return false;
+  }
+  return true;
+}
+
+bool CBM1541Drive::WriteBuffersWithJobs(
+    unsigned int first_buffer, unsigned int track,
+    const std::vector<unsigned int> &sectors, IECStatus *status) {
+  std::vector<unsigned char> track_sectors;
+  for (unsigned int sector : sectors) {
+    track_sectors.push_back(track);
+    track_sectors.push_back(sector);
+  }
+  if (!WriteMemory(kJobTrackSectorAddress + 2 * first_buffer,
+                   track_sectors.size(), &track_sectors[0], status)) {
+    return false;
+  }
+
+  std::vector<unsigned char> job_codes(sectors.size(), kWriteJobCode);
+  for (int pass = 0; pass < (verify_writes_ ? 2 : 1); ++pass) {
+    std::string results;
+    if (!RunJobs(first_buffer, job_codes, &results, status))
+      return false;
+    for (size_t i = 0; i < sectors.size(); ++i) {
+      unsigned char result_code = static_cast<unsigned char>(results[i]);
+      if (result_code != kJobResultOK) {
+        SetError(IECStatus::DRIVE_ERROR,
+                 (boost::format("%s track %u, sector %u failed with "
+                                "error %u") %
+                  (pass == 0 ? "writing" : "verifying") % track % sectors[i] %
+                  (result_code + kJobResultErrorOffset))
+                     .str(),
+                 status);
+        return false;
+      }
     }
-    if (response != kOKResponse) {
-      SetError(IECStatus::DRIVE_ERROR, response, status);
+    // Verify the buffers we just wrote.
+    job_codes.assign(sectors.size(), kVerifyJobCode);
+  }
+  return true;
+}
+
+bool CBM1541Drive::RunJobs(unsigned int first_buffer,
+                           const std::vector<unsigned char> &job_codes,
+                           std::string *results, IECStatus *status) {
+  if (!WriteMemory(kJobCodeAddress + first_buffer, job_codes.size(),
+                   &job_codes[0], status)) {
+    return false;
+  }
+  // The drive clears the top bit of each job code once the job is done.
+  for (int poll = 0; poll < kMaxJobPolls; ++poll) {
+    if (!ReadMemory(kJobCodeAddress + first_buffer, job_codes.size(), results,
+                    status)) {
       return false;
     }
-    bytes_written += num_data_bytes;
+    bool done = true;
+    for (char result_code : *results) {
+      if (result_code & 0x80)
+        done = false;
+    }
+    if (done)
+      return true;
+  }
+  SetError(IECStatus::DRIVE_ERROR, "timeout waiting for drive jobs", status);
+  return false;
+}
+
+bool CBM1541Drive::ProbeTrackFormatted(unsigned int track, bool *formatted,
+                                       IECStatus *status) {
+  // Set up track and sector first, so the job doesn't start before.
+  const unsigned char track_sector[] = {static_cast<unsigned char>(track),
+                                        0x00};
+  if (!WriteMemory(kJobTrackSectorAddress + 2 * kHeadJobBuffer,
+                   sizeof(track_sector), track_sector, status)) {
+    return false;
   }
+  std::string results;
+  if (!RunJobs(kHeadJobBuffer, {kSeekJobCode}, &results, status))
+    return false;
+  *formatted = static_cast<unsigned char>(results[0]) == kJobResultOK;
   return true;
 }
 
+bool CBM1541Drive::ReadMemory(unsigned short int source_address,
+                              size_t num_bytes, std::string *content,
+                              IECStatus *status) {
+  content->clear();
+  // The drive only holds the response to the last command, so each chunk
+  // needs to be read before requesting the next one.
+  for (size_t offset = 0; offset < num_bytes; offset += kMaxMRSize) {
+    size_t chunk_size = std::min(kMaxMRSize, num_bytes - offset);
+    unsigned short int mem_pos = source_address + offset;
+    std::string request = "M-R";
+    request.append(1, mem_pos & 0xff);
+    request.append(1, mem_pos >> 8);
+    request.append(1, chunk_size);
+    if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+      return false;
+    }
+    std::string chunk;
+    if (!bus_conn_->ReadFromChannel(device_number_, 15, &chunk, status)) {
+      return false;
+    }
+    if (chunk.size() != chunk_size) {
+      SetError(IECStatus::DRIVE_ERROR,
+               (boost::format("M-R returned %u bytes, expected %u") %
+                chunk.size() % chunk_size)
+                   .str(),
+               status);
+      return false;
+    }
+    content->append(chunk);
+  }
+  return true;
+}
+
+bool CBM1541Drive::SnapshotDriveRAM(std::string *ram, IECStatus *status) {
+  return ReadMemory(0x0000, kDriveRAMSize, ram, status);
+}
+
 bool CBM1541Drive::InitDirectAccessChannel(IECStatus *status) {
+  if (!InitWriteChannel(status))
+    return false;
+  // Sector content passes through the buffers of our channels.
+  SetPageContent(BufferAddress(3), 0x100, FW_NO_CUSTOM_CODE);
+  if (read_da_chan_ == -1) {
+    if (!OpenChannelWithBuffer(kReadDirectAccessChannel, 3, status)) {
+      return false;
+    }
+    read_da_chan_ = kReadDirectAccessChannel;
+  }
+  return true;
+}
+
+bool CBM1541Drive::InitWriteChannel(IECStatus *status) {
+  SetPageContent(BufferAddress(1), 0x100, FW_NO_CUSTOM_CODE);
   if (write_da_chan_ == -1) {
     if (!OpenChannelWithBuffer(kWriteDirectAccessChannel, 1, status)) {
       return false;
     }
     write_da_chan_ = kWriteDirectAccessChannel;
   }
-  if (read_da_chan_ == -1) {
-    if (!OpenChannelWithBuffer(kReadDirectAccessChannel, 3, status)) {
+  return true;
+}
+
+bool CBM1541Drive::InitBatchChannel(IECStatus *status) {
+  SetPageContent(BufferAddress(0), 0x100, FW_NO_CUSTOM_CODE);
+  if (batch_da_chan_ == -1) {
+    if (!OpenChannelWithBuffer(kBatchDirectAccessChannel, 0, status)) {
       return false;
     }
-    read_da_chan_ = kReadDirectAccessChannel;
+    batch_da_chan_ = kBatchDirectAccessChannel;
+  }
+  return true;
+}
+
+bool CBM1541Drive::ReadBlock(unsigned int track, unsigned int sector,
+                             IECStatus *status) {
+  if (!SetFirmwareState(FW_CUSTOM_READ_WRITE_CODE, status))
+    return false;
+  if (!InitDirectAccessChannel(status))
+    return false;
+
+  // Read from disc.
+  std::string request = "M-E";
+  request.append(1, char(kReadWriteBlockEntryPoint & 0xff));
+  request.append(1, char(kReadWriteBlockEntryPoint >> 8));
+  request.append(1, char(track));
+  request.append(1, char(sector));
+  request.append(1, char(kReadBlockOption));
+  if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+    return false;
+  }
+
+  // Get the result for the read command.
+  std::string response;
+  if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+    return false;
+  }
+  if (response != kOKResponse) {
+    SetError(IECStatus::DRIVE_ERROR, response, status);
+    return false;
   }
   return true;
 }
 
+bool CBM1541Drive::ReadBuffer(int channel, int buffer, std::string *content,
+                              IECStatus *status) {
+  if (fast_transfer_failures_ < kMaxFastTransferFailures &&
+      bus_conn_->SupportsFastTransfer()) {
+    if (!SetFirmwareState(FW_CUSTOM_FAST_SEND_CODE, status))
+      return false;
+    std::string request = "M-E";
+    request.append(1, char(kFastSendEntryPoint & 0xff));
+    request.append(1, char(kFastSendEntryPoint >> 8));
+    request.append(1, char(BufferAddress(buffer) >> 8));
+    request.append(1, char(0x00)); // The full page.
+    IECStatus fast_status;
+    if (bus_conn_->ExecuteAndReceiveFast(device_number_, request,
+                                         kNumBytesPerSector, content,
+                                         &fast_status)) {
+      fast_transfer_failures_ = 0;
+      return true;
+    }
+    // The drive gives up waiting as soon as we talk to it again, and still
+    // holds the sector, so we get it the slow way.
+    ++fast_transfer_failures_;
+  }
+
+  // Reposition buffer pointer
+  auto cmd = boost::format("B-P:%u 0") % channel;
+  if (!bus_conn_->WriteToChannel(device_number_, 15, cmd.str(), status)) {
+    return false;
+  }
+  return bus_conn_->ReadFromChannel(device_number_, channel, content, status);
+}
+
 bool CBM1541Drive::OpenChannelWithBuffer(int channel, int buffer,
                                          IECStatus *status) {
   if (!bus_conn_->OpenChannel(device_number_, channel,
@@ -4,12 +4,29 @@
 #define CBM1541_DRIVE_H
 
 #include <map>
+#include <set>
+#include <utility>
+#include <vector>
 
 #include "drive_interface.h"
 #include "iec_host_lib.h"
 
 class CBM1541Drive : public DriveInterface {
 public:
+  enum {
+    // Maximum number of sectors written by a single batched write job. Limited
+    // by the number of drive buffers available for sector content.
+    kMaxBatchSectors = 3,
+    // Maximum number of track / sector pairs the drive-resident list reader
+    // can hold at a time.
+    kMaxReadListEntries = 45,
+    // Number of 0xff bytes ReadTrackGCR() stores for each sync mark.
+    kGCRSyncLength = 5,
+    // We won't allow trying to access a track higher than this as it might
+    // damage the hardware.
+    kMaxTrackNumber = 41
+  };
+
   // Instantiate a CBM1541 drive using the specified connection object
   // and device_number. Ownership of the object pointed to by bus_conn
   // is not transferred. The object must stay alive during the lifetime
@@ -21,13 +38,103 @@ public:
   ~CBM1541Drive();
 
   bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override;
+  // Reports an extended disc (40 tracks) if tracks 36 to 40 hold sector
+  // headers, a standard disc (35 tracks) otherwise.
   bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
   bool ReadSector(size_t sector_number, std::string *content,
                   IECStatus *status) override;
   bool WriteSector(size_t sector_number, const std::string &content,
                    IECStatus *status) override;
+  // Writes sectors in batches of up to kMaxBatchSectors sectors per track,
+  // using a drive-resident routine that writes all of them in one job.
+  bool WriteSectors(size_t first_sector,
+                    const std::vector<std::string> &contents,
+                    IECStatus *status) override;
+  // Verifies up to a full track per request, using a drive-resident routine
+  // which only transfers a checksum per sector. Sectors which can't be read
+  // are reported as mismatches.
+  bool VerifySectors(size_t first_sector,
+                     const std::vector<unsigned short int> &expected,
+                     std::vector<size_t> *mismatches,
+                     IECStatus *status) override;
+  // Verification happens on the drive in the revolution after writing each
+  // sector. Only the resulting status is transferred.
+  bool SetWriteVerification(bool enable) override;
+  // Each track is formatted by the format routine, which stays resident while
+  // the drive's own write job writes the track's sectors.
+  bool SetFormatOnWrite(bool enable) override;
+  // Sectors are read by a drive-resident routine in an order minimizing head
+  // movement and rotational delay, up to kMaxBatchSectors sectors per
+  // request.
+  bool ReadSectorList(const std::vector<size_t> &sector_numbers,
+                      std::map<size_t, std::string> *contents,
+                      IECStatus *status) override;
+  // Moves the head using the drive's own jobs, no custom code required.
+  bool MoveHead(size_t sector_number, HeadMovement movement,
+                IECStatus *status) override;
   bool ReadCommandChannel(std::string *response, IECStatus *status) override;
 
+  // A sync mark within the GCR data returned by ReadTrackGCR().
+  struct GCRSyncMark {
+    size_t offset;       // Offset of its first 0xff byte.
+    unsigned int length; // Measured length in bytes.
+  };
+
+  // Read the raw GCR data of one full revolution of track and store it in
+  // *gcr, starting right after the header of sector 0. Sync marks are
+  // normalized to kGCRSyncLength bytes of 0xff, which keeps the data of
+  // different captures comparable. Their measured lengths, which some copy
+  // protection schemes rely on, are stored in *sync_marks. Lengths are
+  // accurate to about a byte and saturate at 14 to 17 bytes, depending on
+  // the speed zone. Returns true if successful, sets status otherwise.
+  bool ReadTrackGCR(unsigned int track, std::string *gcr,
+                    std::vector<GCRSyncMark> *sync_marks, IECStatus *status);
+
+  // Copy sector_number to the same sector on target, which must be connected
+  // to the same bus. The sector content goes from one drive to the other
+  // directly, without passing through the host. Requires a bus connection
+  // supporting direct copies. Returns true if successful, sets status
+  // otherwise.
+  bool CopySectorTo(size_t sector_number, CBM1541Drive *target,
+                    IECStatus *status);
+
+  // Write contents to the sectors starting at first_sector on all of drives
+  // at once, like WriteSectors() does for a single drive. The drives must
+  // share a bus connection supporting broadcasts and have the same write
+  // verification setting. Format on write isn't supported. Sector content and
+  // commands are sent to all drives in one go, so they write in parallel.
+  // results must hold an entry for each drive. Drives whose entry isn't ok
+  // are skipped, the others get theirs set if they fail. Returns true unless
+  // an error affects all drives, sets status in that case.
+  static bool WriteSectorsToAll(const std::vector<CBM1541Drive *> &drives,
+                                size_t first_sector,
+                                const std::vector<std::string> &contents,
+                                std::vector<IECStatus> *results,
+                                IECStatus *status);
+
+  // Format num_tracks tracks on all of drives at once, like
+  // FormatDiscLowLevel() does for a single drive. Requirements, results and
+  // return value are the same as for WriteSectorsToAll().
+  static bool FormatDiscLowLevelOnAll(const std::vector<CBM1541Drive *> &drives,
+                                      size_t num_tracks,
+                                      std::vector<IECStatus> *results,
+                                      IECStatus *status);
+
+  // Read num_bytes of drive memory starting at source_address into *content.
+  // Requests larger than a single M-R command can handle are split into as
+  // few of them as possible. Returns true if successful, sets status
+  // otherwise.
+  bool ReadMemory(unsigned short int source_address, size_t num_bytes,
+                  std::string *content, IECStatus *status);
+
+  // Read the drive's entire RAM into *ram. Returns true if successful, sets
+  // status otherwise.
+  bool SnapshotDriveRAM(std::string *ram, IECStatus *status);
+
+  // Returns the number of tracks occupied by a disc of num_sectors sectors,
+  // which must be at least one.
+  static unsigned int GetNumTracks(size_t num_sectors);
+
   // GetTrackSector translates from a sector index to corresponding
   // track and (track local) sector number according to a hardcoded
   // schema matching the 1541's sectors / track configuration.
@@ -41,21 +148,140 @@ private:
     FW_NO_CUSTOM_CODE, // The drive doesn't have any custom firmware code.
     FW_CUSTOM_FORMATTING_CODE, // Drive holds formatting code.
     FW_CUSTOM_READ_WRITE_CODE, // Drive holds custom read/write routines.
+    FW_CUSTOM_WRITE_BATCH_CODE, // Drive holds batched write routines.
+    FW_CUSTOM_READ_LIST_CODE,   // Drive holds list based read routines.
+    FW_CUSTOM_CHECKSUM_CODE,    // Drive holds sector checksum routines.
+    FW_CUSTOM_READ_GCR_CODE,    // Drive holds raw GCR track capture routines.
+    FW_CUSTOM_FAST_SEND_CODE,   // Drive holds fast transfer routines.
   };
 
   // Switch firmware state to firmware_state. After this method returns,
   // any custom firmware code associated with this state will have been
-  // uploaded. In case of error, returns false and sets status.
+  // uploaded, unless it was resident in drive memory already. In case of
+  // error, returns false and sets status.
   bool SetFirmwareState(FirmwareState firmware_state, IECStatus *status);
 
+  struct CustomFirmwareFragment {
+    const unsigned char *binary; // Pointer to the actual binary.
+    size_t binary_size;          // Size of the binary in bytes.
+    size_t loading_address;      // Loading address of the binary.
+  };
+
+  // Compare the drive memory occupied by fragment to its content and set
+  // *resident to true if all of it matches. Returns true if successful, sets
+  // status otherwise.
+  bool ProbeFirmwareFragment(const CustomFirmwareFragment &fragment,
+                             bool *resident, IECStatus *status);
+
+  // Record that the memory pages [first_address, first_address + num_bytes)
+  // now hold content. See page_content_.
+  void SetPageContent(unsigned short int first_address, size_t num_bytes,
+                      FirmwareState content);
+
   // Write num_bytes of the content pointed to by source to target_address
-  // on the drive. Returns true if successful, sets status otherwise.
+  // on the drive. The drive status is only checked once all data has been
+  // written. Returns true if successful, sets status otherwise.
   bool WriteMemory(unsigned short int target_address, size_t num_bytes,
                    const unsigned char *source, IECStatus *status);
 
+  // A list of track local sector numbers along with the content to write.
+  typedef std::vector<std::pair<unsigned int, const std::string *>>
+      SectorBatch;
+
+  // Write the sectors specified by batch, all located on track, using the
+  // batched write routine. batch must not contain more than kMaxBatchSectors
+  // elements. Verifies written content if verify_writes_ is set. Returns true
+  // if successful, sets status otherwise.
+  bool WriteBatch(unsigned int track, const SectorBatch &batch,
+                  IECStatus *status);
+
+  // Build the request making the batched write routine write batch to track.
+  std::string GetWriteBatchRequest(unsigned int track,
+                                   const SectorBatch &batch);
+
+  // Split the sectors starting at first_sector with content contents by
+  // track, with those on each track in the order we write them. Returns true
+  // if successful, sets status if any of them is out of range or has the
+  // wrong size.
+  static bool
+  OrderByTrack(size_t first_sector, const std::vector<std::string> &contents,
+               std::vector<std::pair<unsigned int, SectorBatch>> *tracks,
+               IECStatus *status);
+
+  // Check the requirements shared by all operations on several drives at
+  // once. Returns true if they're met, sets status otherwise.
+  static bool CheckBroadcast(const std::vector<CBM1541Drive *> &drives,
+                             const std::vector<IECStatus> &results,
+                             IECStatus *status);
+
+  // Read the command channel of each of drives whose result is ok, and set
+  // its result unless the drive reports success.
+  static void CollectResults(const std::vector<CBM1541Drive *> &drives,
+                             std::vector<IECStatus> *results);
+
+  // Record that the format routine closed all channels and overwrote the
+  // buffers it uses.
+  void ForgetChannels();
+
+  // Format num_tracks tracks starting at first_track. Note that this closes
+  // all open channels on the drive. Returns true if successful, sets status
+  // otherwise.
+  bool FormatTracks(unsigned int first_track, unsigned int num_tracks,
+                    IECStatus *status);
+
+  // Write the sectors specified by order, all located on track, using the
+  // drive's own write job rather than custom code. Verifies written content
+  // if verify_writes_ is set. Returns true if successful, sets status
+  // otherwise.
+  bool WriteWithJobs(unsigned int track, const SectorBatch &order,
+                     IECStatus *status);
+
+  // Write the content of consecutive buffers, starting at first_buffer, to
+  // sectors on track using the drive's own write job. Verifies written
+  // content if verify_writes_ is set. Returns true if successful, sets status
+  // otherwise.
+  bool WriteBuffersWithJobs(unsigned int first_buffer, unsigned int track,
+                            const std::vector<unsigned int> &sectors,
+                            IECStatus *status);
+
+  // Start the drive jobs specified by job_codes for consecutive buffers,
+  // starting at first_buffer, and wait until all of them are done. The
+  // track and sector for each buffer must have been set up. Sets *results to
+  // the result code of each job. Returns true if successful (failed jobs
+  // don't constitute an error), sets status otherwise.
+  bool RunJobs(unsigned int first_buffer,
+               const std::vector<unsigned char> &job_codes,
+               std::string *results, IECStatus *status);
+
+  // Find out whether track holds any sector headers using the drive's seek
+  // job, which only reads the first header it finds. Sets *formatted
+  // accordingly. Returns true if successful, sets status otherwise.
+  bool ProbeTrackFormatted(unsigned int track, bool *formatted,
+                           IECStatus *status);
+
+  // Read track and sector into buffer 3, the buffer of our read channel,
+  // using the custom read/write routines. Returns true if successful, sets
+  // status otherwise.
+  bool ReadBlock(unsigned int track, unsigned int sector, IECStatus *status);
+
+  // Read the content of buffer, which is associated with channel, into
+  // *content. Uses the fast transfer protocol if the bus connection supports
+  // it, the channel otherwise. Returns true if successful, sets status
+  // otherwise.
+  bool ReadBuffer(int channel, int buffer, std::string *content,
+                  IECStatus *status);
+
   // Initialize direct access channel if it hasn't been initialized yet.
   bool InitDirectAccessChannel(IECStatus *status);
 
+  // Initialize the direct access channel used for writing only, if it
+  // hasn't been initialized yet.
+  bool InitWriteChannel(IECStatus *status);
+
+  // Initialize the additional direct access channel used for batched writes
+  // if it hasn't been initialized yet.
+  bool InitBatchChannel(IECStatus *status);
+
   // Open the specified channel, associate it with buffer and set the buffer
   // pointer to zero. Returns true if successful, sets status otherwise.
   bool OpenChannelWithBuffer(int channel, int buffer, IECStatus *status);
@@ -66,21 +292,40 @@ private:
   // The device number of the physical device we're talking to.
   char device_number_;
 
-  FirmwareState fw_state_;
+  // If true, have the drive verify all content it writes.
+  bool verify_writes_ = false;
+
+  // If true, format each track before writing to it for the first time.
+  bool format_on_write_ = false;
+
+  // Number of fast transfers that failed in a row. We retry on the next
+  // sector, until kMaxFastTransferFailures are reached. We stick to the
+  // standard protocol from then on.
+  int fast_transfer_failures_ = 0;
+
+  // The tracks we formatted since format_on_write_ was enabled.
+  std::set<unsigned int> formatted_tracks_;
 
-  struct CustomFirmwareFragment {
-    const unsigned char *binary; // Pointer to the actual binary.
-    size_t binary_size;          // Size of the binary in bytes.
-    size_t loading_address;      // Loading address of the binary.
-  };
   static const std::map<FirmwareState, CustomFirmwareFragment> fw_fragment_map_;
 
+  // What we know about the content of drive memory, by memory page (i.e.
+  // the high byte of the address). Pages holding a custom firmware fragment
+  // map to its state, pages used for sector data map to FW_NO_CUSTOM_CODE.
+  // Pages we don't know anything about, e.g. because they were last used
+  // before we were created, aren't listed. All fragments but fast_send.asm
+  // run in buffer 2, so this only saves uploads when we return to the
+  // fragment used last.
+  std::map<unsigned int, FirmwareState> page_content_;
+
   // Direct access channel to use for writing sector content.
   // Initialized lazily by InitDirectAccessChannel().
   int write_da_chan_ = -1;
   // Direct access channel to use for reading sector content.
   // Initialized lazily by InitDirectAccessChannel().
   int read_da_chan_ = -1;
+  // Additional direct access channel used for batched writes only.
+  // Initialized lazily by InitBatchChannel().
+  int batch_da_chan_ = -1;
 };
 
 #endif // CBM1541_DRIVE_H
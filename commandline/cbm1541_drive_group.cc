@@ -0,0 +1,94 @@
+// DriveInterface implementation on top of several physical CBM 1541 disk
+// drives.
+
+#include "cbm1541_drive_group.h"
+
+#include "boost/format.hpp"
+
+CBM1541DriveGroup::CBM1541DriveGroup(IECBusConnection *bus_conn,
+                                     const std::vector<char> &device_numbers)
+    : device_numbers_(device_numbers), results_(device_numbers.size()) {
+  for (char device_number : device_numbers) {
+    drives_.push_back(std::make_unique<CBM1541Drive>(bus_conn, device_number));
+    drive_ptrs_.push_back(drives_.back().get());
+  }
+}
+
+bool CBM1541DriveGroup::FormatDiscLowLevel(size_t num_tracks,
+                                           IECStatus *status) {
+  return CBM1541Drive::FormatDiscLowLevelOnAll(drive_ptrs_, num_tracks,
+                                               &results_, status) &&
+         CheckActiveDrives(status);
+}
+
+bool CBM1541DriveGroup::GetNumSectors(size_t *num_sectors,
+                                      IECStatus *status) {
+  CBM1541Drive *drive = GetActiveDrive(status);
+  return drive && drive->GetNumSectors(num_sectors, status);
+}
+
+bool CBM1541DriveGroup::ReadSector(size_t sector_number, std::string *content,
+                                   IECStatus *status) {
+  CBM1541Drive *drive = GetActiveDrive(status);
+  return drive && drive->ReadSector(sector_number, content, status);
+}
+
+bool CBM1541DriveGroup::WriteSector(size_t sector_number,
+                                    const std::string &content,
+                                    IECStatus *status) {
+  return WriteSectors(sector_number, {content}, status);
+}
+
+bool CBM1541DriveGroup::WriteSectors(size_t first_sector,
+                                     const std::vector<std::string> &contents,
+                                     IECStatus *status) {
+  return CBM1541Drive::WriteSectorsToAll(drive_ptrs_, first_sector, contents,
+                                         &results_, status) &&
+         CheckActiveDrives(status);
+}
+
+bool CBM1541DriveGroup::SetWriteVerification(bool enable) {
+  for (auto &drive : drives_) {
+    drive->SetWriteVerification(enable);
+  }
+  return true;
+}
+
+bool CBM1541DriveGroup::ReadCommandChannel(std::string *response,
+                                           IECStatus *status) {
+  response->clear();
+  for (size_t i = 0; i < drives_.size(); ++i) {
+    std::string drive_response;
+    if (results_[i].ok())
+      drives_[i]->ReadCommandChannel(&drive_response, &results_[i]);
+    if (!results_[i].ok())
+      drive_response = "failed: " + results_[i].message;
+    // One line per drive.
+    if (!drive_response.empty() && drive_response.back() == '\r')
+      drive_response.pop_back();
+    *response += (boost::format("%s%u: %s") % (i > 0 ? "\n" : "") %
+                  int(device_numbers_[i]) % drive_response)
+                     .str();
+  }
+  return true;
+}
+
+CBM1541Drive *CBM1541DriveGroup::GetActiveDrive(IECStatus *status) {
+  for (size_t i = 0; i < drives_.size(); ++i) {
+    if (results_[i].ok())
+      return drives_[i].get();
+  }
+  CheckActiveDrives(status);
+  return nullptr;
+}
+
+bool CBM1541DriveGroup::CheckActiveDrives(IECStatus *status) {
+  for (const IECStatus &result : results_) {
+    if (result.ok())
+      return true;
+  }
+  SetError(results_.empty() ? IECStatus::INVALID_ARGUMENT
+                            : results_[0].status_code,
+           "all drives failed", status);
+  return false;
+}
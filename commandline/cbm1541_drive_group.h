@@ -0,0 +1,60 @@
+// DriveInterface implementation on top of several physical CBM 1541 disk
+// drives, writing the same content to all of them at once.
+
+#ifndef CBM1541_DRIVE_GROUP_H
+#define CBM1541_DRIVE_GROUP_H
+
+#include <memory>
+#include <vector>
+
+#include "cbm1541_drive.h"
+#include "drive_interface.h"
+#include "iec_host_lib.h"
+
+class CBM1541DriveGroup : public DriveInterface {
+public:
+  // Instantiate a group of the drives specified by device_numbers, using the
+  // specified connection object, which must support broadcasts. See
+  // CBM1541Drive for the ownership of bus_conn.
+  CBM1541DriveGroup(IECBusConnection *bus_conn,
+                    const std::vector<char> &device_numbers);
+
+  // Formats all drives at once.
+  bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override;
+  // Sectors are read from the first drive which didn't fail yet.
+  bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
+  bool ReadSector(size_t sector_number, std::string *content,
+                  IECStatus *status) override;
+  bool WriteSector(size_t sector_number, const std::string &content,
+                   IECStatus *status) override;
+  // Sector content is sent once for all drives, which then write in
+  // parallel. A drive which fails is left out from then on. Only fails if
+  // there's no drive left.
+  bool WriteSectors(size_t first_sector,
+                    const std::vector<std::string> &contents,
+                    IECStatus *status) override;
+  bool SetWriteVerification(bool enable) override;
+  // Reports the status of each drive on a line of its own, prefixed by its
+  // device number. Drives which failed report the error they failed with.
+  bool ReadCommandChannel(std::string *response, IECStatus *status) override;
+
+  // The outcome of all operations so far for each drive, in the order of
+  // device_numbers as passed to the constructor.
+  const std::vector<IECStatus> &results() const { return results_; }
+
+private:
+  // Returns the first drive which didn't fail yet. Sets status and returns
+  // nullptr if all of them did.
+  CBM1541Drive *GetActiveDrive(IECStatus *status);
+
+  // Set status to report that all drives failed, if that's the case.
+  // Returns true if at least one of them didn't.
+  bool CheckActiveDrives(IECStatus *status);
+
+  std::vector<char> device_numbers_;
+  std::vector<std::unique_ptr<CBM1541Drive>> drives_;
+  std::vector<CBM1541Drive *> drive_ptrs_;
+  std::vector<IECStatus> results_;
+};
+
+#endif // CBM1541_DRIVE_GROUP_H
@@ -1,33 +1,49 @@
 #include "cbm1541_drive.h"
 
+#include <algorithm>
+
 #include "boost/format.hpp"
 #include "iec_host_lib.h"
+#include "mock_iec_bus_connection.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
 using ::testing::_;
 using ::testing::AtLeast;
 using ::testing::DoAll;
+using ::testing::Invoke;
 using ::testing::Return;
+using ::testing::SaveArg;
 using ::testing::SetArgPointee;
 using ::testing::StartsWith;
 using ::testing::StrEq;
 
-class MockIECBusConnection : public IECBusConnection {
+// A connection whose Arduino supports fast transfers.
+class MockFastIECBusConnection : public MockIECBusConnection {
 public:
-  MockIECBusConnection() : IECBusConnection(0, nullptr) {}
+  MOCK_METHOD5(ExecuteAndReceiveFast,
+               bool(char device_number, const std::string &command,
+                    size_t num_bytes, std::string *result, IECStatus *status));
+  bool SupportsFastTransfer() const override { return true; }
+};
 
-  MOCK_METHOD1(Reset, bool(IECStatus *status));
-  MOCK_METHOD4(OpenChannel,
-               bool(char device_number, char channel,
-                    const std::string &data_string, IECStatus *status));
-  MOCK_METHOD4(ReadFromChannel, bool(char device_number, char channel,
-                                     std::string *result, IECStatus *status));
-  MOCK_METHOD4(WriteToChannel,
-               bool(char device_number, char channel,
+// A connection whose Arduino supports direct copies between devices.
+class MockDirectCopyIECBusConnection : public MockIECBusConnection {
+public:
+  MOCK_METHOD5(CopyBetweenChannels,
+               bool(char source_device, char source_channel,
+                    char target_device, char target_channel,
+                    IECStatus *status));
+  bool SupportsDirectCopy() const override { return true; }
+};
+
+// A connection whose Arduino supports broadcasts to several devices.
+class MockBroadcastIECBusConnection : public MockIECBusConnection {
+public:
+  MOCK_METHOD4(WriteToChannels,
+               bool(const std::vector<char> &device_numbers, char channel,
                     const std::string &data_string, IECStatus *status));
-  MOCK_METHOD3(CloseChannel,
-               bool(char device_number, char channel, IECStatus *status));
+  bool SupportsBroadcast() const override { return true; }
 };
 
 class CBM1541DriveTest : public ::testing::Test {};
@@ -41,6 +57,10 @@ TEST_F(CBM1541DriveTest, FormatDiscTest) {
   EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-W"), &status))
       .Times(AtLeast(1))
       .WillRepeatedly(Return(true));
+  // Before uploading, we'll check whether our code is in place already.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-R"), &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(true));
   // And when asked for status we'll say that everything is fine.
   EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
       .Times(AtLeast(1))
@@ -56,19 +76,28 @@ TEST_F(CBM1541DriveTest, FormatDiscTest) {
   ::testing::Mock::VerifyAndClearExpectations(&conn);
 
   // No need to do another upload, our formatting code is already
-  // installed on the drive and ready to execute.
-  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-E"), &status))
+  // installed on the drive and ready to execute. We pass the range of
+  // tracks to format.
+  EXPECT_CALL(conn, WriteToChannel(8, 15,
+                                   StrEq(std::string("M-E\x03\x05\x01\x23", 7)),
+                                   &status))
       .Times(1)
       .WillOnce(Return(true));
   EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
       .Times(1)
       .WillOnce(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
 
-  EXPECT_TRUE(drive.FormatDiscLowLevel(40, &status)) << status.message;
+  EXPECT_TRUE(drive.FormatDiscLowLevel(35, &status)) << status.message;
 
   // Done with one call, prepare for the next one.
   ::testing::Mock::VerifyAndClearExpectations(&conn);
 
+  // We won't move the head beyond track 41.
+  EXPECT_FALSE(drive.FormatDiscLowLevel(42, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  EXPECT_FALSE(drive.FormatDiscLowLevel(0, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
   // We expect connection failures to be passed through.
   IECStatus failure_status;
   failure_status.status_code = IECStatus::IEC_CONNECTION_FAILURE;
@@ -92,6 +121,24 @@ TEST_F(CBM1541DriveTest, FormatDiscTest) {
   EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
 }
 
+TEST_F(CBM1541DriveTest, ExtendedGeometryTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  EXPECT_EQ(CBM1541Drive::GetNumTracks(683), 35u);
+  EXPECT_EQ(CBM1541Drive::GetNumTracks(768), 40u);
+  // 42 track images hold 802 sectors, but a 1541 can't safely reach their
+  // last track. Neither formatting nor writing it must touch the drive.
+  EXPECT_EQ(CBM1541Drive::GetNumTracks(802), 42u);
+  EXPECT_FALSE(
+      drive.FormatDiscLowLevel(CBM1541Drive::GetNumTracks(802), &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  status.Clear();
+  EXPECT_FALSE(drive.WriteSector(801, std::string(256, 0x00), &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+}
+
 TEST_F(CBM1541DriveTest, WriteSectorTest) {
   MockIECBusConnection conn;
   CBM1541Drive drive(&conn, 8);
@@ -101,6 +148,10 @@ TEST_F(CBM1541DriveTest, WriteSectorTest) {
   EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-W"), &status))
       .Times(AtLeast(1))
       .WillRepeatedly(Return(true));
+  // Before uploading, we'll check whether our code is in place already.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-R"), &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(true));
   // And when asked for status we'll say that everything is fine.
   EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
       .Times(AtLeast(1))
@@ -204,14 +255,29 @@ TEST_F(CBM1541DriveTest, ReadSectorTest) {
   CBM1541Drive drive(&conn, 8);
   IECStatus status;
 
+  // Remember the last command, so we can answer M-R requests with the
+  // summary of the sector read and everything else with drive_status.
+  std::string last_command;
+  std::string drive_status = "00, OK,00,00\r";
+  std::string summary("\x01\x42", 2);
+  auto respond = [&](char device_number, char channel, std::string *result,
+                     IECStatus *status) {
+    if (last_command == std::string("M-R\xfe\x05\x02", 6)) {
+      *result = summary;
+    } else {
+      *result = drive_status;
+    }
+    return true;
+  };
+
   // We expect to receive one or more memory writes.
   EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-W"), &status))
       .Times(AtLeast(1))
-      .WillRepeatedly(Return(true));
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
   // And when asked for status we'll say that everything is fine.
   EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
       .Times(AtLeast(1))
-      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+      .WillRepeatedly(Invoke(respond));
 
   // Opening DA channel and positioning block pointer (done once).
   EXPECT_CALL(conn, OpenChannel(8, 2, "#1", &status))
@@ -219,20 +285,32 @@ TEST_F(CBM1541DriveTest, ReadSectorTest) {
       .WillOnce(Return(true));
   EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:2 0"), &status))
       .Times(1)
-      .WillOnce(Return(true));
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
   EXPECT_CALL(conn, OpenChannel(8, 3, "#3", &status))
       .Times(1)
       .WillOnce(Return(true));
   EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:3 0"), &status))
       .Times(2)
-      .WillRepeatedly(Return(true));
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
 
-  // Finally, we expect a single memory execute.
+  // Before uploading, we'll check whether our code is in place already.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-R"), &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
+
+  // Finally, we expect a single memory execute, followed by a memory read
+  // for the sector summary.
   EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-E"), &status))
       .Times(1)
-      .WillOnce(Return(true));
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, WriteToChannel(8, 15,
+                                   StrEq(std::string("M-R\xfe\x05\x02", 6)),
+                                   &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
 
   std::string content(256, 0x42);
+  content[1] = 0x43;
   // Expect sector content to be read from our DA channel.
   EXPECT_CALL(conn, ReadFromChannel(8, 3, _, &status))
       .Times(1)
@@ -247,12 +325,15 @@ TEST_F(CBM1541DriveTest, ReadSectorTest) {
 
   EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:3 0"), &status))
       .Times(1)
-      .WillRepeatedly(Return(true));
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
 
-  // We expect a single memory execute.
+  // We expect a single memory execute and memory read.
   EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-E"), &status))
       .Times(1)
-      .WillOnce(Return(true));
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-R"), &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
 
   // Expect sector content to be read from our DA channel.
   EXPECT_CALL(conn, ReadFromChannel(8, 3, _, &status))
@@ -260,8 +341,8 @@ TEST_F(CBM1541DriveTest, ReadSectorTest) {
       .WillOnce(DoAll(SetArgPointee<2>(content), Return(true)));
 
   EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
-      .Times(1)
-      .WillOnce(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+      .Times(2)
+      .WillRepeatedly(Invoke(respond));
 
   read_content.clear();
   EXPECT_TRUE(drive.ReadSector(43, &read_content, &status)) << status.message;
@@ -270,6 +351,26 @@ TEST_F(CBM1541DriveTest, ReadSectorTest) {
   // Done with one call, prepare for the next one.
   ::testing::Mock::VerifyAndClearExpectations(&conn);
 
+  // Sectors consisting of a single repeated byte aren't transferred.
+  summary = std::string("\x00\x42", 2);
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-E"), &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-R"), &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .Times(2)
+      .WillRepeatedly(Invoke(respond));
+
+  read_content.clear();
+  EXPECT_TRUE(drive.ReadSector(44, &read_content, &status)) << status.message;
+  EXPECT_EQ(read_content, std::string(256, 0x42));
+
+  // Done with one call, prepare for the next one.
+  ::testing::Mock::VerifyAndClearExpectations(&conn);
+  summary = std::string("\x01\x42", 2);
+
   // We expect connection failures to be passed through.
   IECStatus failure_status;
   failure_status.status_code = IECStatus::IEC_CONNECTION_FAILURE;
@@ -284,44 +385,1065 @@ TEST_F(CBM1541DriveTest, ReadSectorTest) {
   // Done with one call, prepare for the next one.
   ::testing::Mock::VerifyAndClearExpectations(&conn);
 
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-E"), &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+
+  // Drive errors are reported before any content is transferred.
+  drive_status = "42, ERROR,42,42\r";
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .Times(1)
+      .WillOnce(Invoke(respond));
+
+  EXPECT_FALSE(drive.ReadSector(42, &read_content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+
+  // Done with one call, prepare for the next one.
+  ::testing::Mock::VerifyAndClearExpectations(&conn);
+  drive_status = "00, OK,00,00\r";
+
   EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:3 0"), &status))
       .Times(1)
-      .WillRepeatedly(Return(true));
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
 
   EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-E"), &status))
       .Times(1)
-      .WillOnce(Return(true));
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-R"), &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .Times(2)
+      .WillRepeatedly(Invoke(respond));
 
-  // Expect sector content to be read from our DA channel.
   EXPECT_CALL(conn, ReadFromChannel(8, 3, _, &status))
       .Times(1)
+      .WillOnce(DoAll(SetArgPointee<3>(failure_status), Return(false)));
+  EXPECT_FALSE(drive.ReadSector(42, &read_content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::IEC_CONNECTION_FAILURE);
+
+  // The destructor of our CBM1541Drive will call CloseChannel.
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).Times(1).WillOnce(Return(true));
+  EXPECT_CALL(conn, CloseChannel(8, 3, _)).Times(1).WillOnce(Return(true));
+}
+
+TEST_F(CBM1541DriveTest, FastReadSectorTest) {
+  MockFastIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  std::string last_command;
+  std::string summary("\x01\x42", 2);
+  auto respond = [&](char device_number, char channel, std::string *result,
+                     IECStatus *status) {
+    if (last_command == std::string("M-R\xfe\x05\x02", 6)) {
+      *result = summary;
+    } else {
+      *result = "00, OK,00,00\r";
+    }
+    return true;
+  };
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke(respond));
+  EXPECT_CALL(conn, OpenChannel(8, _, _, &status))
+      .WillRepeatedly(Return(true));
+
+  // The sender transfers the page sectors are read to, buffer 3.
+  std::string content(256, 0x42);
+  content[1] = 0x43;
+  const std::string fast_send_request("M-E\x00\x07\x06\x00", 7);
+  EXPECT_CALL(conn, ExecuteAndReceiveFast(8, fast_send_request, 256, _, _))
+      .WillOnce(DoAll(SetArgPointee<3>(content), Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 3, _, &status)).Times(0);
+
+  std::string read_content;
+  EXPECT_TRUE(drive.ReadSector(42, &read_content, &status)) << status.message;
+  EXPECT_EQ(content, read_content);
+
+  ::testing::Mock::VerifyAndClearExpectations(&conn);
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke(respond));
+
+  // A failed fast transfer is followed by a standard one, and we try again
+  // on the next sector.
+  EXPECT_CALL(conn, ExecuteAndReceiveFast(8, fast_send_request, 256, _, _))
+      .WillOnce(Return(false))
+      .WillOnce(DoAll(SetArgPointee<3>(content), Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 3, _, &status))
       .WillOnce(DoAll(SetArgPointee<2>(content), Return(true)));
+  read_content.clear();
+  EXPECT_TRUE(drive.ReadSector(43, &read_content, &status)) << status.message;
+  EXPECT_EQ(content, read_content);
+  read_content.clear();
+  EXPECT_TRUE(drive.ReadSector(44, &read_content, &status)) << status.message;
+  EXPECT_EQ(content, read_content);
 
+  ::testing::Mock::VerifyAndClearExpectations(&conn);
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
   EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke(respond));
+
+  // Once three fast transfers failed in a row, we stick to the standard
+  // protocol.
+  EXPECT_CALL(conn, ExecuteAndReceiveFast(8, fast_send_request, 256, _, _))
+      .Times(3)
+      .WillRepeatedly(Return(false));
+  EXPECT_CALL(conn, ReadFromChannel(8, 3, _, &status))
+      .Times(4)
+      .WillRepeatedly(DoAll(SetArgPointee<2>(content), Return(true)));
+  for (size_t sector = 45; sector < 49; ++sector) {
+    read_content.clear();
+    EXPECT_TRUE(drive.ReadSector(sector, &read_content, &status))
+        << status.message;
+    EXPECT_EQ(content, read_content);
+  }
+
+  EXPECT_CALL(conn, CloseChannel(8, _, _)).WillRepeatedly(Return(true));
+  // fast_send.asm replaced the BAM, the destructor has the drive read it
+  // again.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("I0"), _))
       .Times(1)
-      .WillOnce(DoAll(SetArgPointee<2>("42, ERROR,42,42\r"), Return(true)));
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, _))
+      .WillOnce(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+}
 
-  EXPECT_FALSE(drive.ReadSector(42, &read_content, &status));
-  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+TEST_F(CBM1541DriveTest, WriteSectorsTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  // We expect to receive one or more memory writes.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-W"), &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(true));
+  // Before uploading, we'll check whether our code is in place already.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-R"), &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(true));
+  // And when asked for status we'll say that everything is fine.
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+
+  // Opening DA channels and positioning block pointers. A full batch
+  // requires the additional batch channel as well.
+  EXPECT_CALL(conn, OpenChannel(8, 2, "#1", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:2 0"), &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 3, "#3", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  // Positioned once after opening, once before uploading content.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:3 0"), &status))
+      .Times(2)
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 4, "#0", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:4 0"), &status))
+      .Times(1)
+      .WillOnce(Return(true));
+
+  // Sectors 0-3 are all on track 1. With an interleave of 3, we expect
+  // them to be written in the order 0, 3, 1 (first batch), 2 (second batch).
+  std::vector<std::string> contents;
+  for (int i = 0; i < 4; ++i) {
+    contents.push_back(std::string(256, 'a' + i));
+  }
+  {
+    ::testing::InSequence seq;
+    EXPECT_CALL(conn, WriteToChannel(8, 2, StrEq(contents[0]), &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, WriteToChannel(8, 3, StrEq(contents[3]), &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, WriteToChannel(8, 4, StrEq(contents[1]), &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, WriteToChannel(8, 15,
+                                     StrEq(std::string("M-E\x03\x05\x01\x03"
+                                                       "\x00\x00\x03\x01",
+                                                       11)),
+                                     &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, WriteToChannel(8, 2, StrEq(contents[2]), &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, WriteToChannel(
+                          8, 15,
+                          StrEq(std::string("M-E\x03\x05\x01\x01\x00\x02", 9)),
+                          &status))
+        .WillOnce(Return(true));
+  }
+
+  EXPECT_TRUE(drive.WriteSectors(0, contents, &status)) << status.message;
 
   // Done with one call, prepare for the next one.
   ::testing::Mock::VerifyAndClearExpectations(&conn);
 
-  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:3 0"), &status))
+  // With verification enabled, single sectors are written by the batched
+  // write routine as well, and verification failures are reported by the
+  // drive.
+  EXPECT_TRUE(drive.SetWriteVerification(true));
+  EXPECT_CALL(conn, WriteToChannel(8, 2, StrEq(contents[2]), &status))
       .Times(1)
-      .WillRepeatedly(Return(true));
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, WriteToChannel(
+                        8, 15,
+                        StrEq(std::string("M-E\x03\x05\x01\x01\x01\x02", 9)),
+                        &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .Times(1)
+      .WillOnce(DoAll(SetArgPointee<2>("25, WRITE ERROR,01,02\r"),
+                      Return(true)));
+  EXPECT_FALSE(drive.WriteSector(2, contents[2], &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
 
-  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-E"), &status))
+  // Done with one call, prepare for the next one.
+  ::testing::Mock::VerifyAndClearExpectations(&conn);
+
+  // Content of the wrong size is rejected before talking to the drive.
+  contents[1].resize(255);
+  EXPECT_FALSE(drive.WriteSectors(0, contents, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
+  // The destructor of our CBM1541Drive will call CloseChannel.
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).Times(1).WillOnce(Return(true));
+  EXPECT_CALL(conn, CloseChannel(8, 3, _)).Times(1).WillOnce(Return(true));
+  EXPECT_CALL(conn, CloseChannel(8, 4, _)).Times(1).WillOnce(Return(true));
+}
+
+TEST_F(CBM1541DriveTest, ReadSectorListTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  // Remember the last command, so we can answer M-R requests with buffer tags
+  // and everything else with an OK status.
+  std::string last_command;
+  std::vector<std::string> tags = {std::string("\x00\xff\xff", 3),
+                                   std::string("\x01\x02\xff", 3)};
+  size_t num_tags_read = 0;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command == std::string("M-R\xfd\x05\x03", 6)) {
+          *result = tags.at(num_tags_read++);
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+
+  EXPECT_CALL(conn, OpenChannel(8, 2, "#1", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 3, "#3", &status))
       .Times(1)
       .WillOnce(Return(true));
 
+  // Sector 5 is track 1, sector 5. Sectors 22 and 26 are track 2, sectors 1
+  // and 5. We expect the list to be uploaded sorted by track.
+  EXPECT_CALL(conn, WriteToChannel(
+                        8, 15,
+                        StrEq(std::string("M-W\xa0\x05\x03\x01\x02\x02", 9)),
+                        &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, WriteToChannel(
+                        8, 15,
+                        StrEq(std::string("M-W\xd0\x05\x03\x05\x01\x05", 9)),
+                        &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+
+  // One request for track 1, another one for both sectors on track 2.
+  EXPECT_CALL(conn, WriteToChannel(8, 15,
+                                   StrEq(std::string("M-E\x03\x05\x00\x01", 7)),
+                                   &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, WriteToChannel(8, 15,
+                                   StrEq(std::string("M-E\x03\x05\x01\x02", 7)),
+                                   &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+
+  std::string content5(256, 0x05), content22(256, 0x22), content26(256, 0x26);
+  EXPECT_CALL(conn, ReadFromChannel(8, 2, _, &status))
+      .Times(2)
+      .WillOnce(DoAll(SetArgPointee<2>(content5), Return(true)))
+      .WillOnce(DoAll(SetArgPointee<2>(content22), Return(true)));
   EXPECT_CALL(conn, ReadFromChannel(8, 3, _, &status))
       .Times(1)
-      .WillOnce(DoAll(SetArgPointee<3>(failure_status), Return(false)));
-  EXPECT_FALSE(drive.ReadSector(42, &read_content, &status));
-  EXPECT_EQ(status.status_code, IECStatus::IEC_CONNECTION_FAILURE);
+      .WillOnce(DoAll(SetArgPointee<2>(content26), Return(true)));
+
+  std::map<size_t, std::string> contents;
+  EXPECT_TRUE(drive.ReadSectorList({26, 22, 5}, &contents, &status))
+      << status.message;
+  EXPECT_EQ(num_tags_read, 2u);
+  EXPECT_EQ(contents.size(), 3u);
+  EXPECT_EQ(contents[5], content5);
+  EXPECT_EQ(contents[22], content22);
+  EXPECT_EQ(contents[26], content26);
+
+  // The destructor of our CBM1541Drive will call CloseChannel.
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).Times(1).WillOnce(Return(true));
+  EXPECT_CALL(conn, CloseChannel(8, 3, _)).Times(1).WillOnce(Return(true));
+}
+
+TEST_F(CBM1541DriveTest, VerifySectorsTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  // Sectors 0 to 6 are all located on track 1. We'll report a checksum that
+  // doesn't match for sector 6.
+  std::vector<unsigned short int> expected;
+  for (int i = 0; i < 7; ++i) {
+    expected.push_back(Crc16(std::string(256, i)));
+  }
+  std::string checksums;
+  for (int sector : {0, 5, 1, 6, 2, 3, 4}) {
+    unsigned short int checksum = sector == 6 ? 0x1234 : expected[sector];
+    checksums.append(1, char(checksum & 0xff));
+    checksums.append(1, char(checksum >> 8));
+  }
+
+  std::string last_command;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-W"), &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-R"), &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command == std::string("M-R\xd6\x05\x0e", 6)) {
+          *result = checksums;
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+
+  // A single request for the whole track, with sectors in checksum
+  // interleave.
+  EXPECT_CALL(
+      conn,
+      WriteToChannel(
+          8, 15,
+          StrEq(std::string("M-E\x03\x05\x01\x07\x00\x05\x01\x06\x02\x03\x04",
+                            14)),
+          &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+  EXPECT_CALL(conn, WriteToChannel(8, 15,
+                                   StrEq(std::string("M-R\xd6\x05\x0e", 6)),
+                                   &status))
+      .Times(1)
+      .WillOnce(DoAll(SaveArg<2>(&last_command), Return(true)));
+
+  std::vector<size_t> mismatches;
+  EXPECT_TRUE(drive.VerifySectors(0, expected, &mismatches, &status))
+      << status.message;
+  EXPECT_EQ(mismatches, std::vector<size_t>({6}));
+}
+
+TEST_F(CBM1541DriveTest, VerifySectorsReadErrorTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  // Sector 1 can't be read, sector 2 holds different content.
+  std::vector<unsigned short int> expected = {0x1000, 0x1001, 0x1002};
+  unsigned int job_sector = 0;
+  size_t num_job_sectors = 0;
+  std::string last_command;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 5) == std::string("M-E\x03\x05", 5)) {
+          num_job_sectors = static_cast<unsigned char>(data[6]);
+          job_sector = static_cast<unsigned char>(data[7]);
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command.substr(0, 3) == "M-R") {
+          unsigned short int checksum =
+              job_sector == 2 ? 0x1234 : expected[job_sector];
+          *result = std::string(1, char(checksum & 0xff)) +
+                    std::string(1, char(checksum >> 8));
+        } else if (last_command.substr(0, 3) == "M-E" &&
+                   (num_job_sectors > 1 || job_sector == 1)) {
+          *result = "23, READ ERROR,01,01\r";
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+
+  // Unreadable sectors count as mismatches, rather than failing the request.
+  std::vector<size_t> mismatches;
+  EXPECT_TRUE(drive.VerifySectors(0, expected, &mismatches, &status))
+      << status.message;
+  EXPECT_EQ(mismatches, std::vector<size_t>({1, 2}));
+}
+
+TEST_F(CBM1541DriveTest, FirmwareResidencyTest) {
+  MockIECBusConnection conn;
+  IECStatus status;
+
+  // Simulate drive memory, so M-R returns whatever M-W put there.
+  std::string memory(0x800, '\0');
+  std::string last_command;
+  int num_memory_writes = 0;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 3) == "M-W") {
+          size_t address = static_cast<unsigned char>(data[3]) |
+                           static_cast<unsigned char>(data[4]) << 8;
+          memory.replace(address, data.size() - 6, data.substr(6));
+          ++num_memory_writes;
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command.substr(0, 3) == "M-R") {
+          size_t address = static_cast<unsigned char>(last_command[3]) |
+                           static_cast<unsigned char>(last_command[4]) << 8;
+          *result = memory.substr(address,
+                                  static_cast<unsigned char>(last_command[5]));
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+
+  // The first drive instance needs to upload its code.
+  {
+    CBM1541Drive drive(&conn, 8);
+    EXPECT_TRUE(drive.FormatDiscLowLevel(40, &status)) << status.message;
+  }
+  EXPECT_GT(num_memory_writes, 0);
+
+  // The next one finds it in place.
+  num_memory_writes = 0;
+  {
+    CBM1541Drive drive(&conn, 8);
+    EXPECT_TRUE(drive.FormatDiscLowLevel(40, &status)) << status.message;
+  }
+  EXPECT_EQ(num_memory_writes, 0);
+
+  // Unless someone else changed any part of it in the meantime.
+  memory[0x503] ^= 0xff;
+  {
+    CBM1541Drive drive(&conn, 8);
+    EXPECT_TRUE(drive.FormatDiscLowLevel(40, &status)) << status.message;
+  }
+  EXPECT_GT(num_memory_writes, 0);
+}
+
+TEST_F(CBM1541DriveTest, ReadTrackGCRTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  // Simulate a track holding a revolution of 7000 bytes, with a sync mark
+  // every 350 bytes. The drive measures sync marks in iterations of 13
+  // cycles. On track 18, a byte takes 28 cycles, and the drive only starts
+  // measuring after 10 bits, so 8 iterations make 5 bytes and 3 make 3.
+  std::string revolution;
+  std::string expected;
+  std::vector<unsigned int> expected_sync_lengths;
+  unsigned int random = 1;
+  for (int i = 0; i < 7000; ++i) {
+    random = random * 1103515245 + 12345;
+    if (i % 350 == 0) {
+      bool long_sync = i % 700 == 0;
+      revolution.append(1, long_sync ? 8 : 3);
+      expected.append(CBM1541Drive::kGCRSyncLength, '\xff');
+      expected_sync_lengths.push_back(long_sync ? 5 : 3);
+    } else {
+      char c = 0x40 | ((random >> 16) & 0x3f);
+      revolution.append(1, c);
+      expected.append(1, c);
+    }
+  }
+
+  // Serve the window captured last, depending on the number of pages
+  // requested.
+  std::string last_command;
+  size_t window_start = 0;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 6) == std::string("M-E\x03\x05\x12", 6)) {
+          EXPECT_EQ(data.size(), 7u);
+          window_start = (static_cast<unsigned char>(data[6]) - 2) * 0x100;
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+  EXPECT_CALL(conn, OpenChannel(8, 2, "#1", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 3, "#3", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 4, "#0", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  auto window_content = [&](size_t offset) {
+    std::string result;
+    for (size_t i = 0; i < 0x100; ++i) {
+      result.append(1, revolution[(window_start + offset + i) %
+                                  revolution.size()]);
+    }
+    return result;
+  };
+  // Buffer 0 holds the first half of each window, buffer 1 the second.
+  EXPECT_CALL(conn, ReadFromChannel(8, 4, _, &status))
+      .Times(17)
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        *result = window_content(0);
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 2, _, &status))
+      .Times(17)
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        *result = window_content(0x100);
+        return true;
+      }));
+
+  std::string gcr;
+  std::vector<CBM1541Drive::GCRSyncMark> sync_marks;
+  EXPECT_TRUE(drive.ReadTrackGCR(18, &gcr, &sync_marks, &status))
+      << status.message;
+  EXPECT_EQ(gcr, expected);
+  std::vector<unsigned int> sync_lengths;
+  for (size_t i = 0; i < sync_marks.size(); ++i) {
+    EXPECT_EQ(sync_marks[i].offset, i * (349 + CBM1541Drive::kGCRSyncLength));
+    sync_lengths.push_back(sync_marks[i].length);
+  }
+  EXPECT_EQ(sync_lengths, expected_sync_lengths);
+
+  EXPECT_FALSE(drive.ReadTrackGCR(42, &gcr, &sync_marks, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
+  // The destructor of our CBM1541Drive will call CloseChannel.
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).Times(1).WillOnce(Return(true));
+  EXPECT_CALL(conn, CloseChannel(8, 3, _)).Times(1).WillOnce(Return(true));
+  EXPECT_CALL(conn, CloseChannel(8, 4, _)).Times(1).WillOnce(Return(true));
+}
+
+TEST_F(CBM1541DriveTest, ReadTrackGCRNoRevolutionTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  // Simulate a track which doesn't repeat, e.g. because it's unformatted.
+  std::string revolution;
+  unsigned int random = 1;
+  for (int i = 0; i < 17 * 0x200; ++i) {
+    random = random * 1103515245 + 12345;
+    revolution.append(1, 0x40 | ((random >> 16) & 0x3f));
+  }
+
+  // Serve the window captured last, depending on the number of pages
+  // requested.
+  std::string last_command;
+  size_t window_start = 0;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 6) == std::string("M-E\x03\x05\x12", 6)) {
+          EXPECT_EQ(data.size(), 7u);
+          window_start = (static_cast<unsigned char>(data[6]) - 2) * 0x100;
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+  EXPECT_CALL(conn, OpenChannel(8, 2, "#1", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 3, "#3", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 4, "#0", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  auto window_content = [&](size_t offset) {
+    std::string result;
+    for (size_t i = 0; i < 0x100; ++i) {
+      result.append(1, revolution[(window_start + offset + i) %
+                                  revolution.size()]);
+    }
+    return result;
+  };
+  // Buffer 0 holds the first half of each window, buffer 1 the second.
+  EXPECT_CALL(conn, ReadFromChannel(8, 4, _, &status))
+      .Times(17)
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        *result = window_content(0);
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 2, _, &status))
+      .Times(17)
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        *result = window_content(0x100);
+        return true;
+      }));
+
+  std::string gcr;
+  std::vector<CBM1541Drive::GCRSyncMark> sync_marks;
+  EXPECT_FALSE(drive.ReadTrackGCR(18, &gcr, &sync_marks, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
 
   // The destructor of our CBM1541Drive will call CloseChannel.
   EXPECT_CALL(conn, CloseChannel(8, 2, _)).Times(1).WillOnce(Return(true));
   EXPECT_CALL(conn, CloseChannel(8, 3, _)).Times(1).WillOnce(Return(true));
+  EXPECT_CALL(conn, CloseChannel(8, 4, _)).Times(1).WillOnce(Return(true));
+}
+
+TEST_F(CBM1541DriveTest, GetNumSectorsTest) {
+  MockIECBusConnection conn;
+  IECStatus status;
+
+  // Simulate drive memory and the seek job, which reports success for tracks
+  // up to last_formatted_track after having been polled once.
+  unsigned int last_formatted_track = 0;
+  std::string memory(0x800, '\0');
+  std::string last_command;
+  std::vector<unsigned int> probed_tracks;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 3) != "M-W")
+          return true;
+        size_t address = static_cast<unsigned char>(data[3]) |
+                         static_cast<unsigned char>(data[4]) << 8;
+        memory.replace(address, data.size() - 6, data.substr(6));
+        if (address == 0x02) {
+          EXPECT_EQ(memory[0x02], '\xb0');
+          probed_tracks.push_back(memory[0x0a]);
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command == std::string("M-R\x02\x00\x01", 6)) {
+          *result = memory.substr(0x02, 1);
+          if (memory[0x02] == '\xb0') {
+            memory[0x02] =
+                memory[0x0a] <= static_cast<char>(last_formatted_track) ? 0x01
+                                                                        : 0x02;
+          }
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+
+  CBM1541Drive drive(&conn, 8);
+  size_t num_sectors = 0;
+
+  // A standard disc doesn't have any headers on track 36.
+  last_formatted_track = 35;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 683u);
+  EXPECT_EQ(probed_tracks, std::vector<unsigned int>({36}));
+
+  // Partially formatted extended tracks don't count.
+  last_formatted_track = 38;
+  probed_tracks.clear();
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 683u);
+  EXPECT_EQ(probed_tracks, std::vector<unsigned int>({36, 37, 38, 39}));
+
+  last_formatted_track = 40;
+  probed_tracks.clear();
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 768u);
+  EXPECT_EQ(probed_tracks, std::vector<unsigned int>({36, 37, 38, 39, 40}));
+}
+
+TEST_F(CBM1541DriveTest, FormatOnWriteTest) {
+  MockIECBusConnection conn;
+  IECStatus status;
+
+  // Simulate drive memory and the drive's job queue, which completes all
+  // jobs immediately.
+  std::string memory(0x800, '\0');
+  std::string last_command;
+  std::vector<std::string> format_requests;
+  std::vector<std::string> jobs;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 3) == "M-E") {
+          // Every track a request touches is formatted before anything is
+          // written.
+          EXPECT_TRUE(jobs.empty());
+          format_requests.push_back(data);
+        } else if (data.substr(0, 3) == "M-W") {
+          size_t address = static_cast<unsigned char>(data[3]) |
+                           static_cast<unsigned char>(data[4]) << 8;
+          memory.replace(address, data.size() - 6, data.substr(6));
+          if (address == 0x00) {
+            for (size_t i = 0; i < data.size() - 6; ++i) {
+              jobs.push_back((boost::format("%02x:%u/%u") %
+                              int(static_cast<unsigned char>(memory[i])) %
+                              int(memory[6 + 2 * i]) %
+                              int(memory[7 + 2 * i]))
+                                 .str());
+              memory[i] = 0x01;
+            }
+          }
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command.substr(0, 3) == "M-R") {
+          size_t address = static_cast<unsigned char>(last_command[3]) |
+                           static_cast<unsigned char>(last_command[4]) << 8;
+          *result = memory.substr(address,
+                                  static_cast<unsigned char>(last_command[5]));
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+
+  // Formatting closes all channels, so we open them after formatting.
+  EXPECT_CALL(conn, OpenChannel(8, 4, "#0", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 2, "#1", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  std::vector<std::string> buffer_0, buffer_1;
+  EXPECT_CALL(conn, WriteToChannel(8, 4, _, &status))
+      .WillRepeatedly(DoAll(Invoke([&](char device_number, char channel,
+                                       const std::string &data,
+                                       IECStatus *status) {
+                              buffer_0.push_back(data);
+                            }),
+                            Return(true)));
+  EXPECT_CALL(conn, WriteToChannel(8, 2, _, &status))
+      .WillRepeatedly(DoAll(Invoke([&](char device_number, char channel,
+                                       const std::string &data,
+                                       IECStatus *status) {
+                              buffer_1.push_back(data);
+                            }),
+                            Return(true)));
+
+  CBM1541Drive drive(&conn, 8);
+  EXPECT_TRUE(drive.SetFormatOnWrite(true));
+  EXPECT_TRUE(drive.SetWriteVerification(true));
+
+  // Sectors 19 to 22 span tracks 1 and 2, which are formatted at once.
+  std::vector<std::string> contents;
+  for (int i = 0; i < 4; ++i) {
+    contents.push_back(std::string(256, 0x19 + i));
+  }
+  EXPECT_TRUE(drive.WriteSectors(19, contents, &status)) << status.message;
+  // Writing to a track we formatted already doesn't format it again.
+  EXPECT_TRUE(drive.WriteSector(23, contents[0], &status)) << status.message;
+
+  EXPECT_EQ(format_requests,
+            std::vector<std::string>({std::string("M-E\x03\x05\x01\x02", 7)}));
+  // Each write is followed by a verification of the same buffer.
+  EXPECT_EQ(jobs, std::vector<std::string>(
+                      {"90:1/19", "90:1/20", "a0:1/19", "a0:1/20", "90:2/0",
+                       "90:2/1", "a0:2/0", "a0:2/1", "90:2/2", "a0:2/2"}));
+  EXPECT_EQ(buffer_0,
+            std::vector<std::string>({contents[0], contents[2], contents[0]}));
+  EXPECT_EQ(buffer_1, std::vector<std::string>({contents[1], contents[3]}));
+
+  // The destructor of our CBM1541Drive will call CloseChannel.
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).Times(1).WillOnce(Return(true));
+  EXPECT_CALL(conn, CloseChannel(8, 4, _)).Times(1).WillOnce(Return(true));
+}
+
+TEST_F(CBM1541DriveTest, CopySectorToTest) {
+  MockDirectCopyIECBusConnection conn;
+  IECStatus status;
+
+  // The source only needs to acknowledge its commands.
+  std::vector<std::string> source_commands;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(Invoke([&](char device_number, char channel,
+                                       const std::string &data,
+                                       IECStatus *status) {
+                              source_commands.push_back(data);
+                            }),
+                            Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+  EXPECT_CALL(conn, OpenChannel(8, _, _, &status))
+      .WillRepeatedly(Return(true));
+
+  // Simulate the target's memory and job queue, which completes all jobs
+  // immediately.
+  std::string memory(0x800, '\0');
+  std::string last_command;
+  std::vector<std::string> jobs;
+  EXPECT_CALL(conn, WriteToChannel(9, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 3) == "M-W") {
+          size_t address = static_cast<unsigned char>(data[3]) |
+                           static_cast<unsigned char>(data[4]) << 8;
+          memory.replace(address, data.size() - 6, data.substr(6));
+          if (address < 6) {
+            for (size_t i = address; i < address + data.size() - 6; ++i) {
+              jobs.push_back((boost::format("%02x:%u/%u") %
+                              int(static_cast<unsigned char>(memory[i])) %
+                              int(memory[6 + 2 * i]) %
+                              int(memory[7 + 2 * i]))
+                                 .str());
+              memory[i] = 0x01;
+            }
+          }
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(9, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command.substr(0, 3) == "M-R") {
+          size_t address = static_cast<unsigned char>(last_command[3]) |
+                           static_cast<unsigned char>(last_command[4]) << 8;
+          *result = memory.substr(address,
+                                  static_cast<unsigned char>(last_command[5]));
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, OpenChannel(9, 2, "#1", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+
+  // Sector content goes straight from the source's read channel to the
+  // target's write channel.
+  EXPECT_CALL(conn, CopyBetweenChannels(8, 3, 9, 2, &status))
+      .Times(2)
+      .WillRepeatedly(Return(true));
+
+  CBM1541Drive source(&conn, 8);
+  CBM1541Drive target(&conn, 9);
+  EXPECT_TRUE(target.SetWriteVerification(true));
+  EXPECT_TRUE(source.CopySectorTo(19, &target, &status)) << status.message;
+  EXPECT_TRUE(source.CopySectorTo(21, &target, &status)) << status.message;
+
+  // The source reads each block into its read channel's buffer and rewinds
+  // it.
+  EXPECT_EQ(source_commands.back(), "B-P:3 0");
+  EXPECT_NE(std::find(source_commands.begin(), source_commands.end(),
+                      std::string("M-E\x03\x05\x01\x13\x00", 8)),
+            source_commands.end());
+  EXPECT_NE(std::find(source_commands.begin(), source_commands.end(),
+                      std::string("M-E\x03\x05\x02\x00\x00", 8)),
+            source_commands.end());
+  // The target writes buffer 1 with its own jobs, no custom code needed.
+  EXPECT_EQ(jobs, std::vector<std::string>(
+                      {"90:1/19", "a0:1/19", "90:2/0", "a0:2/0"}));
+  EXPECT_EQ(memory.substr(0x500, 0x300), std::string(0x300, '\0'));
+
+  EXPECT_CALL(conn, CloseChannel(_, _, _)).WillRepeatedly(Return(true));
+}
+
+TEST_F(CBM1541DriveTest, WriteSectorsToAllTest) {
+  MockBroadcastIECBusConnection conn;
+  IECStatus status;
+
+  // Code uploads happen drive by drive.
+  EXPECT_CALL(conn, WriteToChannel(_, 15, _, _)).WillRepeatedly(Return(true));
+  EXPECT_CALL(conn, OpenChannel(_, _, _, _))
+      .WillRepeatedly(Return(true));
+  bool write_started = false;
+  EXPECT_CALL(conn, ReadFromChannel(9, 15, _, _))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+  // Drive 10 fails to write.
+  EXPECT_CALL(conn, ReadFromChannel(10, 15, _, _))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        *result = write_started ? "25, WRITE ERROR,01,00\r" : "00, OK,00,00\r";
+        return true;
+      }));
+
+  std::vector<std::string> broadcasts;
+  EXPECT_CALL(conn, WriteToChannels(_, _, _, &status))
+      .WillRepeatedly(Invoke([&](const std::vector<char> &device_numbers,
+                                 char channel, const std::string &data,
+                                 IECStatus *status) {
+        std::string entry;
+        for (char device_number : device_numbers) {
+          entry += (boost::format("%u,") % int(device_number)).str();
+        }
+        entry += (boost::format("%u:") % int(channel)).str();
+        entry += data.size() == 256 ? data.substr(0, 1) : data;
+        broadcasts.push_back(entry);
+        write_started = data.substr(0, 3) == "M-E";
+        return true;
+      }));
+
+  CBM1541Drive drive_9(&conn, 9);
+  CBM1541Drive drive_10(&conn, 10);
+  std::vector<CBM1541Drive *> drives = {&drive_9, &drive_10};
+  std::vector<IECStatus> results(2);
+  std::vector<std::string> contents = {std::string(256, 'a'),
+                                       std::string(256, 'b')};
+  EXPECT_TRUE(CBM1541Drive::WriteSectorsToAll(drives, 0, contents, &results,
+                                              &status))
+      << status.message;
+  // Both sectors fit into a single batch, which is sent to both drives once.
+  EXPECT_EQ(broadcasts,
+            std::vector<std::string>(
+                {"9,10,2:a", "9,10,15:B-P:3 0", "9,10,3:b",
+                 std::string("9,10,15:M-E\x03\x05\x01\x02\x00\x00\x01",
+                             18)}));
+  EXPECT_TRUE(results[0].ok()) << results[0].message;
+  EXPECT_EQ(results[1].status_code, IECStatus::DRIVE_ERROR);
+
+  // The drive that failed is left out from now on.
+  broadcasts.clear();
+  EXPECT_TRUE(CBM1541Drive::WriteSectorsToAll(drives, 1, {contents[1]},
+                                              &results, &status))
+      << status.message;
+  EXPECT_EQ(broadcasts,
+            std::vector<std::string>(
+                {"9,2:b", std::string("9,15:M-E\x03\x05\x01\x01\x00\x01",
+                                      14)}));
+  EXPECT_TRUE(results[0].ok()) << results[0].message;
+
+  EXPECT_CALL(conn, CloseChannel(_, _, _)).WillRepeatedly(Return(true));
+}
+
+TEST_F(CBM1541DriveTest, MoveHeadTest) {
+  MockIECBusConnection conn;
+  IECStatus status;
+
+  // Record each job along with its track, completing it immediately.
+  std::string memory(0x800, '\0');
+  std::string last_command;
+  std::vector<std::string> jobs;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 3) != "M-W")
+          return true;
+        size_t address = static_cast<unsigned char>(data[3]) |
+                         static_cast<unsigned char>(data[4]) << 8;
+        memory.replace(address, data.size() - 6, data.substr(6));
+        if (address == 0x02) {
+          jobs.push_back((boost::format("%02x:%u") %
+                          int(static_cast<unsigned char>(memory[0x02])) %
+                          int(memory[0x0a]))
+                             .str());
+          memory[0x02] = 0x01;
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command == std::string("M-R\x02\x00\x01", 6)) {
+          *result = memory.substr(0x02, 1);
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+
+  CBM1541Drive drive(&conn, 8);
+  // Sector 357 is located on track 18, sector 0 on track 1.
+  EXPECT_TRUE(drive.MoveHead(357, DriveInterface::HEAD_BUMP, &status))
+      << status.message;
+  EXPECT_TRUE(
+      drive.MoveHead(357, DriveInterface::HEAD_NEIGHBOUR_TRACK, &status))
+      << status.message;
+  EXPECT_TRUE(drive.MoveHead(0, DriveInterface::HEAD_NEIGHBOUR_TRACK, &status))
+      << status.message;
+  EXPECT_EQ(jobs, std::vector<std::string>({"c0:18", "b0:17", "b0:2"}));
+}
+
+TEST_F(CBM1541DriveTest, ReadMemoryTest) {
+  MockIECBusConnection conn;
+  IECStatus status;
+
+  // Simulate drive memory holding a counter.
+  std::string memory;
+  for (int i = 0; i < 0x800; ++i) {
+    memory.append(1, i % 251);
+  }
+  std::string last_command;
+  int num_requests = 0;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-R"), &status))
+      .WillRepeatedly(DoAll(SaveArg<2>(&last_command),
+                            Invoke([&](char device_number, char channel,
+                                       const std::string &data,
+                                       IECStatus *status) { ++num_requests; }),
+                            Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        size_t address = static_cast<unsigned char>(last_command[3]) |
+                         static_cast<unsigned char>(last_command[4]) << 8;
+        *result = memory.substr(address,
+                                static_cast<unsigned char>(last_command[5]));
+        return true;
+      }));
+
+  CBM1541Drive drive(&conn, 8);
+  std::string content;
+  EXPECT_TRUE(drive.ReadMemory(0x123, 600, &content, &status))
+      << status.message;
+  EXPECT_EQ(content, memory.substr(0x123, 600));
+  EXPECT_EQ(num_requests, 3);
+
+  num_requests = 0;
+  EXPECT_TRUE(drive.SnapshotDriveRAM(&content, &status)) << status.message;
+  EXPECT_EQ(content, memory);
+  EXPECT_EQ(num_requests, 9);
+
+  // Reading beyond the end of RAM returns less than requested.
+  EXPECT_FALSE(drive.ReadMemory(0x7ff, 2, &content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
 }
@@ -0,0 +1,180 @@
+// DriveInterface implementation on top of a physical CBM 1571 disk drive.
+
+#include "cbm1571_drive.h"
+
+#include <algorithm>
+
+#include "bam.h"
+#include "boost/format.hpp"
+#include "cbm1541_drive.h"
+
+// Number of tracks per side.
+static const unsigned int kNumTracksPerSide = 35;
+
+// Offset of the BAM byte flagging double sided discs.
+static const size_t kBAMDoubleSidedOffset = 3;
+static const unsigned char kBAMDoubleSidedFlag = 0x80;
+
+// Switches the drive to 1571 (double sided) mode. Drives power up in 1541
+// mode, which only uses the first side.
+static const char k1571ModeCommand[] = "U0>M1";
+
+// Job queue location, which the 1571 shares with the 1541. The job code for
+// buffer n is stored at kJobCodeAddress + n, the track and sector it refers
+// to at kJobTrackSectorAddress + 2 * n.
+static const unsigned short int kJobCodeAddress = 0x0000;
+static const unsigned short int kJobTrackSectorAddress = 0x0006;
+
+// Job code reading the job's sector into its buffer.
+static const unsigned char kReadJobCode = 0x80;
+
+// The result code of a successful job.
+static const unsigned char kJobResultOK = 0x01;
+
+// Location of drive buffer 0, which the other buffers follow.
+static const unsigned short int kFirstBufferAddress = 0x0300;
+
+// Channels holding drive buffers 0 to 2 while our read jobs use them.
+static const int kJobChannels[] = {3, 4, 5};
+
+CBM1571Drive::CBM1571Drive(IECBusConnection *bus_conn, char device_number)
+    : CBMDOSDrive(bus_conn, device_number) {}
+
+bool CBM1571Drive::GetNumSectors(size_t *num_sectors, IECStatus *status) {
+  std::string bam;
+  if (!ReadSector(kBAMSectorNumber, &bam, status))
+    return false;
+  if (bam.size() > kBAMDoubleSidedOffset &&
+      (bam[kBAMDoubleSidedOffset] & kBAMDoubleSidedFlag)) {
+    *num_sectors = kNumSectorsDoubleSided;
+  } else {
+    *num_sectors = kNumSectorsSingleSided;
+  }
+  return true;
+}
+
+bool CBM1571Drive::GetTrackSector(size_t sector_number, unsigned int *track,
+                                  unsigned int *sector) {
+  if (sector_number >= kNumSectorsDoubleSided)
+    return false;
+  unsigned int side = sector_number / kNumSectorsSingleSided;
+  CBM1541Drive::GetTrackSector(sector_number % kNumSectorsSingleSided, track,
+                               sector);
+  *track += side * kNumTracksPerSide;
+  return true;
+}
+
+bool CBM1571Drive::GetDOSTrackSector(size_t sector_number, unsigned int *track,
+                                     unsigned int *sector) {
+  return GetTrackSector(sector_number, track, sector);
+}
+
+bool CBM1571Drive::InitDrive(IECStatus *status) {
+  return SendCommand(k1571ModeCommand, status);
+}
+
+bool CBM1571Drive::ReadSectorList(const std::vector<size_t> &sector_numbers,
+                                  std::map<size_t, std::string> *contents,
+                                  IECStatus *status) {
+  contents->clear();
+  // Group the sectors by the track holding them.
+  std::map<unsigned int, std::vector<size_t>> tracks;
+  for (size_t sector_number : sector_numbers) {
+    unsigned int track = 1;
+    unsigned int sector = 0;
+    if (!GetTrackSector(sector_number, &track, &sector)) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("sector %u is out of range") % sector_number)
+                   .str(),
+               status);
+      return false;
+    }
+    tracks[track].push_back(sector_number);
+  }
+  // Our jobs need buffers 0 to 2, one of which the direct access channel
+  // may hold.
+  if (!PrepareDrive(status) || !ReleaseDirectAccessChannel(status))
+    return false;
+
+  const size_t num_job_buffers = sizeof(kJobChannels) / sizeof(kJobChannels[0]);
+  size_t num_open_channels = 0;
+  bool success = true;
+  while (success && num_open_channels < num_job_buffers) {
+    success = bus_conn_->OpenChannel(
+        device_number_, kJobChannels[num_open_channels],
+        (boost::format("#%u") % num_open_channels).str(), status);
+    if (success)
+      ++num_open_channels;
+  }
+  std::vector<size_t> failed;
+  for (auto it = tracks.begin(); success && it != tracks.end(); ++it) {
+    const std::vector<size_t> &sectors = it->second;
+    for (size_t pos = 0; success && pos < sectors.size();
+         pos += num_job_buffers) {
+      std::vector<size_t> batch(
+          sectors.begin() + pos,
+          sectors.begin() + std::min(sectors.size(), pos + num_job_buffers));
+      success = ReadWithJobs(batch, contents, &failed, status);
+    }
+  }
+  // Free the buffers again, reporting the first error only.
+  for (size_t i = 0; i < num_open_channels; ++i) {
+    IECStatus close_status;
+    if (!bus_conn_->CloseChannel(device_number_, kJobChannels[i],
+                                 &close_status) &&
+        success) {
+      *status = close_status;
+      success = false;
+    }
+  }
+  if (!success)
+    return false;
+
+  // Let the DOS read what the jobs couldn't, so it reports the failing
+  // sector.
+  for (size_t sector_number : failed) {
+    if (!ReadSector(sector_number, &(*contents)[sector_number], status))
+      return false;
+  }
+  return true;
+}
+
+bool CBM1571Drive::ReadWithJobs(const std::vector<size_t> &sector_numbers,
+                                std::map<size_t, std::string> *contents,
+                                std::vector<size_t> *failed,
+                                IECStatus *status) {
+  // Set up track and sector first, so the jobs don't start before.
+  std::vector<unsigned char> track_sectors;
+  for (size_t sector_number : sector_numbers) {
+    unsigned int track = 1;
+    unsigned int sector = 0;
+    GetTrackSector(sector_number, &track, &sector);
+    track_sectors.push_back(track);
+    track_sectors.push_back(sector);
+  }
+  if (!WriteMemory(kJobTrackSectorAddress, track_sectors.size(),
+                   &track_sectors[0], status)) {
+    return false;
+  }
+  std::string results;
+  if (!RunJobs(kJobCodeAddress,
+               std::vector<unsigned char>(sector_numbers.size(), kReadJobCode),
+               &results, status)) {
+    return false;
+  }
+  std::string buffers;
+  if (!ReadMemory(kFirstBufferAddress,
+                  sector_numbers.size() * kNumBytesPerSector, &buffers,
+                  status)) {
+    return false;
+  }
+  for (size_t i = 0; i < sector_numbers.size(); ++i) {
+    if (static_cast<unsigned char>(results[i]) == kJobResultOK) {
+      (*contents)[sector_numbers[i]] =
+          buffers.substr(i * kNumBytesPerSector, kNumBytesPerSector);
+    } else {
+      failed->push_back(sector_numbers[i]);
+    }
+  }
+  return true;
+}
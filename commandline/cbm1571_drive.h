@@ -0,0 +1,56 @@
+// DriveInterface implementation on top of a physical CBM 1571 disk drive.
+
+#ifndef CBM1571_DRIVE_H
+#define CBM1571_DRIVE_H
+
+#include "cbm_dos_drive.h"
+
+class CBM1571Drive : public CBMDOSDrive {
+public:
+  enum {
+    // Number of sectors on a single sided (1541 compatible) disc.
+    kNumSectorsSingleSided = 683,
+    // Number of sectors on a double sided disc, as stored in a .d71 image.
+    kNumSectorsDoubleSided = 1366
+  };
+
+  // Instantiate a CBM1571 drive using the specified connection object
+  // and device_number. See CBMDOSDrive for the ownership of bus_conn.
+  CBM1571Drive(IECBusConnection *bus_conn, char device_number);
+
+  // Reports a double sided disc if the BAM says so, a single sided disc
+  // otherwise.
+  bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
+
+  // Queues read jobs for several drive buffers at once, so the drive reads
+  // the sectors of a track as they pass the head rather than waiting a
+  // revolution for each of them, then transfers the buffers with M-R. Like
+  // the 1541, the 1571 only has room for a few sectors, not a whole track.
+  // Sectors the jobs fail to read are read again through the DOS, which
+  // reports the failing sector.
+  bool ReadSectorList(const std::vector<size_t> &sector_numbers,
+                      std::map<size_t, std::string> *contents,
+                      IECStatus *status) override;
+
+  // Sectors of the second side follow those of the first one, on tracks 36
+  // to 70 which use the same sectors / track configuration as tracks 1 to 35.
+  static bool GetTrackSector(size_t sector_number, unsigned int *track,
+                             unsigned int *sector);
+
+protected:
+  bool GetDOSTrackSector(size_t sector_number, unsigned int *track,
+                         unsigned int *sector) override;
+  // Switches the drive to 1571 mode, which makes the second side accessible.
+  bool InitDrive(IECStatus *status) override;
+
+private:
+  // Read sector_numbers into consecutive buffers, starting at buffer 0, and
+  // add the content of those read successfully to *contents. Appends the
+  // sectors the drive couldn't read to *failed. Returns true if successful
+  // (failed jobs don't constitute an error), sets status otherwise.
+  bool ReadWithJobs(const std::vector<size_t> &sector_numbers,
+                    std::map<size_t, std::string> *contents,
+                    std::vector<size_t> *failed, IECStatus *status);
+};
+
+#endif // CBM1571_DRIVE_H
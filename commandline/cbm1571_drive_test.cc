@@ -0,0 +1,197 @@
+#include "cbm1571_drive.h"
+
+#include "iec_host_lib.h"
+#include "mock_iec_bus_connection.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::InSequence;
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::SetArgPointee;
+using ::testing::StartsWith;
+using ::testing::StrEq;
+
+class CBM1571DriveTest : public ::testing::Test {};
+
+TEST_F(CBM1571DriveTest, GetTrackSectorTest) {
+  unsigned int track = 0;
+  unsigned int sector = 0;
+  EXPECT_TRUE(CBM1571Drive::GetTrackSector(0, &track, &sector));
+  EXPECT_EQ(1, track);
+  EXPECT_EQ(0, sector);
+  EXPECT_TRUE(CBM1571Drive::GetTrackSector(682, &track, &sector));
+  EXPECT_EQ(35, track);
+  EXPECT_EQ(16, sector);
+  // The second side starts over with the sectors / track of track 1.
+  EXPECT_TRUE(CBM1571Drive::GetTrackSector(683, &track, &sector));
+  EXPECT_EQ(36, track);
+  EXPECT_EQ(0, sector);
+  EXPECT_TRUE(CBM1571Drive::GetTrackSector(683 + 357, &track, &sector));
+  EXPECT_EQ(53, track);
+  EXPECT_EQ(0, sector);
+  EXPECT_TRUE(CBM1571Drive::GetTrackSector(1365, &track, &sector));
+  EXPECT_EQ(70, track);
+  EXPECT_EQ(16, sector);
+  EXPECT_FALSE(CBM1571Drive::GetTrackSector(1366, &track, &sector));
+}
+
+TEST_F(CBM1571DriveTest, ReadWriteSectorTest) {
+  MockIECBusConnection conn;
+  CBM1571Drive drive(&conn, 8);
+  IECStatus status;
+  std::string content(256, 'x');
+
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+  {
+    InSequence seq;
+    // The drive is switched to 1571 mode before we access it.
+    EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("U0>M1"), &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, OpenChannel(8, 2, StrEq("#"), &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("U1:2 0 36 1"), &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, ReadFromChannel(8, 2, _, &status))
+        .WillOnce(DoAll(SetArgPointee<2>(content), Return(true)));
+    EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:2 0"), &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, WriteToChannel(8, 2, content, &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("U2:2 0 70 16"), &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, CloseChannel(8, 2, _)).WillOnce(Return(true));
+  }
+
+  std::string read_content;
+  EXPECT_TRUE(drive.ReadSector(684, &read_content, &status)) << status.message;
+  EXPECT_EQ(content, read_content);
+  EXPECT_TRUE(drive.WriteSector(1365, content, &status)) << status.message;
+  EXPECT_FALSE(drive.WriteSector(1366, content, &status));
+  EXPECT_EQ(IECStatus::INVALID_ARGUMENT, status.status_code);
+}
+
+TEST_F(CBM1571DriveTest, GetNumSectorsTest) {
+  MockIECBusConnection conn;
+  CBM1571Drive drive(&conn, 8);
+  IECStatus status;
+
+  std::string bam(256, '\0');
+  bam[3] = '\x80';
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+  EXPECT_CALL(conn, OpenChannel(8, 2, _, &status)).WillOnce(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 2, _, &status))
+      .WillOnce(DoAll(SetArgPointee<2>(bam), Return(true)))
+      .WillOnce(DoAll(SetArgPointee<2>(std::string(256, '\0')), Return(true)));
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).WillOnce(Return(true));
+
+  size_t num_sectors = 0;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(1366, num_sectors);
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(683, num_sectors);
+}
+
+TEST_F(CBM1571DriveTest, DriveErrorTest) {
+  MockIECBusConnection conn;
+  CBM1571Drive drive(&conn, 8);
+  IECStatus status;
+
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 2, _, &status)).WillOnce(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillOnce(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)))
+      .WillOnce(DoAll(SetArgPointee<2>("23,READ ERROR,01,00\r"), Return(true)));
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).WillOnce(Return(true));
+
+  std::string content;
+  EXPECT_FALSE(drive.ReadSector(0, &content, &status));
+  EXPECT_EQ(IECStatus::DRIVE_ERROR, status.status_code);
+  EXPECT_THAT(status.message, StartsWith("23,READ ERROR"));
+}
+
+TEST_F(CBM1571DriveTest, ReadSectorListTest) {
+  MockIECBusConnection conn;
+  CBM1571Drive drive(&conn, 8);
+  IECStatus status;
+
+  auto sector_content = [](unsigned int track, unsigned int sector) {
+    return std::string(128, static_cast<char>(track)) +
+           std::string(128, static_cast<char>(sector));
+  };
+  // Simulate drive memory. Read jobs complete at once, but fail for track
+  // 40, sector 3.
+  std::string memory(0x800, '\0');
+  std::string last_command;
+  int num_jobs = 0;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 3) == "M-W") {
+          size_t address = static_cast<unsigned char>(data[3]) |
+                           static_cast<unsigned char>(data[4]) << 8;
+          memory.replace(address, data.size() - 6, data.substr(6));
+          for (size_t n = 0; n < 3; ++n) {
+            if (memory[n] != '\x80')
+              continue;
+            ++num_jobs;
+            unsigned int track = memory[6 + 2 * n];
+            unsigned int sector = memory[7 + 2 * n];
+            memory.replace(0x300 + 0x100 * n, 256,
+                           sector_content(track, sector));
+            memory[n] = track == 40 && sector == 3 ? 0x05 : 0x01;
+          }
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command.substr(0, 3) == "M-R") {
+          size_t address = static_cast<unsigned char>(last_command[3]) |
+                           static_cast<unsigned char>(last_command[4]) << 8;
+          *result = memory.substr(address,
+                                  static_cast<unsigned char>(last_command[5]));
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+  // Buffers 0 to 2 are held while the jobs use them.
+  for (int channel = 3; channel <= 5; ++channel) {
+    EXPECT_CALL(conn, OpenChannel(8, channel,
+                                  StrEq("#" + std::to_string(channel - 3)),
+                                  &status))
+        .WillOnce(Return(true));
+    EXPECT_CALL(conn, CloseChannel(8, channel, _)).WillOnce(Return(true));
+  }
+  // The DOS reads the sector the job failed on.
+  EXPECT_CALL(conn, OpenChannel(8, 2, StrEq("#"), &status))
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 2, _, &status))
+      .WillOnce(DoAll(SetArgPointee<2>(sector_content(40, 3)), Return(true)));
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).WillOnce(Return(true));
+
+  // Track 1 takes two batches of jobs, tracks 2 and 40 one each.
+  std::vector<size_t> sector_numbers = {0, 1, 2, 3, 21, 770};
+  std::map<size_t, std::string> contents;
+  EXPECT_TRUE(drive.ReadSectorList(sector_numbers, &contents, &status))
+      << status.message;
+  EXPECT_EQ(6, num_jobs);
+  EXPECT_EQ(sector_numbers.size(), contents.size());
+  for (size_t sector_number : sector_numbers) {
+    unsigned int track = 0;
+    unsigned int sector = 0;
+    CBM1571Drive::GetTrackSector(sector_number, &track, &sector);
+    EXPECT_EQ(sector_content(track, sector), contents[sector_number])
+        << sector_number;
+  }
+}
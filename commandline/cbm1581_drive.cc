@@ -0,0 +1,129 @@
+// DriveInterface implementation on top of a physical CBM 1581 disk drive.
+
+#include "cbm1581_drive.h"
+
+#include <algorithm>
+
+#include "boost/format.hpp"
+
+// Number of logical sectors held by the track cache, which covers one side
+// of a physical track.
+static const size_t kNumCacheSectors = 20;
+
+// Location of the track cache. Logical sector n of the cached half track is
+// stored at kTrackCacheAddress + kNumBytesPerSector * (n % kNumCacheSectors).
+static const unsigned short int kTrackCacheAddress = 0x0c00;
+
+// Job queue location. The job code for slot n is stored at
+// kJobCodeAddress + n, the track and sector it refers to at
+// kJobTrackSectorAddress + 2 * n.
+static const unsigned short int kJobCodeAddress = 0x0002;
+static const unsigned short int kJobTrackSectorAddress = 0x000b;
+
+// Job code reading the half track holding the job's sector into the track
+// cache.
+static const unsigned char kReadTrackCacheJobCode = 0xaa;
+
+// Job results up to this value mean success.
+static const unsigned char kMaxJobResultOK = 0x01;
+
+// The DOS doesn't leave jobs queued between commands, so any slot is free.
+// Reading into the track cache doesn't touch the slot's buffer.
+static const unsigned int kTrackCacheJobSlot = 0;
+
+CBM1581Drive::CBM1581Drive(IECBusConnection *bus_conn, char device_number)
+    : CBMDOSDrive(bus_conn, device_number) {}
+
+bool CBM1581Drive::GetNumSectors(size_t *num_sectors, IECStatus *status) {
+  *num_sectors = kNumSectors;
+  return true;
+}
+
+bool CBM1581Drive::GetTrackSector(size_t sector_number, unsigned int *track,
+                                  unsigned int *sector) {
+  if (sector_number >= kNumSectors)
+    return false;
+  *track = sector_number / kNumSectorsPerTrack + 1;
+  *sector = sector_number % kNumSectorsPerTrack;
+  return true;
+}
+
+bool CBM1581Drive::GetDOSTrackSector(size_t sector_number, unsigned int *track,
+                                     unsigned int *sector) {
+  return GetTrackSector(sector_number, track, sector);
+}
+
+bool CBM1581Drive::ReadSectorList(const std::vector<size_t> &sector_numbers,
+                                  std::map<size_t, std::string> *contents,
+                                  IECStatus *status) {
+  contents->clear();
+  // Group the sectors by the half track holding them.
+  std::map<size_t, std::vector<size_t>> half_tracks;
+  for (size_t sector_number : sector_numbers) {
+    if (sector_number >= kNumSectors) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("sector %u is out of range") % sector_number)
+                   .str(),
+               status);
+      return false;
+    }
+    half_tracks[sector_number / kNumCacheSectors].push_back(sector_number);
+  }
+  if (!PrepareDrive(status))
+    return false;
+
+  for (auto &half_track : half_tracks) {
+    std::vector<size_t> &sectors = half_track.second;
+    std::sort(sectors.begin(), sectors.end());
+    sectors.erase(std::unique(sectors.begin(), sectors.end()), sectors.end());
+    bool cached = false;
+    if (!ReadTrackCache(half_track.first, &cached, status))
+      return false;
+    if (!cached) {
+      for (size_t sector_number : sectors) {
+        if (!ReadSector(sector_number, &(*contents)[sector_number], status))
+          return false;
+      }
+      continue;
+    }
+    // Transfer each run of consecutive sectors in one go.
+    for (size_t i = 0; i < sectors.size();) {
+      size_t run = 1;
+      while (i + run < sectors.size() && sectors[i + run] == sectors[i] + run)
+        ++run;
+      std::string content;
+      if (!ReadMemory(kTrackCacheAddress + kNumBytesPerSector *
+                                               (sectors[i] % kNumCacheSectors),
+                      run * kNumBytesPerSector, &content, status)) {
+        return false;
+      }
+      for (size_t n = 0; n < run; ++n) {
+        (*contents)[sectors[i + n]] =
+            content.substr(n * kNumBytesPerSector, kNumBytesPerSector);
+      }
+      i += run;
+    }
+  }
+  return true;
+}
+
+bool CBM1581Drive::ReadTrackCache(size_t half_track, bool *cached,
+                                  IECStatus *status) {
+  unsigned int track = 1;
+  unsigned int sector = 0;
+  GetTrackSector(half_track * kNumCacheSectors, &track, &sector);
+  // Set up track and sector first, so the job doesn't start before.
+  const unsigned char track_sector[] = {static_cast<unsigned char>(track),
+                                        static_cast<unsigned char>(sector)};
+  if (!WriteMemory(kJobTrackSectorAddress + 2 * kTrackCacheJobSlot,
+                   sizeof(track_sector), track_sector, status)) {
+    return false;
+  }
+  std::string results;
+  if (!RunJobs(kJobCodeAddress + kTrackCacheJobSlot, {kReadTrackCacheJobCode},
+               &results, status)) {
+    return false;
+  }
+  *cached = static_cast<unsigned char>(results[0]) <= kMaxJobResultOK;
+  return true;
+}
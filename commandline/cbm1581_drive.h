@@ -0,0 +1,50 @@
+// DriveInterface implementation on top of a physical CBM 1581 disk drive.
+
+#ifndef CBM1581_DRIVE_H
+#define CBM1581_DRIVE_H
+
+#include "cbm_dos_drive.h"
+
+class CBM1581Drive : public CBMDOSDrive {
+public:
+  enum {
+    // Number of tracks and sectors per track as seen by the DOS, which
+    // combines both sides of a physical track into a logical one.
+    kNumTracks = 80,
+    kNumSectorsPerTrack = 40,
+    // Number of sectors on a disc, as stored in a .d81 image.
+    kNumSectors = kNumTracks * kNumSectorsPerTrack
+  };
+
+  // Instantiate a CBM1581 drive using the specified connection object
+  // and device_number. See CBMDOSDrive for the ownership of bus_conn.
+  CBM1581Drive(IECBusConnection *bus_conn, char device_number);
+
+  bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
+
+  // Loads each half track (one side of a physical track) holding any of the
+  // sectors into the drive's track cache with a single job, then transfers
+  // the requested sectors from the cache. Half tracks the job fails to read
+  // are read sector by sector through the DOS, which reports the failing
+  // sector.
+  bool ReadSectorList(const std::vector<size_t> &sector_numbers,
+                      std::map<size_t, std::string> *contents,
+                      IECStatus *status) override;
+
+  // Translate sector_number to the corresponding track (starting at 1) and
+  // sector (starting at 0). Returns false if sector_number is out of range.
+  static bool GetTrackSector(size_t sector_number, unsigned int *track,
+                             unsigned int *sector);
+
+protected:
+  bool GetDOSTrackSector(size_t sector_number, unsigned int *track,
+                         unsigned int *sector) override;
+
+private:
+  // Run the job reading half_track into the track cache. Sets *cached to
+  // whether the job succeeded. Returns true if successful (a failed job
+  // doesn't constitute an error), sets status otherwise.
+  bool ReadTrackCache(size_t half_track, bool *cached, IECStatus *status);
+};
+
+#endif // CBM1581_DRIVE_H
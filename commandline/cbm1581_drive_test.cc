@@ -0,0 +1,110 @@
+#include "cbm1581_drive.h"
+
+#include "iec_host_lib.h"
+#include "mock_iec_bus_connection.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::SetArgPointee;
+using ::testing::StrEq;
+
+class CBM1581DriveTest : public ::testing::Test {};
+
+TEST_F(CBM1581DriveTest, GetTrackSectorTest) {
+  unsigned int track = 0;
+  unsigned int sector = 0;
+  EXPECT_TRUE(CBM1581Drive::GetTrackSector(0, &track, &sector));
+  EXPECT_EQ(1, track);
+  EXPECT_EQ(0, sector);
+  EXPECT_TRUE(CBM1581Drive::GetTrackSector(1560, &track, &sector));
+  EXPECT_EQ(40, track);
+  EXPECT_EQ(0, sector);
+  EXPECT_TRUE(CBM1581Drive::GetTrackSector(3199, &track, &sector));
+  EXPECT_EQ(80, track);
+  EXPECT_EQ(39, sector);
+  EXPECT_FALSE(CBM1581Drive::GetTrackSector(3200, &track, &sector));
+
+  MockIECBusConnection conn;
+  CBM1581Drive drive(&conn, 8);
+  IECStatus status;
+  size_t num_sectors = 0;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status));
+  EXPECT_EQ(3200, num_sectors);
+}
+
+TEST_F(CBM1581DriveTest, ReadSectorListTest) {
+  MockIECBusConnection conn;
+  CBM1581Drive drive(&conn, 8);
+  IECStatus status;
+
+  // Every sector is filled with its sector number.
+  auto sector_content = [](size_t sector_number) {
+    return std::string(256, static_cast<char>(sector_number));
+  };
+  // Simulate drive memory. Reading the track cache completes at once, but
+  // fails for track 2.
+  std::string memory(0x2000, '\0');
+  std::string last_command;
+  int num_cache_reads = 0;
+  int num_memory_reads = 0;
+  EXPECT_CALL(conn, WriteToChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 const std::string &data, IECStatus *status) {
+        last_command = data;
+        if (data.substr(0, 3) == "M-W") {
+          size_t address = static_cast<unsigned char>(data[3]) |
+                           static_cast<unsigned char>(data[4]) << 8;
+          memory.replace(address, data.size() - 6, data.substr(6));
+          if (address == 0x0002 && memory[2] == '\xaa') {
+            ++num_cache_reads;
+            unsigned int track = memory[0x0b];
+            unsigned int first_sector = memory[0x0c] / 20 * 20;
+            for (unsigned int i = 0; i < 20; ++i) {
+              memory.replace(0x0c00 + i * 256, 256,
+                             sector_content((track - 1) * 40 + first_sector +
+                                            i));
+            }
+            memory[2] = track == 2 ? 0x05 : 0x00;
+          }
+        } else if (data.substr(0, 3) == "M-R") {
+          ++num_memory_reads;
+        }
+        return true;
+      }));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillRepeatedly(Invoke([&](char device_number, char channel,
+                                 std::string *result, IECStatus *status) {
+        if (last_command.substr(0, 3) == "M-R") {
+          size_t address = static_cast<unsigned char>(last_command[3]) |
+                           static_cast<unsigned char>(last_command[4]) << 8;
+          *result = memory.substr(address,
+                                  static_cast<unsigned char>(last_command[5]));
+        } else {
+          *result = "00, OK,00,00\r";
+        }
+        return true;
+      }));
+  // The DOS reads the sectors of track 2 on its own.
+  EXPECT_CALL(conn, OpenChannel(8, 2, StrEq("#"), &status))
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 2, _, &status))
+      .WillOnce(DoAll(SetArgPointee<2>(sector_content(41)), Return(true)));
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).WillOnce(Return(true));
+
+  std::map<size_t, std::string> contents;
+  EXPECT_TRUE(
+      drive.ReadSectorList({0, 1, 2, 19, 20, 39, 41}, &contents, &status))
+      << status.message;
+  EXPECT_EQ(7, contents.size());
+  for (const auto &entry : contents) {
+    EXPECT_EQ(sector_content(entry.first), entry.second) << entry.first;
+  }
+  // One job per half track, checked with one M-R each. Sectors 0 to 2 take
+  // 4 M-R commands, 19, 20 and 39 two each.
+  EXPECT_EQ(3, num_cache_reads);
+  EXPECT_EQ(3 + 4 + 3 * 2, num_memory_reads);
+}
@@ -0,0 +1,248 @@
+// DriveInterface implementation on top of a physical CBM disk drive, using
+// DOS commands only.
+
+#include "cbm_dos_drive.h"
+
+#include <algorithm>
+
+#include "boost/format.hpp"
+
+// Logical OK response.
+static const char kOKResponse[] = "00, OK,00,00\r";
+
+// The channel we use for transferring sector content.
+static const int kDirectAccessChannel = 2;
+
+// Maximum number of bytes we transfer with a single M-W or M-R command.
+static const size_t kMaxMWSize = 35;
+static const size_t kMaxMRSize = 255;
+
+// Number of times we check for completion of a job before giving up.
+static const int kMaxJobPolls = 1000;
+
+// Name and id used when formatting a disc.
+static const char kFormatCommand[] = "N0:DISCCOPY,AE";
+
+CBMDOSDrive::CBMDOSDrive(IECBusConnection *bus_conn, char device_number)
+    : bus_conn_(bus_conn), device_number_(device_number),
+      drive_initialized_(false), da_chan_(-1) {}
+
+CBMDOSDrive::~CBMDOSDrive() {
+  // Ignore the result of this operation, there's nothing we can do about it.
+  if (da_chan_ != -1) {
+    IECStatus status;
+    bus_conn_->CloseChannel(device_number_, da_chan_, &status);
+    da_chan_ = -1;
+  }
+}
+
+bool CBMDOSDrive::FormatDiscLowLevel(size_t num_tracks, IECStatus *status) {
+  if (!PrepareDrive(status))
+    return false;
+  // Formatting needs the drive's buffers, so don't hold on to ours.
+  if (!ReleaseDirectAccessChannel(status))
+    return false;
+  return SendCommand(kFormatCommand, status);
+}
+
+bool CBMDOSDrive::ReadSector(size_t sector_number, std::string *content,
+                             IECStatus *status) {
+  unsigned int track = 1;
+  unsigned int sector = 0;
+  if (!GetTrackSectorChecked(sector_number, &track, &sector, status))
+    return false;
+  if (!InitDirectAccessChannel(status))
+    return false;
+
+  // U1 reads the full block into the channel's buffer and resets the buffer
+  // pointer to its beginning.
+  if (!SendCommand(
+          (boost::format("U1:%u 0 %u %u") % da_chan_ % track % sector).str(),
+          status)) {
+    return false;
+  }
+  return bus_conn_->ReadFromChannel(device_number_, da_chan_, content, status);
+}
+
+bool CBMDOSDrive::WriteSector(size_t sector_number, const std::string &content,
+                              IECStatus *status) {
+  if (content.size() != kNumBytesPerSector) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("content.size(%u) != kNumBytesPerSector(%u)") %
+              content.size() % kNumBytesPerSector)
+                 .str(),
+             status);
+    return false;
+  }
+  unsigned int track = 1;
+  unsigned int sector = 0;
+  if (!GetTrackSectorChecked(sector_number, &track, &sector, status))
+    return false;
+  if (!InitDirectAccessChannel(status))
+    return false;
+
+  // Fill the buffer from its beginning, then write it to disc.
+  auto cmd = boost::format("B-P:%u 0") % da_chan_;
+  if (!bus_conn_->WriteToChannel(device_number_, 15, cmd.str(), status)) {
+    return false;
+  }
+  if (!bus_conn_->WriteToChannel(device_number_, da_chan_, content, status)) {
+    return false;
+  }
+  return SendCommand(
+      (boost::format("U2:%u 0 %u %u") % da_chan_ % track % sector).str(),
+      status);
+}
+
+bool CBMDOSDrive::ReadCommandChannel(std::string *response,
+                                     IECStatus *status) {
+  // Accessing the command channel is always ok, no open call necessary.
+  return bus_conn_->ReadFromChannel(device_number_, 15, response, status);
+}
+
+bool CBMDOSDrive::SendCommand(const std::string &command, IECStatus *status) {
+  if (!bus_conn_->WriteToChannel(device_number_, 15, command, status)) {
+    return false;
+  }
+  std::string response;
+  if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+    return false;
+  }
+  if (response != kOKResponse) {
+    SetError(IECStatus::DRIVE_ERROR, response, status);
+    return false;
+  }
+  return true;
+}
+
+bool CBMDOSDrive::ReleaseDirectAccessChannel(IECStatus *status) {
+  if (da_chan_ != -1) {
+    if (!bus_conn_->CloseChannel(device_number_, da_chan_, status))
+      return false;
+    da_chan_ = -1;
+  }
+  return true;
+}
+
+bool CBMDOSDrive::ReadMemory(unsigned short int source_address,
+                             size_t num_bytes, std::string *content,
+                             IECStatus *status) {
+  content->clear();
+  // The drive only holds the response to the last command, so each chunk
+  // needs to be read before requesting the next one.
+  for (size_t offset = 0; offset < num_bytes; offset += kMaxMRSize) {
+    size_t chunk_size = std::min(kMaxMRSize, num_bytes - offset);
+    unsigned short int mem_pos = source_address + offset;
+    std::string request = "M-R";
+    request.append(1, mem_pos & 0xff);
+    request.append(1, mem_pos >> 8);
+    request.append(1, chunk_size);
+    if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+      return false;
+    }
+    std::string chunk;
+    if (!bus_conn_->ReadFromChannel(device_number_, 15, &chunk, status)) {
+      return false;
+    }
+    if (chunk.size() != chunk_size) {
+      SetError(IECStatus::DRIVE_ERROR,
+               (boost::format("M-R returned %u bytes, expected %u") %
+                chunk.size() % chunk_size)
+                   .str(),
+               status);
+      return false;
+    }
+    content->append(chunk);
+  }
+  return true;
+}
+
+bool CBMDOSDrive::WriteMemory(unsigned short int target_address,
+                              size_t num_bytes, const unsigned char *source,
+                              IECStatus *status) {
+  for (size_t offset = 0; offset < num_bytes; offset += kMaxMWSize) {
+    size_t chunk_size = std::min(kMaxMWSize, num_bytes - offset);
+    unsigned short int mem_pos = target_address + offset;
+    std::string request = "M-W";
+    request.append(1, mem_pos & 0xff);
+    request.append(1, mem_pos >> 8);
+    request.append(1, chunk_size);
+    request.append(reinterpret_cast<const char *>(source + offset),
+                   chunk_size);
+    if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+      return false;
+    }
+  }
+
+  // M-W only fails for invalid requests, so a single status check at the end
+  // suffices.
+  std::string response;
+  if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+    return false;
+  }
+  if (response != kOKResponse) {
+    SetError(IECStatus::DRIVE_ERROR, response, status);
+    return false;
+  }
+  return true;
+}
+
+bool CBMDOSDrive::RunJobs(unsigned short int job_code_address,
+                          const std::vector<unsigned char> &job_codes,
+                          std::string *results, IECStatus *status) {
+  if (!WriteMemory(job_code_address, job_codes.size(), &job_codes[0],
+                   status)) {
+    return false;
+  }
+  // The drive clears the top bit of each job code once the job is done.
+  for (int poll = 0; poll < kMaxJobPolls; ++poll) {
+    if (!ReadMemory(job_code_address, job_codes.size(), results, status))
+      return false;
+    bool done = true;
+    for (char result_code : *results) {
+      if (result_code & 0x80)
+        done = false;
+    }
+    if (done)
+      return true;
+  }
+  SetError(IECStatus::DRIVE_ERROR, "timeout waiting for drive jobs", status);
+  return false;
+}
+
+bool CBMDOSDrive::PrepareDrive(IECStatus *status) {
+  if (!drive_initialized_) {
+    if (!InitDrive(status))
+      return false;
+    drive_initialized_ = true;
+  }
+  return true;
+}
+
+bool CBMDOSDrive::InitDirectAccessChannel(IECStatus *status) {
+  if (!PrepareDrive(status))
+    return false;
+  if (da_chan_ == -1) {
+    // Let the drive choose a buffer, we don't care which one we get.
+    if (!bus_conn_->OpenChannel(device_number_, kDirectAccessChannel, "#",
+                                status)) {
+      return false;
+    }
+    da_chan_ = kDirectAccessChannel;
+  }
+  return true;
+}
+
+bool CBMDOSDrive::GetTrackSectorChecked(size_t sector_number,
+                                        unsigned int *track,
+                                        unsigned int *sector,
+                                        IECStatus *status) {
+  if (!GetDOSTrackSector(sector_number, track, sector)) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("sector %u is out of range") % sector_number)
+                 .str(),
+             status);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,95 @@
+// DriveInterface implementation on top of a physical CBM disk drive which is
+// accessed exclusively through the commands of its DOS. Unlike CBM1541Drive,
+// this doesn't depend on any of the drive's ROM routines, which makes it
+// suitable for drive models whose ROM differs from the 1541's.
+
+#ifndef CBM_DOS_DRIVE_H
+#define CBM_DOS_DRIVE_H
+
+#include <string>
+#include <vector>
+
+#include "drive_interface.h"
+#include "iec_host_lib.h"
+
+class CBMDOSDrive : public DriveInterface {
+public:
+  // Instantiate a drive using the specified connection object and
+  // device_number. Ownership of the object pointed to by bus_conn is not
+  // transferred. The object must stay alive during the lifetime of this
+  // drive instance.
+  CBMDOSDrive(IECBusConnection *bus_conn, char device_number);
+
+  ~CBMDOSDrive();
+
+  // Formats the disc using the DOS's new command, which formats all tracks
+  // the drive supports in its current mode and writes an empty BAM and
+  // directory. num_tracks is ignored.
+  bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override;
+  bool ReadSector(size_t sector_number, std::string *content,
+                  IECStatus *status) override;
+  bool WriteSector(size_t sector_number, const std::string &content,
+                   IECStatus *status) override;
+  bool ReadCommandChannel(std::string *response, IECStatus *status) override;
+
+protected:
+  // Translate sector_number into the track and sector the drive's DOS uses
+  // to address it. Returns false if sector_number is out of range.
+  virtual bool GetDOSTrackSector(size_t sector_number, unsigned int *track,
+                                 unsigned int *sector) = 0;
+
+  // Called once before the drive is accessed for the first time. Allows
+  // subclasses to switch the drive to the mode they expect. Returns true if
+  // successful, sets status otherwise.
+  virtual bool InitDrive(IECStatus *status) { return true; }
+
+  // Send command to the command channel and check that the drive reports
+  // success. Returns true if successful, sets status otherwise.
+  bool SendCommand(const std::string &command, IECStatus *status);
+
+  // Run InitDrive() unless it succeeded before.
+  bool PrepareDrive(IECStatus *status);
+
+  // Close the direct access channel, which frees its buffer for other uses.
+  // It is reopened on the next sector access. Returns true if successful,
+  // sets status otherwise.
+  bool ReleaseDirectAccessChannel(IECStatus *status);
+
+  // Read num_bytes of drive memory starting at source_address into *content,
+  // using as few M-R commands as possible. Returns true if successful, sets
+  // status otherwise.
+  bool ReadMemory(unsigned short int source_address, size_t num_bytes,
+                  std::string *content, IECStatus *status);
+
+  // Write num_bytes of the content pointed to by source to target_address
+  // on the drive, checking the drive status once all of them are written.
+  // Returns true if successful, sets status otherwise.
+  bool WriteMemory(unsigned short int target_address, size_t num_bytes,
+                   const unsigned char *source, IECStatus *status);
+
+  // Store job_codes at job_code_address, which starts the corresponding
+  // jobs of the drive's job queue, and wait until all of them are done. The
+  // track and sector of each job must have been set up. Sets *results to
+  // the result code of each job. Returns true if successful (failed jobs
+  // don't constitute an error), sets status otherwise.
+  bool RunJobs(unsigned short int job_code_address,
+               const std::vector<unsigned char> &job_codes,
+               std::string *results, IECStatus *status);
+
+  IECBusConnection *bus_conn_;
+  char device_number_;
+
+private:
+  // Prepare the drive and open the direct access channel used to transfer
+  // sector content.
+  bool InitDirectAccessChannel(IECStatus *status);
+
+  // Translate sector_number, setting status if it is out of range.
+  bool GetTrackSectorChecked(size_t sector_number, unsigned int *track,
+                             unsigned int *sector, IECStatus *status);
+
+  bool drive_initialized_;
+  int da_chan_;
+};
+
+#endif // CBM_DOS_DRIVE_H
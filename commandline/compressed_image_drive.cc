@@ -0,0 +1,290 @@
+// DriveInterface implementation on compressed disc images.
+
+#include "compressed_image_drive.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <boost/iostreams/copy.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+
+#include "boost/format.hpp"
+#include "image_drive.h"
+
+namespace io = boost::iostreams;
+
+// Extensions of the compression formats we support.
+static const char kGzipExtension[] = ".gz";
+static const char kZstdExtension[] = ".zst";
+
+// Returns true if path ends in extension, ignoring case.
+static bool HasExtension(const std::string &path, const char *extension) {
+  size_t extension_size = strlen(extension);
+  return path.size() > extension_size &&
+         strcasecmp(path.c_str() + path.size() - extension_size, extension) ==
+             0;
+}
+
+bool CompressedImageDrive::IsCompressedImagePath(
+    const std::string &image_path) {
+  return HasExtension(image_path, kGzipExtension) ||
+         HasExtension(image_path, kZstdExtension);
+}
+
+CompressedImageDrive::CompressedImageDrive(const std::string &image_path,
+                                           bool read_only)
+    : image_path_(image_path), read_only_(read_only),
+      compression_(HasExtension(image_path, kZstdExtension) ? ZSTD : GZIP) {}
+
+CompressedImageDrive::~CompressedImageDrive() { DiscardStream(); }
+
+bool CompressedImageDrive::FormatDiscLowLevel(size_t num_tracks,
+                                              IECStatus *status) {
+  SetError(IECStatus::UNIMPLEMENTED,
+           "CompressedImageDrive::FormatDiscLowLevel", status);
+  return false;
+}
+
+bool CompressedImageDrive::GetNumSectors(size_t *num_sectors,
+                                         IECStatus *status) {
+  if (!read_only_) {
+    *num_sectors = num_written_sectors_;
+    return true;
+  }
+  if (!LoadImage(status))
+    return false;
+
+  // Strip the compression extension to find the image format's.
+  std::string uncompressed_path =
+      image_path_.substr(0, image_path_.find_last_of('.'));
+  const ImageGeometry *geometry =
+      FindImageGeometryByExtension(uncompressed_path);
+  if (!geometry)
+    geometry = FindImageGeometryBySize(image_.size());
+  return GetImageNumSectors(geometry ? *geometry : kD64Geometry,
+                            image_.size(), num_sectors, status);
+}
+
+bool CompressedImageDrive::ReadSector(size_t sector_number,
+                                      std::string *content,
+                                      IECStatus *status) {
+  if (!read_only_) {
+    SetError(IECStatus::UNIMPLEMENTED,
+             "ReadSector: compressed images can't be read while written",
+             status);
+    return false;
+  }
+  if (!LoadImage(status))
+    return false;
+  if ((sector_number + 1) * kNumBytesPerSector > image_.size()) {
+    SetError(IECStatus::DRIVE_ERROR,
+             (boost::format("ReadSector: sector %u is beyond the image end") %
+              sector_number)
+                 .str(),
+             status);
+    return false;
+  }
+  content->assign(image_, sector_number * kNumBytesPerSector,
+                  kNumBytesPerSector);
+  return true;
+}
+
+bool CompressedImageDrive::WriteSector(size_t sector_number,
+                                       const std::string &content,
+                                       IECStatus *status) {
+  if (content.size() != kNumBytesPerSector) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("content.size(%u) != kNumBytesPerSector(%u)") %
+              content.size() % kNumBytesPerSector)
+                 .str(),
+             status);
+    return false;
+  }
+  if (read_only_) {
+    SetError(IECStatus::DRIVE_ERROR, "WriteSector: image is read-only",
+             status);
+    return false;
+  }
+  if (error_map_written_ || sector_number < num_written_sectors_) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("WriteSector: sector %u written out of order") %
+              sector_number)
+                 .str(),
+             status);
+    return false;
+  }
+  if (!FillSectors(sector_number, status) ||
+      !WriteToStream(content.data(), content.size(), status)) {
+    return false;
+  }
+  ++num_written_sectors_;
+  return true;
+}
+
+bool CompressedImageDrive::WriteErrorMap(
+    const std::vector<unsigned int> &error_numbers, IECStatus *status) {
+  std::string error_map;
+  if (!EncodeErrorMap(error_numbers, &error_map, status))
+    return false;
+  if (read_only_) {
+    SetError(IECStatus::DRIVE_ERROR, "WriteErrorMap: image is read-only",
+             status);
+    return false;
+  }
+  if (error_map_written_ || error_numbers.size() < num_written_sectors_) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("WriteErrorMap: image already holds %u sectors") %
+              num_written_sectors_)
+                 .str(),
+             status);
+    return false;
+  }
+  if (!FillSectors(error_numbers.size(), status) ||
+      !WriteToStream(error_map.data(), error_map.size(), status)) {
+    return false;
+  }
+  error_map_written_ = true;
+  return true;
+}
+
+bool CompressedImageDrive::ReadCommandChannel(std::string *response,
+                                              IECStatus *status) {
+  bool result = read_only_ ? LoadImage(status) : OpenStream(status);
+  if (result) {
+    *response = "Accessing image '" + image_path_ + "'";
+  }
+  return result;
+}
+
+bool CompressedImageDrive::Commit(IECStatus *status) {
+  if (read_only_ || stream_fd_ == -1)
+    return true;
+  try {
+    // Closing the chain completes the compressed stream.
+    static_cast<io::filtering_ostream *>(stream_.get())->reset();
+  } catch (const std::exception &e) {
+    SetError(IECStatus::DRIVE_ERROR, std::string("Commit: ") + e.what(),
+             status);
+    DiscardStream();
+    return false;
+  }
+  stream_.reset();
+  if (fdatasync(stream_fd_) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Commit", status);
+    DiscardStream();
+    return false;
+  }
+  int res = close(stream_fd_);
+  stream_fd_ = -1;
+  std::string partial_path = image_path_ + ImageDrive::kPartialSuffix;
+  if (res != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Commit", status);
+    unlink(partial_path.c_str());
+    return false;
+  }
+  return ReplaceImageFile(partial_path, image_path_, status);
+}
+
+bool CompressedImageDrive::LoadImage(IECStatus *status) {
+  if (image_loaded_)
+    return true;
+
+  int fd = open(image_path_.c_str(), O_RDONLY);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "LoadImage", status);
+    return false;
+  }
+  try {
+    io::filtering_istream stream;
+    if (compression_ == ZSTD) {
+      stream.push(io::zstd_decompressor());
+    } else {
+      stream.push(io::gzip_decompressor());
+    }
+    stream.push(io::file_descriptor_source(fd, io::close_handle));
+    image_.clear();
+    io::copy(stream, io::back_inserter(image_));
+  } catch (const std::exception &e) {
+    SetError(IECStatus::DRIVE_ERROR, std::string("LoadImage: ") + e.what(),
+             status);
+    return false;
+  }
+  image_loaded_ = true;
+  return true;
+}
+
+bool CompressedImageDrive::OpenStream(IECStatus *status) {
+  if (stream_fd_ != -1)
+    return true;
+
+  // Start over if a previous attempt left a partial image behind.
+  stream_fd_ = open((image_path_ + ImageDrive::kPartialSuffix).c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG);
+  if (stream_fd_ == -1) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "OpenStream", status);
+    return false;
+  }
+  auto stream = std::make_unique<io::filtering_ostream>();
+  if (compression_ == ZSTD) {
+    stream->push(io::zstd_compressor());
+  } else {
+    stream->push(io::gzip_compressor());
+  }
+  stream->push(io::file_descriptor_sink(stream_fd_, io::never_close_handle));
+  stream_ = std::move(stream);
+  return true;
+}
+
+bool CompressedImageDrive::WriteToStream(const char *data, size_t size,
+                                         IECStatus *status) {
+  if (!OpenStream(status))
+    return false;
+  try {
+    stream_->write(data, size);
+  } catch (const std::exception &e) {
+    SetError(IECStatus::DRIVE_ERROR,
+             std::string("WriteToStream: ") + e.what(), status);
+    return false;
+  }
+  if (!stream_->good()) {
+    SetError(IECStatus::DRIVE_ERROR, "WriteToStream: write failed", status);
+    return false;
+  }
+  return true;
+}
+
+bool CompressedImageDrive::FillSectors(size_t num_sectors, IECStatus *status) {
+  const std::string empty_sector(kNumBytesPerSector, '\0');
+  while (num_written_sectors_ < num_sectors) {
+    if (!WriteToStream(empty_sector.data(), empty_sector.size(), status))
+      return false;
+    ++num_written_sectors_;
+  }
+  return true;
+}
+
+void CompressedImageDrive::DiscardStream() {
+  if (stream_fd_ == -1)
+    return;
+  // Ignore failures, we're throwing away the result anyway.
+  try {
+    stream_.reset();
+  } catch (const std::exception &) {
+  }
+  if (close(stream_fd_) != 0) {
+    std::cerr << "CompressedImageDrive: close() failed: " << strerror(errno)
+              << std::endl;
+  }
+  stream_fd_ = -1;
+  unlink((image_path_ + ImageDrive::kPartialSuffix).c_str());
+}
@@ -0,0 +1,91 @@
+// DriveInterface implementation on compressed disc images, such as
+// .d64.gz or .d71.zst. Images are decompressed into memory when they're read
+// and compressed while they're written, which requires writing their sectors
+// in order.
+
+#ifndef COMPRESSED_IMAGE_DRIVE_H
+#define COMPRESSED_IMAGE_DRIVE_H
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "drive_interface.h"
+
+class CompressedImageDrive : public DriveInterface {
+public:
+  // Returns true if image_path names an image in a compression format we
+  // support, based on its extension.
+  static bool IsCompressedImagePath(const std::string &image_path);
+
+  // Instantiate a drive on the compressed image at image_path. If read_only
+  // is true, the image is expected to exist and attempts to write to it will
+  // fail. Otherwise, the image is written from scratch and can't be read.
+  // Like ImageDrive, a writable drive writes to a separate file, which
+  // replaces the image once Commit() is called.
+  CompressedImageDrive(const std::string &image_path, bool read_only);
+
+  // Changes which haven't been committed are discarded.
+  ~CompressedImageDrive();
+
+  bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override;
+  // For writable images, returns the number of sectors written so far.
+  bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
+  bool ReadSector(size_t sector_number, std::string *content,
+                  IECStatus *status) override;
+  // Sectors must be written in ascending order. Sectors skipped are zero
+  // filled.
+  bool WriteSector(size_t sector_number, const std::string &content,
+                   IECStatus *status) override;
+  // Appends the error map to the image, which ends it. Any sectors up to
+  // error_numbers.size() which weren't written are zero filled.
+  bool WriteErrorMap(const std::vector<unsigned int> &error_numbers,
+                     IECStatus *status) override;
+  bool ReadCommandChannel(std::string *response, IECStatus *status) override;
+
+  // Complete the compressed stream and replace the image with it.
+  bool Commit(IECStatus *status) override;
+
+private:
+  enum Compression {
+    GZIP,
+    ZSTD,
+  };
+
+  // Decompress the image into image_ unless that happened before.
+  bool LoadImage(IECStatus *status);
+
+  // Open the file the compressed image is written to, unless it is open.
+  bool OpenStream(IECStatus *status);
+
+  // Compress size bytes at data into the stream.
+  bool WriteToStream(const char *data, size_t size, IECStatus *status);
+
+  // Write zero filled sectors until num_sectors sectors have been written.
+  bool FillSectors(size_t num_sectors, IECStatus *status);
+
+  // Close the stream and remove what has been written, if anything.
+  void DiscardStream();
+
+  std::string image_path_;
+  bool read_only_;
+  Compression compression_;
+
+  // The decompressed image, once loaded.
+  bool image_loaded_ = false;
+  std::string image_;
+
+  // The stream compressing written sectors into the file at stream_fd_, if
+  // opened.
+  int stream_fd_ = -1;
+  std::unique_ptr<std::ostream> stream_;
+
+  // Number of sectors written so far.
+  size_t num_written_sectors_ = 0;
+
+  // True once the error map, which ends the image, has been written.
+  bool error_map_written_ = false;
+};
+
+#endif // COMPRESSED_IMAGE_DRIVE_H
@@ -0,0 +1,128 @@
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compressed_image_drive.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test_disc.h"
+
+class CompressedImageDriveTest : public TestDiscTest {
+protected:
+  // Returns the content of sector s used by the tests.
+  static std::string GetTestSector(size_t s) {
+    return GetFilledSector(char(s));
+  }
+
+  // Write a 35 track image with the test content to image_path, leaving
+  // sector 100 out.
+  void WriteTestImage(const std::string &image_path) {
+    CompressedImageDrive drive(image_path, /*read_only=*/false);
+    WriteTestDisc(&drive, GetTestSector, {100});
+    IECStatus status;
+    // Sectors can't be written out of order.
+    EXPECT_FALSE(drive.WriteSector(5, GetTestSector(5), &status));
+    EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+    status.Clear();
+
+    // Written content can't be read back before it is committed.
+    std::vector<size_t> mismatches;
+    EXPECT_FALSE(drive.VerifySectors(99, {Crc16(GetTestSector(99))},
+                                     &mismatches, &status));
+    EXPECT_EQ(status.status_code, IECStatus::UNIMPLEMENTED);
+    status.Clear();
+
+    // Nothing shows up before the image is complete.
+    EXPECT_FALSE(boost::filesystem::exists(image_path));
+    EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  }
+
+  // Read back the image written by WriteTestImage.
+  void CheckTestImage(const std::string &image_path) {
+    CompressedImageDrive drive(image_path, /*read_only=*/true);
+    IECStatus status;
+    size_t num_sectors = 0;
+    EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+    EXPECT_EQ(num_sectors, 683);
+    for (size_t s = 0; s < num_sectors; ++s) {
+      std::string content;
+      EXPECT_TRUE(drive.ReadSector(s, &content, &status)) << status.message;
+      EXPECT_EQ(content, s == 100 ? GetTestSector(0) : GetTestSector(s)) << s;
+    }
+  }
+};
+
+TEST_F(CompressedImageDriveTest, GzipTest) {
+  std::string image_path = (directory_ / "disc.d64.gz").string();
+  WriteTestImage(image_path);
+  CheckTestImage(image_path);
+
+  // The image is compressed, and much smaller than the 174848 bytes it
+  // holds.
+  EXPECT_LT(boost::filesystem::file_size(image_path), 10000u);
+  int fd = open(image_path.c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+  unsigned char magic[2] = {0, 0};
+  EXPECT_EQ(read(fd, magic, sizeof(magic)), 2);
+  EXPECT_EQ(close(fd), 0);
+  EXPECT_EQ(magic[0], 0x1f);
+  EXPECT_EQ(magic[1], 0x8b);
+}
+
+TEST_F(CompressedImageDriveTest, ZstdTest) {
+  std::string image_path = (directory_ / "disc.d64.zst").string();
+  WriteTestImage(image_path);
+  CheckTestImage(image_path);
+  EXPECT_LT(boost::filesystem::file_size(image_path), 10000u);
+}
+
+TEST_F(CompressedImageDriveTest, ErrorMapTest) {
+  std::string image_path = (directory_ / "disc.gz").string();
+  {
+    CompressedImageDrive drive(image_path, /*read_only=*/false);
+    IECStatus status;
+    EXPECT_TRUE(drive.WriteSector(0, GetTestSector(1), &status))
+        << status.message;
+    std::vector<unsigned int> error_numbers(683, 0);
+    error_numbers[3] = 23;
+    EXPECT_TRUE(drive.WriteErrorMap(error_numbers, &status)) << status.message;
+    // The error map ends the image.
+    EXPECT_FALSE(drive.WriteSector(683, GetTestSector(1), &status));
+    status.Clear();
+    EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  }
+
+  CompressedImageDrive drive(image_path, /*read_only=*/true);
+  IECStatus status;
+  size_t num_sectors = 0;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 683);
+  std::string content;
+  EXPECT_TRUE(drive.ReadSector(682, &content, &status)) << status.message;
+  EXPECT_EQ(content, GetTestSector(0));
+}
+
+TEST_F(CompressedImageDriveTest, UncommittedTest) {
+  std::string image_path = (directory_ / "disc.d64.gz").string();
+  {
+    CompressedImageDrive drive(image_path, /*read_only=*/false);
+    IECStatus status;
+    EXPECT_TRUE(drive.WriteSector(0, GetTestSector(1), &status))
+        << status.message;
+  }
+  EXPECT_TRUE(boost::filesystem::is_empty(directory_));
+
+  // Corrupt images fail to load.
+  int fd = open(image_path.c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+  ASSERT_NE(fd, -1);
+  EXPECT_EQ(write(fd, "garbage", 7), 7);
+  EXPECT_EQ(close(fd), 0);
+  CompressedImageDrive drive(image_path, /*read_only=*/true);
+  IECStatus status;
+  size_t num_sectors = 0;
+  EXPECT_FALSE(drive.GetNumSectors(&num_sectors, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+}
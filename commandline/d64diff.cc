@@ -0,0 +1,238 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "boost/program_options/cmdline.hpp"
+#include "boost/program_options/options_description.hpp"
+#include "boost/program_options/parsers.hpp"
+#include "boost/program_options/variables_map.hpp"
+#include "cbm1541_drive.h"
+#include "drive_factory.h"
+#include "drive_interface.h"
+#include "iec_host_lib.h"
+#include "sector_patch.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+// Returns true if file_or_id names drives on the IEC bus rather than an
+// image, see CreateDriveObject().
+static bool IsDeviceId(const std::string &file_or_id) {
+  return !file_or_id.empty() &&
+         file_or_id.find_first_not_of("0123456789,") == std::string::npos;
+}
+
+// Create the drive named by file_or_id and report its status. Returns nullptr
+// and prints an error message if the drive can't be accessed.
+static std::unique_ptr<DriveInterface>
+OpenDrive(const std::string &file_or_id, IECBusConnection *connection,
+          bool read_only, IECStatus *status) {
+  std::unique_ptr<DriveInterface> drive =
+      CreateDriveObject(file_or_id, connection, read_only, status);
+  if (!drive) {
+    std::cout << "Failed to access " << file_or_id << ": " << status->message
+              << std::endl;
+    return nullptr;
+  }
+  std::string drive_status;
+  if (!drive->ReadCommandChannel(&drive_status, status)) {
+    std::cout << "Failed to read status of " << file_or_id << ": "
+              << status->message << std::endl;
+    return nullptr;
+  }
+  std::cout << "Initial status of " << file_or_id << ": " << drive_status
+            << std::endl;
+  return drive;
+}
+
+// Compare old_drive to new_drive and list the sectors which differ. If
+// patch_path isn't empty, write a patch turning the old disc into the new one
+// to patch_path. Returns 0 if the discs match, 1 if they differ and 2 if
+// comparing them fails.
+static int Diff(DriveInterface *old_drive, DriveInterface *new_drive,
+                const std::string &patch_path, IECStatus *status) {
+  // A 1541 calculates sector checksums on its own, which saves transferring
+  // the sectors which match. Anything else is compared byte by byte.
+  bool use_checksums = dynamic_cast<CBM1541Drive *>(old_drive) != nullptr;
+  SectorPatch patch;
+  if (!DiffDrives(old_drive, new_drive, use_checksums, &patch, status)) {
+    std::cout << "DiffDrives: " << status->message << std::endl;
+    return 2;
+  }
+  if (patch.old_num_sectors != patch.new_num_sectors) {
+    std::cout << "Old disc holds " << patch.old_num_sectors
+              << " sectors, new disc " << patch.new_num_sectors << "."
+              << std::endl;
+  }
+  for (const SectorPatch::Entry &entry : patch.entries) {
+    std::cout << "Sector " << entry.sector_number << " differs." << std::endl;
+  }
+  std::cout << patch.entries.size() << " of " << patch.new_num_sectors
+            << " sector(s) differ." << std::endl;
+
+  if (!patch_path.empty()) {
+    std::string encoded;
+    EncodeSectorPatch(patch, &encoded);
+    std::ofstream patch_file(patch_path, std::ios::binary | std::ios::trunc);
+    patch_file << encoded;
+    patch_file.close();
+    if (!patch_file) {
+      std::cout << "Failed to write patch to " << patch_path << std::endl;
+      return 2;
+    }
+    std::cout << "Patch written to " << patch_path << " (" << encoded.size()
+              << " bytes)." << std::endl;
+  }
+  return patch.entries.empty() &&
+                 patch.old_num_sectors == patch.new_num_sectors
+             ? 0
+             : 1;
+}
+
+// Apply the patch at patch_path to target_drive. If verify is true, verify
+// the written sectors afterwards. Returns 0 if successful, 2 otherwise.
+static int Apply(const std::string &patch_path, DriveInterface *target_drive,
+                 bool verify, IECStatus *status) {
+  std::ifstream patch_file(patch_path, std::ios::binary);
+  std::stringstream encoded;
+  encoded << patch_file.rdbuf();
+  if (!patch_file) {
+    std::cout << "Failed to read patch from " << patch_path << std::endl;
+    return 2;
+  }
+  SectorPatch patch;
+  if (!DecodeSectorPatch(encoded.str(), &patch, status)) {
+    std::cout << status->message << std::endl;
+    return 2;
+  }
+  std::cout << "Writing " << patch.entries.size() << " sector(s)..."
+            << std::endl;
+  if (!ApplySectorPatch(patch, target_drive, status)) {
+    std::cout << "ApplySectorPatch: " << status->message << std::endl;
+    return 2;
+  }
+  if (verify) {
+    // Verify consecutive sectors at once, so drives can check them in one go.
+    for (size_t first = 0; first < patch.entries.size();) {
+      size_t end = first;
+      std::vector<unsigned short int> expected;
+      while (end < patch.entries.size() &&
+             patch.entries[end].sector_number ==
+                 patch.entries[first].sector_number + (end - first)) {
+        expected.push_back(Crc16(patch.entries[end].content));
+        ++end;
+      }
+      std::vector<size_t> mismatches;
+      if (!target_drive->VerifySectors(patch.entries[first].sector_number,
+                                       expected, &mismatches, status)) {
+        std::cout << "VerifySectors: " << status->message << std::endl;
+        return 2;
+      }
+      if (!mismatches.empty()) {
+        std::cout << "Verification failed (sector " << mismatches[0] << ")."
+                  << std::endl;
+        return 2;
+      }
+      first = end;
+    }
+  }
+  if (!target_drive->Commit(status)) {
+    std::cout << "Failed to write image: " << status->message << std::endl;
+    return 2;
+  }
+  std::cout << "Patch applied." << std::endl;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  std::cout << "IEC Bus disc diff utility." << std::endl
+            << "Copyright (c) 2020 Andreas Eckleder" << std::endl
+            << std::endl;
+
+  std::string arduino_device;
+  int serial_speed = 0;
+  std::string old_disc;
+  std::string new_disc;
+  std::string patch_path;
+  std::string apply_path;
+  std::string target;
+  bool verify = false;
+
+  po::options_description desc("Options");
+  desc.add_options()("help", "usage overview")(
+      "serial",
+      po::value<std::string>(&arduino_device)->default_value("/dev/ttyUSB0"),
+      "serial interface to use")(
+      "speed", po::value<int>(&serial_speed)->default_value(57600),
+      "baud rate")("old", po::value<std::string>(&old_disc)->default_value(""),
+                   "device (e.g. 8, 9) or image holding the old content")(
+      "new", po::value<std::string>(&new_disc)->default_value(""),
+      "device (e.g. 8, 9) or image holding the new content")(
+      "patch", po::value<std::string>(&patch_path)->default_value(""),
+      "write a patch turning the old disc into the new one to this file")(
+      "apply", po::value<std::string>(&apply_path)->default_value(""),
+      "apply the patch in this file to --target")(
+      "target", po::value<std::string>(&target)->default_value(""),
+      "device (e.g. 8, 9) or image to apply the patch to")(
+      "verify", po::value<bool>(&verify)->default_value(false),
+      "verify the sectors written by --apply");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 2;
+  }
+
+  bool apply = !apply_path.empty();
+  if (apply ? target.empty() : old_disc.empty() || new_disc.empty()) {
+    std::cout << desc << std::endl
+              << "Either --old and --new, or --apply and --target are "
+                 "required."
+              << std::endl;
+    return 2;
+  }
+
+  // Images can be compared and patched without an Arduino attached.
+  IECStatus status;
+  std::unique_ptr<IECBusConnection> connection;
+  if (apply ? IsDeviceId(target)
+            : IsDeviceId(old_disc) || IsDeviceId(new_disc)) {
+    connection.reset(IECBusConnection::Create(
+        arduino_device, serial_speed,
+        [](char level, const std::string &channel,
+           const std::string &message) {
+          std::cout << level << ":" << channel << ": " << message
+                    << std::endl;
+        },
+        &status));
+    if (!connection) {
+      std::cout << status.message << std::endl;
+      return 2;
+    }
+    if (!connection->Reset(&status)) {
+      std::cout << "Reset: " << status.message << std::endl;
+      return 2;
+    }
+  }
+
+  if (apply) {
+    std::unique_ptr<DriveInterface> target_drive =
+        OpenDrive(target, connection.get(), /*read_only=*/false, &status);
+    if (!target_drive)
+      return 2;
+    return Apply(apply_path, target_drive.get(), verify, &status);
+  }
+
+  std::unique_ptr<DriveInterface> old_drive =
+      OpenDrive(old_disc, connection.get(), /*read_only=*/true, &status);
+  if (!old_drive)
+    return 2;
+  std::unique_ptr<DriveInterface> new_drive =
+      OpenDrive(new_disc, connection.get(), /*read_only=*/true, &status);
+  if (!new_drive)
+    return 2;
+  return Diff(old_drive.get(), new_drive.get(), patch_path, &status);
+}
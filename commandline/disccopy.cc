@@ -1,20 +1,34 @@
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <map>
 #include <thread>
+#include <vector>
 
 #include <fcntl.h>
+#include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include "assembly/format_h.h"
+#include "bam.h"
 #include "boost/format.hpp"
 #include "boost/program_options/cmdline.hpp"
 #include "boost/program_options/options_description.hpp"
 #include "boost/program_options/parsers.hpp"
 #include "boost/program_options/variables_map.hpp"
+#include "cbm1541_drive.h"
+#include "cbm1541_drive_group.h"
+#include "cbm1571_drive.h"
+#include "cbm1581_drive.h"
+#include "compressed_image_drive.h"
 #include "drive_factory.h"
 #include "drive_interface.h"
+#include "g64_image.h"
 #include "iec_host_lib.h"
+#include "image_drive.h"
+#include "sector_manifest.h"
+#include "sector_store_drive.h"
 #include "utils.h"
 
 namespace po = boost::program_options;
@@ -32,6 +46,256 @@ static std::string BytesToHex(const std::string &input) {
   return result;
 }
 
+// Number of sectors handed to the target drive per write request. This covers
+// the longest track of a 1541 disc, so drives supporting batched writes get
+// to write up to a full track at once.
+static const size_t kSectorsPerWrite = 21;
+
+// Write contents to target_drive, starting at first_sector. If verify is
+// true, verify all written sectors against checksums of contents and read
+// back those that don't match for diagnostics.
+// Returns true if successful, prints an error message and returns false
+// otherwise.
+static bool WriteSectors(DriveInterface *target_drive, size_t first_sector,
+                         const std::vector<std::string> &contents, bool verify,
+                         IECStatus *status) {
+  if (!target_drive->WriteSectors(first_sector, contents, status)) {
+    std::cout << "WriteSectors: " << status->message << std::endl;
+    return false;
+  }
+  if (!verify)
+    return true;
+
+  std::vector<unsigned short int> expected;
+  for (const std::string &content : contents) {
+    expected.push_back(Crc16(content));
+  }
+  std::vector<size_t> mismatches;
+  if (!target_drive->VerifySectors(first_sector, expected, &mismatches,
+                                   status)) {
+    std::cout << "VerifySectors: " << status->message << std::endl;
+    return false;
+  }
+  for (size_t s : mismatches) {
+    const std::string &original = contents[s - first_sector];
+    std::string verify_content;
+    if (!target_drive->ReadSector(s, &verify_content, status)) {
+      std::cout << "ReadSector: " << status->message << std::endl;
+      return false;
+    }
+    std::cout << "Verification failed (sector " << s << "):" << std::endl;
+    std::cout << "Original sector (" << original.size()
+              << " bytes):" << std::endl;
+    std::cout << BytesToHex(original) << std::endl;
+    std::cout << "Read sector (" << verify_content.size()
+              << " bytes):" << std::endl;
+    std::cout << BytesToHex(verify_content) << std::endl;
+  }
+  return true;
+}
+
+// Returns the drive error number if status reports that a sector couldn't be
+// read due to a media error (errors 20 to 29), zero otherwise.
+static unsigned int GetMediaErrorNumber(const IECStatus &status) {
+  unsigned int error_number = 0;
+  if (status.status_code != IECStatus::DRIVE_ERROR ||
+      sscanf(status.message.c_str(), "%u,", &error_number) != 1) {
+    return 0;
+  }
+  return error_number >= 20 && error_number <= 29 ? error_number : 0;
+}
+
+// Read sector s from source_drive into *content. If reading fails due to a
+// media error, retry up to num_retries times. The first retry simply reads
+// again, the second one bumps the head first, any further ones approach the
+// sector's track from a neighbouring track. If all retries fail, zero-fill
+// *content and set *error_number to the drive's error number, set it to zero
+// otherwise. Returns true if successful, prints an error message and returns
+// false for any other error.
+static bool ReadSectorWithRetries(DriveInterface *source_drive, size_t s,
+                                  int num_retries, std::string *content,
+                                  unsigned int *error_number,
+                                  IECStatus *status) {
+  for (int retry = 0;; ++retry) {
+    if (source_drive->ReadSector(s, content, status)) {
+      *error_number = 0;
+      return true;
+    }
+    *error_number = GetMediaErrorNumber(*status);
+    if (*error_number == 0) {
+      std::cout << "ReadSector: " << status->message << std::endl;
+      return false;
+    }
+    status->Clear();
+    if (retry >= num_retries)
+      break;
+    std::cout << "Sector " << s << ": error " << *error_number
+              << ", retrying." << std::endl;
+    if (retry == 0)
+      continue;
+    DriveInterface::HeadMovement movement =
+        retry == 1 ? DriveInterface::HEAD_BUMP
+                   : DriveInterface::HEAD_NEIGHBOUR_TRACK;
+    if (!source_drive->MoveHead(s, movement, status)) {
+      if (status->status_code != IECStatus::UNIMPLEMENTED) {
+        std::cout << "MoveHead: " << status->message << std::endl;
+        return false;
+      }
+      status->Clear();
+    }
+  }
+  std::cout << "Giving up on sector " << s << " (error " << *error_number
+            << ")." << std::endl;
+  content->assign(DriveInterface::kNumBytesPerSector, '\0');
+  return true;
+}
+
+// Copy the sectors marked in copy_sector from source_drive to target_drive,
+// passing their content from drive to drive directly via IEC bus. Sectors
+// that can't be read are retried via host as described for
+// ReadSectorWithRetries(), with their error number stored in
+// (*error_numbers)[s]. Returns true if successful, prints an error message and
+// returns false otherwise.
+static bool CopyDirectly(CBM1541Drive *source_drive, CBM1541Drive *target_drive,
+                         const std::vector<bool> &copy_sector, int num_retries,
+                         std::vector<unsigned int> *error_numbers,
+                         IECStatus *status) {
+  for (size_t s = 0; s < copy_sector.size(); ++s) {
+    if (!copy_sector[s] ||
+        source_drive->CopySectorTo(s, target_drive, status)) {
+      continue;
+    }
+    if (!GetMediaErrorNumber(*status)) {
+      std::cout << "CopySectorTo: " << status->message << std::endl;
+      return false;
+    }
+    status->Clear();
+    std::string content;
+    if (!ReadSectorWithRetries(source_drive, s, num_retries, &content,
+                               &(*error_numbers)[s], status)) {
+      return false;
+    }
+    if (!target_drive->WriteSector(s, content, status)) {
+      std::cout << "WriteSector: " << status->message << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Set (*copy_sector)[s] to true for each of the num_sectors sectors on
+// source_drive which are allocated according to its BAM. If the BAM can't be
+// read or looks corrupt, prints a message and marks all sectors for copying.
+// Returns true if successful, prints an error message and returns false
+// otherwise.
+static bool GetSectorsToCopy(DriveInterface *source_drive, size_t num_sectors,
+                             std::vector<bool> *copy_sector,
+                             IECStatus *status) {
+  copy_sector->assign(num_sectors, true);
+  // Larger discs, such as those of the 1581, keep their BAM elsewhere.
+  if (num_sectors <= kBAMSectorNumber ||
+      num_sectors > CBM1571Drive::kNumSectorsDoubleSided) {
+    std::cout << "Source doesn't hold a 1541 BAM, copying all sectors."
+              << std::endl;
+    return true;
+  }
+  std::string bam;
+  if (!source_drive->ReadSector(kBAMSectorNumber, &bam, status)) {
+    std::cout << "ReadSector: " << status->message << std::endl;
+    return false;
+  }
+  IECStatus bam_status;
+  if (!GetAllocatedSectors(bam, num_sectors, copy_sector, &bam_status)) {
+    std::cout << "BAM looks corrupt (" << bam_status.message
+              << "), copying all sectors." << std::endl;
+    copy_sector->assign(num_sectors, true);
+    return true;
+  }
+  size_t num_allocated = 0;
+  for (bool allocated : *copy_sector) {
+    num_allocated += allocated ? 1 : 0;
+  }
+  std::cout << "Copying " << num_allocated << " of " << num_sectors
+            << " sectors." << std::endl;
+  return true;
+}
+
+// Returns the track sector s is located on, for a disc of num_sectors sectors.
+static unsigned int GetSectorTrack(size_t num_sectors, size_t s) {
+  unsigned int track = 0;
+  unsigned int sector = 0;
+  if (num_sectors == CBM1571Drive::kNumSectorsDoubleSided) {
+    CBM1571Drive::GetTrackSector(s, &track, &sector);
+  } else if (num_sectors == CBM1581Drive::kNumSectors) {
+    CBM1581Drive::GetTrackSector(s, &track, &sector);
+  } else {
+    CBM1541Drive::GetTrackSector(s, &track, &sector);
+  }
+  return track;
+}
+
+// Number of tracks captured when copying to a G64 image.
+static const unsigned int kNumG64Tracks = 35;
+
+// Returns true if path names a G64 image.
+static bool IsG64Image(const std::string &path) {
+  static const std::string kSuffix = ".g64";
+  return path.size() > kSuffix.size() &&
+         path.compare(path.size() - kSuffix.size(), kSuffix.size(),
+                      kSuffix) == 0;
+}
+
+// Returns gcr as returned by CBM1541Drive::ReadTrackGCR(), with each of its
+// sync marks restored to the length listed in sync_marks.
+static std::string
+RestoreSyncLengths(const std::string &gcr,
+                   const std::vector<CBM1541Drive::GCRSyncMark> &sync_marks) {
+  std::string result;
+  size_t pos = 0;
+  for (const CBM1541Drive::GCRSyncMark &sync_mark : sync_marks) {
+    result.append(gcr, pos, sync_mark.offset - pos);
+    result.append(sync_mark.length, '\xff');
+    pos = sync_mark.offset + CBM1541Drive::kGCRSyncLength;
+  }
+  result.append(gcr, pos, std::string::npos);
+  return result;
+}
+
+// Capture the raw GCR data of each track on source_drive and write it to a
+// G64 image at image_path. Sync marks keep their measured length, unless
+// that makes the track exceed what the image can hold. Returns true if
+// successful, prints an error message and returns false otherwise.
+static bool CopyToG64Image(DriveInterface *source_drive,
+                           const std::string &image_path, IECStatus *status) {
+  CBM1541Drive *cbm1541_drive = dynamic_cast<CBM1541Drive *>(source_drive);
+  if (!cbm1541_drive) {
+    std::cout << "G64 images can only be captured from a 1541 drive."
+              << std::endl;
+    return false;
+  }
+  std::map<unsigned int, std::string> tracks;
+  for (unsigned int track = 1; track <= kNumG64Tracks; ++track) {
+    std::cout << "Capturing track " << track << "..." << std::endl;
+    std::string gcr;
+    std::vector<CBM1541Drive::GCRSyncMark> sync_marks;
+    if (!cbm1541_drive->ReadTrackGCR(track, &gcr, &sync_marks, status)) {
+      std::cout << "ReadTrackGCR: " << status->message << std::endl;
+      return false;
+    }
+    tracks[track] = RestoreSyncLengths(gcr, sync_marks);
+    if (tracks[track].size() > kG64MaxTrackSize) {
+      std::cout << "Normalizing sync marks of track " << track
+                << " to fit the image." << std::endl;
+      tracks[track] = gcr;
+    }
+  }
+  if (!WriteG64Image(image_path, tracks, status)) {
+    std::cout << "WriteG64Image: " << status->message << std::endl;
+    return false;
+  }
+  return true;
+}
+
 int main(int argc, char *argv[]) {
   std::cout << "IEC Bus disc copy utility." << std::endl
             << "Copyright (c) 2020 Andreas Eckleder" << std::endl
@@ -42,7 +306,10 @@ int main(int argc, char *argv[]) {
   bool verify = false;
   std::string source;
   std::string target;
+  std::string manifest_path;
   bool format = false;
+  bool smart = false;
+  int num_retries = 0;
 
   po::options_description desc("Options");
   desc.add_options()("help", "usage overview")(
@@ -55,9 +322,17 @@ int main(int argc, char *argv[]) {
       "source", po::value<std::string>(&source)->default_value(""),
       "device (e.g. 8, 9) or image to copy from")(
       "target", po::value<std::string>(&target)->default_value(""),
-      "device (e.g. 8, 9) or image file to copy to")(
+      "device (e.g. 8, 9), several 1541 devices to write to at once (e.g. "
+      "9,10,11) or image file to copy to")(
       "format", po::value<bool>(&format)->default_value(false),
-      "format disc prior to copying");
+      "format disc prior to copying")(
+      "smart", po::value<bool>(&smart)->default_value(false),
+      "only copy sectors allocated in the BAM")(
+      "retries", po::value<int>(&num_retries)->default_value(3),
+      "number of retries for sectors that can't be read")(
+      "manifest", po::value<std::string>(&manifest_path)->default_value(""),
+      "write a manifest of per-sector, per-track and whole-disc digests to "
+      "this file");
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -112,6 +387,20 @@ int main(int argc, char *argv[]) {
     std::cout << "Initial source status: " << drive_status << std::endl;
   }
 
+  // G64 images hold raw track data, so they're not accessed through a
+  // DriveInterface.
+  if (IsG64Image(target)) {
+    if (!manifest_path.empty()) {
+      std::cout << "G64 images don't hold sectors to write a manifest of."
+                << std::endl;
+      return 2;
+    }
+    if (!CopyToG64Image(source_drive.get(), target, &status))
+      return 1;
+    std::cout << "Copying complete." << std::endl;
+    return 0;
+  }
+
   std::unique_ptr<DriveInterface> target_drive =
       CreateDriveObject(target, connection.get(), /*read_only=*/false, &status);
   if (!target_drive) {
@@ -127,15 +416,15 @@ int main(int argc, char *argv[]) {
     }
     std::cout << "Initial target status: " << drive_status << std::endl;
   }
-
-  if (format) {
-    std::cout << "Formatting disc..." << std::endl;
-    if (!target_drive->FormatDiscLowLevel(40, &status)) {
-      std::cout << "FormatDiscLowLevel: " << status.message << std::endl;
-      return 1;
-    }
-    std::cout << "Formatting complete." << std::endl;
+  if (verify &&
+      dynamic_cast<CompressedImageDrive *>(target_drive.get()) != nullptr) {
+    std::cout << "Compressed images can't be verified while they're written."
+              << std::endl;
+    return 2;
   }
+  // Images are written to a copy, which only replaces the image once the
+  // copy is complete.
+  ImageDrive *target_image = dynamic_cast<ImageDrive *>(target_drive.get());
 
   // Copy the entire disc.
   size_t num_sectors = 0;
@@ -144,37 +433,163 @@ int main(int argc, char *argv[]) {
               << std::endl;
     return 1;
   }
-  for (unsigned int s = 0; s < num_sectors; ++s) {
-    std::string current_sector;
-    if (!source_drive->ReadSector(s, &current_sector, &status)) {
-      std::cout << "ReadSector: " << status.message << std::endl;
+  if (num_sectors == 0) {
+    std::cout << "Source doesn't hold any sectors." << std::endl;
+    return 1;
+  }
+
+  // A 1541 can't write discs with more tracks than it can safely reach, such
+  // as 42 track images. Tell right away rather than failing midway.
+  unsigned int num_tracks = GetSectorTrack(num_sectors, num_sectors - 1);
+  if ((dynamic_cast<CBM1541Drive *>(target_drive.get()) ||
+       dynamic_cast<CBM1541DriveGroup *>(target_drive.get())) &&
+      num_tracks > CBM1541Drive::kMaxTrackNumber) {
+    std::cout << "Source holds " << num_tracks << " tracks, but a 1541 can't "
+              << "write beyond track " << CBM1541Drive::kMaxTrackNumber << "."
+              << std::endl;
+    return 1;
+  }
+
+  // Prefer having the target drive format each track as we go, which saves a
+  // separate pass over the disc. Smart copies may skip entire tracks, which
+  // need to be formatted nonetheless.
+  bool format_on_write =
+      format && !smart && target_drive->SetFormatOnWrite(true);
+  if (format && !format_on_write) {
+    // Format as many tracks as the source holds.
+    std::cout << "Formatting disc (" << num_tracks << " tracks)..."
+              << std::endl;
+    if (!target_drive->FormatDiscLowLevel(num_tracks, &status)) {
+      std::cout << "FormatDiscLowLevel: " << status.message << std::endl;
       return 1;
     }
+    std::cout << "Formatting complete." << std::endl;
+  }
+  // Prefer having the target drive verify what it writes, which saves
+  // transferring anything for verification.
+  bool verify_on_drive = verify && target_drive->SetWriteVerification(true);
+
+  std::vector<bool> copy_sector(num_sectors, true);
+  if (smart &&
+      !GetSectorsToCopy(source_drive.get(), num_sectors, &copy_sector,
+                        &status)) {
+    return 1;
+  }
+  // Images need to hold every sector, so we fill the ones we don't copy.
+  // Drives keep whatever they hold.
+  bool fill_skipped =
+      target_image != nullptr ||
+      dynamic_cast<CompressedImageDrive *>(target_drive.get()) != nullptr ||
+      dynamic_cast<SectorStoreDrive *>(target_drive.get()) != nullptr;
+
+  // Drive error number for each sector that couldn't be read, zero otherwise.
+  std::vector<unsigned int> error_numbers(num_sectors, 0);
+
+  // Sectors are hashed as they pass through, which takes a fraction of the
+  // time of reading them.
+  std::unique_ptr<SectorManifest> manifest;
+  if (!manifest_path.empty()) {
+    std::vector<unsigned int> sector_tracks;
+    for (size_t s = 0; s < num_sectors; ++s) {
+      sector_tracks.push_back(GetSectorTrack(num_sectors, s));
+    }
+    manifest = std::make_unique<SectorManifest>(sector_tracks);
+  }
 
-    if (!target_drive->WriteSector(s, current_sector, &status)) {
-      std::cout << "WriteSector: " << status.message << std::endl;
+  // Drives sharing our bus can pass sector content to each other directly,
+  // which takes the serial line out of the loop. The host can't verify or
+  // hash what it never sees, so this needs the target to verify on its own
+  // and no manifest to be requested.
+  CBM1541Drive *source_cbm1541 =
+      dynamic_cast<CBM1541Drive *>(source_drive.get());
+  CBM1541Drive *target_cbm1541 =
+      dynamic_cast<CBM1541Drive *>(target_drive.get());
+  if (source_cbm1541 && target_cbm1541 && connection->SupportsDirectCopy() &&
+      (!verify || verify_on_drive) && !manifest) {
+    std::cout << "Copying directly from drive to drive." << std::endl;
+    if (!CopyDirectly(source_cbm1541, target_cbm1541, copy_sector, num_retries,
+                      &error_numbers, &status)) {
       return 1;
     }
+  } else {
+    std::vector<std::string> pending_sectors;
+    size_t first_pending_sector = 0;
+    std::map<size_t, std::string> prefetched_sectors;
+    for (unsigned int s = 0; s < num_sectors; ++s) {
+      if (s % kSectorsPerWrite == 0) {
+        // Read all the sectors we need up to the next write in one request, so
+        // the source can order them as it sees fit.
+        std::vector<size_t> sector_numbers;
+        for (size_t n = s; n < std::min(num_sectors, s + kSectorsPerWrite);
+             ++n) {
+          if (copy_sector[n])
+            sector_numbers.push_back(n);
+        }
+        if (!source_drive->ReadSectorList(sector_numbers, &prefetched_sectors,
+                                          &status)) {
+          if (!GetMediaErrorNumber(status)) {
+            std::cout << "ReadSectorList: " << status.message << std::endl;
+            return 1;
+          }
+          // Read the sectors one by one, retrying those that fail.
+          status.Clear();
+          prefetched_sectors.clear();
+        }
+      }
 
-    if (verify) {
-      std::string verify_content;
-      if (!target_drive->ReadSector(s, &verify_content, &status)) {
-        std::cout << "ReadSector: " << status.message << std::endl;
+      std::string current_sector;
+      if (!copy_sector[s] && !fill_skipped) {
+        // Write what we have so far, continuing after this sector.
+        if (!pending_sectors.empty() &&
+            !WriteSectors(target_drive.get(), first_pending_sector,
+                          pending_sectors, verify && !verify_on_drive,
+                          &status)) {
+          return 1;
+        }
+        first_pending_sector = s + 1;
+        pending_sectors.clear();
+        continue;
+      } else if (!copy_sector[s]) {
+        current_sector.assign(DriveInterface::kNumBytesPerSector, '\0');
+      } else if (prefetched_sectors.count(s)) {
+        current_sector = prefetched_sectors[s];
+      } else if (!ReadSectorWithRetries(source_drive.get(), s, num_retries,
+                                        &current_sector, &error_numbers[s],
+                                        &status)) {
         return 1;
       }
 
-      if (current_sector != verify_content) {
-        std::cout << "Verification failed (sector " << s << "):" << std::endl;
-        std::cout << "Original sector (" << current_sector.size()
-                  << " bytes):" << std::endl;
-        std::cout << BytesToHex(current_sector) << std::endl;
-        std::cout << "Read sector (" << verify_content.size()
-                  << " bytes):" << std::endl;
-        std::cout << BytesToHex(verify_content) << std::endl;
+      if (manifest)
+        manifest->AddSector(s, current_sector, error_numbers[s]);
+      pending_sectors.push_back(current_sector);
+      if (pending_sectors.size() == kSectorsPerWrite || s + 1 == num_sectors) {
+        if (!WriteSectors(target_drive.get(), first_pending_sector,
+                          pending_sectors, verify && !verify_on_drive,
+                          &status)) {
+          return 1;
+        }
+        first_pending_sector = s + 1;
+        pending_sectors.clear();
       }
     }
   }
 
+  size_t num_errors = num_sectors - std::count(error_numbers.begin(),
+                                               error_numbers.end(), 0u);
+  if (num_errors > 0)
+    std::cout << num_errors << " sector(s) couldn't be read." << std::endl;
+  // Write the error map even if there are no errors, which drops any error
+  // map the target held from an earlier copy.
+  if (!target_drive->WriteErrorMap(error_numbers, &status)) {
+    if (status.status_code != IECStatus::UNIMPLEMENTED) {
+      std::cout << "WriteErrorMap: " << status.message << std::endl;
+      return 1;
+    }
+    if (num_errors > 0)
+      std::cout << "Target can't hold an error map." << std::endl;
+    status.Clear();
+  }
+
   // Get the final result.
   std::string drive_status;
   if (!target_drive->ReadCommandChannel(&drive_status, &status)) {
@@ -182,5 +597,30 @@ int main(int argc, char *argv[]) {
     return 1;
   }
   std::cout << "Copying status: " << drive_status << std::endl;
+
+  if (!target_drive->Commit(&status)) {
+    std::cout << "Failed to write image: " << status.message << std::endl;
+    return 1;
+  }
+  if (manifest && !manifest->Write(manifest_path, &status)) {
+    std::cout << "Failed to write manifest: " << status.message << std::endl;
+    return 1;
+  }
+
+  // Drives written to at once carry on without those that fail.
+  CBM1541DriveGroup *group =
+      dynamic_cast<CBM1541DriveGroup *>(target_drive.get());
+  if (group) {
+    size_t num_failed = 0;
+    for (const IECStatus &result : group->results()) {
+      if (!result.ok())
+        ++num_failed;
+    }
+    if (num_failed > 0) {
+      std::cout << num_failed << " of " << group->results().size()
+                << " target drives failed." << std::endl;
+      return 1;
+    }
+  }
   return 0;
 }
@@ -2,10 +2,129 @@
 
 #include "drive_factory.h"
 
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
+#include <sstream>
+#include <string.h>
+
+#include "boost/format.hpp"
 
 #include "cbm1541_drive.h"
-#include "image_drive_d64.h"
+#include "cbm1541_drive_group.h"
+#include "cbm1571_drive.h"
+#include "cbm1581_drive.h"
+#include "compressed_image_drive.h"
+#include "g64_image.h"
+#include "image_drive.h"
+#include "image_drive_g64.h"
+#include "sector_store_drive.h"
+
+// Resetting the drive's DOS makes it report its version, e.g.
+// "73,CBM DOS V3.0 1571,00,00".
+static const char kSoftResetCommand[] = "UI";
+
+// Identify the drive at device_number by the version message it reports
+// after a soft reset and create a matching drive instance. Drives we don't
+// know about are assumed to be 1541 compatible. Returns nullptr and sets
+// status if we can't talk to the drive.
+static std::unique_ptr<DriveInterface>
+CreateCBMDrive(IECBusConnection *bus_conn, char device_number,
+               IECStatus *status) {
+  std::string version;
+  if (!bus_conn->WriteToChannel(device_number, 15, kSoftResetCommand,
+                                status) ||
+      !bus_conn->ReadFromChannel(device_number, 15, &version, status)) {
+    return nullptr;
+  }
+  if (version.find("1571") != std::string::npos) {
+    return std::make_unique<CBM1571Drive>(bus_conn, device_number);
+  }
+  if (version.find("1581") != std::string::npos) {
+    return std::make_unique<CBM1581Drive>(bus_conn, device_number);
+  }
+  return std::make_unique<CBM1541Drive>(bus_conn, device_number);
+}
+
+// Create a group of the 1541 drives listed in ids, separated by commas.
+// Returns nullptr and sets status if any of them isn't a 1541 or if the bus
+// connection can't address all of them at once.
+static std::unique_ptr<DriveInterface>
+CreateCBMDriveGroup(const std::string &ids, IECBusConnection *bus_conn,
+                    IECStatus *status) {
+  if (!bus_conn->SupportsBroadcast()) {
+    SetError(IECStatus::UNIMPLEMENTED,
+             "writing to several drives at once needs an Arduino supporting "
+             "broadcasts",
+             status);
+    return nullptr;
+  }
+  std::vector<char> device_numbers;
+  std::istringstream stream(ids);
+  std::string id;
+  while (std::getline(stream, id, ',')) {
+    int device_number = boost::lexical_cast<int>(id);
+    std::unique_ptr<DriveInterface> drive =
+        CreateCBMDrive(bus_conn, device_number, status);
+    if (!drive)
+      return nullptr;
+    if (!dynamic_cast<CBM1541Drive *>(drive.get())) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("device %u isn't a 1541, which writing to "
+                              "several drives at once requires") %
+                device_number)
+                   .str(),
+               status);
+      return nullptr;
+    }
+    device_numbers.push_back(device_number);
+  }
+  return std::make_unique<CBM1541DriveGroup>(bus_conn, device_numbers);
+}
+
+// Create a drive on the image at image_path. Compressed images are recognized
+// by their extension, G64 images by their signature, other formats by their
+// extension or size. Images we can't identify are taken for d64 images.
+// Returns nullptr and sets status if the image can't be accessed as requested.
+static std::unique_ptr<DriveInterface>
+CreateImageDrive(const std::string &image_path, bool read_only,
+                 IECStatus *status) {
+  if (CompressedImageDrive::IsCompressedImagePath(image_path))
+    return std::make_unique<CompressedImageDrive>(image_path, read_only);
+  if (HasG64Signature(image_path)) {
+    if (!read_only) {
+      SetError(IECStatus::UNIMPLEMENTED,
+               "G64 images can't be written sector by sector", status);
+      return nullptr;
+    }
+    return std::make_unique<ImageDriveG64>(image_path);
+  }
+  const ImageGeometry *geometry = FindImageGeometry(image_path);
+  return std::make_unique<ImageDrive>(image_path, read_only,
+                                      geometry ? *geometry : kD64Geometry);
+}
+
+// Create a drive on a disc in a sector store, named by a path like
+// "cas://path/to/store/disc_name". Returns nullptr and sets status if the path
+// doesn't name a disc.
+static std::unique_ptr<DriveInterface>
+CreateSectorStoreDrive(const std::string &path, bool read_only,
+                       IECStatus *status) {
+  std::string store_path =
+      path.substr(strlen(SectorStoreDrive::kPathPrefix));
+  size_t slash = store_path.find_last_of('/');
+  std::string disc_name;
+  if (slash != std::string::npos) {
+    disc_name = store_path.substr(slash + 1);
+    store_path.erase(std::max<size_t>(slash, 1));
+  }
+  if (store_path.empty() || disc_name.empty() || disc_name == "." ||
+      disc_name == "..") {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             path + " doesn't name a store and a disc within it", status);
+    return nullptr;
+  }
+  return std::make_unique<SectorStoreDrive>(store_path, disc_name, read_only);
+}
 
 std::unique_ptr<DriveInterface> CreateDriveObject(const std::string &file_or_id,
                                                   IECBusConnection *bus_conn,
@@ -13,13 +132,21 @@ std::unique_ptr<DriveInterface> CreateDriveObject(const std::string &file_or_id,
                                                   IECStatus *status) {
   std::unique_ptr<DriveInterface> result;
   try {
+    // Several device numbers separated by commas make up a group of drives.
+    if (file_or_id.find(',') != std::string::npos)
+      return CreateCBMDriveGroup(file_or_id, bus_conn, status);
+
     // Try to interpret file_or_id as a device number. If this fails,
     // we end up in the exception handler below.
     int device_number = boost::lexical_cast<int>(file_or_id);
 
-    result = std::make_unique<CBM1541Drive>(bus_conn, device_number);
+    result = CreateCBMDrive(bus_conn, device_number, status);
   } catch (const boost::bad_lexical_cast &) {
-    result = std::make_unique<ImageDriveD64>(file_or_id, read_only);
+    if (file_or_id.compare(0, strlen(SectorStoreDrive::kPathPrefix),
+                           SectorStoreDrive::kPathPrefix) == 0) {
+      return CreateSectorStoreDrive(file_or_id, read_only, status);
+    }
+    result = CreateImageDrive(file_or_id, read_only, status);
   }
   return result;
 }
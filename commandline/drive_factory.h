@@ -9,9 +9,16 @@
 #include "iec_host_lib.h"
 
 // Factory for creating a drive instance from the specified file_or_id.
-// file_or_id can be either a IEC bus id or a path to a disc image.
+// file_or_id can be either a IEC bus id or a path to a disc image in d64, d71,
+// d81 or G64 format, the latter being read-only. d64, d71 and d81 images may
+// be compressed with gzip (.gz) or zstd (.zst). A path like
+// "cas://path/to/store/disc_name" names a disc in a content-addressed sector
+// store, see SectorStoreDrive. Several IEC bus ids separated by commas
+// (e.g. "9,10,11") result in a drive writing to all of these 1541 drives at
+// once.
 // If file_or_id specifies a IEC bus id, bus_conn must be a pointer to
-// and IECBusConnection instance used to talk to the drive.
+// and IECBusConnection instance used to talk to the drive. The drive's DOS
+// is reset to find out which drive model we're talking to.
 // if read_only is true, expect the drive to reject attempts to write to it.
 // If successful, returns a drive instance, nullptr otherwise.
 // The string pointed to by drive_status receives the current drive status
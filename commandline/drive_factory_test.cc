@@ -0,0 +1,140 @@
+#include "drive_factory.h"
+
+#include <boost/filesystem.hpp>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cbm1541_drive.h"
+#include "cbm1541_drive_group.h"
+#include "cbm1571_drive.h"
+#include "cbm1581_drive.h"
+#include "g64_image.h"
+#include "iec_host_lib.h"
+#include "mock_iec_bus_connection.h"
+#include "image_drive.h"
+#include "image_drive_g64.h"
+#include "sector_store_drive.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::Return;
+using ::testing::SetArgPointee;
+using ::testing::StrEq;
+
+// A connection whose Arduino supports broadcasts to several devices.
+class MockBroadcastIECBusConnection : public MockIECBusConnection {
+public:
+  bool SupportsBroadcast() const override { return true; }
+};
+
+class DriveFactoryTest : public ::testing::Test {};
+
+TEST_F(DriveFactoryTest, IdentifyDriveTest) {
+  MockIECBusConnection conn;
+  IECStatus status;
+
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("UI"), &status))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .WillOnce(DoAll(SetArgPointee<2>("73,CBM DOS V3.0 1571,00,00\r"),
+                      Return(true)))
+      .WillOnce(DoAll(
+          SetArgPointee<2>("73,COPYRIGHT CBM DOS V10 1581,00,00\r"),
+          Return(true)))
+      .WillOnce(DoAll(SetArgPointee<2>("73,CBM DOS V2.6 1541,00,00\r"),
+                      Return(true)));
+
+  std::unique_ptr<DriveInterface> drive =
+      CreateDriveObject("8", &conn, /*read_only=*/true, &status);
+  EXPECT_NE(nullptr, dynamic_cast<CBM1571Drive *>(drive.get()));
+  drive = CreateDriveObject("8", &conn, /*read_only=*/true, &status);
+  EXPECT_NE(nullptr, dynamic_cast<CBM1581Drive *>(drive.get()));
+  drive = CreateDriveObject("8", &conn, /*read_only=*/true, &status);
+  EXPECT_NE(nullptr, dynamic_cast<CBM1541Drive *>(drive.get()));
+}
+
+TEST_F(DriveFactoryTest, DriveNotPresentTest) {
+  MockIECBusConnection conn;
+  IECStatus status;
+
+  EXPECT_CALL(conn, WriteToChannel(9, 15, _, &status))
+      .WillOnce(Return(false));
+
+  EXPECT_EQ(nullptr,
+            CreateDriveObject("9", &conn, /*read_only=*/true, &status));
+}
+
+TEST_F(DriveFactoryTest, DriveGroupTest) {
+  MockBroadcastIECBusConnection conn;
+  IECStatus status;
+
+  EXPECT_CALL(conn, WriteToChannel(_, 15, StrEq("UI"), &status))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(_, 15, _, &status))
+      .WillRepeatedly(DoAll(
+          SetArgPointee<2>("73,CBM DOS V2.6 1541,00,00\r"), Return(true)));
+  EXPECT_CALL(conn, ReadFromChannel(11, 15, _, &status))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("73,CBM DOS V3.0 1571,00,00\r"),
+                            Return(true)));
+
+  std::unique_ptr<DriveInterface> drive =
+      CreateDriveObject("9,10", &conn, /*read_only=*/false, &status);
+  EXPECT_NE(nullptr, dynamic_cast<CBM1541DriveGroup *>(drive.get()));
+
+  // Only 1541 drives can be written to at once.
+  EXPECT_EQ(nullptr,
+            CreateDriveObject("9,11", &conn, /*read_only=*/false, &status));
+  EXPECT_EQ(IECStatus::INVALID_ARGUMENT, status.status_code);
+}
+
+TEST_F(DriveFactoryTest, DriveGroupUnsupportedTest) {
+  MockIECBusConnection conn;
+  IECStatus status;
+
+  // Writing to several drives at once needs broadcasts.
+  EXPECT_EQ(nullptr,
+            CreateDriveObject("9,10", &conn, /*read_only=*/false, &status));
+  EXPECT_EQ(IECStatus::UNIMPLEMENTED, status.status_code);
+}
+
+TEST_F(DriveFactoryTest, ImageFormatTest) {
+  std::string image_path =
+      (boost::filesystem::temp_directory_path() / "image_XXXXXX").string();
+  close(mkstemp(&image_path[0]));
+  IECStatus status;
+  ASSERT_TRUE(WriteG64Image(image_path, {}, &status)) << status.message;
+
+  // G64 images are recognized by their signature and can only be read.
+  std::unique_ptr<DriveInterface> drive =
+      CreateDriveObject(image_path, nullptr, /*read_only=*/true, &status);
+  EXPECT_NE(nullptr, dynamic_cast<ImageDriveG64 *>(drive.get()));
+  EXPECT_EQ(nullptr,
+            CreateDriveObject(image_path, nullptr, /*read_only=*/false,
+                              &status));
+  EXPECT_EQ(status.status_code, IECStatus::UNIMPLEMENTED);
+  EXPECT_EQ(unlink(image_path.c_str()), 0);
+
+  drive = CreateDriveObject("/nonexistent/disc.d81", nullptr,
+                            /*read_only=*/true, &status);
+  EXPECT_NE(nullptr, dynamic_cast<ImageDrive *>(drive.get()));
+  EXPECT_EQ(nullptr, dynamic_cast<ImageDriveG64 *>(drive.get()));
+}
+
+TEST_F(DriveFactoryTest, SectorStoreTest) {
+  IECStatus status;
+  std::unique_ptr<DriveInterface> drive = CreateDriveObject(
+      "cas:///path/to/store/disc", nullptr, /*read_only=*/true, &status);
+  EXPECT_NE(nullptr, dynamic_cast<SectorStoreDrive *>(drive.get()));
+  drive = CreateDriveObject("cas://store/disc", nullptr, /*read_only=*/false,
+                            &status);
+  EXPECT_NE(nullptr, dynamic_cast<SectorStoreDrive *>(drive.get()));
+
+  // Paths need to name both the store and a disc.
+  EXPECT_EQ(nullptr, CreateDriveObject("cas://disc", nullptr,
+                                       /*read_only=*/true, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  EXPECT_EQ(nullptr, CreateDriveObject("cas://store/", nullptr,
+                                       /*read_only=*/true, &status));
+}
@@ -8,7 +8,10 @@
 #ifndef DRIVE_INTERFACE_H
 #define DRIVE_INTERFACE_H
 
+#include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "utils.h"
 
@@ -19,6 +22,16 @@ public:
     kNumBytesPerSector = 256
   };
 
+  // Ways of moving the head of a physical drive before retrying to read a
+  // sector that couldn't be read.
+  enum HeadMovement {
+    // Bump the head against its stop, which recalibrates its position.
+    HEAD_BUMP,
+    // Move the head to a neighbouring track, so it approaches the sector's
+    // track from there.
+    HEAD_NEIGHBOUR_TRACK,
+  };
+
   virtual ~DriveInterface() {}
 
   // Physically formats the disc. Note that depending on the implementation,
@@ -42,6 +55,98 @@ public:
   virtual bool WriteSector(size_t sector_number, const std::string &content,
                            IECStatus *status) = 0;
 
+  // Write contents to consecutive sectors, starting at first_sector. The
+  // default implementation writes one sector at a time. Implementations
+  // which can write several sectors with a single request should override
+  // this. Returns true if successful, sets status otherwise.
+  virtual bool WriteSectors(size_t first_sector,
+                            const std::vector<std::string> &contents,
+                            IECStatus *status) {
+    for (size_t i = 0; i < contents.size(); ++i) {
+      if (!WriteSector(first_sector + i, contents[i], status))
+        return false;
+    }
+    return true;
+  }
+
+  // Read all sectors specified by sector_numbers and set *contents to map
+  // each of them to its content. The default implementation reads one
+  // sector at a time. Implementations which can read several sectors with a
+  // single request should override this. Returns true if successful, sets
+  // status otherwise.
+  virtual bool ReadSectorList(const std::vector<size_t> &sector_numbers,
+                              std::map<size_t, std::string> *contents,
+                              IECStatus *status) {
+    contents->clear();
+    for (size_t sector_number : sector_numbers) {
+      if (!ReadSector(sector_number, &(*contents)[sector_number], status))
+        return false;
+    }
+    return true;
+  }
+
+  // Enable or disable verification of written content by the drive itself,
+  // so that write requests fail if what was written can't be read back.
+  // Returns true if the implementation supports this, false otherwise. The
+  // default implementation doesn't, callers should use VerifySectors instead.
+  virtual bool SetWriteVerification(bool enable) { return false; }
+
+  // Enable or disable formatting each track right before content is written
+  // to it for the first time, which saves a separate pass over the disc when
+  // copying to an unformatted one. Returns true if the implementation
+  // supports this, false otherwise. The default implementation doesn't,
+  // callers should use FormatDiscLowLevel instead.
+  virtual bool SetFormatOnWrite(bool enable) { return false; }
+
+  // Verify the content of consecutive sectors, starting at first_sector,
+  // against expected, which holds the Crc16() of the expected content of
+  // each sector. Sets *mismatches to the sector numbers whose content
+  // doesn't match. The default implementation reads back each sector.
+  // Implementations which can calculate checksums without transferring the
+  // sector content should override this. Returns true if successful (a
+  // mismatch doesn't constitute an error), sets status otherwise.
+  virtual bool VerifySectors(size_t first_sector,
+                             const std::vector<unsigned short int> &expected,
+                             std::vector<size_t> *mismatches,
+                             IECStatus *status) {
+    mismatches->clear();
+    for (size_t i = 0; i < expected.size(); ++i) {
+      std::string content;
+      if (!ReadSector(first_sector + i, &content, status))
+        return false;
+      if (Crc16(content) != expected[i])
+        mismatches->push_back(first_sector + i);
+    }
+    return true;
+  }
+
+  // Move the head as specified by movement before retrying to read
+  // sector_number. Returns true if successful, sets status otherwise. The
+  // default implementation doesn't support this.
+  virtual bool MoveHead(size_t sector_number, HeadMovement movement,
+                        IECStatus *status) {
+    SetError(IECStatus::UNIMPLEMENTED, "MoveHead", status);
+    return false;
+  }
+
+  // Record which sectors couldn't be read from the original disc.
+  // error_numbers holds the drive's error number for each sector (e.g. 23 for
+  // a checksum error), or zero if the sector was read successfully. If none
+  // of the sectors has an error, any error map recorded before is dropped.
+  // Returns true if successful, sets status otherwise. The default
+  // implementation doesn't support this.
+  virtual bool WriteErrorMap(const std::vector<unsigned int> &error_numbers,
+                             IECStatus *status) {
+    SetError(IECStatus::UNIMPLEMENTED, "WriteErrorMap", status);
+    return false;
+  }
+
+  // Finish writing. Implementations which only make what was written visible
+  // once writing completed successfully, such as images, do so now. Returns
+  // true if successful, sets status otherwise. The default implementation has
+  // nothing to do.
+  virtual bool Commit(IECStatus *status) { return true; }
+
   // Read string from the command channel and set response to the result.
   // Returns true if successful, sets status otherwise.
   virtual bool ReadCommandChannel(std::string *response, IECStatus *status) = 0;
@@ -0,0 +1,425 @@
+// Runs the fast transfer protocol end to end: the drive side executes the
+// assembled code of assembly/fast_send.asm on a cycle counting 6502, the
+// Arduino side follows IEC::receiveFast() in uno2iec/iec_driver.cpp, using
+// the timing and decoding it shares through uno2iec/fast_receive.h.
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#include "assembly/fast_send_h.h"
+#include "fast_receive.h"
+#include "gtest/gtest.h"
+
+// Drive memory layout, see assembly/definitions.asm.
+static const unsigned short int kFastSendAddress = 0x0700;
+static const unsigned short int kInputBufferAddress = 0x0200;
+static const unsigned short int kSerialPortAddress = 0x1800;
+// Serial port bits. Inputs are set while the line is pulled low, outputs
+// pull the line low while set.
+static const unsigned char kSerialDataIn = 0x01;
+static const unsigned char kSerialDataOut = 0x02;
+static const unsigned char kSerialClockIn = 0x04;
+static const unsigned char kSerialClockOut = 0x08;
+static const unsigned char kSerialAtnIn = 0x80;
+
+// The page the drive sends, filled with every byte value.
+static const unsigned char kSourcePage = 0x03;
+// Return address we push for the final rts, which stops the drive.
+static const unsigned short int kReturnAddress = 0xffff;
+// Upper bound for the drive cycles it takes to send a page.
+static const double kMaxDriveCycles = 100000;
+
+// Arduino side, in Arduino cycles. Unlike the timing in fast_receive.h,
+// these depend on the code the compiler generates for receiveFast().
+static const int kArduinoCyclesPerUs = 16;
+// An iteration of the loops waiting for the drive.
+static const int kArduinoWaitLoopCycles = 14;
+// Upper bound for pulling or releasing DATA through writeDATA().
+static const int kArduinoWriteDataCycles = 100;
+// Port masks of the DATA and CLK pins.
+static const uint8_t kArduinoDataMask = 0x08;
+static const uint8_t kArduinoClockMask = 0x10;
+
+enum Line { DATA, CLK, ATN };
+
+// One of the bus outputs of either side, tracking when it pulls its line.
+class Output {
+public:
+  // Pull (or release) the line from time on. Calls need to be in order.
+  void Set(double time, bool pulled) {
+    if (pulled != Pulled(time))
+      transitions_.push_back(time);
+  }
+
+  // Returns true if the line is pulled at time.
+  bool Pulled(double time) const { return NumTransitions(time) % 2 == 1; }
+
+  // Returns the time since which the line has been released at time, or
+  // infinity if it is pulled.
+  double ReleasedSince(double time) const {
+    size_t num_transitions = NumTransitions(time);
+    if (num_transitions % 2 == 1)
+      return std::numeric_limits<double>::infinity();
+    if (num_transitions == 0)
+      return -std::numeric_limits<double>::infinity();
+    return transitions_[num_transitions - 1];
+  }
+
+private:
+  size_t NumTransitions(double time) const {
+    return std::upper_bound(transitions_.begin(), transitions_.end(), time) -
+           transitions_.begin();
+  }
+
+  // Times at which the output changes, starting released.
+  std::vector<double> transitions_;
+};
+
+// The bus lines, with released lines taking rise_time to be seen as high
+// through the pull-ups. All times are in microseconds.
+class SimulatedBus {
+public:
+  explicit SimulatedBus(double rise_time) : rise_time_(rise_time) {}
+
+  Output drive_data, drive_clock, host_data, host_atn;
+
+  // Returns true if line is seen as high at time.
+  bool High(Line line, double time) const {
+    double released_since = -std::numeric_limits<double>::infinity();
+    switch (line) {
+    case DATA:
+      released_since = std::max(drive_data.ReleasedSince(time),
+                                host_data.ReleasedSince(time));
+      break;
+    case CLK:
+      released_since = drive_clock.ReleasedSince(time);
+      break;
+    case ATN:
+      released_since = host_atn.ReleasedSince(time);
+      break;
+    }
+    return released_since + rise_time_ <= time;
+  }
+
+private:
+  double rise_time_;
+};
+
+// A 1541 running the drive code, one instruction at a time. Only supports
+// the instructions fast_send.asm uses. A cycle takes a microsecond.
+class SimulatedDrive {
+public:
+  explicit SimulatedDrive(SimulatedBus *bus)
+      : bus_(bus), memory_(0x10000, 0), port_(0), a_(0), x_(0), y_(0),
+        sp_(0xfd), pc_(kFastSendAddress), n_(false), z_(false), c_(false),
+        cycle_(0) {
+    std::copy(fast_send_bin, fast_send_bin + sizeof(fast_send_bin),
+              memory_.begin() + kFastSendAddress);
+    memory_[0x1fe] = (kReturnAddress - 1) & 0xff;
+    memory_[0x1ff] = (kReturnAddress - 1) >> 8;
+  }
+
+  std::vector<unsigned char> &memory() { return memory_; }
+  double cycle() const { return cycle_; }
+  bool done() const { return pc_ == kReturnAddress; }
+
+  // Called to bring the other side up to date before the drive reads the
+  // bus at the specified time.
+  std::function<void(double)> before_bus_read;
+
+  // Execute a single instruction. Returns false for unsupported ones.
+  bool Step() {
+    unsigned char opcode = Fetch();
+    switch (opcode) {
+    case 0xa9: // lda #
+      SetNZ(a_ = Fetch());
+      return Cycles(2);
+    case 0xa2: // ldx #
+      SetNZ(x_ = Fetch());
+      return Cycles(2);
+    case 0xa0: // ldy #
+      SetNZ(y_ = Fetch());
+      return Cycles(2);
+    case 0x29: // and #
+      SetNZ(a_ &= Fetch());
+      return Cycles(2);
+    case 0xad: // lda abs
+      SetNZ(a_ = Read(FetchAddress(), 3));
+      return Cycles(4);
+    case 0xbd: // lda abs,x
+      return LoadIndexed(x_);
+    case 0xb9: // lda abs,y
+      return LoadIndexed(y_);
+    case 0xcc: { // cpy abs
+      unsigned char value = Read(FetchAddress(), 3);
+      c_ = y_ >= value;
+      SetNZ(y_ - value);
+      return Cycles(4);
+    }
+    case 0x8d: // sta abs
+      Write(FetchAddress(), a_, 3);
+      return Cycles(4);
+    case 0x8e: // stx abs
+      Write(FetchAddress(), x_, 3);
+      return Cycles(4);
+    case 0xaa: // tax
+      SetNZ(x_ = a_);
+      return Cycles(2);
+    case 0xc8: // iny
+      SetNZ(++y_);
+      return Cycles(2);
+    case 0x4a: // lsr
+      c_ = a_ & 1;
+      SetNZ(a_ >>= 1);
+      return Cycles(2);
+    case 0x30: // bmi
+      return Branch(n_);
+    case 0xb0: // bcs
+      return Branch(c_);
+    case 0xd0: // bne
+      return Branch(!z_);
+    case 0x78: // sei
+    case 0x58: // cli
+    case 0xea: // nop
+      return Cycles(2);
+    case 0x60: // rts
+      pc_ = memory_[0x100 + ++sp_];
+      pc_ |= memory_[0x100 + ++sp_] << 8;
+      ++pc_;
+      return Cycles(6);
+    }
+    ADD_FAILURE() << "unsupported opcode " << int(opcode) << " at "
+                  << pc_ - 1;
+    return false;
+  }
+
+private:
+  unsigned char Fetch() { return memory_[pc_++]; }
+  unsigned short int FetchAddress() {
+    unsigned short int address = Fetch();
+    return address | Fetch() << 8;
+  }
+  void SetNZ(unsigned char value) {
+    n_ = value & 0x80;
+    z_ = value == 0;
+  }
+  bool Cycles(int num_cycles) {
+    cycle_ += num_cycles;
+    return true;
+  }
+
+  bool LoadIndexed(unsigned char index) {
+    unsigned short int base = FetchAddress();
+    unsigned short int address = base + index;
+    int num_cycles = (address >> 8) == (base >> 8) ? 4 : 5;
+    SetNZ(a_ = Read(address, num_cycles - 1));
+    return Cycles(num_cycles);
+  }
+
+  bool Branch(bool taken) {
+    signed char offset = Fetch();
+    if (!taken)
+      return Cycles(2);
+    unsigned short int target = pc_ + offset;
+    int num_cycles = (target >> 8) == (pc_ >> 8) ? 3 : 4;
+    pc_ = target;
+    return Cycles(num_cycles);
+  }
+
+  // Accesses happen in the last cycle of an instruction, offset cycles after
+  // its start.
+  unsigned char Read(unsigned short int address, int offset) {
+    if (address != kSerialPortAddress)
+      return memory_[address];
+    double time = cycle_ + offset;
+    before_bus_read(time);
+    unsigned char value = port_ & (kSerialDataOut | kSerialClockOut);
+    if (!bus_->High(DATA, time))
+      value |= kSerialDataIn;
+    if (!bus_->High(CLK, time))
+      value |= kSerialClockIn;
+    if (!bus_->High(ATN, time))
+      value |= kSerialAtnIn;
+    return value;
+  }
+
+  void Write(unsigned short int address, unsigned char value, int offset) {
+    if (address != kSerialPortAddress) {
+      memory_[address] = value;
+      return;
+    }
+    double time = cycle_ + offset;
+    port_ = value;
+    bus_->drive_data.Set(time, value & kSerialDataOut);
+    bus_->drive_clock.Set(time, value & kSerialClockOut);
+  }
+
+  SimulatedBus *bus_;
+  std::vector<unsigned char> memory_;
+  unsigned char port_;
+  unsigned char a_, x_, y_, sp_;
+  unsigned short int pc_;
+  bool n_, z_, c_;
+  double cycle_;
+};
+
+// The Arduino receiving bytes like IEC::receiveFast(), with its clock off by
+// clock_error. Each time it waits for the start signal, the loop waiting for
+// it begins phase cycles later. Stops after receiving num_bytes. If
+// give_up is set, it pulls ATN next rather than ending the transfer, which
+// makes the drive give up.
+class SimulatedArduino {
+public:
+  SimulatedArduino(SimulatedBus *bus, double clock_error, int phase,
+                   size_t num_bytes, bool give_up)
+      : bus_(bus), us_per_cycle_((1 + clock_error) / kArduinoCyclesPerUs),
+        phase_(phase), num_bytes_(num_bytes), give_up_(give_up),
+        state_(WAIT_BUSY),
+        next_time_(0), pair_(0) {
+    // beginFastReceive(): Not ready yet.
+    bus_->host_data.Set(0, true);
+  }
+
+  const std::vector<unsigned char> &received() const { return received_; }
+
+  // Do everything happening before time. The drive must have run up to
+  // there.
+  void RunUntil(double time) {
+    while (state_ != DONE && next_time_ < time)
+      Step();
+  }
+
+private:
+  enum State { WAIT_BUSY, WAIT_START, SAMPLE, DONE };
+
+  double Cycles(int num_cycles) const { return num_cycles * us_per_cycle_; }
+
+  void Step() {
+    switch (state_) {
+    case WAIT_BUSY:
+      if (bus_->High(CLK, next_time_)) {
+        next_time_ += Cycles(kArduinoWaitLoopCycles);
+      } else if (received_.size() == num_bytes_) {
+        bus_->host_atn.Set(next_time_, true);
+        state_ = DONE;
+      } else {
+        // Ready.
+        next_time_ += Cycles(kArduinoWriteDataCycles);
+        bus_->host_data.Set(next_time_, false);
+        next_time_ += Cycles(phase_);
+        state_ = WAIT_START;
+      }
+      break;
+    case WAIT_START:
+      if (!bus_->High(CLK, next_time_)) {
+        next_time_ += Cycles(kArduinoWaitLoopCycles);
+      } else {
+        next_time_ += Cycles(TIMING_FAST_FIRST_SAMPLE * kArduinoCyclesPerUs -
+                             CYCLES_FAST_START);
+        pair_ = 0;
+        state_ = SAMPLE;
+      }
+      break;
+    case SAMPLE:
+      data_samples_[pair_] =
+          bus_->High(DATA, next_time_) ? kArduinoDataMask : 0;
+      clock_samples_[pair_] =
+          bus_->High(CLK, next_time_) ? kArduinoClockMask : 0;
+      if (++pair_ < FAST_NUM_PAIRS) {
+        next_time_ += Cycles(TIMING_FAST_PAIR * kArduinoCyclesPerUs);
+        break;
+      }
+      // Not ready, as late as writeDATA() gets it done.
+      next_time_ += Cycles(TIMING_FAST_BUSY * kArduinoCyclesPerUs +
+                           kArduinoWriteDataCycles);
+      bus_->host_data.Set(next_time_, true);
+      received_.push_back(decodeFastSamples(data_samples_, clock_samples_,
+                                            kArduinoDataMask,
+                                            kArduinoClockMask));
+      if (received_.size() < num_bytes_ || give_up_) {
+        state_ = WAIT_BUSY;
+      } else {
+        // endFastReceive().
+        bus_->host_data.Set(next_time_, false);
+        state_ = DONE;
+      }
+      break;
+    case DONE:
+      break;
+    }
+  }
+
+  SimulatedBus *bus_;
+  double us_per_cycle_;
+  int phase_;
+  size_t num_bytes_;
+  bool give_up_;
+  State state_;
+  double next_time_;
+  int pair_;
+  uint8_t data_samples_[FAST_NUM_PAIRS];
+  uint8_t clock_samples_[FAST_NUM_PAIRS];
+  std::vector<unsigned char> received_;
+};
+
+// Run fast_send.asm on a page holding every byte value until it returns,
+// with the Arduino set up as specified. Sets *received to what the Arduino
+// got. Returns false if the drive didn't finish.
+static bool RunTransfer(SimulatedBus *bus, double clock_error, int phase,
+                        size_t num_bytes, bool give_up,
+                        std::vector<unsigned char> *received) {
+  SimulatedDrive drive(bus);
+  SimulatedArduino arduino(bus, clock_error, phase, num_bytes, give_up);
+  drive.before_bus_read = [&arduino](double time) { arduino.RunUntil(time); };
+  for (unsigned int i = 0; i < 0x100; ++i)
+    drive.memory()[kSourcePage << 8 | i] = i;
+  // M-E parameters: the page and the number of bytes, zero for all of them.
+  drive.memory()[kInputBufferAddress + 5] = kSourcePage;
+  drive.memory()[kInputBufferAddress + 6] = 0;
+
+  while (!drive.done() && drive.cycle() < kMaxDriveCycles) {
+    if (!drive.Step())
+      return false;
+  }
+  // The Arduino may still be sampling the last byte.
+  arduino.RunUntil(drive.cycle() + 1000);
+  *received = arduino.received();
+  return drive.done();
+}
+
+class FastTransferTest : public ::testing::Test {};
+
+TEST_F(FastTransferTest, TransferPageTest) {
+  std::vector<unsigned char> page;
+  for (unsigned int i = 0; i < 0x100; ++i)
+    page.push_back(i);
+
+  // Cover every point within the loop waiting for the start signal, slow
+  // line rise times and resonators 1% off.
+  for (double rise_time : {0.0, 0.5, 1.0, 1.5}) {
+    for (double clock_error : {-0.01, 0.0, 0.01}) {
+      for (int phase = 0; phase < kArduinoWaitLoopCycles; ++phase) {
+        SimulatedBus bus(rise_time);
+        std::vector<unsigned char> received;
+        ASSERT_TRUE(RunTransfer(&bus, clock_error, phase, page.size(), false,
+                                &received));
+        ASSERT_EQ(page, received)
+            << "rise time " << rise_time << ", clock error " << clock_error
+            << ", phase " << phase;
+      }
+    }
+  }
+}
+
+TEST_F(FastTransferTest, AbortTest) {
+  // If the host gives up and talks to the drive instead, the drive returns
+  // to the DOS right away and releases the bus.
+  SimulatedBus bus(0.5);
+  std::vector<unsigned char> received;
+  ASSERT_TRUE(RunTransfer(&bus, 0.0, 0, 10, true, &received));
+  EXPECT_EQ(10, received.size());
+  EXPECT_FALSE(bus.drive_data.Pulled(kMaxDriveCycles));
+  EXPECT_FALSE(bus.drive_clock.Pulled(kMaxDriveCycles));
+}
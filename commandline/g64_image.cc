@@ -0,0 +1,318 @@
+// Support for G64 disc images, which hold the raw GCR data of each track
+// rather than decoded sector content.
+
+#include "g64_image.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "boost/format.hpp"
+
+// Signature and version at the start of each G64 image.
+static const char kG64Signature[] = "GCR-1541";
+static const unsigned char kG64Version = 0x00;
+
+// Size of the header, up to and including the maximum track size.
+static const size_t kG64HeaderSize = 12;
+
+// Number of sectors per track in each speed zone.
+static const unsigned int kNumSectorsInZone[] = {17, 18, 19, 21};
+
+// Minimum number of consecutive one bits the drive recognizes as sync mark.
+static const size_t kMinSyncBits = 10;
+
+// Blocks following a sync mark start with their id.
+static const unsigned char kHeaderBlockId = 0x08;
+static const unsigned char kDataBlockId = 0x07;
+
+// Bytes decoded from header blocks (id, checksum, sector, track, two id
+// bytes) and data blocks (id, content, checksum).
+static const size_t kSectorSize = 256;
+static const size_t kHeaderBlockSize = 6;
+static const size_t kDataBlockSize = 2 + kSectorSize;
+
+// Drive errors reported for sectors that can't be read.
+static const unsigned int kErrorHeaderNotFound = 20;
+static const unsigned int kErrorDataNotFound = 22;
+static const unsigned int kErrorDataChecksum = 23;
+static const unsigned int kErrorDataDecoding = 24;
+static const unsigned int kErrorHeaderChecksum = 27;
+
+// Nibbles encoded by each 5 bit GCR code, 0xff for invalid codes.
+static const unsigned char kGCRDecodeTable[32] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x08, 0x00,
+    0x01, 0xff, 0x0c, 0x04, 0x05, 0xff, 0xff, 0x02, 0x03, 0xff, 0x0f,
+    0x06, 0x07, 0xff, 0x09, 0x0a, 0x0b, 0xff, 0x0d, 0x0e, 0xff};
+
+// Append value to *image as a little endian number of num_bytes bytes.
+static void AppendLittleEndian(unsigned int value, size_t num_bytes,
+                               std::string *image) {
+  for (size_t i = 0; i < num_bytes; ++i) {
+    image->append(1, char((value >> (8 * i)) & 0xff));
+  }
+}
+
+unsigned int GetSpeedZone(unsigned int track) {
+  if (track <= 17)
+    return 3;
+  if (track <= 24)
+    return 2;
+  if (track <= 30)
+    return 1;
+  return 0;
+}
+
+// Returns the little endian number of num_bytes bytes at offset in image.
+static unsigned int GetLittleEndian(const unsigned char *image, size_t offset,
+                                    size_t num_bytes) {
+  unsigned int result = 0;
+  for (size_t i = 0; i < num_bytes; ++i) {
+    result |= image[offset + i] << (8 * i);
+  }
+  return result;
+}
+
+// Returns bit number pos of the circular track gcr, counting from the most
+// significant bit of its first byte.
+static bool GetTrackBit(const std::string &gcr, size_t pos) {
+  pos %= 8 * gcr.size();
+  return (static_cast<unsigned char>(gcr[pos / 8]) >> (7 - pos % 8)) & 1;
+}
+
+// Decode num_bytes bytes from the GCR data on track gcr, starting at bit pos.
+// Returns false if the data holds invalid GCR codes.
+static bool DecodeGCRBytes(const std::string &gcr, size_t pos,
+                           size_t num_bytes, std::string *bytes) {
+  bytes->clear();
+  for (size_t i = 0; i < 2 * num_bytes; ++i) {
+    unsigned int code = 0;
+    for (size_t bit = 0; bit < 5; ++bit) {
+      code = (code << 1) | GetTrackBit(gcr, pos++);
+    }
+    if (kGCRDecodeTable[code] == 0xff)
+      return false;
+    if (i % 2 == 0) {
+      bytes->append(1, char(kGCRDecodeTable[code] << 4));
+    } else {
+      bytes->back() |= kGCRDecodeTable[code];
+    }
+  }
+  return true;
+}
+
+// Returns the XOR of the bytes in data.
+static unsigned char XorBytes(const std::string &data) {
+  unsigned char result = 0;
+  for (char c : data) {
+    result ^= c;
+  }
+  return result;
+}
+
+unsigned int GetNumSectorsOnTrack(unsigned int track) {
+  return kNumSectorsInZone[GetSpeedZone(track)];
+}
+
+bool HasG64Signature(const std::string &image_path) {
+  int fd = open(image_path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  char signature[sizeof(kG64Signature) - 1];
+  bool result = read(fd, signature, sizeof(signature)) == sizeof(signature) &&
+                memcmp(signature, kG64Signature, sizeof(signature)) == 0;
+  close(fd);
+  return result;
+}
+
+bool EncodeG64Image(const std::map<unsigned int, std::string> &tracks,
+                    std::string *image, IECStatus *status) {
+  for (const auto &track : tracks) {
+    if (track.first < 1 || 2 * track.first - 1 > kG64NumHalfTracks) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("track %u can't be stored in G64 image") %
+                track.first)
+                   .str(),
+               status);
+      return false;
+    }
+    if (track.second.size() > kG64MaxTrackSize) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("track %u holds %u bytes, max is %u") %
+                track.first % track.second.size() % kG64MaxTrackSize)
+                   .str(),
+               status);
+      return false;
+    }
+  }
+
+  image->assign(kG64Signature);
+  image->append(1, kG64Version);
+  image->append(1, char(kG64NumHalfTracks));
+  AppendLittleEndian(kG64MaxTrackSize, 2, image);
+
+  // Track data follows the offset and speed zone tables, one entry per half
+  // track each. We only store full tracks, so odd half tracks stay empty.
+  size_t track_offset = kG64HeaderSize + 2 * 4 * kG64NumHalfTracks;
+  for (unsigned int half_track = 0; half_track < kG64NumHalfTracks;
+       ++half_track) {
+    if (half_track % 2 == 0 && tracks.count(half_track / 2 + 1)) {
+      AppendLittleEndian(track_offset, 4, image);
+      track_offset += 2 + kG64MaxTrackSize;
+    } else {
+      AppendLittleEndian(0, 4, image);
+    }
+  }
+  for (unsigned int half_track = 0; half_track < kG64NumHalfTracks;
+       ++half_track) {
+    AppendLittleEndian(GetSpeedZone(half_track / 2 + 1), 4, image);
+  }
+  for (const auto &track : tracks) {
+    AppendLittleEndian(track.second.size(), 2, image);
+    image->append(track.second);
+    image->append(kG64MaxTrackSize - track.second.size(), 0x00);
+  }
+  return true;
+}
+
+bool WriteG64Image(const std::string &image_path,
+                   const std::map<unsigned int, std::string> &tracks,
+                   IECStatus *status) {
+  std::string image;
+  if (!EncodeG64Image(tracks, &image, status))
+    return false;
+
+  int fd = open(image_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "WriteG64Image", status);
+    return false;
+  }
+  ssize_t res = write(fd, image.data(), image.size());
+  if (res != static_cast<ssize_t>(image.size())) {
+    SetErrorFromErrno(
+        IECStatus::DRIVE_ERROR,
+        (boost::format("WriteG64Image: write returned %d") % res).str(),
+        status);
+    close(fd);
+    return false;
+  }
+  if (close(fd) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "WriteG64Image", status);
+    return false;
+  }
+  return true;
+}
+
+bool GetG64TrackGCR(const unsigned char *image, size_t image_size,
+                    unsigned int track, std::string *gcr, IECStatus *status) {
+  if (image_size < kG64HeaderSize ||
+      memcmp(image, kG64Signature, sizeof(kG64Signature) - 1) != 0) {
+    SetError(IECStatus::DRIVE_ERROR, "GetG64TrackGCR: not a G64 image",
+             status);
+    return false;
+  }
+  gcr->clear();
+  unsigned int half_track = 2 * track - 2;
+  if (track < 1 || half_track >= image[9])
+    return true;
+
+  size_t table_offset = kG64HeaderSize + 4 * half_track;
+  if (table_offset + 4 > image_size) {
+    SetError(IECStatus::DRIVE_ERROR,
+             "GetG64TrackGCR: image ends within its track table", status);
+    return false;
+  }
+  size_t track_offset = GetLittleEndian(image, table_offset, 4);
+  if (track_offset == 0)
+    return true;
+  if (track_offset + 2 > image_size ||
+      track_offset + 2 + GetLittleEndian(image, track_offset, 2) >
+          image_size) {
+    SetError(IECStatus::DRIVE_ERROR,
+             (boost::format("GetG64TrackGCR: track %u exceeds the image") %
+              track)
+                 .str(),
+             status);
+    return false;
+  }
+  gcr->assign(reinterpret_cast<const char *>(image) + track_offset + 2,
+              GetLittleEndian(image, track_offset, 2));
+  return true;
+}
+
+void DecodeGCRTrack(const std::string &gcr, unsigned int track,
+                    std::vector<std::string> *sectors,
+                    std::vector<unsigned int> *error_numbers) {
+  unsigned int num_sectors = GetNumSectorsOnTrack(track);
+  sectors->assign(num_sectors, std::string(kSectorSize, '\0'));
+  error_numbers->assign(num_sectors, kErrorHeaderNotFound);
+  size_t num_bits = 8 * gcr.size();
+  if (num_bits == 0)
+    return;
+
+  // Scan the track twice, so we catch sync marks and blocks which wrap
+  // around its end, as well as data blocks which precede their header at the
+  // start of the track. Sectors keep the best result we get for them.
+  size_t num_ones = 0;
+  // Sector whose header we found last, if its data block may follow.
+  int pending_sector = -1;
+  for (size_t pos = 0; pos < 2 * num_bits; ++pos) {
+    if (GetTrackBit(gcr, pos)) {
+      ++num_ones;
+      continue;
+    }
+    bool block_start = num_ones >= kMinSyncBits && num_ones < num_bits;
+    num_ones = 0;
+    if (!block_start)
+      continue;
+
+    std::string block;
+    if (DecodeGCRBytes(gcr, pos, kHeaderBlockSize, &block) &&
+        block[0] == kHeaderBlockId) {
+      unsigned int sector = static_cast<unsigned char>(block[2]);
+      pending_sector = -1;
+      if (static_cast<unsigned char>(block[3]) != track ||
+          sector >= num_sectors) {
+        continue;
+      }
+      unsigned int &error_number = (*error_numbers)[sector];
+      if (XorBytes(block.substr(2, 4)) !=
+          static_cast<unsigned char>(block[1])) {
+        if (error_number == kErrorHeaderNotFound)
+          error_number = kErrorHeaderChecksum;
+        continue;
+      }
+      pending_sector = sector;
+      if (error_number == kErrorHeaderNotFound ||
+          error_number == kErrorHeaderChecksum) {
+        error_number = kErrorDataNotFound;
+      }
+      continue;
+    }
+    if (pending_sector == -1)
+      continue;
+
+    // Anything following a header other than another header is taken for
+    // its data block.
+    unsigned int sector = pending_sector;
+    pending_sector = -1;
+    if ((*error_numbers)[sector] == 0)
+      continue;
+    std::string data;
+    bool decoded = DecodeGCRBytes(gcr, pos, kDataBlockSize, &data);
+    if (decoded && data[0] != kDataBlockId)
+      continue;
+    if (!decoded) {
+      (*error_numbers)[sector] = kErrorDataDecoding;
+      continue;
+    }
+    (*sectors)[sector] = data.substr(1, kSectorSize);
+    (*error_numbers)[sector] =
+        XorBytes((*sectors)[sector]) == static_cast<unsigned char>(data.back())
+            ? 0
+            : kErrorDataChecksum;
+  }
+}
@@ -0,0 +1,54 @@
+// Support for G64 disc images, which hold the raw GCR data of each track
+// rather than decoded sector content.
+
+#ifndef G64_IMAGE_H
+#define G64_IMAGE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+// Number of half tracks covered by a G64 image.
+const unsigned int kG64NumHalfTracks = 84;
+
+// Maximum number of GCR bytes stored per track.
+const size_t kG64MaxTrackSize = 7928;
+
+// Returns the speed zone (0 - 3) of track on a 1541 formatted disc.
+unsigned int GetSpeedZone(unsigned int track);
+
+// Returns the number of sectors on track on a 1541 formatted disc.
+unsigned int GetNumSectorsOnTrack(unsigned int track);
+
+// Returns true if the file at image_path starts with the G64 signature.
+bool HasG64Signature(const std::string &image_path);
+
+// Encode the GCR data in tracks, which maps (full) track numbers starting at 1
+// to their raw content, as a G64 image and store the result in *image.
+// Returns true if successful, sets status otherwise.
+bool EncodeG64Image(const std::map<unsigned int, std::string> &tracks,
+                    std::string *image, IECStatus *status);
+
+// Like EncodeG64Image, but write the resulting image to the file at
+// image_path, replacing any previous content.
+bool WriteG64Image(const std::string &image_path,
+                   const std::map<unsigned int, std::string> &tracks,
+                   IECStatus *status);
+
+// Retrieve the GCR data of (full) track from the G64 image of image_size bytes
+// at image into *gcr. Tracks the image doesn't hold result in an empty *gcr.
+// Returns true if successful, sets status if the image is malformed.
+bool GetG64TrackGCR(const unsigned char *image, size_t image_size,
+                    unsigned int track, std::string *gcr, IECStatus *status);
+
+// Decode the sectors of track from its raw GCR data, as the drive would read
+// them. (*sectors)[s] receives the content of sector s and
+// (*error_numbers)[s] is set to the drive error number reading it would
+// result in, zero if the sector was read successfully.
+void DecodeGCRTrack(const std::string &gcr, unsigned int track,
+                    std::vector<std::string> *sectors,
+                    std::vector<unsigned int> *error_numbers);
+
+#endif // G64_IMAGE_H
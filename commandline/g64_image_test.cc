@@ -0,0 +1,74 @@
+#include "g64_image.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+// Returns the little endian number of num_bytes bytes at offset in image.
+static unsigned int GetLittleEndian(const std::string &image, size_t offset,
+                                    size_t num_bytes) {
+  unsigned int result = 0;
+  for (size_t i = 0; i < num_bytes; ++i) {
+    result |= static_cast<unsigned char>(image.at(offset + i)) << (8 * i);
+  }
+  return result;
+}
+
+TEST(G64ImageTest, SpeedZoneTest) {
+  EXPECT_EQ(GetSpeedZone(1), 3u);
+  EXPECT_EQ(GetSpeedZone(17), 3u);
+  EXPECT_EQ(GetSpeedZone(18), 2u);
+  EXPECT_EQ(GetSpeedZone(24), 2u);
+  EXPECT_EQ(GetSpeedZone(25), 1u);
+  EXPECT_EQ(GetSpeedZone(30), 1u);
+  EXPECT_EQ(GetSpeedZone(31), 0u);
+  EXPECT_EQ(GetSpeedZone(42), 0u);
+}
+
+TEST(G64ImageTest, EncodeTest) {
+  std::map<unsigned int, std::string> tracks = {
+      {1, std::string(7000, '\x55')}, {18, std::string(6500, '\x52')}};
+  std::string image;
+  IECStatus status;
+  ASSERT_TRUE(EncodeG64Image(tracks, &image, &status)) << status.message;
+
+  const size_t kTrackDataStart = 12 + 8 * kG64NumHalfTracks;
+  EXPECT_EQ(image.size(), kTrackDataStart + 2 * (2 + kG64MaxTrackSize));
+  EXPECT_EQ(image.substr(0, 8), "GCR-1541");
+  EXPECT_EQ(image[8], 0x00);
+  EXPECT_EQ(GetLittleEndian(image, 9, 1), kG64NumHalfTracks);
+  EXPECT_EQ(GetLittleEndian(image, 10, 2), kG64MaxTrackSize);
+
+  for (unsigned int half_track = 0; half_track < kG64NumHalfTracks;
+       ++half_track) {
+    unsigned int offset = GetLittleEndian(image, 12 + 4 * half_track, 4);
+    unsigned int speed_zone =
+        GetLittleEndian(image, 12 + 4 * (kG64NumHalfTracks + half_track), 4);
+    EXPECT_EQ(speed_zone, GetSpeedZone(half_track / 2 + 1));
+    if (half_track == 0) {
+      EXPECT_EQ(offset, kTrackDataStart);
+    } else if (half_track == 34) {
+      EXPECT_EQ(offset, kTrackDataStart + 2 + kG64MaxTrackSize);
+    } else {
+      EXPECT_EQ(offset, 0u) << half_track;
+    }
+  }
+
+  for (const auto &track : tracks) {
+    unsigned int offset =
+        GetLittleEndian(image, 12 + 4 * (2 * track.first - 2), 4);
+    EXPECT_EQ(GetLittleEndian(image, offset, 2), track.second.size());
+    EXPECT_EQ(image.substr(offset + 2, track.second.size()), track.second);
+  }
+}
+
+TEST(G64ImageTest, EncodeInvalidTrackTest) {
+  std::string image;
+  IECStatus status;
+  EXPECT_FALSE(EncodeG64Image({{43, "\x55"}}, &image, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
+  status.Clear();
+  EXPECT_FALSE(EncodeG64Image(
+      {{1, std::string(kG64MaxTrackSize + 1, '\x55')}}, &image, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+}
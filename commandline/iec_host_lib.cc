@@ -30,6 +30,22 @@ static const std::string kConnectionStringPrefix = "connect_arduino:";
 // Needs to support host mode.
 static const int kMinProtocolVersion = 3;
 
+// First protocol version supporting bulk get data requests.
+static const int kBulkProtocolVersion = 4;
+
+// First protocol version supporting fast transfers from drive code.
+static const int kFastTransferProtocolVersion = 5;
+
+// First protocol version supporting direct copies between devices.
+static const int kDirectCopyProtocolVersion = 6;
+
+// First protocol version supporting writes to multiple devices at once.
+static const int kBroadcastProtocolVersion = 7;
+
+// Maximum number of devices a single broadcast can address. Matches
+// MAX_BROADCAST_DEVICES of the Arduino implementation.
+static const size_t kMaxBroadcastDevices = 8;
+
 // Number of tries for successfully reading the connection string prefix.
 static const int kNumRetries = 5;
 
@@ -55,6 +71,14 @@ static const std::string kCmdGetData =
     "g"; // Get data from a channel on a device.
 static const std::string kCmdPutData =
     "p"; // Put data onto a channel on a device.
+static const std::string kCmdGetDataBulk =
+    "b"; // Get data from a channel on a device in unescaped chunks.
+static const std::string kCmdFastGetData =
+    "f"; // Run drive code and receive its data using the fast protocol.
+static const std::string kCmdCopy =
+    "x"; // Copy data from a channel on one device to one on another.
+static const std::string kCmdPutDataMulti =
+    "m"; // Put data onto the same channel on several devices.
 
 static std::string GetPrintableString(const std::string &str) {
   std::string result;
@@ -142,7 +166,12 @@ bool IECBusConnection::OpenChannel(char device_number, char channel,
 bool IECBusConnection::ReadFromChannel(char device_number, char channel,
                                        std::string *result, IECStatus *status) {
   auto f = RequestResult();
-  std::string request_string = kCmdGetData + device_number + channel;
+  // Prefer bulk transfers, which avoid escaping the data and aren't limited
+  // in size.
+  std::string request_string =
+      (protocol_version_ >= kBulkProtocolVersion ? kCmdGetDataBulk
+                                                 : kCmdGetData) +
+      device_number + channel;
   if (!arduino_writer_->WriteString(request_string, status)) {
     return false;
   }
@@ -184,6 +213,144 @@ bool IECBusConnection::WriteToChannel(char device_number, char channel,
   return true;
 }
 
+bool IECBusConnection::WriteToChannels(const std::vector<char> &device_numbers,
+                                       char channel,
+                                       const std::string &data_string,
+                                       IECStatus *status) {
+  if (!SupportsBroadcast()) {
+    SetError(IECStatus::UNIMPLEMENTED,
+             (boost::format("broadcasts need protocol version %i, the "
+                            "Arduino speaks version %i") %
+              kBroadcastProtocolVersion % protocol_version_)
+                 .str(),
+             status);
+    return false;
+  }
+  if (device_numbers.empty() ||
+      device_numbers.size() > kMaxBroadcastDevices) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("can't broadcast to %u devices, the maximum is "
+                            "%u") %
+              device_numbers.size() % kMaxBroadcastDevices)
+                 .str(),
+             status);
+    return false;
+  }
+  // Empty string, we're done.
+  if (data_string.empty())
+    return true;
+
+  std::string devices(device_numbers.begin(), device_numbers.end());
+  size_t curr_pos = 0;
+  while (curr_pos < data_string.size()) {
+    auto f = RequestResult();
+    size_t to_write =
+        std::min(data_string.size() - curr_pos, kMaxSendPacketSize);
+    std::string request_string =
+        kCmdPutDataMulti + static_cast<char>(devices.size()) + devices +
+        channel + static_cast<char>(to_write) +
+        data_string.substr(curr_pos, to_write);
+    if (!arduino_writer_->WriteString(request_string, status)) {
+      return false;
+    }
+    auto r = f.get();
+    if (!r.second.ok()) {
+      *status = r.second;
+      return false;
+    }
+    curr_pos += to_write;
+  }
+  return true;
+}
+
+bool IECBusConnection::SupportsBroadcast() const {
+  return protocol_version_ >= kBroadcastProtocolVersion;
+}
+
+bool IECBusConnection::ExecuteAndReceiveFast(char device_number,
+                                             const std::string &command,
+                                             size_t num_bytes,
+                                             std::string *result,
+                                             IECStatus *status) {
+  if (!SupportsFastTransfer()) {
+    SetError(IECStatus::UNIMPLEMENTED,
+             (boost::format("fast transfers need protocol version %i, the "
+                            "Arduino speaks version %i") %
+              kFastTransferProtocolVersion % protocol_version_)
+                 .str(),
+             status);
+    return false;
+  }
+  if (num_bytes < 1 || num_bytes > 256 || command.empty() ||
+      command.size() > 255) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("can't receive %u bytes using a %u byte command") %
+              num_bytes % command.size())
+                 .str(),
+             status);
+    return false;
+  }
+  auto f = RequestResult();
+  std::string request_string = kCmdFastGetData + device_number +
+                               static_cast<char>(num_bytes & 0xff) +
+                               static_cast<char>(command.size()) + command;
+  if (!arduino_writer_->WriteString(request_string, status)) {
+    return false;
+  }
+  auto r = f.get();
+  if (!r.second.ok()) {
+    *status = r.second;
+    return false;
+  }
+  if (r.first.size() != num_bytes) {
+    SetError(IECStatus::IEC_CONNECTION_FAILURE,
+             (boost::format("expected %u bytes, received %u") % num_bytes %
+              r.first.size())
+                 .str(),
+             status);
+    return false;
+  }
+  *result = r.first;
+  return true;
+}
+
+bool IECBusConnection::SupportsFastTransfer() const {
+  return protocol_version_ >= kFastTransferProtocolVersion;
+}
+
+bool IECBusConnection::CopyBetweenChannels(char source_device,
+                                           char source_channel,
+                                           char target_device,
+                                           char target_channel,
+                                           IECStatus *status) {
+  if (!SupportsDirectCopy()) {
+    SetError(IECStatus::UNIMPLEMENTED,
+             (boost::format("direct copies need protocol version %i, the "
+                            "Arduino speaks version %i") %
+              kDirectCopyProtocolVersion % protocol_version_)
+                 .str(),
+             status);
+    return false;
+  }
+  auto f = RequestResult();
+  std::string request_string = kCmdCopy + source_device + source_channel +
+                               target_device + target_channel;
+  if (!arduino_writer_->WriteString(request_string, status)) {
+    return false;
+  }
+  auto r = f.get();
+  if (r.second.ok()) {
+    return true;
+  } else {
+    *status = r.second;
+    return false;
+  }
+}
+
+bool IECBusConnection::SupportsDirectCopy() const {
+  return protocol_version_ >= kDirectCopyProtocolVersion;
+}
+
 bool IECBusConnection::CloseChannel(char device_number, char channel,
                                     IECStatus *status) {
   auto f = RequestResult();
@@ -224,10 +391,9 @@ bool IECBusConnection::Initialize(IECStatus *status) {
                         .str());
     }
   }
-  int protocol_version = 0;
   if (sscanf(connection_string.substr(kConnectionStringPrefix.size()).c_str(),
-             "%i", &protocol_version) <= 0 ||
-      protocol_version < kMinProtocolVersion) {
+             "%i", &protocol_version_) <= 0 ||
+      protocol_version_ < kMinProtocolVersion) {
     SetError(IECStatus::CONNECTION_FAILURE,
              std::string("Unsupported protocol: '") + connection_string + "'",
              status);
@@ -341,6 +507,21 @@ void IECBusConnection::ProcessResponses() {
       }
       last_response = unescaped_response;
     } break;
+    case 'b': {
+      // Bulk data response chunk. There may be any number of these, the
+      // status response terminates the data.
+      if (!arduino_writer_->ReadUpTo(1, 1, &read_string, &status)) {
+        log_callback_('E', "CLIENT", status.message);
+        return;
+      }
+      size_t chunk_size = static_cast<unsigned char>(read_string[0]);
+      if (!arduino_writer_->ReadUpTo(chunk_size, chunk_size, &read_string,
+                                     &status)) {
+        log_callback_('E', "CLIENT", status.message);
+        return;
+      }
+      last_response += read_string;
+    } break;
     case 's': {
       // Standard status response message.
       if (!arduino_writer_->ReadTerminatedString('\r', kMaxLength, &read_string,
@@ -11,6 +11,7 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "utils.h"
 
@@ -54,12 +55,51 @@ public:
                               const std::string &data_string,
                               IECStatus *status);
 
+  // Write data_string to channel on all devices listed in device_numbers at
+  // once, so they receive it in parallel. Returns true if successful, sets
+  // status and returns false otherwise, with status UNIMPLEMENTED if the
+  // Arduino doesn't support broadcasts. If data_string has > 256 bytes,
+  // multiple requests will be generated.
+  virtual bool WriteToChannels(const std::vector<char> &device_numbers,
+                               char channel, const std::string &data_string,
+                               IECStatus *status);
+
+  // Returns true if the Arduino supports WriteToChannels().
+  virtual bool SupportsBroadcast() const;
+
   // Close channel on the device with the specific device_number.
   // Returns true on success. In case of an error, status will be
   // set to an appropriate error status.
   virtual bool CloseChannel(char device_number, char channel,
                             IECStatus *status);
 
+  // Write command to the command channel of device_number, typically an M-E
+  // starting drive code which sends num_bytes (1 to 256) using the fast
+  // transfer protocol described in uno2iec/interface.h. Sets *result to the
+  // data received and returns true if successful. Sets status and returns
+  // false otherwise, with status UNIMPLEMENTED if the Arduino doesn't support
+  // fast transfers.
+  virtual bool ExecuteAndReceiveFast(char device_number,
+                                     const std::string &command,
+                                     size_t num_bytes, std::string *result,
+                                     IECStatus *status);
+
+  // Returns true if the Arduino supports ExecuteAndReceiveFast().
+  virtual bool SupportsFastTransfer() const;
+
+  // Have source_device talk on source_channel while target_device listens on
+  // target_channel, so data goes from one device to the other directly. The
+  // Arduino only monitors the transfer until the source signals EOI, nothing
+  // is transferred via serial line. Returns true if successful, sets status
+  // and returns false otherwise, with status UNIMPLEMENTED if the Arduino
+  // doesn't support direct copies.
+  virtual bool CopyBetweenChannels(char source_device, char source_channel,
+                                   char target_device, char target_channel,
+                                   IECStatus *status);
+
+  // Returns true if the Arduino supports CopyBetweenChannels().
+  virtual bool SupportsDirectCopy() const;
+
   // Create IECBusConnection instance using the specified device_file and serial
   // port speed. If log_callback is specified, the function will be called for
   // every log message received from the Arduino. Returns nullptr in case of a
@@ -116,6 +156,10 @@ private:
   // A pipe created in the constructor and used to signal to the background
   // thread that it should terminate execution.
   int tthread_pipe_[2];
+
+  // Protocol version spoken by the Arduino, as announced during
+  // initialization.
+  int protocol_version_ = 0;
 };
 
 #endif // IEC_HOST_LIB_H
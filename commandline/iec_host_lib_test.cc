@@ -53,7 +53,9 @@ protected:
     IECStatus status;
     BufferedReadWriter writer(pipefd_[1]);
     std::string r;
-    EXPECT_TRUE(writer.WriteString("connect_arduino:3\r", &status))
+    EXPECT_TRUE(writer.WriteString(
+        (boost::format("connect_arduino:%u\r") % protocol_version_).str(),
+        &status))
         << status.message;
     EXPECT_TRUE(writer.ReadTerminatedString('\r', 256, &r, &status))
         << status.message;
@@ -84,12 +86,47 @@ protected:
           return;
         r = r + params + cmd_string;
       } break;
+      case 'f': {
+        // Device, number of bytes to receive and size of the command string,
+        // followed by the command string.
+        if (!writer.ReadUpTo(3, 3, &params, &status))
+          return;
+        std::string cmd_string;
+        int num_read = static_cast<unsigned char>(params[2]);
+        if (!writer.ReadUpTo(num_read, num_read, &cmd_string, &status))
+          return;
+        r = r + params + cmd_string;
+      } break;
       case 'g':
+      case 'b':
       case 'c':
         if (!writer.ReadUpTo(2, 2, &params, &status))
           return;
         r = r + params;
         break;
+      case 'x':
+        if (!writer.ReadUpTo(4, 4, &params, &status))
+          return;
+        r = r + params;
+        break;
+      case 'm': {
+        // Number of devices, the devices, channel and data size, followed by
+        // the data.
+        if (!writer.ReadUpTo(1, 1, &params, &status))
+          return;
+        std::string header;
+        int header_size = static_cast<unsigned char>(params[0]) + 2;
+        if (!writer.ReadUpTo(header_size, header_size, &header, &status))
+          return;
+        std::string data;
+        int num_read = static_cast<unsigned char>(header.back());
+        if (num_read == 0) {
+          num_read = 256;
+        }
+        if (!writer.ReadUpTo(num_read, num_read, &data, &status))
+          return;
+        r = r + params + header + data;
+      } break;
       default:
         EXPECT_TRUE(false) << "Unknown command: " << Escape(r) << std::endl;
       }
@@ -122,6 +159,9 @@ protected:
   std::thread producer_;
   int pipefd_[2] = {-1, -1};
 
+  // The protocol version announced by our fake Arduino.
+  int protocol_version_ = 3;
+
   // Provides a map from request to response to be used by the
   // background thread.
   std::map<std::string, std::string> request_response_map_;
@@ -180,3 +220,154 @@ TEST_F(IECBusConnectionTest, BasicProtocolTest) {
                                       &status));
   EXPECT_TRUE(bus_conn.CloseChannel(8, 15, &status));
 }
+
+class IECBusConnectionBulkTest : public IECBusConnectionTest {
+protected:
+  IECBusConnectionBulkTest() { protocol_version_ = 4; }
+};
+
+TEST_F(IECBusConnectionBulkTest, BulkReadTest) {
+  IECBusConnection bus_conn(
+      pipefd_[0],
+      [](char level, const std::string &channel, const std::string &message) {
+        // We'd like to learn about errors we produce.
+        ASSERT_NE(level, 'E') << level << ":" << channel << ": " << message;
+        std::cout << level << ":" << channel << ":" << message;
+      });
+  // Data containing characters that would require escaping, split across
+  // two chunks.
+  std::string data(300, '\r');
+  data[0] = '\\';
+  AddRequestResponse((boost::format("b%c%c") % char(8) % char(3)).str(),
+                     std::string("b\xff") + data.substr(0, 255) + "b\x2d" +
+                         data.substr(255) + "s\r");
+
+  IECStatus status;
+  EXPECT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  std::string response;
+  EXPECT_TRUE(bus_conn.ReadFromChannel(8, 3, &response, &status))
+      << status.message;
+  EXPECT_EQ(response, data);
+}
+
+TEST_F(IECBusConnectionBulkTest, FastTransferUnsupportedTest) {
+  IECBusConnection bus_conn(pipefd_[0], [](char level,
+                                           const std::string &channel,
+                                           const std::string &message) {});
+  IECStatus status;
+  EXPECT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  EXPECT_FALSE(bus_conn.SupportsFastTransfer());
+  std::string response;
+  EXPECT_FALSE(bus_conn.ExecuteAndReceiveFast(8, "M-E\x00\x07", 256,
+                                              &response, &status));
+  EXPECT_EQ(IECStatus::UNIMPLEMENTED, status.status_code);
+}
+
+class IECBusConnectionFastTest : public IECBusConnectionTest {
+protected:
+  IECBusConnectionFastTest() { protocol_version_ = 5; }
+};
+
+TEST_F(IECBusConnectionFastTest, ExecuteAndReceiveFastTest) {
+  IECBusConnection bus_conn(
+      pipefd_[0],
+      [](char level, const std::string &channel, const std::string &message) {
+        // We'd like to learn about errors we produce.
+        ASSERT_NE(level, 'E') << level << ":" << channel << ": " << message;
+        std::cout << level << ":" << channel << ":" << message;
+      });
+  std::string command("M-E\x00\x07\x06\x00", 7);
+  std::string data(256, '\r');
+  // A full page is requested as zero bytes.
+  AddRequestResponse(std::string("f\x08\x00\x07", 4) + command,
+                     std::string("b\x40") + data.substr(0, 64) + "b\x40" +
+                         data.substr(64, 64) + "b\x40" + data.substr(128, 64) +
+                         "b\x40" + data.substr(192) + "s\r");
+  // Receiving fewer bytes than requested is an error.
+  AddRequestResponse(std::string("f\x08\x02\x07", 4) + command,
+                     "b\x01xs\r");
+
+  IECStatus status;
+  EXPECT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  EXPECT_TRUE(bus_conn.SupportsFastTransfer());
+  std::string response;
+  EXPECT_TRUE(bus_conn.ExecuteAndReceiveFast(8, command, 256, &response,
+                                             &status))
+      << status.message;
+  EXPECT_EQ(data, response);
+  EXPECT_FALSE(
+      bus_conn.ExecuteAndReceiveFast(8, command, 2, &response, &status));
+  EXPECT_EQ(IECStatus::IEC_CONNECTION_FAILURE, status.status_code);
+}
+
+TEST_F(IECBusConnectionFastTest, DirectCopyUnsupportedTest) {
+  IECBusConnection bus_conn(pipefd_[0], [](char level,
+                                           const std::string &channel,
+                                           const std::string &message) {});
+  IECStatus status;
+  EXPECT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  EXPECT_FALSE(bus_conn.SupportsDirectCopy());
+  EXPECT_FALSE(bus_conn.CopyBetweenChannels(8, 3, 9, 2, &status));
+  EXPECT_EQ(IECStatus::UNIMPLEMENTED, status.status_code);
+}
+
+class IECBusConnectionDirectCopyTest : public IECBusConnectionTest {
+protected:
+  IECBusConnectionDirectCopyTest() { protocol_version_ = 6; }
+};
+
+TEST_F(IECBusConnectionDirectCopyTest, CopyBetweenChannelsTest) {
+  IECBusConnection bus_conn(
+      pipefd_[0],
+      [](char level, const std::string &channel, const std::string &message) {
+        // We'd like to learn about errors we produce.
+        ASSERT_NE(level, 'E') << level << ":" << channel << ": " << message;
+        std::cout << level << ":" << channel << ":" << message;
+      });
+  AddRequestResponse(std::string("x\x08\x03\x09\x02", 5), "s\r");
+  AddRequestResponse(std::string("x\x08\x03\x0a\x02", 5),
+                     "sSending ATN LISTEN + TALK failed.\r");
+
+  IECStatus status;
+  EXPECT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  EXPECT_TRUE(bus_conn.SupportsDirectCopy());
+  EXPECT_TRUE(bus_conn.CopyBetweenChannels(8, 3, 9, 2, &status))
+      << status.message;
+  EXPECT_FALSE(bus_conn.CopyBetweenChannels(8, 3, 10, 2, &status));
+  EXPECT_EQ(IECStatus::IEC_CONNECTION_FAILURE, status.status_code);
+  EXPECT_EQ(0, status.message.find("Sending ATN LISTEN + TALK failed."));
+}
+
+class IECBusConnectionBroadcastTest : public IECBusConnectionTest {
+protected:
+  IECBusConnectionBroadcastTest() { protocol_version_ = 7; }
+};
+
+TEST_F(IECBusConnectionBroadcastTest, WriteToChannelsTest) {
+  IECBusConnection bus_conn(
+      pipefd_[0],
+      [](char level, const std::string &channel, const std::string &message) {
+        // We'd like to learn about errors we produce.
+        ASSERT_NE(level, 'E') << level << ":" << channel << ": " << message;
+        std::cout << level << ":" << channel << ":" << message;
+      });
+  // A full sector followed by the remainder in a separate request.
+  std::string data(300, 'x');
+  AddRequestResponse(std::string("m\x03\x09\x0a\x0b\x02\x00", 7) +
+                         data.substr(0, 256),
+                     "s\r");
+  AddRequestResponse(std::string("m\x03\x09\x0a\x0b\x02\x2c", 7) +
+                         data.substr(256),
+                     "s\r");
+
+  IECStatus status;
+  EXPECT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  EXPECT_TRUE(bus_conn.SupportsBroadcast());
+  EXPECT_TRUE(bus_conn.WriteToChannels({9, 10, 11}, 2, data, &status))
+      << status.message;
+  EXPECT_FALSE(bus_conn.WriteToChannels({}, 2, data, &status));
+  EXPECT_EQ(IECStatus::INVALID_ARGUMENT, status.status_code);
+  EXPECT_FALSE(bus_conn.WriteToChannels({8, 9, 10, 11, 12, 13, 14, 15, 16}, 2,
+                                        data, &status));
+  EXPECT_EQ(IECStatus::INVALID_ARGUMENT, status.status_code);
+}
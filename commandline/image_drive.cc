@@ -0,0 +1,479 @@
+// DriveInterface implementation on sector based disc images.
+
+#include "image_drive.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "boost/format.hpp"
+
+// 1541 discs of 35, 40 and 42 tracks.
+const ImageGeometry kD64Geometry = {".d64", {683, 768, 802}};
+// Double sided 1571 discs.
+const ImageGeometry kD71Geometry = {".d71", {1366}};
+// 1581 discs of 80 tracks with 40 sectors each.
+const ImageGeometry kD81Geometry = {".d81", {3200}};
+
+static const ImageGeometry *const kImageGeometries[] = {
+    &kD64Geometry, &kD71Geometry, &kD81Geometry};
+
+// Error map entry for a sector without errors. Drive errors 20 to 29 map to
+// entries 2 to 11.
+static const unsigned char kErrorMapOK = 0x01;
+static const unsigned int kErrorMapDriveErrorOffset = 18;
+static const unsigned int kFirstMappedDriveError = 20;
+static const unsigned int kLastMappedDriveError = 29;
+
+// Number of bytes read at once when copying an image.
+static const size_t kCopyBufferSize = 64 * DriveInterface::kNumBytesPerSector;
+
+const char ImageDrive::kPartialSuffix[] = ".part";
+
+// Returns true if all size bytes at data are zero. Comparing the data to
+// itself, shifted by a byte, lets memcmp() do the work with vector
+// instructions.
+static bool IsZeroFilled(const unsigned char *data, size_t size) {
+  return size == 0 || (data[0] == 0 && memcmp(data, data + 1, size - 1) == 0);
+}
+
+const ImageGeometry *FindImageGeometry(const std::string &image_path) {
+  const ImageGeometry *geometry = FindImageGeometryByExtension(image_path);
+  if (geometry)
+    return geometry;
+
+  struct stat stat_buf;
+  if (stat(image_path.c_str(), &stat_buf) != 0)
+    return nullptr;
+  return FindImageGeometryBySize(stat_buf.st_size);
+}
+
+const ImageGeometry *
+FindImageGeometryByExtension(const std::string &image_path) {
+  for (const ImageGeometry *geometry : kImageGeometries) {
+    size_t extension_size = strlen(geometry->extension);
+    if (image_path.size() >= extension_size &&
+        strcasecmp(image_path.c_str() + image_path.size() - extension_size,
+                   geometry->extension) == 0) {
+      return geometry;
+    }
+  }
+  return nullptr;
+}
+
+const ImageGeometry *FindImageGeometryBySize(size_t image_size) {
+  for (const ImageGeometry *geometry : kImageGeometries) {
+    for (size_t num_sectors : geometry->standard_num_sectors) {
+      // Plain or extended by an error map.
+      size_t size = num_sectors * DriveInterface::kNumBytesPerSector;
+      if (image_size == size || image_size == size + num_sectors)
+        return geometry;
+    }
+  }
+  return nullptr;
+}
+
+bool GetImageNumSectors(const ImageGeometry &geometry, size_t image_size,
+                        size_t *num_sectors, IECStatus *status) {
+  for (size_t standard_num_sectors : geometry.standard_num_sectors) {
+    if (image_size ==
+        standard_num_sectors * (DriveInterface::kNumBytesPerSector + 1)) {
+      *num_sectors = standard_num_sectors;
+      return true;
+    }
+  }
+
+  if (image_size % DriveInterface::kNumBytesPerSector > 0) {
+    SetError(IECStatus::DRIVE_ERROR,
+             "GetNumSectors: File size not a multiple of sector size.", status);
+    return false;
+  }
+
+  *num_sectors = image_size / DriveInterface::kNumBytesPerSector;
+  return true;
+}
+
+bool EncodeErrorMap(const std::vector<unsigned int> &error_numbers,
+                    std::string *error_map, IECStatus *status) {
+  error_map->clear();
+  if (std::all_of(error_numbers.begin(), error_numbers.end(),
+                  [](unsigned int e) { return e == 0; })) {
+    return true;
+  }
+  for (unsigned int error_number : error_numbers) {
+    if (error_number == 0) {
+      error_map->append(1, kErrorMapOK);
+    } else if (error_number >= kFirstMappedDriveError &&
+               error_number <= kLastMappedDriveError) {
+      error_map->append(1, error_number - kErrorMapDriveErrorOffset);
+    } else {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("WriteErrorMap: error %u can't be stored") %
+                error_number)
+                   .str(),
+               status);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReplaceImageFile(const std::string &partial_path,
+                      const std::string &image_path, IECStatus *status) {
+  if (rename(partial_path.c_str(), image_path.c_str()) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Commit", status);
+    unlink(partial_path.c_str());
+    return false;
+  }
+
+  // Make the rename itself durable.
+  size_t slash = image_path.find_last_of('/');
+  std::string dir_path = ".";
+  if (slash != std::string::npos)
+    dir_path = image_path.substr(0, std::max<size_t>(slash, 1));
+  int dir_fd = open(dir_path.c_str(), O_RDONLY);
+  if (dir_fd == -1 || fsync(dir_fd) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Commit: " + dir_path, status);
+    if (dir_fd != -1)
+      close(dir_fd);
+    return false;
+  }
+  close(dir_fd);
+  return true;
+}
+
+bool WriteAndCloseFile(int fd, const std::string &content, bool sync,
+                       const std::string &context, IECStatus *status) {
+  bool result = true;
+  for (size_t pos = 0; result && pos < content.size();) {
+    ssize_t res = write(fd, content.data() + pos, content.size() - pos);
+    if (res <= 0) {
+      SetErrorFromErrno(IECStatus::DRIVE_ERROR, context, status);
+      result = false;
+    } else {
+      pos += res;
+    }
+  }
+  if (result && sync && fdatasync(fd) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, context, status);
+    result = false;
+  }
+  if (close(fd) != 0 && result) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, context, status);
+    result = false;
+  }
+  return result;
+}
+
+bool ReplaceFileContent(const std::string &path, const std::string &content,
+                        IECStatus *status) {
+  std::string partial_path = path + ImageDrive::kPartialSuffix;
+  int fd = open(partial_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "ReplaceFileContent: " + path,
+                      status);
+    return false;
+  }
+  if (!WriteAndCloseFile(fd, content, /*sync=*/true,
+                         "ReplaceFileContent: " + path, status)) {
+    unlink(partial_path.c_str());
+    return false;
+  }
+  return ReplaceImageFile(partial_path, path, status);
+}
+
+ImageDrive::ImageDrive(const std::string &image_path, bool read_only,
+                       const ImageGeometry &geometry)
+    : image_path_(image_path), read_only_(read_only), geometry_(geometry) {}
+
+ImageDrive::~ImageDrive() { CloseDiscImage(); }
+
+bool ImageDrive::FormatDiscLowLevel(size_t num_tracks, IECStatus *status) {
+  SetError(IECStatus::UNIMPLEMENTED, "ImageDrive::FormatDiscLowLevel",
+           status);
+  return false;
+}
+
+bool ImageDrive::GetNumSectors(size_t *num_sectors, IECStatus *status) {
+  if (!OpenDiscImage(status))
+    return false;
+  assert(image_fd_ != -1);
+  return GetImageNumSectors(geometry_, image_size_, num_sectors, status);
+}
+
+bool ImageDrive::ReadSector(size_t sector_number, std::string *content,
+                            IECStatus *status) {
+  if (!OpenDiscImage(status))
+    return false;
+  assert(image_fd_ != -1);
+  if ((sector_number + 1) * kNumBytesPerSector > image_size_) {
+    SetError(IECStatus::DRIVE_ERROR,
+             (boost::format("ReadSector: sector %u is beyond the image end") %
+              sector_number)
+                 .str(),
+             status);
+    return false;
+  }
+
+  content->assign(
+      reinterpret_cast<const char *>(image_data_) +
+          sector_number * kNumBytesPerSector,
+      kNumBytesPerSector);
+  return true;
+}
+
+bool ImageDrive::WriteSector(size_t sector_number, const std::string &content,
+                             IECStatus *status) {
+  if (content.size() != kNumBytesPerSector) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("content.size(%u) != kNumBytesPerSector(%u)") %
+              content.size() % kNumBytesPerSector)
+                 .str(),
+             status);
+    return false;
+  }
+  if (!OpenDiscImage(status))
+    return false;
+  assert(image_fd_ != -1);
+  if (read_only_) {
+    SetError(IECStatus::DRIVE_ERROR, "WriteSector: image is read-only",
+             status);
+    return false;
+  }
+  if (!EnsureNumSectors(sector_number + 1, status))
+    return false;
+
+  // Leave sectors which already hold the same content alone. Besides saving
+  // writes of unchanged sectors, this keeps empty sectors of new images as
+  // holes in the file, which take no space on disk.
+  unsigned char *sector_data =
+      image_data_ + sector_number * kNumBytesPerSector;
+  if (memcmp(sector_data, content.data(), kNumBytesPerSector) == 0)
+    return true;
+  memcpy(sector_data, content.data(), kNumBytesPerSector);
+  return true;
+}
+
+bool ImageDrive::WriteErrorMap(const std::vector<unsigned int> &error_numbers,
+                               IECStatus *status) {
+  std::string error_map;
+  if (!EncodeErrorMap(error_numbers, &error_map, status))
+    return false;
+
+  if (!OpenDiscImage(status))
+    return false;
+  assert(image_fd_ != -1);
+  if (read_only_) {
+    SetError(IECStatus::DRIVE_ERROR, "WriteErrorMap: image is read-only",
+             status);
+    return false;
+  }
+  // Drop anything the image held beyond the error map, including a previous
+  // one if there's no error map this time.
+  size_t map_offset = error_numbers.size() * kNumBytesPerSector;
+  if (!ResizeDiscImage(map_offset + error_map.size(), status))
+    return false;
+  memcpy(image_data_ + map_offset, error_map.data(), error_map.size());
+  return true;
+}
+
+bool ImageDrive::ReadCommandChannel(std::string *response,
+                                    IECStatus *status) {
+  bool result = OpenDiscImage(status);
+  if (result) {
+    *response = "Accessing image '" + image_path_ + "'";
+  }
+  return result;
+}
+
+bool ImageDrive::Flush(IECStatus *status) {
+  if (image_fd_ == -1 || read_only_)
+    return true;
+  if (image_data_ != nullptr && image_size_ > 0 &&
+      msync(image_data_, image_size_, MS_SYNC) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Flush", status);
+    return false;
+  }
+  // Growing the image changed its size, which msync() doesn't cover.
+  if (fdatasync(image_fd_) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Flush", status);
+    return false;
+  }
+  return true;
+}
+
+bool ImageDrive::Commit(IECStatus *status) {
+  if (image_fd_ == -1 || read_only_)
+    return true;
+  if (!Flush(status) || !UnmapDiscImage(status))
+    return false;
+  int res = close(image_fd_);
+  image_fd_ = -1;
+  std::string partial_path = image_path_ + kPartialSuffix;
+  if (res != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Commit", status);
+    unlink(partial_path.c_str());
+    return false;
+  }
+  return ReplaceImageFile(partial_path, image_path_, status);
+}
+
+bool ImageDrive::OpenDiscImage(IECStatus *status) {
+  if (image_fd_ != -1) {
+    return true;
+  }
+
+  if (read_only_) {
+    image_fd_ = open(image_path_.c_str(), O_RDONLY);
+  } else {
+    // Start over if a previous attempt left a copy behind.
+    image_fd_ = open((image_path_ + kPartialSuffix).c_str(),
+                     O_RDWR | O_CREAT | O_TRUNC, S_IRWXU | S_IRWXG);
+  }
+  if (image_fd_ == -1) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "OpenDiscImage", status);
+    return false;
+  }
+  if ((!read_only_ && !CopyDiscImage(status)) ||
+      (image_data_ == nullptr && !MapDiscImage(0, status))) {
+    CloseDiscImage();
+    return false;
+  }
+  return true;
+}
+
+bool ImageDrive::CopyDiscImage(IECStatus *status) {
+  int source_fd = open(image_path_.c_str(), O_RDONLY);
+  if (source_fd == -1) {
+    if (errno == ENOENT)
+      return true;
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "CopyDiscImage", status);
+    return false;
+  }
+
+  struct stat stat_buf;
+  bool result = fstat(source_fd, &stat_buf) == 0;
+  if (!result) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "CopyDiscImage", status);
+  } else if (stat_buf.st_size > 0) {
+    // The copy starts out as a hole, which empty sectors are left as.
+    result = ResizeDiscImage(stat_buf.st_size, status);
+    std::vector<unsigned char> buffer(kCopyBufferSize);
+    for (size_t pos = 0; result && pos < image_size_;) {
+      size_t size = std::min(buffer.size(), image_size_ - pos);
+      for (size_t buffer_pos = 0; result && buffer_pos < size;) {
+        ssize_t res =
+            read(source_fd, buffer.data() + buffer_pos, size - buffer_pos);
+        if (res <= 0) {
+          SetErrorFromErrno(
+              IECStatus::DRIVE_ERROR,
+              (boost::format("CopyDiscImage: read returned %d") % res).str(),
+              status);
+          result = false;
+        }
+        buffer_pos += std::max<ssize_t>(res, 0);
+      }
+      for (size_t offset = 0; result && offset < size;
+           offset += kNumBytesPerSector) {
+        size_t length = std::min<size_t>(kNumBytesPerSector, size - offset);
+        if (!IsZeroFilled(buffer.data() + offset, length))
+          memcpy(image_data_ + pos + offset, buffer.data() + offset, length);
+      }
+      pos += size;
+    }
+  }
+  close(source_fd);
+  return result;
+}
+
+bool ImageDrive::MapDiscImage(size_t capacity, IECStatus *status) {
+  assert(image_data_ == nullptr);
+  struct stat stat_buf;
+  if (fstat(image_fd_, &stat_buf) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "MapDiscImage", status);
+    return false;
+  }
+  image_size_ = stat_buf.st_size;
+  // Empty mappings aren't possible. The image gets mapped once it grows.
+  size_t size = std::max(image_size_, capacity);
+  if (size == 0)
+    return true;
+
+  int prot = read_only_ ? PROT_READ : PROT_READ | PROT_WRITE;
+  void *data = mmap(nullptr, size, prot, MAP_SHARED, image_fd_, 0);
+  if (data == MAP_FAILED) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "MapDiscImage", status);
+    return false;
+  }
+  image_data_ = static_cast<unsigned char *>(data);
+  mapped_size_ = size;
+  return true;
+}
+
+bool ImageDrive::UnmapDiscImage(IECStatus *status) {
+  if (image_data_ == nullptr)
+    return true;
+  int res = munmap(image_data_, mapped_size_);
+  image_data_ = nullptr;
+  mapped_size_ = 0;
+  if (res != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "UnmapDiscImage", status);
+    return false;
+  }
+  return true;
+}
+
+void ImageDrive::CloseDiscImage() {
+  if (image_fd_ == -1)
+    return;
+  // Ignore failures, we can't do anything about them here.
+  IECStatus status;
+  if (!UnmapDiscImage(&status)) {
+    std::cerr << "ImageDrive: " << status.message << std::endl;
+  }
+  if (close(image_fd_) != 0) {
+    std::cerr << "ImageDrive: close() failed: " << strerror(errno)
+              << std::endl;
+  }
+  image_fd_ = -1;
+  if (!read_only_) {
+    unlink((image_path_ + kPartialSuffix).c_str());
+  }
+}
+
+bool ImageDrive::ResizeDiscImage(size_t size, IECStatus *status) {
+  if (ftruncate(image_fd_, size) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "ResizeDiscImage", status);
+    return false;
+  }
+  if (size <= mapped_size_) {
+    image_size_ = size;
+    return true;
+  }
+
+  // Reserve room for the smallest standard layout holding the image and its
+  // error map, so growing the image sector by sector maps it only once.
+  size_t capacity = size;
+  for (size_t standard_num_sectors : geometry_.standard_num_sectors) {
+    if (standard_num_sectors * (kNumBytesPerSector + 1) >= size) {
+      capacity = standard_num_sectors * (kNumBytesPerSector + 1);
+      break;
+    }
+  }
+  return UnmapDiscImage(status) && MapDiscImage(capacity, status);
+}
+
+bool ImageDrive::EnsureNumSectors(size_t num_sectors, IECStatus *status) {
+  if (num_sectors * kNumBytesPerSector <= image_size_)
+    return true;
+  return ResizeDiscImage(num_sectors * kNumBytesPerSector, status);
+}
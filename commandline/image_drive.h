@@ -0,0 +1,165 @@
+// DriveInterface implementation on sector based disc images, such as d64, d71
+// and d81 images. The image is mapped into memory while it is in use, which
+// turns sector accesses into plain copies.
+// Writable images are modified in a copy next to the image, which replaces the
+// image once Commit() is called. Readers of the image never see a partially
+// written image.
+
+#ifndef IMAGE_DRIVE_H
+#define IMAGE_DRIVE_H
+
+#include <string>
+#include <vector>
+
+#include "drive_interface.h"
+
+// Describes the layout of an image format, whose images hold the content of
+// each sector in order.
+struct ImageGeometry {
+  // File name extension of images in this format.
+  const char *extension;
+
+  // Number of sectors of the standard layouts, from smallest to largest.
+  // Extended images of these layouts are followed by an error map holding one
+  // byte per sector.
+  std::vector<size_t> standard_num_sectors;
+};
+
+extern const ImageGeometry kD64Geometry;
+extern const ImageGeometry kD71Geometry;
+extern const ImageGeometry kD81Geometry;
+
+// Returns the geometry of the image at image_path, identified by its extension
+// or, failing that, its size. Returns nullptr if neither is known.
+const ImageGeometry *FindImageGeometry(const std::string &image_path);
+
+// Returns the geometry of images with the extension image_path ends in,
+// nullptr if there is none.
+const ImageGeometry *
+FindImageGeometryByExtension(const std::string &image_path);
+
+// Returns the geometry having a standard layout of image_size bytes, with or
+// without error map, nullptr if there is none.
+const ImageGeometry *FindImageGeometryBySize(size_t image_size);
+
+// Set *num_sectors to the number of sectors held by an image of image_size
+// bytes in the format described by geometry. Returns true if successful, sets
+// status otherwise.
+bool GetImageNumSectors(const ImageGeometry &geometry, size_t image_size,
+                        size_t *num_sectors, IECStatus *status);
+
+// Encode error_numbers, as passed to DriveInterface::WriteErrorMap(), as the
+// error map appended to extended images. If none of the sectors has an
+// error, *error_map is left empty, as such discs don't need one. Returns true
+// if successful, sets status if any of the errors can't be stored.
+bool EncodeErrorMap(const std::vector<unsigned int> &error_numbers,
+                    std::string *error_map, IECStatus *status);
+
+// Replace the image at image_path by the completely written image at
+// partial_path and make sure the change is durable. Returns true if
+// successful, removes partial_path and sets status otherwise.
+bool ReplaceImageFile(const std::string &partial_path,
+                      const std::string &image_path, IECStatus *status);
+
+// Write content to fd, which is closed afterwards. If sync is true, wait for
+// the content to reach the disk first. context prefixes error messages.
+// Returns true if successful, sets status otherwise.
+bool WriteAndCloseFile(int fd, const std::string &content, bool sync,
+                       const std::string &context, IECStatus *status);
+
+// Replace the file at path by one holding content, which is written to a
+// copy first, like images are, so path is never left partially written.
+// Returns true if successful, sets status otherwise.
+bool ReplaceFileContent(const std::string &path, const std::string &content,
+                        IECStatus *status);
+
+class ImageDrive : public DriveInterface {
+public:
+  // Instantiate a image drive object based on image_path, laid out as
+  // described by geometry, which must outlive the drive. If read_only is
+  // true, the image file is expected to exist and will be opened in readonly
+  // mode. Attempts to write to the image will fail.
+  ImageDrive(const std::string &image_path, bool read_only,
+             const ImageGeometry &geometry);
+
+  // Unmaps the image. Changes which haven't been committed are discarded.
+  ~ImageDrive();
+
+  bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override;
+  bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
+  bool ReadSector(size_t sector_number, std::string *content,
+                  IECStatus *status) override;
+  // Sectors already holding the same content are left untouched, so empty
+  // sectors of a new image remain holes in the image file.
+  bool WriteSector(size_t sector_number, const std::string &content,
+                   IECStatus *status) override;
+  // Appends the error map to the image, making it an extended image of
+  // error_numbers.size() sectors.
+  bool WriteErrorMap(const std::vector<unsigned int> &error_numbers,
+                     IECStatus *status) override;
+  bool ReadCommandChannel(std::string *response, IECStatus *status) override;
+
+  // Write modified sectors back to the copy being written and wait for the
+  // writes to complete. Returns true if successful, sets status otherwise.
+  bool Flush(IECStatus *status);
+
+  // Flush the changes made and replace the image by the modified copy. The
+  // image is opened again when accessed after this. Copies aren't resumed,
+  // so this is the only time they're made durable.
+  bool Commit(IECStatus *status) override;
+
+  // Suffix appended to the image path to name the copy being written.
+  static const char kPartialSuffix[];
+
+protected:
+  // Open and map the disc image if it isn't already open. Writable images
+  // are copied first. In case of an error, returns false and sets status.
+  bool OpenDiscImage(IECStatus *status);
+
+  // The mapped image file, nullptr unless the image is mapped.
+  unsigned char *image_data_ = nullptr;
+
+  // Size of the image file in bytes.
+  size_t image_size_ = 0;
+
+private:
+  // Copy the content of the image at image_path_, if it exists, to the
+  // freshly opened copy.
+  bool CopyDiscImage(IECStatus *status);
+
+  // Map the image file, reserving room for it to grow to capacity bytes
+  // without mapping it again. Empty files without reserved room aren't
+  // mapped.
+  bool MapDiscImage(size_t capacity, IECStatus *status);
+
+  // Unmap the image, if it is mapped.
+  bool UnmapDiscImage(IECStatus *status);
+
+  // Close the image, discarding uncommitted changes.
+  void CloseDiscImage();
+
+  // Change the size of the image file to size bytes, mapping it again if it
+  // grows beyond the room reserved.
+  bool ResizeDiscImage(size_t size, IECStatus *status);
+
+  // Make sure the image holds num_sectors sectors, growing it if necessary.
+  bool EnsureNumSectors(size_t num_sectors, IECStatus *status);
+
+  // Path to the disc image we're operating on.
+  std::string image_path_;
+
+  // True if image should be opened read-only.
+  bool read_only_;
+
+  const ImageGeometry &geometry_;
+
+  // If the image is opened, contains the file descriptor used to
+  // access it. For writable images, this refers to the copy being written.
+  int image_fd_ = -1;
+
+  // Number of bytes mapped at image_data_. This may exceed the size of the
+  // image file to leave room for growing it.
+  size_t mapped_size_ = 0;
+};
+
+#endif // IMAGE_DRIVE_H
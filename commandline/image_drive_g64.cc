@@ -0,0 +1,81 @@
+// Read-only DriveInterface implementation on G64 images.
+
+#include "image_drive_g64.h"
+
+#include "boost/format.hpp"
+#include "g64_image.h"
+
+// Highest track a G64 image may hold sectors on, for 42 track discs.
+static const unsigned int kMaxTrack = 42;
+
+ImageDriveG64::ImageDriveG64(const std::string &image_path)
+    : ImageDrive(image_path, /*read_only=*/true, kD64Geometry) {}
+
+bool ImageDriveG64::GetNumSectors(size_t *num_sectors, IECStatus *status) {
+  if (!OpenDiscImage(status))
+    return false;
+
+  // Number of sectors up to the last track the image holds.
+  size_t num_used_sectors = 0;
+  size_t num_track_end_sectors = 0;
+  for (unsigned int track = 1; track <= kMaxTrack; ++track) {
+    std::string gcr;
+    if (!GetG64TrackGCR(image_data_, image_size_, track, &gcr, status))
+      return false;
+    num_track_end_sectors += GetNumSectorsOnTrack(track);
+    if (!gcr.empty())
+      num_used_sectors = num_track_end_sectors;
+  }
+
+  // The largest layout covers all kMaxTrack tracks.
+  for (size_t standard_num_sectors : kD64Geometry.standard_num_sectors) {
+    *num_sectors = standard_num_sectors;
+    if (standard_num_sectors >= num_used_sectors)
+      break;
+  }
+  return true;
+}
+
+bool ImageDriveG64::ReadSector(size_t sector_number, std::string *content,
+                               IECStatus *status) {
+  unsigned int track = 1;
+  size_t sector = sector_number;
+  while (track <= kMaxTrack && sector >= GetNumSectorsOnTrack(track)) {
+    sector -= GetNumSectorsOnTrack(track);
+    ++track;
+  }
+  if (track > kMaxTrack) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("sector %u is out of range") % sector_number)
+                 .str(),
+             status);
+    return false;
+  }
+  if (!DecodeTrack(track, status))
+    return false;
+
+  if (error_numbers_[sector] != 0) {
+    // Report the error the way the drive would.
+    SetError(IECStatus::DRIVE_ERROR,
+             (boost::format("%02u,READ ERROR,%02u,%02u") %
+              error_numbers_[sector] % track % sector)
+                 .str(),
+             status);
+    return false;
+  }
+  *content = decoded_sectors_[sector];
+  return true;
+}
+
+bool ImageDriveG64::DecodeTrack(unsigned int track, IECStatus *status) {
+  if (track == decoded_track_)
+    return true;
+  if (!OpenDiscImage(status))
+    return false;
+  std::string gcr;
+  if (!GetG64TrackGCR(image_data_, image_size_, track, &gcr, status))
+    return false;
+  DecodeGCRTrack(gcr, track, &decoded_sectors_, &error_numbers_);
+  decoded_track_ = track;
+  return true;
+}
@@ -0,0 +1,37 @@
+// Read-only DriveInterface implementation on G64 images, which decodes the
+// sectors of each track from its raw GCR data when they are read.
+
+#ifndef IMAGE_DRIVE_G64_H
+#define IMAGE_DRIVE_G64_H
+
+#include <string>
+#include <vector>
+
+#include "image_drive.h"
+
+class ImageDriveG64 : public ImageDrive {
+public:
+  // Instantiate a drive reading from the G64 image at image_path.
+  explicit ImageDriveG64(const std::string &image_path);
+
+  // Returns the number of sectors of the smallest 1541 disc layout covering
+  // all tracks the image holds.
+  bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
+  // Sectors which the drive couldn't read from the GCR data fail with a
+  // DRIVE_ERROR status carrying the drive's error message.
+  bool ReadSector(size_t sector_number, std::string *content,
+                  IECStatus *status) override;
+
+private:
+  // Decode the sectors of track, unless they were decoded last.
+  bool DecodeTrack(unsigned int track, IECStatus *status);
+
+  // The track decoded last, zero if none.
+  unsigned int decoded_track_ = 0;
+
+  // Content and drive error number of each sector on decoded_track_.
+  std::vector<std::string> decoded_sectors_;
+  std::vector<unsigned int> error_numbers_;
+};
+
+#endif // IMAGE_DRIVE_G64_H
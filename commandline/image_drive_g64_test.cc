@@ -0,0 +1,137 @@
+#include <boost/filesystem.hpp>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "image_drive_g64.h"
+
+#include "g64_image.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+// GCR code of each nibble.
+static const unsigned char kGCREncodeTable[16] = {
+    0x0a, 0x0b, 0x12, 0x13, 0x0e, 0x0f, 0x16, 0x17,
+    0x09, 0x19, 0x1a, 0x1b, 0x0d, 0x1d, 0x1e, 0x15};
+
+// Returns the GCR encoding of data, whose size must be a multiple of four.
+static std::string EncodeGCR(const std::string &data) {
+  std::string gcr;
+  for (size_t i = 0; i < data.size(); i += 4) {
+    unsigned long long bits = 0;
+    for (size_t j = 0; j < 4; ++j) {
+      unsigned char c = data[i + j];
+      bits = (bits << 10) | (kGCREncodeTable[c >> 4] << 5) |
+             kGCREncodeTable[c & 0x0f];
+    }
+    for (int shift = 32; shift >= 0; shift -= 8) {
+      gcr.append(1, char((bits >> shift) & 0xff));
+    }
+  }
+  return gcr;
+}
+
+// Returns the content of sector on track used by the tests.
+static std::string GetTestSector(unsigned int track, unsigned int sector) {
+  std::string content;
+  for (size_t c = 0; c < DriveInterface::kNumBytesPerSector; ++c) {
+    content.append(1, char(track * 7 + sector + c));
+  }
+  return content;
+}
+
+// Returns the GCR data of track as formatted by a 1541, holding the test
+// content in each sector.
+static std::string FormatTestTrack(unsigned int track) {
+  std::string gcr;
+  for (unsigned int sector = 0; sector < GetNumSectorsOnTrack(track);
+       ++sector) {
+    std::string header = {0x08, 0, char(sector), char(track), 'A', 'B',
+                          0x0f, 0x0f};
+    header[1] = header[2] ^ header[3] ^ header[4] ^ header[5];
+    std::string content = GetTestSector(track, sector);
+    char checksum = 0;
+    for (char c : content) {
+      checksum ^= c;
+    }
+    std::string data = "\x07" + content + checksum + std::string(2, '\0');
+    gcr += std::string(5, '\xff') + EncodeGCR(header) +
+           std::string(9, '\x55') + std::string(5, '\xff') + EncodeGCR(data) +
+           std::string(8, '\x55');
+  }
+  return gcr;
+}
+
+class ImageDriveG64Test : public ::testing::Test {
+public:
+  void SetUp() {
+    image_path_ =
+        (boost::filesystem::temp_directory_path() / "image_XXXXXX").string();
+    close(mkstemp(&image_path_[0]));
+  }
+
+  void TearDown() { EXPECT_EQ(unlink(image_path_.c_str()), 0); }
+
+protected:
+  // Path to a generated test image.
+  std::string image_path_;
+};
+
+TEST_F(ImageDriveG64Test, ReadSectorTest) {
+  std::map<unsigned int, std::string> tracks = {{1, FormatTestTrack(1)},
+                                                {18, FormatTestTrack(18)}};
+  // Start track 18 in the middle of a data block, so the block wraps around.
+  tracks[18] = tracks[18].substr(200) + tracks[18].substr(0, 200);
+  IECStatus status;
+  ASSERT_TRUE(WriteG64Image(image_path_, tracks, &status)) << status.message;
+  EXPECT_TRUE(HasG64Signature(image_path_));
+
+  ImageDriveG64 drive(image_path_);
+  size_t num_sectors = 0;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 683);
+
+  for (unsigned int sector = 0; sector < 21; ++sector) {
+    std::string content;
+    EXPECT_TRUE(drive.ReadSector(sector, &content, &status)) << status.message;
+    EXPECT_EQ(content, GetTestSector(1, sector)) << sector;
+  }
+  for (unsigned int sector = 0; sector < 19; ++sector) {
+    std::string content;
+    EXPECT_TRUE(drive.ReadSector(357 + sector, &content, &status))
+        << status.message;
+    EXPECT_EQ(content, GetTestSector(18, sector)) << sector;
+  }
+
+  // Tracks the image doesn't hold have no sector headers.
+  std::string content;
+  EXPECT_FALSE(drive.ReadSector(21, &content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+  EXPECT_EQ(status.message.find("20,READ ERROR,02,00"), 0u) << status.message;
+
+  // G64 images are read-only.
+  status.Clear();
+  EXPECT_FALSE(drive.WriteSector(0, GetTestSector(1, 0), &status));
+}
+
+TEST_F(ImageDriveG64Test, ChecksumErrorTest) {
+  std::string track = FormatTestTrack(1);
+  // Change content bytes 3 to 6 of sector 0, keeping the GCR codes valid.
+  const size_t kContentStart = 5 + 10 + 9 + 5 + 5;
+  std::string data = EncodeGCR("\x11\x22\x33\x44");
+  track.replace(kContentStart, data.size(), data);
+  IECStatus status;
+  ASSERT_TRUE(WriteG64Image(image_path_, {{1, track}, {40, track}}, &status))
+      << status.message;
+
+  ImageDriveG64 drive(image_path_);
+  size_t num_sectors = 0;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 768);
+
+  std::string content;
+  EXPECT_FALSE(drive.ReadSector(0, &content, &status));
+  EXPECT_EQ(status.message.find("23,READ ERROR,01,00"), 0u) << status.message;
+  status.Clear();
+  EXPECT_TRUE(drive.ReadSector(1, &content, &status)) << status.message;
+  EXPECT_EQ(content, GetTestSector(1, 1));
+}
@@ -0,0 +1,288 @@
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "image_drive.h"
+
+#include "boost/format.hpp"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+const size_t kTestImageNumSectors = 768;
+
+class ImageDriveTest : public ::testing::Test {
+public:
+  void SetUp() {
+    // Create a temp image we'll be working it and populate it.
+    image_path_ =
+        (boost::filesystem::temp_directory_path() / "image_XXXXXX").string();
+    // Requires C++11.
+    int fd = mkstemp(&image_path_[0]);
+    for (size_t s = 0; s < kTestImageNumSectors; ++s) {
+      unsigned char buffer[DriveInterface::kNumBytesPerSector];
+      FillTestBuffer(buffer, s);
+      EXPECT_TRUE(write(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    }
+    EXPECT_TRUE(close(fd) == 0);
+  }
+
+  void TearDown() {
+    // Remove image.
+    EXPECT_TRUE(unlink(image_path_.c_str()) == 0);
+  }
+
+protected:
+  void FillTestBuffer(unsigned char *buffer, size_t sector_number) {
+    for (size_t c = 0; c < DriveInterface::kNumBytesPerSector; ++c) {
+      // Fill buffer with a counter starting at sector number for each
+      // sector and wrapping over as required.
+      buffer[c] = (sector_number + c) % 256;
+    }
+  }
+
+  // Path to a generated test image.
+  std::string image_path_;
+};
+
+TEST_F(ImageDriveTest, ReadSectorTest) {
+  ImageDrive drive(image_path_, /*read_only=*/true, kD64Geometry);
+
+  IECStatus status;
+  size_t num_sectors = 0;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status));
+  EXPECT_EQ(num_sectors, kTestImageNumSectors);
+
+  // Read all the sectors on the disc, in reverse order to make sure
+  // we're seeking to the requested sector.
+  for (int s = num_sectors - 1; s >= 0; --s) {
+    std::string content;
+    EXPECT_TRUE(drive.ReadSector(s, &content, &status)) << status.message;
+
+    // We expect our sector content to match.
+    std::string golden;
+    golden.resize(DriveInterface::kNumBytesPerSector);
+    FillTestBuffer(reinterpret_cast<unsigned char *>(&golden[0]), s);
+    EXPECT_EQ(golden, content);
+  }
+}
+
+TEST_F(ImageDriveTest, ErrorMapTest) {
+  std::vector<unsigned int> error_numbers(kTestImageNumSectors, 0);
+  error_numbers[5] = 23;
+  error_numbers[767] = 20;
+  {
+    ImageDrive drive(image_path_, /*read_only=*/false, kD64Geometry);
+    IECStatus status;
+    EXPECT_TRUE(drive.WriteErrorMap(error_numbers, &status)) << status.message;
+
+    // Errors outside the range covered by the error map are rejected.
+    error_numbers[1] = 74;
+    EXPECT_FALSE(drive.WriteErrorMap(error_numbers, &status));
+    EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+    status.Clear();
+    EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  }
+
+  // The error map follows the sector content.
+  struct stat stat_buf;
+  ASSERT_EQ(stat(image_path_.c_str(), &stat_buf), 0);
+  ASSERT_EQ(stat_buf.st_size, 197376);
+  int fd = open(image_path_.c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+  std::string error_map(kTestImageNumSectors, '\0');
+  EXPECT_EQ(pread(fd, &error_map[0], error_map.size(),
+                  kTestImageNumSectors * DriveInterface::kNumBytesPerSector),
+            static_cast<ssize_t>(error_map.size()));
+  EXPECT_EQ(close(fd), 0);
+  for (size_t s = 0; s < kTestImageNumSectors; ++s) {
+    EXPECT_EQ(error_map[s], s == 5 ? 5 : s == 767 ? 2 : 1) << s;
+  }
+
+  // Extended images hold as many sectors as before.
+  {
+    ImageDrive drive(image_path_, /*read_only=*/true, kD64Geometry);
+    IECStatus status;
+    size_t num_sectors = 0;
+    EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+    EXPECT_EQ(num_sectors, kTestImageNumSectors);
+  }
+
+  // Recording a clean copy drops the error map.
+  {
+    ImageDrive drive(image_path_, /*read_only=*/false, kD64Geometry);
+    IECStatus status;
+    std::vector<unsigned int> no_errors(kTestImageNumSectors, 0);
+    EXPECT_TRUE(drive.WriteErrorMap(no_errors, &status)) << status.message;
+    EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  }
+  ASSERT_EQ(stat(image_path_.c_str(), &stat_buf), 0);
+  EXPECT_EQ(stat_buf.st_size,
+            kTestImageNumSectors * DriveInterface::kNumBytesPerSector);
+}
+
+TEST_F(ImageDriveTest, WriteSectorTest) {
+  std::string content(DriveInterface::kNumBytesPerSector, 'x');
+  {
+    ImageDrive drive(image_path_, /*read_only=*/false, kD64Geometry);
+    IECStatus status;
+    EXPECT_TRUE(drive.WriteSector(17, content, &status)) << status.message;
+    std::string read_back;
+    EXPECT_TRUE(drive.ReadSector(17, &read_back, &status)) << status.message;
+    EXPECT_EQ(read_back, content);
+    EXPECT_TRUE(drive.Flush(&status)) << status.message;
+
+    // Only full sectors can be written.
+    EXPECT_FALSE(drive.WriteSector(18, "short", &status));
+    EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+    status.Clear();
+    EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  }
+
+  // The change made it to the file.
+  int fd = open(image_path_.c_str(), O_RDONLY);
+  ASSERT_NE(fd, -1);
+  std::string file_content(DriveInterface::kNumBytesPerSector, '\0');
+  EXPECT_EQ(pread(fd, &file_content[0], file_content.size(),
+                  17 * DriveInterface::kNumBytesPerSector),
+            static_cast<ssize_t>(file_content.size()));
+  EXPECT_EQ(close(fd), 0);
+  EXPECT_EQ(file_content, content);
+
+  // Read-only images reject writes.
+  ImageDrive drive(image_path_, /*read_only=*/true, kD64Geometry);
+  IECStatus status;
+  EXPECT_FALSE(drive.WriteSector(17, content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+}
+
+TEST_F(ImageDriveTest, GrowNewImageTest) {
+  ASSERT_EQ(unlink(image_path_.c_str()), 0);
+  ImageDrive drive(image_path_, /*read_only=*/false, kD64Geometry);
+  IECStatus status;
+  size_t num_sectors = 1;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 0);
+  std::string content;
+  EXPECT_FALSE(drive.ReadSector(0, &content, &status));
+  status.Clear();
+
+  // New images grow with the sectors written, so their size tells the
+  // progress of a copy.
+  content.assign(DriveInterface::kNumBytesPerSector, 'a');
+  EXPECT_TRUE(drive.WriteSector(0, content, &status)) << status.message;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 1);
+  EXPECT_TRUE(drive.WriteSector(700, content, &status)) << status.message;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 701);
+
+  // Growing keeps what the image held.
+  std::string read_back;
+  EXPECT_TRUE(drive.ReadSector(0, &read_back, &status)) << status.message;
+  EXPECT_EQ(read_back, content);
+  EXPECT_TRUE(drive.ReadSector(1, &read_back, &status)) << status.message;
+  EXPECT_EQ(read_back, std::string(DriveInterface::kNumBytesPerSector, '\0'));
+
+  // The image only appears once it is complete.
+  struct stat stat_buf;
+  EXPECT_NE(stat(image_path_.c_str(), &stat_buf), 0);
+  EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  ASSERT_EQ(stat(image_path_.c_str(), &stat_buf), 0);
+  EXPECT_EQ(stat_buf.st_size, 701 * DriveInterface::kNumBytesPerSector);
+}
+
+TEST_F(ImageDriveTest, SparseImageTest) {
+  ASSERT_EQ(unlink(image_path_.c_str()), 0);
+  IECStatus status;
+  std::string content(DriveInterface::kNumBytesPerSector, 'a');
+  std::string empty(DriveInterface::kNumBytesPerSector, '\0');
+  {
+    ImageDrive drive(image_path_, /*read_only=*/false, kD64Geometry);
+    EXPECT_TRUE(drive.WriteSector(0, content, &status)) << status.message;
+    for (size_t s = 1; s < 683; ++s) {
+      EXPECT_TRUE(drive.WriteSector(s, empty, &status)) << status.message;
+    }
+    EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  }
+
+  // Empty sectors take no space, also once the image has been modified.
+  struct stat stat_buf;
+  ASSERT_EQ(stat(image_path_.c_str(), &stat_buf), 0);
+  EXPECT_EQ(stat_buf.st_size, 683 * DriveInterface::kNumBytesPerSector);
+  EXPECT_LT(stat_buf.st_blocks * 512, stat_buf.st_size / 4);
+  {
+    ImageDrive drive(image_path_, /*read_only=*/false, kD64Geometry);
+    EXPECT_TRUE(drive.WriteSector(682, content, &status)) << status.message;
+    EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  }
+  ASSERT_EQ(stat(image_path_.c_str(), &stat_buf), 0);
+  EXPECT_LT(stat_buf.st_blocks * 512, stat_buf.st_size / 4);
+
+  ImageDrive drive(image_path_, /*read_only=*/true, kD64Geometry);
+  std::string read_back;
+  EXPECT_TRUE(drive.ReadSector(0, &read_back, &status)) << status.message;
+  EXPECT_EQ(read_back, content);
+  EXPECT_TRUE(drive.ReadSector(300, &read_back, &status)) << status.message;
+  EXPECT_EQ(read_back, empty);
+  EXPECT_TRUE(drive.ReadSector(682, &read_back, &status)) << status.message;
+  EXPECT_EQ(read_back, content);
+}
+
+TEST_F(ImageDriveTest, UncommittedWriteTest) {
+  std::string partial_path = image_path_ + ImageDrive::kPartialSuffix;
+  std::string content(DriveInterface::kNumBytesPerSector, 'x');
+  struct stat stat_buf;
+  {
+    ImageDrive drive(image_path_, /*read_only=*/false, kD64Geometry);
+    IECStatus status;
+    EXPECT_TRUE(drive.WriteSector(3, content, &status)) << status.message;
+
+    // Changes go to a complete copy of the image.
+    ASSERT_EQ(stat(partial_path.c_str(), &stat_buf), 0);
+    EXPECT_EQ(stat_buf.st_size,
+              kTestImageNumSectors * DriveInterface::kNumBytesPerSector);
+  }
+
+  // Without committing, the image stays as it was and the copy is gone.
+  EXPECT_NE(stat(partial_path.c_str(), &stat_buf), 0);
+  ImageDrive drive(image_path_, /*read_only=*/true, kD64Geometry);
+  IECStatus status;
+  std::string read_back;
+  EXPECT_TRUE(drive.ReadSector(3, &read_back, &status)) << status.message;
+  std::string golden(DriveInterface::kNumBytesPerSector, '\0');
+  FillTestBuffer(reinterpret_cast<unsigned char *>(&golden[0]), 3);
+  EXPECT_EQ(read_back, golden);
+}
+
+TEST_F(ImageDriveTest, GeometryTest) {
+  // Extensions decide, regardless of the image's size.
+  EXPECT_EQ(FindImageGeometry("disc.d71"), &kD71Geometry);
+  EXPECT_EQ(FindImageGeometry("DISC.D81"), &kD81Geometry);
+  EXPECT_EQ(FindImageGeometry("disc.d64"), &kD64Geometry);
+  EXPECT_EQ(FindImageGeometry(image_path_), &kD64Geometry);
+  EXPECT_EQ(FindImageGeometry("/nonexistent/disc"), nullptr);
+
+  // Extended images of a standard layout report its number of sectors.
+  ASSERT_EQ(truncate(image_path_.c_str(), 1366 * 257), 0);
+  EXPECT_EQ(FindImageGeometry(image_path_), &kD71Geometry);
+  {
+    ImageDrive drive(image_path_, /*read_only=*/true, kD71Geometry);
+    IECStatus status;
+    size_t num_sectors = 0;
+    EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+    EXPECT_EQ(num_sectors, 1366);
+  }
+
+  ASSERT_EQ(truncate(image_path_.c_str(), 3200 * 256), 0);
+  EXPECT_EQ(FindImageGeometry(image_path_), &kD81Geometry);
+  ImageDrive drive(image_path_, /*read_only=*/true, kD81Geometry);
+  IECStatus status;
+  size_t num_sectors = 0;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 3200);
+  std::string content;
+  EXPECT_TRUE(drive.ReadSector(3199, &content, &status)) << status.message;
+}
@@ -0,0 +1,26 @@
+// Mock of IECBusConnection shared by the tests of drives talking to it.
+
+#ifndef MOCK_IEC_BUS_CONNECTION_H
+#define MOCK_IEC_BUS_CONNECTION_H
+
+#include "iec_host_lib.h"
+#include "gmock/gmock.h"
+
+class MockIECBusConnection : public IECBusConnection {
+public:
+  MockIECBusConnection() : IECBusConnection(0, nullptr) {}
+
+  MOCK_METHOD1(Reset, bool(IECStatus *status));
+  MOCK_METHOD4(OpenChannel,
+               bool(char device_number, char channel,
+                    const std::string &data_string, IECStatus *status));
+  MOCK_METHOD4(ReadFromChannel, bool(char device_number, char channel,
+                                     std::string *result, IECStatus *status));
+  MOCK_METHOD4(WriteToChannel,
+               bool(char device_number, char channel,
+                    const std::string &data_string, IECStatus *status));
+  MOCK_METHOD3(CloseChannel,
+               bool(char device_number, char channel, IECStatus *status));
+};
+
+#endif // MOCK_IEC_BUS_CONNECTION_H
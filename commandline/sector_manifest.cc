@@ -0,0 +1,81 @@
+// Manifests of the content of a disc.
+
+#include "sector_manifest.h"
+
+#include <assert.h>
+
+#include "boost/format.hpp"
+#include "image_drive.h"
+
+SectorManifest::SectorManifest(const std::vector<unsigned int> &sector_tracks)
+    : sector_tracks_(sector_tracks), sectors_(sector_tracks.size()) {}
+
+void SectorManifest::AddSector(size_t sector_number,
+                               const std::string &content,
+                               unsigned int error_number) {
+  assert(sector_number < sectors_.size());
+  Sector &sector = sectors_[sector_number];
+  sector.known = true;
+  sector.digest = Crc32c(content);
+  sector.disc_digest = Fnv1a64(content);
+  sector.error_number = error_number;
+}
+
+std::string SectorManifest::Format() const {
+  std::string manifest =
+      (boost::format("disc %016x %u\n") % GetDiscDigest() % sectors_.size())
+          .str();
+  for (size_t first_sector = 0; first_sector < sectors_.size();) {
+    unsigned int track = sector_tracks_[first_sector];
+    size_t end_sector = first_sector + 1;
+    while (end_sector < sectors_.size() && sector_tracks_[end_sector] == track)
+      ++end_sector;
+    manifest += (boost::format("track %u %08x\n") % track %
+                 CombineDigests(first_sector, end_sector))
+                    .str();
+    for (size_t s = first_sector; s < end_sector; ++s) {
+      const Sector &sector = sectors_[s];
+      if (!sector.known) {
+        manifest += (boost::format("sector %u -\n") % s).str();
+      } else if (sector.error_number != 0) {
+        manifest += (boost::format("sector %u %08x error %u\n") % s %
+                     sector.digest % sector.error_number)
+                        .str();
+      } else {
+        manifest +=
+            (boost::format("sector %u %08x\n") % s % sector.digest).str();
+      }
+    }
+    first_sector = end_sector;
+  }
+  return manifest;
+}
+
+bool SectorManifest::Write(const std::string &path, IECStatus *status) const {
+  return ReplaceFileContent(path, Format(), status);
+}
+
+uint32_t SectorManifest::CombineDigests(size_t first_sector,
+                                        size_t end_sector) const {
+  std::string digests;
+  for (size_t s = first_sector; s < end_sector; ++s) {
+    if (!sectors_[s].known)
+      continue;
+    for (int shift = 0; shift < 32; shift += 8) {
+      digests.append(1, static_cast<char>(sectors_[s].digest >> shift));
+    }
+  }
+  return Crc32c(digests);
+}
+
+uint64_t SectorManifest::GetDiscDigest() const {
+  std::string digests;
+  for (const Sector &sector : sectors_) {
+    if (!sector.known)
+      continue;
+    for (int shift = 0; shift < 64; shift += 8) {
+      digests.append(1, static_cast<char>(sector.disc_digest >> shift));
+    }
+  }
+  return Fnv1a64(digests);
+}
@@ -0,0 +1,66 @@
+// Manifests of the content of a disc, holding a CRC-32C digest of each
+// sector and each track, and a 64 bit digest of the whole disc. Comparing
+// manifests tells whether discs, tracks or sectors match without access to
+// their content.
+//
+// A manifest is a text file with a line
+//   disc <digest> <number of sectors>
+// followed by the tracks in order, each with a line
+//   track <track> <digest>
+// followed by a line for each of its sectors
+//   sector <sector number> <digest> [error <drive error number>]
+// Sectors are numbered linearly, as by DriveInterface. The digest of a track
+// is the CRC-32C of the digests of its sectors, each as 4 bytes in little
+// endian order. The digest of the disc is the Fnv1a64() of the Fnv1a64() of
+// the content of all sectors, each as 8 bytes in little endian order, so it
+// tells apart discs whose sectors only share their CRC-32C. Sectors whose
+// content is unknown have the digest "-" and are left out of the track's and
+// disc's digest.
+
+#ifndef SECTOR_MANIFEST_H
+#define SECTOR_MANIFEST_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+class SectorManifest {
+public:
+  // Instantiate an empty manifest of a disc whose sectors are located on
+  // the tracks listed in sector_tracks, one for each sector.
+  explicit SectorManifest(const std::vector<unsigned int> &sector_tracks);
+
+  // Record content as the content of sector_number. error_number holds the
+  // drive's error number if the sector couldn't be read, zero otherwise.
+  void AddSector(size_t sector_number, const std::string &content,
+                 unsigned int error_number);
+
+  // Returns the manifest in its textual form.
+  std::string Format() const;
+
+  // Write the manifest to path, which is only replaced once the manifest is
+  // complete. Returns true if successful, sets status otherwise.
+  bool Write(const std::string &path, IECStatus *status) const;
+
+private:
+  struct Sector {
+    bool known = false;
+    uint32_t digest = 0;
+    uint64_t disc_digest = 0; // Fnv1a64() of the content.
+    unsigned int error_number = 0;
+  };
+
+  // Returns the CRC-32C of the digests of the known sectors among
+  // [first_sector, end_sector).
+  uint32_t CombineDigests(size_t first_sector, size_t end_sector) const;
+
+  // Returns the digest of the disc, as described above.
+  uint64_t GetDiscDigest() const;
+
+  std::vector<unsigned int> sector_tracks_;
+  std::vector<Sector> sectors_;
+};
+
+#endif // SECTOR_MANIFEST_H
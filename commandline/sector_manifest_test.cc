@@ -0,0 +1,58 @@
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+
+#include "sector_manifest.h"
+
+#include "boost/format.hpp"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+TEST(SectorManifestTest, FormatTest) {
+  SectorManifest manifest({1, 1, 2, 2});
+  manifest.AddSector(0, "123456789", 0);
+  manifest.AddSector(1, "123456789", 23);
+  manifest.AddSector(3, std::string(32, '\0'), 0);
+
+  std::string digests_1("\x83\x92\x06\xe3\x83\x92\x06\xe3", 8);
+  std::string digests_2("\xaa\x36\x91\x8a", 4);
+  // The disc digest is based on 64 bit digests of the content instead.
+  std::string disc_digests;
+  for (const std::string &content :
+       {std::string("123456789"), std::string("123456789"),
+        std::string(32, '\0')}) {
+    uint64_t digest = Fnv1a64(content);
+    for (int shift = 0; shift < 64; shift += 8)
+      disc_digests.append(1, static_cast<char>(digest >> shift));
+  }
+  std::string expected =
+      (boost::format("disc %016x 4\n"
+                     "track 1 %08x\n"
+                     "sector 0 e3069283\n"
+                     "sector 1 e3069283 error 23\n"
+                     "track 2 %08x\n"
+                     "sector 2 -\n"
+                     "sector 3 8a9136aa\n") %
+       Fnv1a64(disc_digests) % Crc32c(digests_1) % Crc32c(digests_2))
+          .str();
+  EXPECT_EQ(manifest.Format(), expected);
+}
+
+TEST(SectorManifestTest, WriteTest) {
+  boost::filesystem::path path = boost::filesystem::temp_directory_path() /
+                                 boost::filesystem::unique_path();
+  SectorManifest manifest({1});
+  manifest.AddSector(0, "123456789", 0);
+  IECStatus status;
+  ASSERT_TRUE(manifest.Write(path.string(), &status)) << status.message;
+
+  std::ifstream file(path.string());
+  std::stringstream content;
+  content << file.rdbuf();
+  EXPECT_EQ(content.str(), manifest.Format());
+  EXPECT_FALSE(boost::filesystem::exists(path.string() + ".part"));
+  boost::filesystem::remove(path);
+
+  EXPECT_FALSE(manifest.Write("/nonexistent/manifest", &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+}
@@ -0,0 +1,231 @@
+// Patches holding the sectors in which two discs differ.
+
+#include "sector_patch.h"
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+
+#include "boost/format.hpp"
+
+static const char kPatchSignature[] = "CBMP";
+static const unsigned char kPatchVersion = 1;
+static const size_t kHeaderSize = sizeof(kPatchSignature) - 1 + 1 + 3 * 2;
+static const size_t kEntrySize = 2 * 2 + DriveInterface::kNumBytesPerSector;
+
+static void AppendUInt16(size_t value, std::string *encoded) {
+  encoded->append(1, static_cast<char>(value & 0xff));
+  encoded->append(1, static_cast<char>((value >> 8) & 0xff));
+}
+
+static size_t GetUInt16(const std::string &encoded, size_t pos) {
+  return static_cast<unsigned char>(encoded[pos]) |
+         static_cast<unsigned char>(encoded[pos + 1]) << 8;
+}
+
+bool DiffDrives(DriveInterface *old_drive, DriveInterface *new_drive,
+                bool use_checksums, SectorPatch *patch, IECStatus *status) {
+  if (!old_drive->GetNumSectors(&patch->old_num_sectors, status) ||
+      !new_drive->GetNumSectors(&patch->new_num_sectors, status)) {
+    return false;
+  }
+  patch->entries.clear();
+
+  std::vector<size_t> sector_numbers(patch->new_num_sectors);
+  std::iota(sector_numbers.begin(), sector_numbers.end(), 0);
+  std::map<size_t, std::string> new_contents;
+  if (!new_drive->ReadSectorList(sector_numbers, &new_contents, status))
+    return false;
+
+  // Find the sectors both discs hold which differ, and read their old
+  // content.
+  size_t num_common_sectors =
+      std::min(patch->old_num_sectors, patch->new_num_sectors);
+  std::vector<size_t> mismatches;
+  if (use_checksums) {
+    std::vector<unsigned short int> expected;
+    for (size_t s = 0; s < num_common_sectors; ++s) {
+      expected.push_back(Crc16(new_contents[s]));
+    }
+    if (!old_drive->VerifySectors(0, expected, &mismatches, status))
+      return false;
+  } else {
+    mismatches.assign(sector_numbers.begin(),
+                      sector_numbers.begin() + num_common_sectors);
+  }
+  std::map<size_t, std::string> old_contents;
+  if (!old_drive->ReadSectorList(mismatches, &old_contents, status))
+    return false;
+
+  for (size_t s = 0; s < patch->new_num_sectors; ++s) {
+    unsigned short int old_checksum = 0;
+    if (s < num_common_sectors) {
+      auto old_content = old_contents.find(s);
+      if (old_content == old_contents.end() ||
+          old_content->second == new_contents[s]) {
+        continue;
+      }
+      old_checksum = Crc16(old_content->second);
+    }
+    patch->entries.push_back({s, old_checksum, new_contents[s]});
+  }
+  return true;
+}
+
+bool ApplySectorPatch(const SectorPatch &patch, DriveInterface *drive,
+                      IECStatus *status) {
+  size_t num_sectors = 0;
+  if (!drive->GetNumSectors(&num_sectors, status))
+    return false;
+  if (num_sectors != patch.old_num_sectors) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("ApplySectorPatch: disc holds %u sectors, the "
+                            "patch was made for %u") %
+              num_sectors % patch.old_num_sectors)
+                 .str(),
+             status);
+    return false;
+  }
+  // Drives can grow to hold the new disc's sectors, but there's no way to
+  // drop the ones the new disc lacks.
+  if (patch.new_num_sectors < patch.old_num_sectors) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("ApplySectorPatch: the patch shrinks the disc to "
+                            "%u sectors, which isn't supported") %
+              patch.new_num_sectors)
+                 .str(),
+             status);
+    return false;
+  }
+
+  // Make sure each sector holds either its old or its new content. The drive
+  // checks consecutive sectors at once.
+  std::vector<bool> skip_entry(patch.entries.size(), false);
+  for (size_t first = 0; first < patch.entries.size();) {
+    size_t end = first;
+    std::vector<unsigned short int> expected;
+    while (end < patch.entries.size() &&
+           patch.entries[end].sector_number < patch.old_num_sectors &&
+           patch.entries[end].sector_number ==
+               patch.entries[first].sector_number + (end - first)) {
+      expected.push_back(patch.entries[end].old_checksum);
+      ++end;
+    }
+    if (end == first) {
+      // Sectors beyond the old disc's end hold nothing to check.
+      ++first;
+      continue;
+    }
+    std::vector<size_t> mismatches;
+    if (!drive->VerifySectors(patch.entries[first].sector_number, expected,
+                              &mismatches, status)) {
+      return false;
+    }
+    for (size_t s : mismatches) {
+      size_t entry = first + (s - patch.entries[first].sector_number);
+      std::vector<size_t> new_mismatches;
+      if (!drive->VerifySectors(s, {Crc16(patch.entries[entry].content)},
+                                &new_mismatches, status)) {
+        return false;
+      }
+      if (!new_mismatches.empty()) {
+        SetError(IECStatus::DRIVE_ERROR,
+                 (boost::format("ApplySectorPatch: sector %u doesn't hold the "
+                                "content the patch was made for") %
+                  s)
+                     .str(),
+                 status);
+        return false;
+      }
+      skip_entry[entry] = true;
+    }
+    first = end;
+  }
+
+  // Write consecutive sectors at once, so drives can write them in batches.
+  for (size_t first = 0; first < patch.entries.size();) {
+    if (skip_entry[first]) {
+      ++first;
+      continue;
+    }
+    std::vector<std::string> contents;
+    size_t end = first;
+    while (end < patch.entries.size() && !skip_entry[end] &&
+           patch.entries[end].sector_number ==
+               patch.entries[first].sector_number + (end - first)) {
+      contents.push_back(patch.entries[end].content);
+      ++end;
+    }
+    if (!drive->WriteSectors(patch.entries[first].sector_number, contents,
+                             status)) {
+      return false;
+    }
+    first = end;
+  }
+  return true;
+}
+
+void EncodeSectorPatch(const SectorPatch &patch, std::string *encoded) {
+  encoded->assign(kPatchSignature, sizeof(kPatchSignature) - 1);
+  encoded->append(1, static_cast<char>(kPatchVersion));
+  AppendUInt16(patch.old_num_sectors, encoded);
+  AppendUInt16(patch.new_num_sectors, encoded);
+  AppendUInt16(patch.entries.size(), encoded);
+  for (const SectorPatch::Entry &entry : patch.entries) {
+    AppendUInt16(entry.sector_number, encoded);
+    AppendUInt16(entry.old_checksum, encoded);
+    encoded->append(entry.content);
+  }
+}
+
+bool DecodeSectorPatch(const std::string &encoded, SectorPatch *patch,
+                       IECStatus *status) {
+  if (encoded.size() < kHeaderSize ||
+      encoded.compare(0, sizeof(kPatchSignature) - 1, kPatchSignature) != 0) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             "DecodeSectorPatch: not a sector patch", status);
+    return false;
+  }
+  size_t pos = sizeof(kPatchSignature) - 1;
+  unsigned int version = static_cast<unsigned char>(encoded[pos++]);
+  if (version != kPatchVersion) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("DecodeSectorPatch: unknown version %u") % version)
+                 .str(),
+             status);
+    return false;
+  }
+  patch->old_num_sectors = GetUInt16(encoded, pos);
+  patch->new_num_sectors = GetUInt16(encoded, pos + 2);
+  size_t num_entries = GetUInt16(encoded, pos + 4);
+  pos += 6;
+  if (encoded.size() != kHeaderSize + num_entries * kEntrySize) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("DecodeSectorPatch: size %u doesn't match %u "
+                            "entries") %
+              encoded.size() % num_entries)
+                 .str(),
+             status);
+    return false;
+  }
+
+  patch->entries.clear();
+  for (size_t i = 0; i < num_entries; ++i, pos += kEntrySize) {
+    SectorPatch::Entry entry = {
+        GetUInt16(encoded, pos),
+        static_cast<unsigned short int>(GetUInt16(encoded, pos + 2)),
+        encoded.substr(pos + 4, DriveInterface::kNumBytesPerSector)};
+    if (entry.sector_number >= patch->new_num_sectors ||
+        (!patch->entries.empty() &&
+         entry.sector_number <= patch->entries.back().sector_number)) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("DecodeSectorPatch: entry %u is out of order") %
+                i)
+                   .str(),
+               status);
+      return false;
+    }
+    patch->entries.push_back(std::move(entry));
+  }
+  return true;
+}
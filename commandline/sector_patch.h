@@ -0,0 +1,64 @@
+// Patches holding the sectors in which two discs differ. Applying the patch
+// to a disc holding the old content only writes those sectors, which takes a
+// fraction of the time of writing the entire disc.
+//
+// Encoded patches start with a header of
+//   4 bytes  signature "CBMP"
+//   1 byte   format version, currently 1
+//   2 bytes  number of sectors of the old disc
+//   2 bytes  number of sectors of the new disc
+//   2 bytes  number of entries
+// followed by the entries, in ascending order of their sectors, each of
+//   2 bytes    sector number
+//   2 bytes    Crc16() of the sector's old content, zero beyond the old disc
+//   256 bytes  the sector's new content
+// Numbers are stored in little endian order.
+
+#ifndef SECTOR_PATCH_H
+#define SECTOR_PATCH_H
+
+#include <string>
+#include <vector>
+
+#include "drive_interface.h"
+
+struct SectorPatch {
+  struct Entry {
+    size_t sector_number;
+    unsigned short int old_checksum;
+    std::string content;
+  };
+
+  size_t old_num_sectors = 0;
+  size_t new_num_sectors = 0;
+  std::vector<Entry> entries;
+};
+
+// Set *patch to the sectors of new_drive which differ from old_drive. If
+// use_checksums is true, sectors are compared by having old_drive verify
+// their checksums, which is faster for drives that can calculate them on
+// their own, but misses changes that keep the 16 bit checksum. Otherwise,
+// they're compared byte by byte. Sectors beyond the end of new_drive are
+// ignored. Returns true if successful, sets status otherwise.
+bool DiffDrives(DriveInterface *old_drive, DriveInterface *new_drive,
+                bool use_checksums, SectorPatch *patch, IECStatus *status);
+
+// Write the sectors of patch to drive, which is expected to hold the old
+// content the patch was created for. Sectors already holding their new
+// content are skipped, so a patch can be applied again after a failure.
+// Patches for a new disc with fewer sectors than the old one are rejected,
+// since drives can't drop sectors. Returns true if successful. If drive
+// holds different content, or if writing fails, sets status and returns
+// false.
+bool ApplySectorPatch(const SectorPatch &patch, DriveInterface *drive,
+                      IECStatus *status);
+
+// Encode patch in the format described above.
+void EncodeSectorPatch(const SectorPatch &patch, std::string *encoded);
+
+// Decode the patch in encoded into *patch. Returns true if successful, sets
+// status otherwise.
+bool DecodeSectorPatch(const std::string &encoded, SectorPatch *patch,
+                       IECStatus *status);
+
+#endif // SECTOR_PATCH_H
@@ -0,0 +1,124 @@
+#include <boost/filesystem.hpp>
+
+#include "image_drive.h"
+#include "sector_patch.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test_disc.h"
+
+class SectorPatchTest : public TestDiscTest {
+public:
+  void SetUp() override {
+    TestDiscTest::SetUp();
+    old_path_ = (directory_ / "old.d64").string();
+    new_path_ = (directory_ / "new.d64").string();
+    WriteTestImage(old_path_, {});
+    WriteTestImage(new_path_, {5, 6, 7, 400});
+  }
+
+protected:
+  // Returns the content of sector s of the test images, or of its changed
+  // version.
+  static std::string GetTestSector(size_t s, bool changed) {
+    return GetFilledSector(static_cast<char>(changed ? 0xff - s % 128 : s));
+  }
+
+  // Write a 35 track test image, changing the sectors listed in changed.
+  void WriteTestImage(const std::string &image_path,
+                      const std::set<size_t> &changed) {
+    ImageDrive drive(image_path, /*read_only=*/false, kD64Geometry);
+    WriteTestDisc(&drive, [&changed](size_t s) {
+      return GetTestSector(s, changed.count(s) != 0);
+    });
+    IECStatus status;
+    ASSERT_TRUE(drive.Commit(&status)) << status.message;
+  }
+
+  std::string old_path_;
+  std::string new_path_;
+};
+
+TEST_F(SectorPatchTest, DiffAndApplyTest) {
+  for (bool use_checksums : {false, true}) {
+    WriteTestImage(old_path_, {});
+    IECStatus status;
+    SectorPatch patch;
+    {
+      ImageDrive old_drive(old_path_, /*read_only=*/true, kD64Geometry);
+      ImageDrive new_drive(new_path_, /*read_only=*/true, kD64Geometry);
+      ASSERT_TRUE(DiffDrives(&old_drive, &new_drive, use_checksums, &patch,
+                             &status))
+          << status.message;
+    }
+    EXPECT_EQ(patch.old_num_sectors, 683);
+    EXPECT_EQ(patch.new_num_sectors, 683);
+    ASSERT_EQ(patch.entries.size(), 4);
+    EXPECT_EQ(patch.entries[0].sector_number, 5);
+    EXPECT_EQ(patch.entries[0].old_checksum, Crc16(GetTestSector(5, false)));
+    EXPECT_EQ(patch.entries[0].content, GetTestSector(5, true));
+    EXPECT_EQ(patch.entries[3].sector_number, 400);
+
+    std::string encoded;
+    EncodeSectorPatch(patch, &encoded);
+    EXPECT_EQ(encoded.size(), 11 + 4 * 260);
+    SectorPatch decoded;
+    ASSERT_TRUE(DecodeSectorPatch(encoded, &decoded, &status))
+        << status.message;
+    ASSERT_EQ(decoded.entries.size(), 4);
+    EXPECT_EQ(decoded.entries[3].content, GetTestSector(400, true));
+
+    // Applying the patch twice has the same effect as applying it once.
+    for (int i = 0; i < 2; ++i) {
+      ImageDrive drive(old_path_, /*read_only=*/false, kD64Geometry);
+      EXPECT_TRUE(ApplySectorPatch(decoded, &drive, &status))
+          << status.message;
+      EXPECT_TRUE(drive.Commit(&status)) << status.message;
+    }
+    ImageDrive old_drive(old_path_, /*read_only=*/true, kD64Geometry);
+    ImageDrive new_drive(new_path_, /*read_only=*/true, kD64Geometry);
+    EXPECT_TRUE(DiffDrives(&old_drive, &new_drive, use_checksums, &patch,
+                           &status))
+        << status.message;
+    EXPECT_TRUE(patch.entries.empty());
+  }
+}
+
+TEST_F(SectorPatchTest, MismatchTest) {
+  IECStatus status;
+  SectorPatch patch;
+  {
+    ImageDrive old_drive(old_path_, /*read_only=*/true, kD64Geometry);
+    ImageDrive new_drive(new_path_, /*read_only=*/true, kD64Geometry);
+    ASSERT_TRUE(
+        DiffDrives(&old_drive, &new_drive, /*use_checksums=*/false, &patch,
+                   &status))
+        << status.message;
+  }
+
+  // Patches are only applied to discs holding the content they were made
+  // for, leaving other discs untouched.
+  ImageDrive drive(old_path_, /*read_only=*/false, kD64Geometry);
+  EXPECT_TRUE(drive.WriteSector(6, GetTestSector(0, false), &status));
+  EXPECT_FALSE(ApplySectorPatch(patch, &drive, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+  std::string content;
+  EXPECT_TRUE(drive.ReadSector(5, &content, &status)) << status.message;
+  EXPECT_EQ(content, GetTestSector(5, false));
+
+  // So are patches for a smaller disc, which would leave the sectors beyond
+  // its end in place.
+  SectorPatch shrinking_patch = patch;
+  shrinking_patch.new_num_sectors = 664;
+  EXPECT_FALSE(ApplySectorPatch(shrinking_patch, &drive, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
+  // So are patches that don't decode.
+  std::string encoded;
+  EncodeSectorPatch(patch, &encoded);
+  EXPECT_FALSE(DecodeSectorPatch(encoded.substr(0, encoded.size() - 1),
+                                 &patch, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  encoded[0] = 'X';
+  EXPECT_FALSE(DecodeSectorPatch(encoded, &patch, &status));
+}
@@ -0,0 +1,337 @@
+// DriveInterface implementation on a content-addressed sector store.
+
+#include "sector_store_drive.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "boost/format.hpp"
+#include "image_drive.h"
+
+const char SectorStoreDrive::kPathPrefix[] = "cas://";
+
+// Directories within the store holding objects and manifests.
+static const char kObjectsDir[] = "/objects";
+static const char kDiscsDir[] = "/discs";
+
+// Prefix of the manifest line naming the error map.
+static const char kErrorMapTag[] = "errors ";
+
+// Create the directory at path unless it exists. Returns true if successful,
+// sets status otherwise.
+static bool MakeDirectory(const std::string &path, IECStatus *status) {
+  if (mkdir(path.c_str(), S_IRWXU | S_IRWXG) != 0 && errno != EEXIST) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "mkdir " + path, status);
+    return false;
+  }
+  return true;
+}
+
+uint64_t SectorStoreDrive::HashContent(const std::string &content) {
+  // Objects are compared when they're stored, so collisions can't go
+  // unnoticed.
+  return Fnv1a64(content);
+}
+
+SectorStoreDrive::SectorStoreDrive(const std::string &store_path,
+                                   const std::string &disc_name,
+                                   bool read_only)
+    : store_path_(store_path), disc_name_(disc_name), read_only_(read_only) {}
+
+bool SectorStoreDrive::FormatDiscLowLevel(size_t num_tracks,
+                                          IECStatus *status) {
+  SetError(IECStatus::UNIMPLEMENTED, "SectorStoreDrive::FormatDiscLowLevel",
+           status);
+  return false;
+}
+
+bool SectorStoreDrive::GetNumSectors(size_t *num_sectors, IECStatus *status) {
+  if (!LoadManifest(status))
+    return false;
+  *num_sectors = sector_hashes_.size();
+  return true;
+}
+
+bool SectorStoreDrive::ReadSector(size_t sector_number, std::string *content,
+                                  IECStatus *status) {
+  if (!LoadManifest(status))
+    return false;
+  if (sector_number >= sector_hashes_.size()) {
+    SetError(IECStatus::DRIVE_ERROR,
+             (boost::format("ReadSector: sector %u is beyond the disc end") %
+              sector_number)
+                 .str(),
+             status);
+    return false;
+  }
+  return LoadObject(sector_hashes_[sector_number], kNumBytesPerSector,
+                    content, status);
+}
+
+bool SectorStoreDrive::WriteSector(size_t sector_number,
+                                   const std::string &content,
+                                   IECStatus *status) {
+  if (content.size() != kNumBytesPerSector) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("content.size(%u) != kNumBytesPerSector(%u)") %
+              content.size() % kNumBytesPerSector)
+                 .str(),
+             status);
+    return false;
+  }
+  if (read_only_) {
+    SetError(IECStatus::DRIVE_ERROR, "WriteSector: disc is read-only",
+             status);
+    return false;
+  }
+  uint64_t hash = HashContent(content);
+  if (!LoadManifest(status) || !StoreObject(hash, content, status) ||
+      !FillSectors(sector_number + 1, status)) {
+    return false;
+  }
+  sector_hashes_[sector_number] = hash;
+  return true;
+}
+
+bool SectorStoreDrive::WriteErrorMap(
+    const std::vector<unsigned int> &error_numbers, IECStatus *status) {
+  std::string error_map;
+  if (!EncodeErrorMap(error_numbers, &error_map, status))
+    return false;
+  if (read_only_) {
+    SetError(IECStatus::DRIVE_ERROR, "WriteErrorMap: disc is read-only",
+             status);
+    return false;
+  }
+  if (!LoadManifest(status) || !FillSectors(error_numbers.size(), status))
+    return false;
+  // Like extended images, the disc ends where the error map does.
+  sector_hashes_.resize(error_numbers.size());
+  // Drop a previous error map if the disc doesn't need one anymore.
+  has_error_map_ = !error_map.empty();
+  if (!has_error_map_)
+    return true;
+  uint64_t hash = HashContent(error_map);
+  if (!StoreObject(hash, error_map, status))
+    return false;
+  error_map_hash_ = hash;
+  return true;
+}
+
+bool SectorStoreDrive::ReadCommandChannel(std::string *response,
+                                          IECStatus *status) {
+  bool result = LoadManifest(status);
+  if (result) {
+    *response = "Accessing disc '" + disc_name_ + "' in sector store '" +
+                store_path_ + "'";
+  }
+  return result;
+}
+
+bool SectorStoreDrive::Commit(IECStatus *status) {
+  if (read_only_ || !manifest_loaded_)
+    return true;
+
+  // Objects aren't synced one by one, which would take a sync per sector.
+  // Syncing the file system they're on makes all of them durable at once,
+  // before the manifest refers to them.
+  int store_fd = open(store_path_.c_str(), O_RDONLY);
+  if (store_fd == -1 || syncfs(store_fd) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Commit: " + store_path_,
+                      status);
+    if (store_fd != -1)
+      close(store_fd);
+    return false;
+  }
+  close(store_fd);
+
+  std::string manifest;
+  char line[32];
+  for (uint64_t hash : sector_hashes_) {
+    snprintf(line, sizeof(line), "%016" PRIx64 "\n", hash);
+    manifest += line;
+  }
+  if (has_error_map_) {
+    snprintf(line, sizeof(line), "%s%016" PRIx64 "\n", kErrorMapTag,
+             error_map_hash_);
+    manifest += line;
+  }
+
+  std::string manifest_path = store_path_ + kDiscsDir + "/" + disc_name_;
+  return ReplaceFileContent(manifest_path, manifest, status);
+}
+
+bool SectorStoreDrive::LoadManifest(IECStatus *status) {
+  if (manifest_loaded_)
+    return true;
+
+  if (!read_only_ && (!MakeDirectory(store_path_, status) ||
+                      !MakeDirectory(store_path_ + kObjectsDir, status) ||
+                      !MakeDirectory(store_path_ + kDiscsDir, status))) {
+    return false;
+  }
+
+  std::string manifest_path = store_path_ + kDiscsDir + "/" + disc_name_;
+  FILE *file = fopen(manifest_path.c_str(), "r");
+  if (file == nullptr) {
+    if (!read_only_ && errno == ENOENT) {
+      manifest_loaded_ = true;
+      return true;
+    }
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "LoadManifest", status);
+    return false;
+  }
+
+  std::vector<uint64_t> sector_hashes;
+  bool has_error_map = false;
+  uint64_t error_map_hash = 0;
+  bool result = true;
+  char line[64];
+  for (size_t line_number = 1; fgets(line, sizeof(line), file) != nullptr;
+       ++line_number) {
+    bool is_error_map =
+        strncmp(line, kErrorMapTag, strlen(kErrorMapTag)) == 0;
+    const char *hex = is_error_map ? line + strlen(kErrorMapTag) : line;
+    uint64_t hash;
+    int end = 0;
+    if (sscanf(hex, "%16" SCNx64 "\n%n", &hash, &end) != 1)
+      end = 0;
+    // Nothing may follow the error map.
+    if (end == 0 || hex[end] != '\0' || has_error_map) {
+      SetError(IECStatus::DRIVE_ERROR,
+               (boost::format("LoadManifest: %s: malformed line %u") %
+                manifest_path % line_number)
+                   .str(),
+               status);
+      result = false;
+      break;
+    }
+    if (is_error_map) {
+      has_error_map = true;
+      error_map_hash = hash;
+    } else {
+      sector_hashes.push_back(hash);
+    }
+  }
+  if (result && ferror(file)) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "LoadManifest", status);
+    result = false;
+  }
+  fclose(file);
+  if (!result)
+    return false;
+
+  sector_hashes_ = std::move(sector_hashes);
+  has_error_map_ = has_error_map;
+  error_map_hash_ = error_map_hash;
+  manifest_loaded_ = true;
+  return true;
+}
+
+std::string SectorStoreDrive::GetObjectPath(uint64_t hash) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%016" PRIx64, hash);
+  // Spread objects over subdirectories, keeping directories small.
+  return store_path_ + kObjectsDir + "/" + std::string(name, 2) + "/" +
+         std::string(name + 2);
+}
+
+bool SectorStoreDrive::StoreObject(uint64_t hash, const std::string &content,
+                                   IECStatus *status) {
+  if (stored_hashes_.count(hash) > 0)
+    return true;
+
+  std::string object_path = GetObjectPath(hash);
+  struct stat stat_buf;
+  if (stat(object_path.c_str(), &stat_buf) == 0) {
+    std::string stored_content;
+    if (!LoadObject(hash, content.size(), &stored_content, status))
+      return false;
+    if (stored_content != content) {
+      SetError(IECStatus::DRIVE_ERROR,
+               "StoreObject: hash collision with " + object_path, status);
+      return false;
+    }
+    stored_hashes_.insert(hash);
+    return true;
+  }
+  if (errno != ENOENT) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "StoreObject: " + object_path,
+                      status);
+    return false;
+  }
+
+  // Write to a file of our own first, so concurrent writers of the same
+  // content never see each other's partial objects.
+  std::string dir_path = object_path.substr(0, object_path.find_last_of('/'));
+  if (!MakeDirectory(dir_path, status))
+    return false;
+  std::string partial_path = object_path + ".XXXXXX";
+  int fd = mkstemp(&partial_path[0]);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "StoreObject", status);
+    return false;
+  }
+  if (!WriteAndCloseFile(fd, content, /*sync=*/false, "StoreObject",
+                         status) ||
+      rename(partial_path.c_str(), object_path.c_str()) != 0) {
+    if (status->ok())
+      SetErrorFromErrno(IECStatus::DRIVE_ERROR, "StoreObject", status);
+    unlink(partial_path.c_str());
+    return false;
+  }
+  stored_hashes_.insert(hash);
+  return true;
+}
+
+bool SectorStoreDrive::LoadObject(uint64_t hash, size_t size,
+                                  std::string *content, IECStatus *status) {
+  std::string object_path = GetObjectPath(hash);
+  int fd = open(object_path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "LoadObject: " + object_path,
+                      status);
+    return false;
+  }
+  // Read one byte more than expected to notice objects being too large.
+  content->resize(size + 1);
+  size_t pos = 0;
+  ssize_t res = 0;
+  while (pos < content->size() &&
+         (res = read(fd, &(*content)[pos], content->size() - pos)) > 0) {
+    pos += res;
+  }
+  int read_errno = errno;
+  close(fd);
+  if (res < 0) {
+    errno = read_errno;
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "LoadObject: " + object_path,
+                      status);
+    return false;
+  }
+  content->resize(pos);
+  if (pos != size || HashContent(*content) != hash) {
+    SetError(IECStatus::DRIVE_ERROR,
+             "LoadObject: " + object_path + " is corrupt", status);
+    return false;
+  }
+  return true;
+}
+
+bool SectorStoreDrive::FillSectors(size_t num_sectors, IECStatus *status) {
+  if (sector_hashes_.size() >= num_sectors)
+    return true;
+  const std::string empty_sector(kNumBytesPerSector, '\0');
+  uint64_t hash = HashContent(empty_sector);
+  if (!StoreObject(hash, empty_sector, status))
+    return false;
+  sector_hashes_.resize(num_sectors, hash);
+  return true;
+}
@@ -0,0 +1,94 @@
+// DriveInterface implementation on a content-addressed sector store. The
+// store keeps the content of each distinct sector once, in a file named by
+// the hash of its content, and describes each disc by a manifest listing the
+// hashes of its sectors in order. Discs sharing sectors, such as blank or
+// freshly formatted ones, share their storage, and identical discs have
+// identical manifests.
+//
+// The store at store_path is laid out as follows:
+//   store_path/objects/xx/yyyyyyyyyyyyyy  sector content, and error maps,
+//                                         named by their hash in hex.
+//   store_path/discs/disc_name            the manifest of disc_name.
+// A manifest holds a line with the hash of each sector, optionally followed
+// by a line "errors <hash>" naming the disc's error map, encoded as in
+// extended d64 images.
+
+#ifndef SECTOR_STORE_DRIVE_H
+#define SECTOR_STORE_DRIVE_H
+
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "drive_interface.h"
+
+class SectorStoreDrive : public DriveInterface {
+public:
+  // Prefix of the paths naming discs in a sector store, e.g.
+  // "cas://path/to/store/disc_name".
+  static const char kPathPrefix[];
+
+  // Returns the hash content is stored by.
+  static uint64_t HashContent(const std::string &content);
+
+  // Instantiate a drive on the disc disc_name in the store at store_path. If
+  // read_only is true, the disc is expected to exist and attempts to write to
+  // it will fail. Otherwise, the store is created if necessary. Like
+  // ImageDrive, a writable drive starts out with what the disc held, if
+  // anything, and only replaces the disc's manifest once Commit() is called.
+  // Sector content is added to the store as it is written.
+  SectorStoreDrive(const std::string &store_path, const std::string &disc_name,
+                   bool read_only);
+
+  bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override;
+  bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
+  bool ReadSector(size_t sector_number, std::string *content,
+                  IECStatus *status) override;
+  // Sectors skipped are zero filled.
+  bool WriteSector(size_t sector_number, const std::string &content,
+                   IECStatus *status) override;
+  bool WriteErrorMap(const std::vector<unsigned int> &error_numbers,
+                     IECStatus *status) override;
+  bool ReadCommandChannel(std::string *response, IECStatus *status) override;
+
+  // Make sure the content written is durable, then replace the disc's
+  // manifest.
+  bool Commit(IECStatus *status) override;
+
+private:
+  // Load the disc's manifest unless that happened before. Writable drives
+  // start out empty if there is none.
+  bool LoadManifest(IECStatus *status);
+
+  // Returns the path of the object holding the content hashing to hash.
+  std::string GetObjectPath(uint64_t hash) const;
+
+  // Add content, which hashes to hash, to the store unless it is there
+  // already. Returns true if successful, sets status otherwise.
+  bool StoreObject(uint64_t hash, const std::string &content,
+                   IECStatus *status);
+
+  // Read the object hashing to hash into *content, expecting it to hold size
+  // bytes. Returns true if successful, sets status otherwise.
+  bool LoadObject(uint64_t hash, size_t size, std::string *content,
+                  IECStatus *status);
+
+  // Zero fill the disc up to num_sectors sectors.
+  bool FillSectors(size_t num_sectors, IECStatus *status);
+
+  std::string store_path_;
+  std::string disc_name_;
+  bool read_only_;
+
+  // The disc's content, once its manifest has been loaded.
+  bool manifest_loaded_ = false;
+  std::vector<uint64_t> sector_hashes_;
+  bool has_error_map_ = false;
+  uint64_t error_map_hash_ = 0;
+
+  // Hashes of the objects known to be in the store.
+  std::set<uint64_t> stored_hashes_;
+};
+
+#endif // SECTOR_STORE_DRIVE_H
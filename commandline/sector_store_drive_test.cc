@@ -0,0 +1,166 @@
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+
+#include "sector_store_drive.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "test_disc.h"
+
+class SectorStoreDriveTest : public TestDiscTest {
+public:
+  void SetUp() override {
+    TestDiscTest::SetUp();
+    store_path_ = (directory_ / "store").string();
+  }
+
+protected:
+  // Returns the content of sector s of the test discs, which only differ in
+  // their first sector.
+  static std::string GetTestSector(size_t s, char disc) {
+    return GetFilledSector(s == 0 ? disc : char(s % 16));
+  }
+
+  // Write a 35 track test disc named disc_name, leaving out sector 100.
+  void WriteStoreDisc(const std::string &disc_name, char disc) {
+    SectorStoreDrive drive(store_path_, disc_name, /*read_only=*/false);
+    WriteTestDisc(&drive, [disc](size_t s) { return GetTestSector(s, disc); },
+                  {100});
+    IECStatus status;
+    EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  }
+
+  // Returns the number of objects in the store.
+  size_t CountObjects() {
+    size_t num_objects = 0;
+    for (boost::filesystem::recursive_directory_iterator it(
+             boost::filesystem::path(store_path_) / "objects");
+         it != boost::filesystem::recursive_directory_iterator(); ++it) {
+      if (boost::filesystem::is_regular_file(it->status()))
+        ++num_objects;
+    }
+    return num_objects;
+  }
+
+  std::string store_path_;
+};
+
+TEST_F(SectorStoreDriveTest, DeduplicationTest) {
+  WriteStoreDisc("first", 'A');
+  WriteStoreDisc("second", 'B');
+
+  // 16 distinct sectors shared by both discs, among them the empty one
+  // filling the gap, and one first sector for each disc.
+  EXPECT_EQ(CountObjects(), 16 + 2);
+  EXPECT_EQ(
+      boost::filesystem::file_size(boost::filesystem::path(store_path_) /
+                                   "discs" / "first"),
+      683 * 17);
+
+  for (char disc : {'A', 'B'}) {
+    SectorStoreDrive drive(store_path_, disc == 'A' ? "first" : "second",
+                           /*read_only=*/true);
+    IECStatus status;
+    size_t num_sectors = 0;
+    EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+    EXPECT_EQ(num_sectors, 683);
+    for (size_t s = 0; s < num_sectors; ++s) {
+      std::string content;
+      EXPECT_TRUE(drive.ReadSector(s, &content, &status)) << status.message;
+      EXPECT_EQ(content, s == 100 ? std::string(256, '\0')
+                                  : GetTestSector(s, disc))
+          << s;
+    }
+    std::string content;
+    EXPECT_FALSE(drive.ReadSector(683, &content, &status));
+    EXPECT_FALSE(drive.WriteSector(0, GetTestSector(0, 'C'), &status));
+  }
+}
+
+TEST_F(SectorStoreDriveTest, UpdateDiscTest) {
+  WriteStoreDisc("disc", 'A');
+  IECStatus status;
+  {
+    // Writable discs start out with what they held.
+    SectorStoreDrive drive(store_path_, "disc", /*read_only=*/false);
+    EXPECT_TRUE(drive.WriteSector(1, GetTestSector(0, 'C'), &status))
+        << status.message;
+    std::vector<unsigned int> error_numbers(683, 0);
+    error_numbers[2] = 23;
+    EXPECT_TRUE(drive.WriteErrorMap(error_numbers, &status))
+        << status.message;
+
+    // Nothing changes until the disc is committed.
+    SectorStoreDrive reader(store_path_, "disc", /*read_only=*/true);
+    std::string content;
+    EXPECT_TRUE(reader.ReadSector(1, &content, &status)) << status.message;
+    EXPECT_EQ(content, GetTestSector(1, 'A'));
+
+    EXPECT_TRUE(drive.Commit(&status)) << status.message;
+  }
+  SectorStoreDrive drive(store_path_, "disc", /*read_only=*/true);
+  size_t num_sectors = 0;
+  EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+  EXPECT_EQ(num_sectors, 683);
+  std::string content;
+  EXPECT_TRUE(drive.ReadSector(0, &content, &status)) << status.message;
+  EXPECT_EQ(content, GetTestSector(0, 'A'));
+  EXPECT_TRUE(drive.ReadSector(1, &content, &status)) << status.message;
+  EXPECT_EQ(content, GetTestSector(0, 'C'));
+
+  // Recording a clean copy drops the error map.
+  auto manifest_has_errors = [&]() {
+    std::ifstream manifest(
+        (boost::filesystem::path(store_path_) / "discs" / "disc").string());
+    std::stringstream lines;
+    lines << manifest.rdbuf();
+    return lines.str().find("errors ") != std::string::npos;
+  };
+  EXPECT_TRUE(manifest_has_errors());
+  {
+    SectorStoreDrive writer(store_path_, "disc", /*read_only=*/false);
+    EXPECT_TRUE(writer.WriteErrorMap(std::vector<unsigned int>(683, 0),
+                                     &status))
+        << status.message;
+    EXPECT_TRUE(writer.Commit(&status)) << status.message;
+  }
+  EXPECT_FALSE(manifest_has_errors());
+}
+
+TEST_F(SectorStoreDriveTest, CorruptStoreTest) {
+  WriteStoreDisc("disc", 'A');
+  IECStatus status;
+
+  // Objects whose content doesn't match their hash are rejected.
+  std::string content = GetTestSector(0, 'A');
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx",
+           static_cast<unsigned long long>(
+               SectorStoreDrive::HashContent(content)));
+  {
+    std::ofstream object((boost::filesystem::path(store_path_) / "objects" /
+                          std::string(name, 2) / (name + 2))
+                             .string());
+    object << std::string(256, 'X');
+  }
+  SectorStoreDrive drive(store_path_, "disc", /*read_only=*/true);
+  EXPECT_FALSE(drive.ReadSector(0, &content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+  status.Clear();
+  EXPECT_TRUE(drive.ReadSector(1, &content, &status)) << status.message;
+
+  // So are malformed manifests, and discs which don't exist.
+  {
+    std::ofstream manifest(
+        (boost::filesystem::path(store_path_) / "discs" / "bad").string());
+    manifest << "0123456789abcdef\nnot a hash\n";
+  }
+  size_t num_sectors = 0;
+  SectorStoreDrive bad_drive(store_path_, "bad", /*read_only=*/true);
+  EXPECT_FALSE(bad_drive.GetNumSectors(&num_sectors, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+  status.Clear();
+  SectorStoreDrive missing_drive(store_path_, "missing", /*read_only=*/true);
+  EXPECT_FALSE(missing_drive.GetNumSectors(&num_sectors, &status));
+}
@@ -0,0 +1,53 @@
+// Fixture shared by the tests of drives keeping discs in files: a temporary
+// directory to put them in, and test discs to fill them with.
+
+#ifndef TEST_DISC_H
+#define TEST_DISC_H
+
+#include <boost/filesystem.hpp>
+#include <functional>
+#include <set>
+#include <string>
+
+#include "drive_interface.h"
+#include "gtest/gtest.h"
+
+class TestDiscTest : public ::testing::Test {
+public:
+  void SetUp() override {
+    directory_ = boost::filesystem::temp_directory_path() /
+                 boost::filesystem::unique_path();
+    ASSERT_TRUE(boost::filesystem::create_directory(directory_));
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(directory_); }
+
+protected:
+  // Number of sectors on a 35 track test disc.
+  static const size_t kNumTestSectors = 683;
+
+  // Returns a sector filled with fill.
+  static std::string GetFilledSector(char fill) {
+    return std::string(DriveInterface::kNumBytesPerSector, fill);
+  }
+
+  // Write a 35 track test disc to drive, with get_sector returning the
+  // content of each sector. Sectors listed in skipped are left out. Leaves
+  // committing the drive to the caller.
+  static void
+  WriteTestDisc(DriveInterface *drive,
+                const std::function<std::string(size_t)> &get_sector,
+                const std::set<size_t> &skipped = {}) {
+    IECStatus status;
+    for (size_t s = 0; s < kNumTestSectors; ++s) {
+      if (skipped.count(s))
+        continue;
+      ASSERT_TRUE(drive->WriteSector(s, get_sector(s), &status))
+          << status.message;
+    }
+  }
+
+  boost::filesystem::path directory_;
+};
+
+#endif // TEST_DISC_H
@@ -4,9 +4,14 @@
 #include <cassert>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/select.h>
 #include <unistd.h>
 
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
 #include "boost/format.hpp"
 
 void SetError(IECStatus::IECStatusCode status_code, const std::string &context,
@@ -257,3 +262,75 @@ bool UnescapeString(const std::string &source, std::string *target,
   }
   return true;
 }
+
+unsigned short int Crc16(const std::string &data) {
+  unsigned short int crc = 0xffff;
+  for (unsigned char c : data) {
+    crc ^= c << 8;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+// Reflected CRC-32C polynomial.
+static const uint32_t kCrc32cPolynomial = 0x82f63b78;
+
+static uint32_t Crc32cSoftware(uint32_t crc, const unsigned char *data,
+                               size_t size) {
+  static const struct Table {
+    Table() {
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t entry = i;
+        for (int bit = 0; bit < 8; ++bit) {
+          entry = (entry & 1) ? (entry >> 1) ^ kCrc32cPolynomial : entry >> 1;
+        }
+        entries[i] = entry;
+      }
+    }
+    uint32_t entries[256];
+  } table;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t
+Crc32cSSE42(uint32_t crc, const unsigned char *data, size_t size) {
+  uint64_t crc64 = crc;
+  for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += sizeof(word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+  for (; size > 0; --size) {
+    crc = _mm_crc32_u8(crc, *data++);
+  }
+  return crc;
+}
+#endif
+
+unsigned int Crc32c(const std::string &data) {
+  const unsigned char *bytes =
+      reinterpret_cast<const unsigned char *>(data.data());
+#if defined(__x86_64__)
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  if (has_sse42)
+    return ~Crc32cSSE42(~0u, bytes, data.size());
+#endif
+  return ~Crc32cSoftware(~0u, bytes, data.size());
+}
+
+uint64_t Fnv1a64(const std::string &data) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
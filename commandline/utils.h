@@ -4,6 +4,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdint.h>
 #include <string>
 #include <unistd.h>
 
@@ -54,6 +55,18 @@ void SetErrorFromErrno(IECStatus::IECStatusCode status_code,
 bool UnescapeString(const std::string &source, std::string *target,
                     IECStatus *status);
 
+// Returns the CRC-16 (CCITT, polynomial 0x1021, initial value 0xffff) of data.
+// This matches the checksums calculated by the drive-resident checksum
+// routine.
+unsigned short int Crc16(const std::string &data);
+
+// Returns the CRC-32C (Castagnoli, as used by iSCSI) of data. Uses the CPU's
+// crc32 instruction if available, which hashes a sector in a few nanoseconds.
+unsigned int Crc32c(const std::string &data);
+
+// Returns the 64 bit FNV-1a hash of data.
+uint64_t Fnv1a64(const std::string &data);
+
 // BufferedReadWriter can be used to read both terminated and fixed
 // character amounts from a file handle. It buffers reads internally,
 // writes are executed immediately. Note that file handle ownership is not
@@ -167,3 +167,27 @@ TEST(Utils, UnescapeStringTest) {
   EXPECT_FALSE(UnescapeString(kIncompleteEscapedString, &result, &status));
   EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT) << status.message;
 }
+
+TEST(Utils, Crc16Test) {
+  EXPECT_EQ(Crc16(""), 0xffff);
+  EXPECT_EQ(Crc16("123456789"), 0x29b1);
+  EXPECT_NE(Crc16(std::string(256, '\0')), Crc16(std::string(256, '\1')));
+}
+
+TEST(Utils, Crc32cTest) {
+  EXPECT_EQ(Crc32c(""), 0u);
+  EXPECT_EQ(Crc32c("123456789"), 0xe3069283u);
+  // Test vectors from RFC 3720, covering both whole words and leftover bytes.
+  EXPECT_EQ(Crc32c(std::string(32, '\0')), 0x8a9136aau);
+  EXPECT_EQ(Crc32c(std::string(32, '\xff')), 0x62a8ab43u);
+  std::string ascending;
+  for (int i = 0; i < 32; ++i)
+    ascending += char(i);
+  EXPECT_EQ(Crc32c(ascending), 0x46dd794eu);
+}
+
+TEST(Utils, Fnv1a64Test) {
+  EXPECT_EQ(Fnv1a64(""), 0xcbf29ce484222325ull);
+  EXPECT_EQ(Fnv1a64("a"), 0xaf63dc4c8601ec8cull);
+  EXPECT_EQ(Fnv1a64("foobar"), 0x85944171f73967e8ull);
+}
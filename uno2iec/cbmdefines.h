@@ -16,11 +16,17 @@ namespace CBM {
 // Largest Serial byte buffer request from / to arduino.
 #define MAX_BYTES_PER_REQUEST 256
 
+// Number of bytes sent per chunk in response to a bulk get data request.
+#define BULK_CHUNK_SIZE 64
+
+// Maximum number of devices addressed by a single broadcast request.
+#define MAX_BROADCAST_DEVICES 8
+
 // For every change of the serial protocol that makes a difference enough for
 // incompitability, this number
 // should be increased. That way the host side can detect whether the peers are
 // compatible or not.
-#define CURRENT_UNO2IEC_PROTOCOL_VERSION 3
+#define CURRENT_UNO2IEC_PROTOCOL_VERSION 7
 
 // Device OPEN channels.
 // Special channels.
@@ -0,0 +1,42 @@
+#ifndef FAST_RECEIVE_H
+#define FAST_RECEIVE_H
+
+// Timing and decoding of the fast transfer protocol, as received by
+// IEC::receiveFast(). commandline/fast_transfer_test.cc runs this against
+// the drive code in commandline/assembly/fast_send.asm, so this file must not
+// depend on anything Arduino specific.
+
+#include <stdint.h>
+
+// Fast transfer protocol timing, relative to the drive's start signal. The
+// drive holds each bit pair for 8 us, the first one starting after 8 us. We
+// sample in the middle of each pair and wait for the drive to signal busy
+// again (42 us after the start) before looking at the clock line.
+#define TIMING_FAST_FIRST_SAMPLE 12 // first bit pair sample (us)
+#define TIMING_FAST_PAIR 8          // bit pair hold time     (us)
+#define TIMING_FAST_BUSY 8          // last sample to busy    (us)
+
+// Cycles it takes to sample both lines.
+#define CYCLES_FAST_SAMPLE 4
+// Cycles from the drive releasing CLK until we notice, on average. That's
+// half an iteration of the loop waiting for it.
+#define CYCLES_FAST_START 7
+
+// Number of bit pairs making up a byte.
+#define FAST_NUM_PAIRS 4
+
+// Combine the port values sampled for each bit pair into the byte the drive
+// sent. A released line represents a 1, the lower bit of each pair is on
+// DATA, the higher one on CLK, lowest bits first.
+inline uint8_t decodeFastSamples(const uint8_t dataSamples[FAST_NUM_PAIRS],
+                                 const uint8_t clockSamples[FAST_NUM_PAIRS],
+                                 uint8_t dataMask, uint8_t clockMask) {
+  uint8_t data = 0;
+  for (int8_t pair = FAST_NUM_PAIRS - 1; pair >= 0; --pair) {
+    data = (data << 2) | ((dataSamples[pair] & dataMask) ? 1 : 0) |
+           ((clockSamples[pair] & clockMask) ? 2 : 0);
+  }
+  return data;
+} // decodeFastSamples
+
+#endif // FAST_RECEIVE_H
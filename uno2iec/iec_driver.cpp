@@ -1,4 +1,5 @@
 #include "iec_driver.h"
+#include "fast_receive.h"
 #include "log.h"
 
 using namespace CBM;
@@ -20,6 +21,10 @@ using namespace CBM;
 #define TIMING_FNF_DELAY 100   // delay after fnf?         (us)
 #define TIMING_RESET_DELAY 200 // delay for IEC bus reset  (ms)
 
+// The fast transfer is timed by counting cycles, which delayMicroseconds()
+// is too coarse for. See fast_receive.h for the protocol timing.
+#define CYCLES_PER_US (F_CPU / 1000000UL)
+
 // Version 0.5 equivalent timings: 70, 5, 200, 20, 20, 50, 100, 100
 
 // TIMING TESTING:
@@ -41,6 +46,11 @@ using namespace CBM;
 // See timeoutWait below.
 #define TIMEOUT 65000
 
+// Loop iterations to wait for the drive during fast transfers (approx. 1s).
+// The first byte can take a while, because the drive has to process the
+// command starting its transfer code.
+#define TIMEOUT_FAST 250000UL
+
 IEC::IEC(byte deviceNumber)
     : m_state(noFlags), m_deviceNumber(deviceNumber), m_atnPin(DEFAULT_ATN_PIN),
       m_dataPin(DEFAULT_DATA_PIN), m_clockPin(DEFAULT_CLOCK_PIN),
@@ -436,6 +446,62 @@ boolean IEC::sendATNToChannel(byte deviceNumber, byte channel,
   return true;
 }
 
+boolean IEC::sendATNTalkToListener(byte talker, byte talkerChannel,
+                                   byte listener, byte listenerChannel) {
+  // Pull ATN line to GND.
+  writeATN(true);
+
+  // Release the data line and pull clock to GND to indicate we're ready.
+  writeDATA(false);
+  writeCLOCK(true);
+
+  // Address the listener first, so it is ready once the talker starts.
+  const byte commands[] = {byte(ATN_CODE_LISTEN bitor listener),
+                           byte(ATN_CODE_DATA bitor listenerChannel),
+                           byte(ATN_CODE_TALK bitor talker),
+                           byte(ATN_CODE_DATA bitor talkerChannel)};
+  boolean result = true;
+  for (byte i = 0; i < sizeof(commands) && result; ++i) {
+    delay(1); // Wait for 1 ms.
+    result = sendByte(commands[i], /*signalEOI=*/false, /*atnMode=*/true);
+  }
+  // Release ATN line.
+  writeATN(false);
+
+  if (!result)
+    return false;
+
+  // The talker will be talking shortly.
+  return turnAround();
+}
+
+boolean IEC::sendATNListenToChannels(const byte *deviceNumbers,
+                                     byte numDevices, byte channel,
+                                     ATNCommand command) {
+  // Pull ATN line to GND.
+  writeATN(true);
+
+  // Release the data line and pull clock to GND to indicate we're ready.
+  writeDATA(false);
+  writeCLOCK(true);
+
+  boolean result = true;
+  for (byte i = 0; i < numDevices && result; ++i) {
+    delay(1); // Wait for 1 ms.
+    byte data = ATN_CODE_LISTEN bitor deviceNumbers[i];
+    result = sendByte(data, /*signalEOI=*/false, /*atnMode=*/true);
+    if (result) {
+      delay(1); // Wait for 1 ms.
+      data = command bitor channel;
+      result = sendByte(data, /*signalEOI=*/false, /*atnMode=*/true);
+    }
+  }
+  // Release ATN line.
+  writeATN(false);
+
+  return result;
+}
+
 boolean IEC::sendATNToDevice(byte deviceNumber, ATNCommand talkOrListen) {
   // Pull ATN line to GND.
   writeATN(true);
@@ -468,6 +534,72 @@ boolean IEC::sendATNToDevice(byte deviceNumber, ATNCommand talkOrListen) {
 //
 byte IEC::receive() { return receiveByte(); } // receive
 
+void IEC::beginFastReceive() {
+  // The drive code waits for us to release DATA before sending each byte.
+  writeCLOCK(false);
+  writeDATA(true);
+} // beginFastReceive
+
+boolean IEC::receiveFast(byte &data) {
+  // Look up the port registers up front. Looking them up for each sample
+  // takes long enough to push the later samples out of their bit pair.
+  volatile uint8_t *clockIn = portInputRegister(digitalPinToPort(m_clockPin));
+  volatile uint8_t *dataIn = portInputRegister(digitalPinToPort(m_dataPin));
+  const uint8_t clockMask = digitalPinToBitMask(m_clockPin);
+  const uint8_t dataMask = digitalPinToBitMask(m_dataPin);
+
+  // Wait for the drive to pull CLK (busy), then tell it we're ready.
+  unsigned long t = 0;
+  while (*clockIn & clockMask) {
+    if (++t > TIMEOUT_FAST)
+      return false;
+  }
+  writeDATA(false);
+
+  // Wait for the start signal. This loop needs to be tight, everything
+  // below is timed relative to it.
+  t = 0;
+  while (!(*clockIn & clockMask)) {
+    if (++t > TIMEOUT_FAST)
+      return false;
+  }
+
+  // Cycle exact from here on. Only store the raw port values, decoding them
+  // takes a variable number of cycles.
+  uint8_t clockSamples[FAST_NUM_PAIRS];
+  uint8_t dataSamples[FAST_NUM_PAIRS];
+  __builtin_avr_delay_cycles(TIMING_FAST_FIRST_SAMPLE * CYCLES_PER_US -
+                             CYCLES_FAST_START - CYCLES_FAST_SAMPLE);
+  dataSamples[0] = *dataIn;
+  clockSamples[0] = *clockIn;
+  __builtin_avr_delay_cycles(TIMING_FAST_PAIR * CYCLES_PER_US -
+                             CYCLES_FAST_SAMPLE);
+  dataSamples[1] = *dataIn;
+  clockSamples[1] = *clockIn;
+  __builtin_avr_delay_cycles(TIMING_FAST_PAIR * CYCLES_PER_US -
+                             CYCLES_FAST_SAMPLE);
+  dataSamples[2] = *dataIn;
+  clockSamples[2] = *clockIn;
+  __builtin_avr_delay_cycles(TIMING_FAST_PAIR * CYCLES_PER_US -
+                             CYCLES_FAST_SAMPLE);
+  dataSamples[3] = *dataIn;
+  clockSamples[3] = *clockIn;
+
+  // Until the drive signals busy, CLK still carries the last bit pair, so
+  // wait for that before we look at it again. Then tell the drive we're not
+  // ready for the next byte. It only checks DATA well after going busy.
+  __builtin_avr_delay_cycles(TIMING_FAST_BUSY * CYCLES_PER_US);
+  writeDATA(true);
+
+  data = decodeFastSamples(dataSamples, clockSamples, dataMask, clockMask);
+  return true;
+} // receiveFast
+
+void IEC::endFastReceive() {
+  writeDATA(false);
+  writeCLOCK(false);
+} // endFastReceive
+
 // IEC_send sends a byte
 //
 boolean IEC::send(byte data) {
@@ -77,6 +77,20 @@ public:
   boolean sendATNToChannel(byte deviceNumber, byte channel,
                            ATNCommand talkOrListen, ATNCommand command);
 
+  // Make talker talk on talkerChannel and listener listen on listenerChannel
+  // with ATN pulled to GND once. We become an additional listener, so we can
+  // follow the data going from talker to listener directly. If something is
+  // not OK, FALSE is returned.
+  boolean sendATNTalkToListener(byte talker, byte talkerChannel, byte listener,
+                                byte listenerChannel);
+
+  // Send LISTEN to each of the numDevices devices in deviceNumbers, each
+  // followed by command for channel, with ATN pulled to GND once. All of them
+  // receive the data sent afterwards. If something is not OK, FALSE is
+  // returned.
+  boolean sendATNListenToChannels(const byte *deviceNumbers, byte numDevices,
+                                  byte channel, ATNCommand command);
+
   // Send talkOrListen to the specified deviceNumber with ATN pulled to GND.
   // If something is not OK, FALSE is returned.
   boolean sendATNToDevice(byte deviceNumber, ATNCommand talkOrListen);
@@ -99,6 +113,18 @@ public:
   //
   byte receive();
 
+  // Prepare the bus for receiving bytes from custom drive code using the
+  // fast transfer protocol (see interface.h). Must be called right after the
+  // command starting the drive code has been sent.
+  void beginFastReceive();
+
+  // Receives a byte using the fast transfer protocol. Must be called with
+  // interrupts disabled. Returns false if the drive doesn't send in time.
+  boolean receiveFast(byte &data);
+
+  // Release the bus after a fast transfer.
+  void endFastReceive();
+
   byte deviceNumber() const;
   void setDeviceNumber(const byte deviceNumber);
   void setPins(byte atn, byte clock, byte data, byte srqIn, byte reset);
@@ -319,11 +319,23 @@ byte Interface::hostModeHandler(void) {
       result = handleCloseRequest();
       break;
     case 'g':
-      result = handleGetDataRequest();
+      result = handleGetDataRequest(false);
+      break;
+    case 'b':
+      result = handleGetDataRequest(true);
       break;
     case 'p':
       result = handleOpenOrPutDataRequest(IEC::ATN_CODE_DATA);
       break;
+    case 'f':
+      result = handleFastGetDataRequest();
+      break;
+    case 'x':
+      result = handleCopyRequest();
+      break;
+    case 'm':
+      result = handleBroadcastDataRequest();
+      break;
     default:
       strcpy_P(serCmdIOBuf, (PGM_P)F("UNKNOWN SERIAL COMMAND"));
       Log(Error, FAC_IFACE, serCmdIOBuf);
@@ -474,7 +486,7 @@ const char *Interface::handleCloseRequest(void) {
   return result;
 } // handleCloseRequest
 
-const char *Interface::handleGetDataRequest(void) {
+const char *Interface::handleGetDataRequest(bool bulk) {
   const char *result = (PGM_P)F("");
   char requestHeader[2];
   if (COMPORT.readBytes(requestHeader, 2) != 2) {
@@ -492,9 +504,11 @@ const char *Interface::handleGetDataRequest(void) {
 
   bool dataStreamStarted = false;
   if (!hasIECError) {
-    // Indicate that a data package is coming.
+    // Indicate that a data package is coming. Bulk data chunks
+    // announce themselves.
     dataStreamStarted = true;
-    COMPORT.write('r');
+    if (!bulk)
+      COMPORT.write('r');
   } else {
     // Sending ATN Open failed.
     sprintf_P(
@@ -506,6 +520,8 @@ const char *Interface::handleGetDataRequest(void) {
   }
 
   int i = 0;
+  byte chunk[BULK_CHUNK_SIZE];
+  byte chunkSize = 0;
   while (!hasIECError) {
     // Retrieve a byte from the IEC bus.
     noInterrupts();
@@ -513,9 +529,18 @@ const char *Interface::handleGetDataRequest(void) {
     interrupts();
     if (!(m_iec.state() bitand IEC::errorFlag)) {
       // We receive a valid byte. Make something of it.
-      // TODO(aeckleder): Escape the data.
-      byte escaped[2];
-      COMPORT.write(escaped, EscapeChar(data, escaped));
+      if (bulk) {
+        chunk[chunkSize++] = data;
+        if (chunkSize == BULK_CHUNK_SIZE) {
+          COMPORT.write('b');
+          COMPORT.write(chunkSize);
+          COMPORT.write(chunk, chunkSize);
+          chunkSize = 0;
+        }
+      } else {
+        byte escaped[2];
+        COMPORT.write(escaped, EscapeChar(data, escaped));
+      }
     } else {
       hasIECError = true;
       break;
@@ -524,7 +549,16 @@ const char *Interface::handleGetDataRequest(void) {
       break;
     ++i;
   }
-  if (dataStreamStarted) {
+  if (bulk) {
+    // Send whatever is left. There's no terminator, the status response
+    // following below ends the data stream.
+    if (chunkSize > 0) {
+      COMPORT.write('b');
+      COMPORT.write(chunkSize);
+      COMPORT.write(chunk, chunkSize);
+    }
+    COMPORT.flush();
+  } else if (dataStreamStarted) {
     // If we started a data stream, we definitely need to terminate it,
     // no matter whether we ran into problems or not.
     // TODO(aeckleder): Also return an error code in case we *did*
@@ -565,6 +599,203 @@ const char *Interface::handleGetDataRequest(void) {
   return result;
 } // handleGetDataRequest
 
+const char *Interface::handleFastGetDataRequest(void) {
+  byte requestHeader[3];
+  if (COMPORT.readBytes((char *)requestHeader, 3) != 3) {
+    const char *result =
+        (PGM_P)F("Received incomplete fast get data command on serial line.");
+    strcpy_P(serCmdIOBuf, result);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return result;
+  }
+  int numBytes = requestHeader[1] == 0 ? 256 : requestHeader[1];
+  int cmdSize = requestHeader[2];
+  if (cmdSize == 0 || COMPORT.readBytes(serCmdIOBuf, cmdSize) != cmdSize) {
+    const char *result =
+        (PGM_P)F("Received incomplete fast get data command on serial line.");
+    strcpy_P(serCmdIOBuf, result);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return result;
+  }
+
+  // Send the command starting the drive code to the command channel.
+  noInterrupts();
+  boolean hasIECError =
+      !m_iec.sendATNToChannel(requestHeader[0], 15, IEC::ATN_CODE_LISTEN,
+                              IEC::ATN_CODE_DATA);
+  for (int i = 0; i < cmdSize && !hasIECError; ++i) {
+    if (i < cmdSize - 1) {
+      hasIECError = !m_iec.send(serCmdIOBuf[i]);
+    } else {
+      hasIECError = !m_iec.sendEOI(serCmdIOBuf[i]);
+    }
+  }
+  if (!hasIECError)
+    hasIECError = !m_iec.sendATNToDevice(0, IEC::ATN_CODE_UNLISTEN);
+  if (!hasIECError)
+    m_iec.beginFastReceive();
+  interrupts();
+  if (hasIECError) {
+    sprintf_P(serCmdIOBuf,
+              (PGM_P)F("Sending fast transfer command failed for dev=%d"),
+              requestHeader[0]);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return (PGM_P)F("Sending fast transfer command failed.");
+  }
+
+  int i = 0;
+  byte chunk[BULK_CHUNK_SIZE];
+  byte chunkSize = 0;
+  for (i = 0; i < numBytes; ++i) {
+    byte data;
+    noInterrupts();
+    hasIECError = !m_iec.receiveFast(data);
+    interrupts();
+    if (hasIECError)
+      break;
+    chunk[chunkSize++] = data;
+    if (chunkSize == BULK_CHUNK_SIZE) {
+      COMPORT.write('b');
+      COMPORT.write(chunkSize);
+      COMPORT.write(chunk, chunkSize);
+      chunkSize = 0;
+    }
+  }
+  m_iec.endFastReceive();
+  if (chunkSize > 0) {
+    COMPORT.write('b');
+    COMPORT.write(chunkSize);
+    COMPORT.write(chunk, chunkSize);
+  }
+  COMPORT.flush();
+
+  if (hasIECError) {
+    sprintf_P(serCmdIOBuf,
+              (PGM_P)F("fast receive of byte %d timed out, dev=%d"), i,
+              requestHeader[0]);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return (PGM_P)F("Fast transfer timed out");
+  }
+  return (PGM_P)F("");
+} // handleFastGetDataRequest
+
+const char *Interface::handleCopyRequest(void) {
+  char requestHeader[4];
+  if (COMPORT.readBytes(requestHeader, 4) != 4) {
+    const char *result =
+        (PGM_P)F("Received incomplete copy command on serial line.");
+    strcpy_P(serCmdIOBuf, result);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return result;
+  }
+  noInterrupts();
+  boolean hasIECError = !m_iec.sendATNTalkToListener(
+      requestHeader[0], requestHeader[1], requestHeader[2], requestHeader[3]);
+  interrupts();
+  if (hasIECError) {
+    sprintf_P(serCmdIOBuf,
+              (PGM_P)F("Sending ATN LISTEN + TALK failed for dev=%d chan=%d "
+                       "to dev=%d chan=%d"),
+              requestHeader[0], requestHeader[1], requestHeader[2],
+              requestHeader[3]);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return (PGM_P)F("Sending ATN LISTEN + TALK failed.");
+  }
+
+  // We listen along with the target, but only to find out when the source
+  // is done.
+  int i = 0;
+  while (true) {
+    noInterrupts();
+    m_iec.receive();
+    interrupts();
+    if (m_iec.state() bitand IEC::errorFlag) {
+      hasIECError = true;
+      break;
+    }
+    if (m_iec.state() bitand IEC::eoiFlag)
+      break;
+    ++i;
+  }
+
+  noInterrupts();
+  boolean unlistenError = !m_iec.sendATNToDevice(0, IEC::ATN_CODE_UNTALK) ||
+                          !m_iec.sendATNToDevice(0, IEC::ATN_CODE_UNLISTEN);
+  interrupts();
+
+  if (hasIECError) {
+    sprintf_P(serCmdIOBuf, (PGM_P)F("copying byte %d failed, dev=%d"), i,
+              requestHeader[0]);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return (PGM_P)F("Copy error on IEC bus");
+  }
+  if (unlistenError) {
+    strcpy_P(serCmdIOBuf, (PGM_P)F("Sending ATN UNTALK + UNLISTEN failed"));
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return (PGM_P)F("Sending ATN UNTALK + UNLISTEN failed");
+  }
+  return (PGM_P)F("");
+} // handleCopyRequest
+
+const char *Interface::handleBroadcastDataRequest(void) {
+  const char *incomplete =
+      (PGM_P)F("Received incomplete broadcast command on serial line.");
+  byte numDevices = 0;
+  byte devices[MAX_BROADCAST_DEVICES];
+  byte requestHeader[2];
+  if (COMPORT.readBytes((char *)&numDevices, 1) != 1 || numDevices == 0 ||
+      numDevices > MAX_BROADCAST_DEVICES ||
+      COMPORT.readBytes((char *)devices, numDevices) != numDevices ||
+      COMPORT.readBytes((char *)requestHeader, 2) != 2) {
+    strcpy_P(serCmdIOBuf, incomplete);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return incomplete;
+  }
+  int dataSize = requestHeader[1] == 0 ? 256 : requestHeader[1];
+  if (COMPORT.readBytes(serCmdIOBuf, dataSize) != dataSize) {
+    strcpy_P(serCmdIOBuf, incomplete);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return incomplete;
+  }
+
+  noInterrupts();
+  boolean hasIECError = !m_iec.sendATNListenToChannels(
+      devices, numDevices, requestHeader[0], IEC::ATN_CODE_DATA);
+  interrupts();
+  if (hasIECError) {
+    sprintf_P(serCmdIOBuf,
+              (PGM_P)F("Sending ATN LISTEN + DATA failed for %d devices "
+                       "chan=%d"),
+              numDevices, requestHeader[0]);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return (PGM_P)F("Sending ATN LISTEN + DATA failed.");
+  }
+
+  noInterrupts();
+  int i = 0;
+  for (i = 0; i < dataSize && !hasIECError; ++i) {
+    if (i < dataSize - 1) {
+      hasIECError = !m_iec.send(serCmdIOBuf[i]);
+    } else {
+      // Send the last character with an EOI.
+      hasIECError = !m_iec.sendEOI(serCmdIOBuf[i]);
+    }
+  }
+  boolean unlistenError = !m_iec.sendATNToDevice(0, IEC::ATN_CODE_UNLISTEN);
+  interrupts();
+  if (hasIECError) {
+    sprintf_P(serCmdIOBuf, (PGM_P)F("byte %d of broadcast failed"), i - 1);
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return (PGM_P)F("Sending data to IEC bus failed.");
+  }
+  if (unlistenError) {
+    strcpy_P(serCmdIOBuf, (PGM_P)F("Sending ATN UNLISTEN failed"));
+    Log(Error, FAC_IFACE, serCmdIOBuf);
+    return (PGM_P)F("Sending ATN UNLISTEN failed.");
+  }
+  return (PGM_P)F("");
+} // handleBroadcastDataRequest
+
 byte Interface::deviceModeHandler(void) {
 #ifdef HAS_RESET_LINE
   if (m_iec.checkRESET()) {
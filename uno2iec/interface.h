@@ -31,10 +31,28 @@
 //      <num data bytes>, <data to send to the channel>
 // 'g': Get data from a channel. The following bytes are <device number>,
 //      <channel>. The response is encoded as described below.
+// 'b': Bulk get data from a channel. Same as 'g', but the data is sent in
+//      unescaped chunks as described below (protocol version 4 and above).
 // 'p': Put data onto a channel. The following bytes are <device number>,
 //      <channel>, <num data bytes>, <data to send to the channel>.
 //      If <data to send to the channel> is 0, we expect 256 bytes of data.
 // 'c': Close a channel. The following bytes are <device number>, <channel>.
+// 'f': Run custom drive code and receive its data using the fast transfer
+//      protocol described below (protocol version 5 and above). The following
+//      bytes are <device number>, <num bytes to receive>, <num command bytes>,
+//      <command to send to the command channel>. The command must start the
+//      drive code, usually by means of M-E. If <num bytes to receive> is 0, we
+//      expect 256 bytes. The response is the same as for 'b'.
+// 'x': Copy data from one device to another, directly via IEC bus. The
+//      following bytes are <source device number>, <source channel>,
+//      <target device number>, <target channel>. The source talks until it
+//      signals EOI while the target listens. No data is sent via serial line
+//      (protocol version 6 and above).
+// 'm': Put data onto a channel of several devices at once. The following
+//      bytes are <num devices>, <device numbers>, <channel>,
+//      <num data bytes>, <data to send to the channel>. As for 'p', 0 data
+//      bytes means 256. At most MAX_BROADCAST_DEVICES devices can be
+//      addressed (protocol version 7 and above).
 //
 // Host mode responses
 // -------------------
@@ -43,6 +61,9 @@
 // '!': Register logging facility. (same as device mode).
 // 'r': Standard host mode data response, followed by an escaped data stream
 //      as described below (and terminated by '\r').
+// 'b': Bulk data response chunk, followed by <num data bytes> and the raw,
+//      unescaped data. A bulk get data request results in any number of
+//      these, followed by a status response.
 // 's': Standard host mode status response, followed by a string describing
 //      the status (not escaped, terminated by '\r'). An empty status string
 //      means
@@ -62,6 +83,19 @@
 //   '\' + '\':  Represents ASCII code 0x5C (backslash) when contained in the
 //               data stream.
 //
+// Fast transfer protocol:
+//  Used by custom drive code to send data to the Arduino, two bits at a time.
+//  After the command starting the drive code, the Arduino releases CLK and
+//  pulls DATA. For each byte:
+//   - The drive pulls CLK (busy) and waits for the Arduino to release DATA
+//     (ready).
+//   - The drive releases CLK (start). Starting 8us later, it puts a bit pair
+//     on the bus every 8us, lowest bits first. The lower bit of each pair is
+//     on DATA, the higher one on CLK. A released line represents a 1.
+//   - The drive pulls CLK (busy) 42us after the start, the Arduino pulls DATA
+//     after sampling the last bit pair.
+//  Pulling ATN makes the drive code give up.
+//
 // TODO(aeckleder): Document device mode requests.
 
 /*
@@ -147,13 +181,31 @@ private:
   // Handle a get data request coming in via serial line.
   // Reads remaining arguments from the serial line
   // and sends a corresponding request to the bus.
-  const char *handleGetDataRequest();
+  // If bulk is true, data is sent in unescaped chunks.
+  const char *handleGetDataRequest(bool bulk);
 
   // Handle a put data request coming in via serial line.
   // Reads remaining arguments from the serial line
   // and sends a corresponding request to the bus.
   const char *handlePutDataRequest();
 
+  // Handle a fast get data request coming in via serial line.
+  // Reads remaining arguments from the serial line, sends the
+  // command to the drive and receives the data sent by the drive
+  // code it starts using the fast transfer protocol.
+  const char *handleFastGetDataRequest();
+
+  // Handle a copy request coming in via serial line.
+  // Reads remaining arguments from the serial line and
+  // has the source device talk to the target device
+  // until the source signals EOI.
+  const char *handleCopyRequest();
+
+  // Handle a put data request for several devices coming in via serial
+  // line. Reads remaining arguments from the serial line and
+  // sends the data to all devices at once.
+  const char *handleBroadcastDataRequest();
+
   //
   // The following methods are device mode specific.
   //
@@ -41,6 +41,24 @@ function get_filename(){
 	return pathinfo($fname, PATHINFO_FILENAME) . '.d64';
 }
 
+/**
+ * Returns the path of the file disccopy writes to while dumping to $filename.
+ * It replaces $filename once the dump is complete.
+ */
+function partial_filename(string $filename){
+	return $filename . '.part';
+}
+
+/**
+ * Returns the number of bytes dumped to $filename so far
+ */
+function dumped_size(string $filename){
+	foreach([partial_filename($filename), $filename] as $path){
+		if(file_exists($path)) return filesize($path);
+	}
+	return 0;
+}
+
 /**
  * Reads the pid file
  */
@@ -146,11 +164,12 @@ function start(){
 	$outcome['filename'] = $fullPath;
 
 	
+	$partialPath = partial_filename($fullPath);
 	for($i=0; $i<5; $i++){
-		if(file_exists($filename)) break;
+		if(file_exists($partialPath)) break;
 		sleep(1);
 	}
-	$outcome['running'] = file_exists($fullPath);
+	$outcome['running'] = file_exists($partialPath) || file_exists($fullPath);
 	
 
 output:
@@ -170,9 +189,15 @@ output:
 function status(){
 	$running = is_running($filename, $pid);
 
-	$size = file_exists($filename)
-		? filesize($filename)
-		: 0;
+	// Only a running dumper writes the partial copy, the finished image
+	// replaces it.
+	if($running){
+		$size = dumped_size($filename);
+	} else {
+		$size = file_exists($filename)
+			? filesize($filename)
+			: 0;
+	}
 	
 	$json = json_encode([
 		'running' => $running,